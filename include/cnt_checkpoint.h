@@ -0,0 +1,92 @@
+#pragma once
+// =========================【工件計數：斷電保存的紀錄與時機】=========================
+// 紀錄格式（magic / seq / 各路數量 / CRC）、開機還原時的挑選規則、RTC 與 flash 的寫入時機。
+// 不含 SPIFFS / RTC 記憶體存取：韌體（main.cpp 的 CntCheckpoint）負責搬位元組，
+// 主機測試（test/native/test_cnt_checkpoint）以隨機斷電模擬驗證最多遺失一個 checkpoint 間隔。
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc32.h"
+
+static const int      CNT_CK_CH    = 2;             // 紀錄的計數路數（= main.cpp 的 CNT_COUNT）
+static const uint32_t CNT_CK_MAGIC = 0x4B434E43;    // "CNCK"
+
+static const uint32_t    CNT_CK_RTC_MS    = 2000;           // RTC checkpoint 間隔
+static const uint32_t    CNT_CK_FLASH_MS  = 60000;          // flash checkpoint 最短間隔
+static const uint32_t    CNT_CK_URGENT_MS = 2000;           // 歸零後最快多久寫 flash
+static const char* const CNT_CK_PATH      = "/cntck.log";
+static const char* const CNT_CK_TMP       = "/cntck.tmp";   // 壓實用暫存檔
+static const size_t      CNT_CK_FILE_MAX  = 4096;           // 日誌超過就壓實成最新一筆
+
+struct CntCkRec {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t qty[CNT_CK_CH];
+  uint32_t crc;
+};
+
+static inline uint32_t cntCkCrc(const CntCkRec& r){ return crc32Update(0, (const uint8_t*)&r, offsetof(CntCkRec, crc)); }
+static inline bool     cntCkValid(const CntCkRec& r){ return r.magic == CNT_CK_MAGIC && r.crc == cntCkCrc(r); }
+
+// 開機還原：RTC 一份 + flash 日誌依序餵入，取 CRC 有效且序號最大的那一份
+struct CntCkPick {
+  CntCkRec    best = {};
+  bool        have = false;
+  const char* src  = "none";
+
+  void offerRtc(const CntCkRec& r){ offer(r, "rtc"); }
+  // 日誌遇到無效紀錄（斷電寫一半的尾巴）回傳 false，呼叫端停止讀取
+  bool offerLog(const CntCkRec& r){
+    if (!cntCkValid(r)) return false;
+    offer(r, "flash");
+    return true;
+  }
+
+private:
+  void offer(const CntCkRec& r, const char* from){
+    if (!cntCkValid(r)) return;
+    if (!have || (int32_t)(r.seq - best.seq) > 0) { best = r; have = true; src = from; }
+  }
+};
+
+// 寫入時機：每 rtcMs 寫一次 RTC；數量與上次寫入 flash 的不同，且距上次 flash 寫入滿 flashMs
+// （歸零後 urgentMs）才一併寫 flash
+class CntCkPlanner {
+public:
+  enum { W_NONE = 0, W_RTC = 1, W_FLASH = 2 };
+
+  CntCkPlanner(uint32_t rtcMs, uint32_t flashMs, uint32_t urgentMs)
+    : _rtcMs(rtcMs), _flashMs(flashMs), _urgentMs(urgentMs) {}
+
+  void begin(const CntCkPick& p, uint32_t nowMs){
+    if (p.have) { _seq = p.best.seq; _flashRec = p.best; }
+    _lastRtcMs = _lastFlashMs = nowMs;
+  }
+
+  // loop() 每圈呼叫；回傳本次要寫入的層（W_RTC | W_FLASH），rec 為要寫的紀錄
+  int step(uint32_t nowMs, const uint32_t* qty, bool urgent, CntCkRec& rec){
+    if (nowMs - _lastRtcMs < _rtcMs) return W_NONE;
+    _lastRtcMs = nowMs;
+
+    rec.magic = CNT_CK_MAGIC;
+    memcpy(rec.qty, qty, sizeof(rec.qty));
+    rec.seq = ++_seq;
+    rec.crc = cntCkCrc(rec);
+
+    bool changed = memcmp(rec.qty, _flashRec.qty, sizeof(rec.qty)) != 0;
+    if (changed && nowMs - _lastFlashMs >= (urgent ? _urgentMs : _flashMs)) {
+      _lastFlashMs = nowMs;
+      return W_RTC | W_FLASH;
+    }
+    return W_RTC;
+  }
+
+  // flash 寫入成功後呼叫（失敗則下次數量有變時再試）
+  void flashDone(const CntCkRec& r){ _flashRec = r; }
+
+private:
+  uint32_t _rtcMs, _flashMs, _urgentMs;
+  uint32_t _seq = 0;
+  CntCkRec _flashRec = {};
+  uint32_t _lastRtcMs = 0, _lastFlashMs = 0;
+};
@@ -0,0 +1,65 @@
+#pragma once
+// =========================【工件計數：脈衝接受規則】=========================
+// 不依賴 Arduino：韌體（main.cpp 的 CounterIsr / CounterPcnt）與主機測試（test/native）共用。
+//   CntGate     ：GPIO 中斷實作的去抖（武裝 → 計一次 → 回閒置電平且穩定後 re-arm）
+//   CntWiden32  ：32 位元 ISR 計數延伸為 64 位元
+//   cntPcntTotal：PCNT 溢位次數 + 16 位元硬體值 → 單調的 64 位元總數
+#include <stdint.h>
+
+// ISR 內呼叫的函式必須內聯進 IRAM（flash cache 關閉時仍可執行）
+#define CNT_ALWAYS_INLINE inline __attribute__((always_inline))
+
+// 機械接點按下與放開都會彈跳：進入作用電平時只有「已武裝」且距上次計數超過 minUs 才算一次並立即去武裝；
+// loop() 看到輸入回到閒置電平並穩定 debounceMs 後才重新武裝
+struct CntGate {
+  volatile bool     armed  = false;   // 是否允許下一次計數（ISR 清除、loop 設定）
+  volatile uint32_t lastUs = 0;       // 上次計數時間戳 (us)
+  int               lastLvl = 1;      // loop() 上次讀到的電平
+  uint32_t          sinceMs = 0;      // 電平最後一次變化的時間 (ms)
+  bool              wasArmed = false; // loop() 上次看到的武裝狀態
+
+  void begin(int lvl, uint32_t nowMs){ lastLvl = lvl; sinceMs = nowMs; armed = wasArmed = true; }
+
+  // ISR：輸入進入作用電平；回傳這次是否計數
+  CNT_ALWAYS_INLINE bool onActive(uint32_t nowUs, uint32_t minUs){
+    if (!armed || (uint32_t)(nowUs - lastUs) <= minUs) return false;
+    lastUs = nowUs;
+    armed  = false;
+    return true;
+  }
+
+  // loop() 每圈呼叫；回傳是否已武裝（未武裝時呼叫端應在 debounceMs 內再來看）
+  // 兩次輪詢之間的彈跳 loop() 看不到電平變化 → ISR 去武裝本身也要重置去抖計時，
+  // 否則會拿計數前的閒置時間當成「已穩定」，在彈跳中途就 re-arm
+  bool poll(int lvl, int idleLvl, uint32_t nowMs, uint32_t debounceMs){
+    bool a = armed;
+    if (wasArmed && !a) { lastLvl = lvl; sinceMs = nowMs; }
+    wasArmed = a;
+    if (lvl != lastLvl) {
+      lastLvl = lvl;
+      sinceMs = nowMs;                          // 電平變化 → 重置去抖計時
+    } else if (!armed && lvl == idleLvl && (uint32_t)(nowMs - sinceMs) >= debounceMs) {
+      armed = wasArmed = true;                  // 放開且穩定於閒置電平 → 允許下一次計數
+    }
+    return armed;
+  }
+};
+
+// loop() 讀取頻率遠高於 2^32 個脈衝，兩次讀取間最多繞回一次
+struct CntWiden32 {
+  uint32_t lo = 0, hi = 0;
+  uint64_t operator()(uint32_t v){
+    if (v < lo) hi++;
+    lo = v;
+    return ((uint64_t)hi << 32) | v;
+  }
+};
+
+// 硬體計到 lim 自動歸零並觸發事件，ISR 把 ovf 加一；
+// 硬體已歸零但 ISR 尚未累加的瞬間算出來會倒退 → 維持上次的值
+static inline uint64_t cntPcntTotal(uint32_t ovf, int16_t v, int16_t lim, uint64_t& last){
+  uint64_t t = (uint64_t)ovf * (uint16_t)lim + (uint16_t)(v < 0 ? 0 : v);
+  if (t < last) t = last;
+  last = t;
+  return t;
+}
@@ -0,0 +1,14 @@
+#pragma once
+// CRC-32（IEEE，反射多項式 0xEDB88320）；crc 傳入前一段結果可分段累算
+// 不依賴 Arduino：韌體與主機測試（test/native）共用。
+#include <stdint.h>
+#include <stddef.h>
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* p, size_t n){
+  crc = ~crc;
+  while (n--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+}
@@ -0,0 +1,38 @@
+#pragma once
+// =========================【HTTP：串流回應寫入管道】=========================
+// HttpJobServer::pipeWrite 的等待規則（韌體與主機負載測試 test/native/test_http_load 共用）：
+//   管道有空間就直接寫；第一次寫不下時先送出回應標頭（dispatch），讓 AsyncTCP 開始取資料；
+//   之後仍寫不下 → 交出 app lock 再等，loop() 與另一條 worker 不會被慢速 / 停滯的 client 卡住；
+//   對方停止接收超過 timeoutMs 即中止。
+// 等待期間 p 仍會被讀取：只能傳入呼叫端自己的緩衝（HttpChunkWriter / streamFile），不可指向全域 String。
+// Port 介面：
+//   size_t   send(const uint8_t* p, size_t n, uint32_t waitMs)   寫入管道，最多等 waitMs
+//   void     dispatch()                                          送出回應標頭（失敗時設 aborted）
+//   void     unlock() / lock()                                   app lock
+//   uint32_t now()                                               ms
+#include <stdint.h>
+#include <stddef.h>
+
+static const uint32_t HTTP_PIPE_WAIT_MS = 50;   // 每次等待管道空間的上限（之後重新檢查中止 / 逾時）
+
+enum HttpPipeResult : uint8_t { HP_OK = 0, HP_ABORTED, HP_STALLED };
+
+template <class Port>
+static HttpPipeResult httpPipeWrite(Port& port, const uint8_t* p, size_t n, uint32_t timeoutMs,
+                                    bool& dispatched, uint32_t& lastProgress, const volatile bool& aborted){
+  lastProgress = port.now();
+  while (n) {
+    if (aborted) return HP_ABORTED;
+    size_t w = port.send(p, n, 0);
+    if (!w && !dispatched) { dispatched = true; port.dispatch(); continue; }
+    if (!w) {
+      port.unlock();
+      w = port.send(p, n, HTTP_PIPE_WAIT_MS);
+      port.lock();
+    }
+    p += w; n -= w;
+    if (w) { lastProgress = port.now(); continue; }
+    if (port.now() - lastProgress > timeoutMs) return HP_STALLED;
+  }
+  return aborted ? HP_ABORTED : HP_OK;
+}
@@ -0,0 +1,128 @@
+#pragma once
+// =========================【頁面模板：掃描成文字區段 + 變數槽】=========================
+// 把模板切成「文字區段（檔案偏移）」與「變數槽」；渲染時依序複製文字區段、印出變數值。
+// 不依賴 Arduino：韌體（main.cpp 的 PageTemplate）與主機測試（test/native/test_page_template）共用。
+// 支援的 {{KEY}}：
+//   {{IP}} / {{NOW}} / {{RTC_STATUS}} / {{SHOW_SECRETS}} / {{SSID}} {{PASS}} {{TOKEN}} {{CHAT}} / {{WD0..6}}
+//   計數器：{{CT0/1}} {{CM0/1}} {{CN0/1}}
+//   排程：{{T0..}} {{TX0..}} {{SW0..}} {{HM0..}} {{HS0..}} {{M0..}} {{MON0..}} {{MOFF0..}}
+//   異常 DI：{{AM0..5}}
+// 不認得的 {{KEY}} 原樣輸出（與舊版 replace 行為相同）。
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+
+enum TplVar : uint8_t {
+  TV_TEXT = 0,            // 文字區段
+  TV_IP, TV_NOW, TV_RTC_STATUS, TV_SHOW_SECRETS, TV_SSID, TV_PASS, TV_TOKEN, TV_CHAT,
+  TV_WD, TV_CT, TV_CM, TV_CN, TV_T, TV_TX, TV_SW, TV_HM, TV_HS, TV_M, TV_MON, TV_MOFF, TV_AM
+};
+
+struct TplPart {
+  uint32_t off;           // TV_TEXT：檔案偏移
+  uint16_t len;           // TV_TEXT：長度
+  uint8_t  var;
+  uint8_t  idx;           // 變數索引（WD3 → 3）
+};
+
+static const size_t TPL_SPAN_MAX = 512;   // 單一文字區段上限（渲染時的讀取單位）
+
+// 各類索引變數的上限（計數器 / 異常 DI / 繼電器路數）
+struct TplLimits { int cnt, alarm, relay; };
+
+// 逐段餵入模板內容，結束時 finish()；結果寫進建構時給的 parts
+class TplScanner {
+public:
+  TplScanner(std::vector<TplPart>& parts, const TplLimits& lim) : _parts(parts), _lim(lim) { _parts.clear(); }
+
+  void feed(const uint8_t* buf, size_t n){
+    for (size_t i = 0; i < n; ++i, ++_pos) {
+      char c = (char)buf[i];
+      switch (_st) {
+        case LIT:    if (c == '{') { _st = OPEN1; _tokStart = _pos; } break;
+        case OPEN1:  if (c == '{') { _st = NAME; _nameLen = 0; }
+                     else _st = LIT;
+                     break;
+        case NAME:
+          if (c == '}') { _st = CLOSE1; break; }
+          if (c == '{' && !_nameLen) { _tokStart = _pos - 1; break; }   // "{{{IP}}"：從最後兩個 { 起算
+          if (_nameLen < sizeof(_name) - 1 && (isupper((unsigned char)c) || isdigit((unsigned char)c) || c == '_')) {
+            _name[_nameLen++] = c;
+          } else {
+            _st = (c == '{') ? OPEN1 : LIT;
+            if (c == '{') _tokStart = _pos;
+          }
+          break;
+        case CLOSE1: {
+          _st = LIT;
+          if (c == '{') { _st = OPEN1; _tokStart = _pos; break; }
+          if (c != '}') break;
+          _name[_nameLen] = 0;
+          uint8_t var, idx;
+          if (!lookup(_name, _lim, var, idx)) break;   // 不認得 → 留在文字區段
+          addText(_textStart, _tokStart);
+          _parts.push_back(TplPart{ 0, 0, var, idx });
+          _textStart = _pos + 1;
+          break;
+        }
+      }
+    }
+  }
+
+  // 收尾並回傳變數槽數量
+  size_t finish(){
+    addText(_textStart, _pos);
+    size_t slots = 0;
+    for (const TplPart& p : _parts) if (p.var != TV_TEXT) slots++;
+    return slots;
+  }
+
+  // "WD3" → (TV_WD, 3)；"NOW" → (TV_NOW, 0)
+  static bool lookup(const char* name, const TplLimits& lim, uint8_t& var, uint8_t& idx){
+    struct Key { const char* name; uint8_t var; bool indexed; };
+    static const Key keys[] = {
+      {"IP", TV_IP, false}, {"NOW", TV_NOW, false}, {"RTC_STATUS", TV_RTC_STATUS, false},
+      {"SHOW_SECRETS", TV_SHOW_SECRETS, false}, {"SSID", TV_SSID, false}, {"PASS", TV_PASS, false},
+      {"TOKEN", TV_TOKEN, false}, {"CHAT", TV_CHAT, false},
+      {"WD", TV_WD, true}, {"CT", TV_CT, true}, {"CM", TV_CM, true}, {"CN", TV_CN, true},
+      {"T", TV_T, true}, {"TX", TV_TX, true}, {"SW", TV_SW, true}, {"HM", TV_HM, true}, {"HS", TV_HS, true}, {"M", TV_M, true},
+      {"MON", TV_MON, true}, {"MOFF", TV_MOFF, true}, {"AM", TV_AM, true},
+    };
+    size_t alpha = 0;
+    while (name[alpha] && !isdigit((unsigned char)name[alpha])) alpha++;
+    for (size_t i = alpha; name[i]; ++i) if (!isdigit((unsigned char)name[i])) return false;   // "AM1WD" 不是 AM1
+    if (name[alpha] == '0' && name[alpha + 1]) return false;                                     // "AM01" 不是 AM1
+    int n = name[alpha] ? atoi(name + alpha) : -1;
+    for (const Key& k : keys) {
+      if (strlen(k.name) != alpha || strncmp(k.name, name, alpha) != 0) continue;
+      if (k.indexed != (n >= 0)) return false;
+      int max = (k.var == TV_WD) ? 7 : (k.var == TV_CT || k.var == TV_CM || k.var == TV_CN) ? lim.cnt
+              : (k.var == TV_AM) ? lim.alarm : k.indexed ? lim.relay : 1;
+      if (k.indexed && n >= max) return false;
+      var = k.var;
+      idx = (uint8_t)(n < 0 ? 0 : n);
+      return true;
+    }
+    return false;
+  }
+
+private:
+  enum { LIT, OPEN1, NAME, CLOSE1 } _st = LIT;
+  std::vector<TplPart>& _parts;
+  TplLimits _lim;
+  uint32_t  _pos = 0, _textStart = 0, _tokStart = 0;
+  char      _name[17];
+  uint8_t   _nameLen = 0;
+
+  // 文字區段 [from, to)，超過 TPL_SPAN_MAX 切成多段
+  void addText(uint32_t from, uint32_t to){
+    while (from < to) {
+      uint16_t len = (uint16_t)((to - from) > TPL_SPAN_MAX ? TPL_SPAN_MAX : (to - from));
+      _parts.push_back(TplPart{ from, len, TV_TEXT, 0 });
+      from += len;
+    }
+  }
+};
@@ -0,0 +1,53 @@
+#pragma once
+// =========================【RTC 鬧鐘：下一個事件與寫入規則】=========================
+// 下一個事件 = 繼電器排程堆頂（SchedCore::nextDue）與計數每日回報（cntReportNextDue）取較早者；
+// RTC 每日鬧鐘只比對 HH:MM，所以目標是該事件的當日分鐘：
+//   明天的事件也以它的 HH:MM 寫入 —— 若今天那個時刻還沒過，會在今天多叫醒一次，重新評估即可；
+//   跨午夜的事件（例如 00:00）自然落在隔天。沒有任何事件 → 關閉鬧鐘。
+// 目標改變才寫 I²C（寫入失敗下次重試）。
+// Rtc 介面（韌體：IRtc；主機測試：假 RTC 記錄寫入）：
+//   bool setDailyAlarm(uint8_t hh, uint8_t mm) / bool disableAlarm()
+// 不依賴 Arduino：韌體（main.cpp 的 RtcAlarm）與主機測試（test/native/test_rtc_alarm）共用。
+#include <stdint.h>
+#include "sched_engine.h"
+
+// 下一次計數每日回報（本地秒數；無 → -1）；mod[i] = 第 i 路回報的當日分鐘，daily[i]=false 表示不回報
+static inline int64_t cntReportNextDue(int64_t now, const uint16_t* mod, const bool* daily, int n, uint8_t mask){
+  int64_t best = -1;
+  for (int i = 0; i < n; ++i) {
+    if (!daily[i]) continue;
+    int64_t d = schNextDue(now, mod[i], mask);
+    if (d >= 0 && (best < 0 || d < best)) best = d;
+  }
+  return best;
+}
+
+// 兩個候選（本地秒數，-1 = 無）取較早者，換成鬧鐘的當日分鐘；都沒有回 -1
+static inline int rtcAlarmTarget(int64_t schedDue, int64_t cntDue){
+  int64_t next = (schedDue < 0) ? cntDue : (cntDue < 0 || schedDue < cntDue) ? schedDue : cntDue;
+  if (next < 0) return -1;
+  int64_t mod = (next / 60) % (24 * 60);
+  return (int)(mod < 0 ? mod + 24 * 60 : mod);
+}
+
+class RtcAlarmPlan {
+public:
+  // 依目前候選更新 RTC；有寫入（且成功）回 true
+  template <class Rtc>
+  bool arm(Rtc& rtc, int64_t schedDue, int64_t cntDue){
+    int want = rtcAlarmTarget(schedDue, cntDue);
+    if (want == _armed) return false;
+    bool ok = (want < 0) ? rtc.disableAlarm() : rtc.setDailyAlarm((uint8_t)(want / 60), (uint8_t)(want % 60));
+    if (!ok) return false;
+    _armed = want;
+    _writes++;
+    return true;
+  }
+
+  int      armed()  const { return _armed; }    // 已寫入的 HH:MM（分鐘數）；-1 = 關閉，-2 = 尚未寫過
+  uint32_t writes() const { return _writes; }
+
+private:
+  int      _armed = -2;
+  uint32_t _writes = 0;
+};
@@ -0,0 +1,151 @@
+#pragma once
+// =========================【排程器核心：預算下次觸發 + 最小堆積】=========================
+// 每個（路, 第 k 個時間）是一個工作：預先算出「下次觸發」的本地秒數，放進最小堆積（堆頂 = 最早到期）。
+// step() 每輪只比較堆頂與目前本地時間；到期 → 觸發 → 算下一次 → 放回堆積。
+// 星期：jobMask()（韌體為 cfg.wdMask & sch[i].wd）；沒有任何一天允許的工作不排入。
+// 補觸發：loop 被卡住而晚到的觸發，延遲在 SCH_GRACE_SEC 內仍會補上；超過則計入 missed 並跳過。
+// 重建：ver 改變、第一次呼叫、或時間往回跳時，從「本分鐘開頭」重算所有工作；
+//       _fired[] 記錄各工作最後觸發的時間點，避免同一時間點重複觸發（與舊版同分鐘去重相同）。
+// 預排：到期前 SCH_PREARM_MS 內的工作交給 relayStartAt()（韌體為 relayEng.startAt，由 esp_timer 準時吸合）；
+//       到期時只補推播（已預排者不受寬限窗限制，因為繼電器已動作）。
+// 不依賴 Arduino：韌體（main.cpp 的 SchedEngine 接上 cfg / timeSvc / relayEng）
+// 與主機測試（test/native/test_sched_week）共用。
+#include <stdint.h>
+
+static const int      SCH_CH        = 6;        // 排程路數（= main.cpp 的 RELAY_COUNT）
+static const int      SCH_TIMES     = 4;        // 每路每日最多觸發次數（主時間 hh:mm + 3 組額外時間）
+static const uint16_t SCH_T_NONE    = 0xFFFF;   // 額外時間未使用
+static const int      SCH_JOBS      = SCH_CH * SCH_TIMES;
+static const int64_t  SCH_GRACE_SEC = 120;
+static const int64_t  SCH_PREARM_MS = 1500;
+
+// after 之後（不含）第一個落在 minuteOfDay 且星期允許的本地秒數；mask 全 0 → -1
+static inline int64_t schNextDue(int64_t after, uint16_t minuteOfDay, uint8_t mask){
+  if (!(mask & 0x7F) || minuteOfDay >= 24 * 60) return -1;
+  int64_t day = after >= 0 ? after / 86400 : (after - 86399) / 86400;
+  for (int k = 0; k <= 7; ++k) {
+    int64_t d = day + k;
+    int mon0 = (int)(((d % 7) + 7 + 3) % 7);     // 1970-01-01 為週四（Mon=0 → 3）
+    if (!((mask >> mon0) & 0x01)) continue;
+    int64_t t = d * 86400 + (int64_t)minuteOfDay * 60;
+    if (t > after) return t;
+  }
+  return -1;
+}
+
+class SchedCore {
+public:
+  virtual ~SchedCore() {}
+
+  // nowUs：本地時間（μs）；tmrUs：同一時刻的單調計時器（esp_timer）；ver：設定版本
+  void step(int64_t nowUs, int64_t tmrUs, uint32_t ver){
+    int64_t now = nowUs / 1000000LL;
+    if (!_built || _ver != ver || now < _lastNow - 2) rebuild(now, ver);
+    _lastNow = now;
+
+    while (_n && _due[_heap[0]] <= now) {
+      uint8_t j  = _heap[0];
+      int64_t due = _due[j];
+      int64_t lag = now - due;
+      bool    pre = _pre[j] == due;
+      if (pre || lag <= SCH_GRACE_SEC) fire(j, due, lag, pre);
+      else                             _missed++;
+      _fired[j] = due;
+      _pre[j]   = -1;
+      // 下一次：從觸發點往後算；錯過太久則從寬限窗開頭算，避免逐日補算
+      int64_t from = (lag > SCH_GRACE_SEC) ? now - SCH_GRACE_SEC : due;
+      _due[j] = schNextDue(from, jobMinute(j), jobMask(j));
+      if (_due[j] < 0) { _heap[0] = _heap[--_n]; }
+      siftDown(0);
+    }
+    prearm(nowUs, tmrUs);
+  }
+
+  // 最早到期的本地秒數；沒有工作回 -1（供 /diag、鬧鐘 / 休眠規劃用）
+  int64_t nextDue() const { return _n ? _due[_heap[0]] : -1; }
+  int     nextChannel() const { return _n ? _heap[0] / SCH_TIMES : -1; }
+  int     jobs() const { return _n; }
+
+  uint32_t fired()    const { return _firedCnt; }
+  uint32_t prearmed() const { return _prearmed; }
+  uint32_t late()     const { return _late; }
+  uint32_t missed()   const { return _missed; }
+  uint32_t rebuilds() const { return _rebuilds; }
+  int32_t  maxLagS()  const { return _maxLag; }
+
+protected:
+  virtual uint16_t jobMinute(int j) = 0;                    // 當日分鐘；SCH_T_NONE = 未使用
+  virtual uint8_t  jobMask(int j) = 0;                      // 星期遮罩（bit0=Mon）
+  virtual void     relayStartAt(int ch, int64_t tmrUs) = 0; // 預排在計時器時刻 tmrUs 吸合
+  virtual bool     relayCancelAt(int ch) = 0;               // 撤回預排；已吸合（或沒有預排）回 false
+  // 觸發：pre = 繼電器已由預排吸合，只需補推播；否則要立即吸合
+  virtual void     onFire(int j, int64_t due, int64_t lag, bool pre) = 0;
+
+private:
+  int64_t  _due[SCH_JOBS];
+  int64_t  _fired[SCH_JOBS];
+  int64_t  _pre[SCH_JOBS];                     // 已預排的時間點（-1 = 無）
+  uint8_t  _heap[SCH_JOBS];
+  int      _n = 0;
+  bool     _built = false;
+  uint32_t _ver = 0;
+  int64_t  _lastNow = 0;
+  uint32_t _firedCnt = 0, _prearmed = 0, _late = 0, _missed = 0, _rebuilds = 0;
+  int32_t  _maxLag = 0;
+
+  void rebuild(int64_t now, uint32_t ver){
+    if (!_built) for (int j = 0; j < SCH_JOBS; ++j) { _fired[j] = -1; _pre[j] = -1; }
+    // 撤回預排；已吸合者視為已觸發（補推播，並登記 _fired 以免重建後重複）
+    for (int j = 0; j < SCH_JOBS; ++j) {
+      if (_pre[j] < 0) continue;
+      if (!relayCancelAt(j / SCH_TIMES)) { fire(j, _pre[j], 0, true); _fired[j] = _pre[j]; }
+      _pre[j] = -1;
+    }
+    _built = true; _ver = ver; _rebuilds++;
+    _n = 0;
+    int64_t from = now - (now % 60) - 1;       // 本分鐘開頭之前 → 本分鐘的時間點仍可觸發
+    for (int j = 0; j < SCH_JOBS; ++j) {
+      uint16_t mod = jobMinute(j);
+      if (mod == SCH_T_NONE) continue;
+      int64_t d = schNextDue(from, mod, jobMask(j));
+      if (d >= 0 && d == _fired[j]) d = schNextDue(d, mod, jobMask(j));   // 此時間點已觸發過
+      if (d < 0) continue;
+      _due[j] = d;
+      _heap[_n++] = (uint8_t)j;
+    }
+    for (int i = _n / 2 - 1; i >= 0; --i) siftDown(i);
+  }
+
+  void siftDown(int i){
+    for (;;) {
+      int l = 2 * i + 1, r = l + 1, m = i;
+      if (l < _n && _due[_heap[l]] < _due[_heap[m]]) m = l;
+      if (r < _n && _due[_heap[r]] < _due[_heap[m]]) m = r;
+      if (m == i) return;
+      uint8_t t = _heap[i]; _heap[i] = _heap[m]; _heap[m] = t;
+      i = m;
+    }
+  }
+
+  // 到期前 SCH_PREARM_MS 內的工作：換算成計時器時刻預排
+  void prearm(int64_t nowUs, int64_t tmrUs){
+    for (int i = 0; i < _n; ++i) {
+      uint8_t j = _heap[i];
+      if (_pre[j] == _due[j]) continue;
+      int64_t leadUs = _due[j] * 1000000LL - nowUs;
+      if (leadUs <= 0 || leadUs > SCH_PREARM_MS * 1000LL) continue;   // 已過點 → 由 onFire() 立即吸合
+      relayStartAt(j / SCH_TIMES, tmrUs + leadUs);
+      _pre[j] = _due[j];
+      _prearmed++;
+    }
+  }
+
+  void fire(int j, int64_t due, int64_t lag, bool pre){
+    _firedCnt++;
+    if (!pre) {                                 // 預排者的吸合精度見 relayEng
+      if (lag >= 2) _late++;
+      if (lag > _maxLag) _maxLag = (int32_t)lag;
+    }
+    onFire(j, due, lag, pre);
+  }
+};
@@ -0,0 +1,66 @@
+#pragma once
+// =========================【Telegram 補送：批次組裝 / 限流解析】=========================
+// TgJournal::front() 把積存的記錄依序餵給 TgBatch，合併成一則 sendMessage：
+//   每則一行；延遲超過 TGJ_STAMP_AGE_S 的記錄行首加發生時間 "[MM/DD HH:MM:SS] "；
+//   一批最多 maxMsgs 則、合併後不超過 TG_MSG_MAX（第一則一律收下，單則本身已截在 TG_MSG_MAX）。
+// tgRetryAfterSec() 從 429 回應取出 parameters.retry_after。
+// 不依賴 SPIFFS / 網路：韌體與主機測試（test/native/test_tg_batch）共用。
+#include <WString.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const size_t   TG_MSG_MAX      = 4000;   // 單則上限（Telegram sendMessage 4096 字元）
+static const uint16_t TG_BATCH_MSGS   = 20;     // 補送一批最多幾則
+static const uint32_t TGJ_STAMP_AGE_S = 60;     // 延遲超過這麼久才在行首加發生時間
+
+// 行首時間戳；未對時（ts / now 為 0）或延遲不到 TGJ_STAMP_AGE_S 回空字串
+static inline String tgStamp(uint32_t ts, uint32_t now){
+  if (!ts || !now || now - ts < TGJ_STAMP_AGE_S) return String();
+  time_t t = (time_t)ts;
+  struct tm tmv;
+  localtime_r(&t, &tmv);
+  char buf[20];
+  strftime(buf, sizeof(buf), "[%m/%d %H:%M:%S] ", &tmv);
+  return String(buf);
+}
+
+class TgBatch {
+public:
+  TgBatch(String& out, uint16_t maxMsgs, uint32_t now) : _out(out), _max(maxMsgs), _now(now) { _out = ""; }
+
+  // 接上一則；放不下（則數或長度）回 false，呼叫端就此停止
+  bool add(uint32_t seq, uint32_t ts, const String& text){
+    if (_count >= _max) return false;
+    String line = tgStamp(ts, _now);
+    if (_count && _out.length() + 1 + line.length() + text.length() > TG_MSG_MAX) return false;
+    if (_count) _out += '\n';
+    _out += line;
+    _out += text;
+    _lastSeq = seq;
+    _textBytes += text.length();
+    _count++;
+    return true;
+  }
+
+  bool     full()      const { return _count >= _max; }
+  uint16_t count()     const { return _count; }
+  uint32_t lastSeq()   const { return _lastSeq; }
+  size_t   textBytes() const { return _textBytes; }   // 原始文字總長（不含時間戳與換行）
+
+private:
+  String&  _out;
+  uint16_t _max;
+  uint32_t _now;
+  uint16_t _count = 0;
+  uint32_t _lastSeq = 0;
+  size_t   _textBytes = 0;
+};
+
+// 429 回應：{"ok":false,"error_code":429,...,"parameters":{"retry_after":35}} → 35；缺欄位或 ≤0 → 1
+static inline long tgRetryAfterSec(const char* body){
+  const char* k = body ? strstr(body, "\"retry_after\":") : nullptr;
+  long sec = k ? atol(k + 14) : 0;
+  return sec > 0 ? sec : 1;
+}
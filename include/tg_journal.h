@@ -0,0 +1,375 @@
+#pragma once
+// =========================【Telegram 持久化 outbox（flash 日誌）】=========================
+// 每個優先類別一份 append-only 日誌（TGJ_ALARM / TGJ_RELAY，各有自己的序號與 checkpoint），
+// TgJournalSet::front() 永遠先取 ALARM 日誌：警報不會排在先前積存的繼電器訊息後面。
+// 記錄送達（HTTP 200 + ok:true）後 ack() 前進讀取位置；checkpoint（ack 檔）批次寫入：
+// 累積 TGJ_ACK_EVERY 則或距第一則未寫入的 ack 已 TGJ_ACK_MS 才寫一次。斷電時最多重送這一段，
+// 重開機從 checkpoint 之後接續（至少送達一次），序號 ≤ checkpoint 的記錄一律略過。
+// 日誌全部送達後整檔刪除（此時 checkpoint 不必再寫：沒有記錄可重送）；
+// 斷電造成的半筆尾巴在開機時以 CRC 偵測並壓實。
+// 最近寫入的記錄另存一份在 RAM 快取（CACHE 位元組），front() 命中時不必讀 flash；快取只是副本。
+// 只由單一任務呼叫（韌體為 tgTask），內部不加鎖；統計值可由其他任務讀取。
+// Fs 介面（韌體：SPIFFS；主機測試：RAM 假檔案系統）：
+//   File open(const char* path, const char* mode)   "r" / "w" / "a"；File 需有
+//        read(p,n) / write(p,n) / seek(off) / size() / close() / operator bool
+//   bool remove(const char* path) / bool rename(const char* from, const char* to)
+// 不依賴 Arduino：韌體（main.cpp 的 tgJournal）與主機測試（test/native/test_tg_journal）共用。
+#include <WString.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "crc32.h"
+#include "tg_batch.h"
+
+enum TgjClass : uint8_t { TGJ_ALARM = 0, TGJ_RELAY = 1, TGJ_CLASSES = 2 };   // RELAY 也收轉入的 INFO
+
+static const char* const TGJ_LOG_PATH[TGJ_CLASSES] = { "/tgqa.log", "/tgq.log" };
+static const char* const TGJ_ACK_PATH[TGJ_CLASSES] = { "/tgqa.ack", "/tgq.ack" };
+static const char* const TGJ_TMP_PATH[TGJ_CLASSES] = { "/tgqa.tmp", "/tgq.tmp" };
+static const size_t      TGJ_MAX_BYTES[TGJ_CLASSES] = { 8 * 1024, 24 * 1024 };   // 各日誌上限（超過則拒收）
+static const size_t      TGJ_CACHE_BYTES = 1024;   // 每份日誌最近記錄的 RAM 副本
+static const uint16_t    TGJ_ACK_EVERY   = 8;      // 累積幾則 ack 寫一次 checkpoint
+static const uint32_t    TGJ_ACK_MS      = 10000;  // 或最舊一則未寫入的 ack 已過多久
+
+template <class Fs, size_t CACHE = TGJ_CACHE_BYTES>
+class TgJournal {
+public:
+  TgJournal(Fs& fs, const char* logPath, const char* ackPath, const char* tmpPath, size_t maxBytes)
+    : _fs(fs), _logPath(logPath), _ackPath(ackPath), _tmpPath(tmpPath), _maxBytes(maxBytes) {}
+
+  // 檔案系統掛載後呼叫：讀 checkpoint、掃描日誌、重建讀取位置；發現半筆尾巴（已壓實）回 false
+  bool begin(){
+    _ackSeq = 0;
+    auto a = _fs.open(_ackPath, "r");
+    if (a) {
+      uint8_t b[8];
+      if (a.read(b, 8) == 8 && crc32Update(0, b, 4) == get32(b + 4)) _ackSeq = get32(b);
+      a.close();
+    }
+    _ackSaved = _ackSeq;
+    _ackDirty = 0;
+
+    _nextSeq = _ackSeq + 1;
+    _size = 0; _readOff = 0; _pending = 0;
+    _cHead = _cUsed = 0; _cCount = 0;
+    bool torn = false;
+    auto f = _fs.open(_logPath, "r");
+    if (f) {
+      size_t fileSize = f.size();
+      Rec r;
+      while (_size < fileSize) {
+        if (!readRec(f, r, nullptr)) { torn = true; break; }
+        if (r.seq >= _nextSeq) _nextSeq = r.seq + 1;
+        if (r.seq > _ackSeq && _pending++ == 0) { _readOff = _size; _frontSeq = r.seq; }
+        _size += HDR + r.len;
+      }
+      f.close();
+    }
+    _ready = true;
+
+    if (torn) compact();
+    else if (!_pending && _size) { _fs.remove(_logPath); _size = 0; }
+    return !torn;
+  }
+
+  // 追加一則；ts = 發生時間（epoch 秒，未對時為 0）
+  bool append(const String& text, uint32_t ts){
+    if (!_ready || !text.length()) return false;
+    size_t len = text.length() < TG_MSG_MAX ? text.length() : TG_MSG_MAX;
+    if (_size + HDR + len > _maxBytes && _readOff > 0) compact();   // 先回收已送達的前段
+    if (_size + HDR + len > _maxBytes) { _dropped++; return false; }
+
+    auto f = _fs.open(_logPath, "a");
+    if (!f) { _dropped++; return false; }
+    bool ok = writeRec(f, _nextSeq, ts, text, len);
+    f.close();
+    if (!ok) { _dropped++; compact(); return false; }   // 寫一半 → 壓實去掉殘尾
+
+    if (_pending++ == 0) { _readOff = _size; _frontSeq = _nextSeq; }
+    cachePut(_nextSeq, ts, text.c_str(), len);
+    _size += HDR + len;
+    _nextSeq++;
+    _appended++;
+    return true;
+  }
+
+  bool pending() const { return _pending > 0; }
+
+  // 讀出待送的前幾則（不移除），由 TgBatch 合併成一則（見 tg_batch.h）；
+  // lastSeq = 本批最後一則的序號。第一則就讀壞時捨棄整個日誌剩餘部分。
+  bool front(String& out, uint32_t& lastSeq, uint16_t maxMsgs, uint32_t nowEpoch){
+    if (!_ready || !_pending) return false;
+    _frontBytes = 0; _frontCount = 0;
+    uint16_t limit = maxMsgs < _pending ? maxMsgs : (uint16_t)_pending;
+    TgBatch b(out, limit, nowEpoch);
+    bool ok = true;
+    if (cacheFront(b)) {
+      _cacheHits++;
+    } else {
+      auto f = _fs.open(_logPath, "r");
+      ok = f && f.seek(_readOff);
+      Rec r; String text;
+      while (ok && !b.full()) {
+        if (!readRec(f, r, &text)) { ok = (b.count() > 0); break; }
+        if (!b.add(r.seq, r.ts, text)) break;
+      }
+      if (f) f.close();
+    }
+    if (!ok) {
+      _dropped += _pending;
+      _corrupt++;
+      reset();
+      return false;
+    }
+    lastSeq     = b.lastSeq();
+    _frontCount = b.count();
+    _frontBytes = HDR * b.count() + b.textBytes();
+    return true;
+  }
+
+  uint16_t frontCount() const { return _frontCount; }
+
+  // 標記 front() 讀出的那一批已送達；checkpoint 依 TGJ_ACK_EVERY / TGJ_ACK_MS 批次寫入
+  void ack(uint32_t lastSeq, uint32_t nowMs){
+    if (!_frontCount) return;
+    _ackSeq   = lastSeq;
+    if (!_ackDirty) _ackDirtyAt = nowMs;
+    _ackDirty += _frontCount;
+    _readOff += _frontBytes;
+    _pending -= _frontCount;
+    _acked   += _frontCount;
+    _frontSeq = lastSeq + 1;
+    if (_frontCount > 1) _batches++;
+    _frontBytes = 0; _frontCount = 0;
+    cacheDropThrough(lastSeq);
+    if (!_pending) { _fs.remove(_logPath); _size = 0; _readOff = 0; _ackDirty = 0; }   // 沒有可重送的記錄
+    tick(nowMs);
+  }
+
+  // 到期的 checkpoint 寫入（tgTask 每輪呼叫）
+  void tick(uint32_t nowMs){
+    if (_ackDirty && (_ackDirty >= TGJ_ACK_EVERY || nowMs - _ackDirtyAt >= TGJ_ACK_MS)) flushAck();
+  }
+
+  // 立即寫入 checkpoint（例如即將斷電 / 重開機前）
+  void flushAck(){
+    if (!_ackDirty) return;
+    writeAck(_ackSeq);
+    _ackDirty = 0;
+  }
+
+  uint32_t pendingCount() const { return _pending; }
+  size_t   bytes()        const { return _size; }
+  size_t   maxBytes()     const { return _maxBytes; }
+  uint32_t ackSeq()       const { return _ackSeq; }     // 已送達（RAM）
+  uint32_t ackSaved()     const { return _ackSaved; }   // 已寫入 checkpoint
+  uint32_t ackWrites()    const { return _ackWrites; }
+  uint32_t appended()     const { return _appended; }
+  uint32_t acked()        const { return _acked; }
+  uint32_t batches()      const { return _batches; }
+  uint32_t dropped()      const { return _dropped; }
+  uint32_t corrupt()      const { return _corrupt; }
+  uint32_t cacheHits()    const { return _cacheHits; }
+
+private:
+  // 記錄：magic(2) len(2) seq(4) ts(4) crc(4) + 文字；crc 涵蓋 len..ts 與文字
+  static const size_t   HDR   = 16;
+  static const uint16_t MAGIC = 0x5154;   // "TQ"
+
+  struct Rec { uint16_t len; uint32_t seq, ts; };
+
+  static void     put16(uint8_t* p, uint16_t v){ p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+  static void     put32(uint8_t* p, uint32_t v){ for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i)); }
+  static uint16_t get16(const uint8_t* p){ return (uint16_t)(p[0] | (p[1] << 8)); }
+  static uint32_t get32(const uint8_t* p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  // 從目前位置讀一筆並驗 CRC；text=nullptr 時只驗證不保留內容
+  template <class F>
+  static bool readRec(F& f, Rec& r, String* text){
+    uint8_t h[HDR];
+    if (f.read(h, HDR) != HDR || get16(h) != MAGIC) return false;
+    r.len = get16(h + 2); r.seq = get32(h + 4); r.ts = get32(h + 8);
+    if (r.len == 0 || r.len > TG_MSG_MAX) return false;
+    uint32_t crc = crc32Update(0, h + 2, 10);
+    if (text) { *text = ""; text->reserve(r.len); }
+    uint8_t buf[64];
+    for (size_t left = r.len; left; ) {
+      size_t n = left < sizeof(buf) ? left : sizeof(buf);
+      if (f.read(buf, n) != n) return false;
+      crc = crc32Update(crc, buf, n);
+      if (text) for (size_t i = 0; i < n; ++i) *text += (char)buf[i];
+      left -= n;
+    }
+    return crc == get32(h + 12);
+  }
+
+  template <class F>
+  static bool writeRec(F& f, uint32_t seq, uint32_t ts, const String& text, size_t len){
+    uint8_t h[HDR];
+    put16(h, MAGIC); put16(h + 2, (uint16_t)len); put32(h + 4, seq); put32(h + 8, ts);
+    put32(h + 12, crc32Update(crc32Update(0, h + 2, 10), (const uint8_t*)text.c_str(), len));
+    return f.write(h, HDR) == HDR && f.write((const uint8_t*)text.c_str(), len) == len;
+  }
+
+  void writeAck(uint32_t seq){
+    uint8_t b[8];
+    put32(b, seq); put32(b + 4, crc32Update(0, b, 4));
+    auto a = _fs.open(_ackPath, "w");
+    if (a) { a.write(b, 8); a.close(); }
+    _ackSaved = seq;
+    _ackWrites++;
+  }
+
+  // 只保留「有效且未送達」的記錄，重寫成新檔（已送達的記錄不在檔內 → 未寫入的 ack 不必再寫）
+  void compact(){
+    auto in  = _fs.open(_logPath, "r");
+    auto out = _fs.open(_tmpPath, "w");
+    _size = 0; _readOff = 0; _pending = 0;
+    if (in && out) {
+      size_t fileSize = in.size(), off = 0;
+      Rec r; String text;
+      while (off < fileSize && readRec(in, r, &text)) {
+        off += HDR + r.len;
+        if (r.seq <= _ackSeq) continue;
+        if (!writeRec(out, r.seq, r.ts, text, r.len)) break;
+        if (_pending++ == 0) _frontSeq = r.seq;
+        _size += HDR + r.len;
+      }
+    }
+    if (in)  in.close();
+    if (out) out.close();
+    _fs.remove(_logPath);
+    if (_pending) _fs.rename(_tmpPath, _logPath);
+    else { _fs.remove(_tmpPath); _size = 0; }
+    _ackDirty = 0;
+  }
+
+  void reset(){
+    _fs.remove(_logPath);
+    _size = 0; _readOff = 0; _pending = 0;
+    _frontBytes = 0; _frontCount = 0;
+    _cHead = _cUsed = 0; _cCount = 0;
+    _ackDirty = 0;
+  }
+
+  // ---- RAM 快取：環形區，記錄 len(2) seq(4) ts(4) + 文字；滿了丟最舊（flash 上仍有） ----
+  static const size_t CHDR = 10;
+  uint8_t  _cache[CACHE];
+  size_t   _cHead = 0, _cUsed = 0;
+  uint16_t _cCount = 0;
+
+  uint8_t  cAt(size_t off) const { return _cache[(_cHead + off) % CACHE]; }
+  uint32_t cGet32(size_t off) const {
+    return (uint32_t)cAt(off) | ((uint32_t)cAt(off + 1) << 8) | ((uint32_t)cAt(off + 2) << 16) | ((uint32_t)cAt(off + 3) << 24);
+  }
+  void cWrite(const uint8_t* p, size_t n){
+    for (size_t i = 0; i < n; ++i) _cache[(_cHead + _cUsed + i) % CACHE] = p[i];
+    _cUsed += n;
+  }
+  void cPopFront(){
+    size_t len = cAt(0) | (cAt(1) << 8);
+    _cHead = (_cHead + CHDR + len) % CACHE;
+    _cUsed -= CHDR + len;
+    _cCount--;
+  }
+
+  void cachePut(uint32_t seq, uint32_t ts, const char* text, size_t len){
+    if (CHDR + len > CACHE) { _cHead = _cUsed = 0; _cCount = 0; return; }   // 太長：不快取（也打斷連續性）
+    while (_cUsed + CHDR + len > CACHE) cPopFront();
+    uint8_t h[CHDR];
+    put16(h, (uint16_t)len); put32(h + 2, seq); put32(h + 6, ts);
+    cWrite(h, CHDR);
+    cWrite((const uint8_t*)text, len);
+    _cCount++;
+  }
+
+  void cacheDropThrough(uint32_t seq){
+    while (_cCount && cGet32(2) <= seq) cPopFront();
+  }
+
+  // 待送的第一筆在快取裡 → 從 RAM 組批（與讀 flash 的結果相同）；否則回 false
+  bool cacheFront(TgBatch& b){
+    cacheDropThrough(_frontSeq - 1);
+    if (!_cCount || cGet32(2) != _frontSeq) return false;
+    size_t off = 0;
+    uint32_t want = _frontSeq;
+    String text;
+    for (uint16_t i = 0; i < _cCount && !b.full(); ++i) {
+      size_t   len = cAt(off) | (cAt(off + 1) << 8);
+      uint32_t seq = cGet32(off + 2);
+      if (seq != want) break;
+      text = "";
+      text.reserve(len);
+      for (size_t k = 0; k < len; ++k) text += (char)cAt(off + CHDR + k);
+      if (!b.add(seq, cGet32(off + 6), text)) break;
+      off += CHDR + len;
+      want++;
+    }
+    return b.count() > 0;
+  }
+
+  Fs&         _fs;
+  const char* _logPath;
+  const char* _ackPath;
+  const char* _tmpPath;
+  size_t      _maxBytes;
+  bool     _ready = false;
+  uint32_t _frontSeq = 0;                  // _readOff 那一筆的序號
+  uint32_t _cacheHits = 0;
+  uint32_t _ackSeq = 0, _nextSeq = 1;
+  uint32_t _ackSaved = 0, _ackWrites = 0;
+  uint16_t _ackDirty = 0;                  // 已送達但尚未寫入 checkpoint 的則數
+  uint32_t _ackDirtyAt = 0;
+  size_t   _size = 0, _readOff = 0;
+  size_t   _frontBytes = 0;
+  uint16_t _frontCount = 0;
+  uint32_t _pending = 0;
+  uint32_t _appended = 0, _acked = 0, _batches = 0, _dropped = 0, _corrupt = 0;
+};
+
+// 每類一份日誌；front() 依類別優先序挑選（ALARM 有積存就先送）
+template <class Fs>
+class TgJournalSet {
+public:
+  explicit TgJournalSet(Fs& fs)
+    : _j{ { fs, TGJ_LOG_PATH[TGJ_ALARM], TGJ_ACK_PATH[TGJ_ALARM], TGJ_TMP_PATH[TGJ_ALARM], TGJ_MAX_BYTES[TGJ_ALARM] },
+          { fs, TGJ_LOG_PATH[TGJ_RELAY], TGJ_ACK_PATH[TGJ_RELAY], TGJ_TMP_PATH[TGJ_RELAY], TGJ_MAX_BYTES[TGJ_RELAY] } } {}
+
+  // 回傳是否有日誌發現半筆尾巴（已壓實）
+  bool begin(){
+    bool clean = true;
+    for (int c = 0; c < TGJ_CLASSES; ++c) clean &= _j[c].begin();
+    return clean;
+  }
+
+  bool append(TgjClass c, const String& text, uint32_t ts){ return _j[c].append(text, ts); }
+
+  bool pending() const {
+    for (int c = 0; c < TGJ_CLASSES; ++c) if (_j[c].pending()) return true;
+    return false;
+  }
+
+  // 最高優先類別的前幾則；cls = 這一批所屬類別（ack 時帶回）
+  bool front(String& out, uint32_t& lastSeq, TgjClass& cls, uint16_t maxMsgs, uint32_t nowEpoch){
+    for (int c = 0; c < TGJ_CLASSES; ++c) {
+      if (_j[c].pending() && _j[c].front(out, lastSeq, maxMsgs, nowEpoch)) { cls = (TgjClass)c; return true; }
+    }
+    return false;
+  }
+
+  uint16_t frontCount(TgjClass c) const { return _j[c].frontCount(); }
+  void ack(TgjClass c, uint32_t lastSeq, uint32_t nowMs){ _j[c].ack(lastSeq, nowMs); }
+  void tick(uint32_t nowMs){ for (int c = 0; c < TGJ_CLASSES; ++c) _j[c].tick(nowMs); }
+  void flushAck(){ for (int c = 0; c < TGJ_CLASSES; ++c) _j[c].flushAck(); }
+
+  uint32_t pendingCount() const {
+    uint32_t n = 0;
+    for (int c = 0; c < TGJ_CLASSES; ++c) n += _j[c].pendingCount();
+    return n;
+  }
+  const TgJournal<Fs>& journal(TgjClass c) const { return _j[c]; }
+
+private:
+  TgJournal<Fs> _j[TGJ_CLASSES];
+};
@@ -0,0 +1,205 @@
+#pragma once
+// =========================【Telegram 傳輸層：HTTP/1.1 keep-alive 連線】=========================
+// 請求組裝、回應解析（Content-Length / chunked / 讀到關閉）與連線重用規則：
+//   連線中且閒置未超過 TG_IDLE_CLOSE_MS → 沿用；否則關閉並重新握手。
+//   回應帶 Connection: close、沒有長度資訊或讀取失敗 → 用完即關，下次請求重新握手。
+//   重送只限「寫入就失敗」的重用連線（對方沒收到完整請求）；已寫出但沒有回應時不重送，
+//   因為 sendMessage 不是冪等的 —— 交給呼叫端（tgTask 的日誌至少送達一次，以序號去重）。
+// Io 介面（韌體：WiFiClientSecure + millis/delay；主機測試：假傳輸計算握手次數）：
+//   bool     connect()                        建立連線（含 TLS 握手）
+//   bool     connected()
+//   void     stop()
+//   size_t   write(const uint8_t* p, size_t n)
+//   int      available()
+//   int      read()                           / int read(uint8_t* p, size_t n)
+//   uint32_t now()                            ms
+//   void     idle()                           等資料時讓出 CPU
+// 不依賴 Arduino：韌體（main.cpp 的 TgLink 加上互斥鎖）與主機測試（test/native/test_tg_link）共用。
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// TG_API_HOST / TG_API_PORT 可由 build_flags 覆寫（例如指向本機 HTTPS 測試伺服器）
+#ifndef TG_API_HOST
+  #define TG_API_HOST "api.telegram.org"
+#endif
+#ifndef TG_API_PORT
+  #define TG_API_PORT 443
+#endif
+static const uint32_t TG_IDLE_CLOSE_MS = 50000;  // 伺服器約 60s 會關閉閒置連線 → 提早自行重連
+
+// 回應 body 接收者：連線邊讀邊餵，呼叫端不必先把整包存起來
+class TgBodySink {
+public:
+  virtual void begin(long /*contentLen*/) {}              // contentLen<0 = 未知長度
+  virtual void onBody(const uint8_t* p, size_t n) = 0;
+  virtual ~TgBodySink() {}
+};
+
+template <class Io>
+class TgHttpConn {
+public:
+  explicit TgHttpConn(Io& io) : _io(io) {}
+
+  // 送出一次請求；回傳 HTTP 狀態碼（<0 = 連線/逾時失敗）。sink 可為 nullptr（仍會把回應讀完）
+  int request(const char* verb, const char* path, const char* ctype,
+              const char* body, size_t bodyLen, TgBodySink* sink, uint32_t timeoutMs){
+    int code = -1;
+    for (int attempt = 0; attempt < 2; ++attempt){
+      bool reused = false;
+      if (!ensureOpen(reused)) break;
+      if (!writeRequest(verb, path, ctype, body, bodyLen)) {
+        drop();
+        if (reused) { _retries++; continue; }     // 重用的連線已被關閉：請求沒送出，換新連線再送
+        break;
+      }
+      bool keepAlive = true;
+      code = readResponse(sink, timeoutMs, keepAlive);
+      if (code < 0) { drop(); break; }            // 已寫出：對方可能已處理，不重送
+      if (reused) _reuses++;
+      _lastUse = _io.now();
+      if (!keepAlive) drop();
+      break;
+    }
+    return code;
+  }
+
+  void close(){ drop(); }
+
+  uint32_t handshakes() const { return _handshakes; }  // 完整 TLS 握手次數
+  uint32_t reuses()     const { return _reuses; }      // 沿用既有連線的請求數
+  uint32_t retries()    const { return _retries; }     // 重用連線寫入失敗後換新連線重送的次數
+
+private:
+  Io&      _io;
+  bool     _open = false;
+  uint32_t _lastUse = 0;
+  uint32_t _handshakes = 0, _reuses = 0, _retries = 0;
+
+  void drop(){
+    if (_open) _io.stop();
+    _open = false;
+  }
+
+  bool ensureOpen(bool& reused){
+    if (_open && _io.connected() && _io.now() - _lastUse < TG_IDLE_CLOSE_MS) { reused = true; return true; }
+    drop();
+    if (!_io.connect()) return false;
+    _handshakes++;
+    _open = true;
+    _lastUse = _io.now();
+    return true;
+  }
+
+  // 標頭與小 body 合併成一次寫入（TLS 上每次 write 都是一筆 record）
+  bool writeRequest(const char* verb, const char* path, const char* ctype, const char* body, size_t bodyLen){
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), "%s %s HTTP/1.1\r\nHost: " TG_API_HOST "\r\n", verb, path);
+    if (n < 0 || (size_t)n >= sizeof(buf)) return false;
+    if (ctype) n += snprintf(buf + n, sizeof(buf) - n, "Content-Type: %s\r\n", ctype);
+    if ((size_t)n < sizeof(buf) && (ctype || bodyLen))
+      n += snprintf(buf + n, sizeof(buf) - n, "Content-Length: %u\r\n", (unsigned)bodyLen);
+    if ((size_t)n < sizeof(buf)) n += snprintf(buf + n, sizeof(buf) - n, "Connection: keep-alive\r\n\r\n");
+    if ((size_t)n >= sizeof(buf)) return false;
+    if (bodyLen && (size_t)n + bodyLen <= sizeof(buf)) {
+      memcpy(buf + n, body, bodyLen);
+      n += (int)bodyLen;
+      bodyLen = 0;
+    }
+    if (_io.write((const uint8_t*)buf, (size_t)n) != (size_t)n) return false;
+    return !bodyLen || _io.write((const uint8_t*)body, bodyLen) == bodyLen;
+  }
+
+  // 等到有資料可讀；斷線或逾時回 false
+  bool waitData(uint32_t deadline){
+    while (!_io.available()){
+      if (!_io.connected()) return false;
+      if ((int32_t)(_io.now() - deadline) >= 0) return false;
+      _io.idle();
+    }
+    return true;
+  }
+
+  // 讀一行（去掉 \r\n，轉小寫以便比對 header）；回傳長度，-1=失敗
+  int readLine(char* buf, size_t cap, uint32_t deadline){
+    size_t n = 0;
+    for (;;){
+      if (!waitData(deadline)) return -1;
+      int c = _io.read();
+      if (c < 0) return -1;
+      if (c == '\n') break;
+      if (c == '\r') continue;
+      if (n + 1 < cap) buf[n++] = (char)tolower(c);
+    }
+    buf[n] = 0;
+    return (int)n;
+  }
+
+  // 讀取 len 位元組 body 並交給 sink
+  bool readBody(size_t len, TgBodySink* sink, uint32_t deadline){
+    uint8_t buf[128];
+    while (len > 0){
+      if (!waitData(deadline)) return false;
+      int k = _io.read(buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (k <= 0) return false;
+      if (sink) sink->onBody(buf, (size_t)k);
+      len -= (size_t)k;
+    }
+    return true;
+  }
+
+  int readResponse(TgBodySink* sink, uint32_t timeoutMs, bool& keepAlive){
+    uint32_t deadline = _io.now() + timeoutMs;
+    char line[128];
+
+    // 狀態列："HTTP/1.1 200 OK"
+    if (readLine(line, sizeof(line), deadline) < 0) return -1;
+    const char* sp = strchr(line, ' ');
+    if (!sp) return -1;
+    int code = atoi(sp + 1);
+    keepAlive = (strncmp(line, "http/1.1", 8) == 0);
+
+    // header：只關心長度、chunked 與 connection
+    long contentLen = -1;
+    bool chunked = false;
+    for (;;){
+      int n = readLine(line, sizeof(line), deadline);
+      if (n < 0) return -1;
+      if (n == 0) break;
+      if (!strncmp(line, "content-length:", 15)) contentLen = atol(line + 15);
+      else if (!strncmp(line, "transfer-encoding:", 18) && strstr(line, "chunked")) chunked = true;
+      else if (!strncmp(line, "connection:", 11) && strstr(line, "close")) keepAlive = false;
+    }
+    if (sink) sink->begin(chunked ? -1 : contentLen);
+
+    if (chunked){
+      for (;;){
+        if (readLine(line, sizeof(line), deadline) < 0) return -1;
+        size_t sz = strtoul(line, nullptr, 16);
+        if (sz == 0) {                       // 最後一塊：吃掉 trailer 到空行
+          int n;
+          while ((n = readLine(line, sizeof(line), deadline)) > 0) {}
+          if (n < 0) return -1;
+          break;
+        }
+        if (!readBody(sz, sink, deadline)) return -1;
+        if (readLine(line, sizeof(line), deadline) < 0) return -1;  // chunk 尾端 CRLF
+      }
+    } else if (contentLen >= 0){
+      if (!readBody((size_t)contentLen, sink, deadline)) return -1;
+    } else {
+      // 沒有長度資訊：讀到對方關閉為止，連線不可再用
+      keepAlive = false;
+      uint8_t buf[128];
+      while (waitData(deadline)){
+        int k = _io.read(buf, sizeof(buf));
+        if (k <= 0) break;
+        if (sink) sink->onBody(buf, (size_t)k);
+      }
+    }
+    return code;
+  }
+};
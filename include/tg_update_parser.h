@@ -0,0 +1,209 @@
+#pragma once
+// =========================【getUpdates 串流解析器】=========================
+// 邊收邊解析的 JSON 狀態機：只追蹤 result[].update_id、message.text、
+// message.web_app_data.data 三個欄位，其餘內容直接略過；
+// 使用固定緩衝（不配置 String），記憶體用量與回應大小無關。
+// 支援 \uXXXX（含代理對）轉 UTF-8，Telegram 會把非 ASCII 字元轉成這種跳脫。
+// 不依賴 Arduino：韌體（main.cpp 的 TgUpdateParser）與主機測試（test/native）共用。
+// 每筆 update 結束時呼叫 onUpdate()，子類別以 text() / data() 取本筆擷取結果。
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+
+static const size_t TG_WEBAPP_MAX = 4096;   // Telegram web_app_data 上限
+
+class TgUpdateScanner {
+public:
+  virtual ~TgUpdateScanner() {}
+
+  void feed(const uint8_t* p, size_t n){ for (size_t i = 0; i < n; ++i) feed((char)p[i]); }
+
+  uint32_t updates()      const { return _updates; }   // 本次完整解析的 update 筆數
+  long     lastUpdateId() const { return _lastUid; }
+
+  void reset(){
+    _st = S_VALUE; _depth = 0; _esc = false; _uLeft = 0; _hiSur = 0;
+    _cap = CAP_NONE; _capBuf = nullptr;
+    _updates = 0; _lastUid = 0;
+    resetUpdate();
+  }
+
+protected:
+  // 一筆 update 解析完成（_lastUid / _updates 已更新）
+  virtual void onUpdate() {}
+
+  const char* text()          const { return _text; }
+  size_t      textLen()       const { return _textLen; }
+  bool        hasData()       const { return _hasData; }
+  const char* data()          const { return _data; }
+  size_t      dataLen()       const { return _dataLen; }
+  bool        dataTruncated() const { return _dataTrunc; }
+
+private:
+  enum St  : uint8_t { S_VALUE, S_KEY_OR_END, S_AFTER_KEY, S_AFTER_VALUE, S_STRING, S_ATOM };
+  enum Cap : uint8_t { CAP_NONE, CAP_KEY, CAP_TEXT, CAP_DATA, CAP_UID };
+  static const int MAX_DEPTH = 8;
+
+  St       _st;
+  int8_t   _depth;
+  char     _ctr[MAX_DEPTH];        // 各層容器 '{' / '['
+  char     _key[MAX_DEPTH][16];    // 各層物件目前的 key（截斷即可，只比對短 key）
+  bool     _esc;
+  uint8_t  _uLeft;                 // \uXXXX 還差幾個 hex
+  uint16_t _uVal, _hiSur;
+
+  Cap      _cap;
+  char*    _capBuf;
+  size_t   _capCap, _capLen;
+  bool     _capTrunc;
+
+  uint32_t _updates;
+  long     _lastUid;
+  long     _num; bool _neg;
+
+  // 目前這筆 update 的擷取結果
+  bool     _hasUid;  long _uid;
+  char     _text[48];  size_t _textLen;
+  char     _data[TG_WEBAPP_MAX + 1]; size_t _dataLen; bool _hasData, _dataTrunc;
+
+  void resetUpdate(){ _hasUid = false; _textLen = 0; _text[0] = 0; _dataLen = 0; _hasData = false; _dataTrunc = false; }
+
+  static bool keyIs(const char* k, const char* name){ return strcmp(k, name) == 0; }
+
+  // 是否位於 {"result":[ {update} ]} 的 update 物件之內
+  bool inUpdate() const {
+    return _depth >= 3 && _ctr[0] == '{' && keyIs(_key[0], "result") && _ctr[1] == '[' && _ctr[2] == '{';
+  }
+
+  // 依目前路徑決定此值要擷取到哪裡
+  Cap valueCapture() const {
+    if (!inUpdate()) return CAP_NONE;
+    if (_depth == 3 && keyIs(_key[2], "update_id")) return CAP_UID;
+    if (_depth == 4 && keyIs(_key[2], "message") && keyIs(_key[3], "text")) return CAP_TEXT;
+    if (_depth == 5 && keyIs(_key[2], "message") && keyIs(_key[3], "web_app_data")
+                    && _ctr[4] == '{' && keyIs(_key[4], "data")) return CAP_DATA;
+    return CAP_NONE;
+  }
+
+  void push(char c){
+    if (_depth < MAX_DEPTH) { _ctr[_depth] = c; _key[_depth][0] = 0; }
+    _depth++;
+  }
+  void pop(){
+    if (_depth <= 0) return;
+    _depth--;
+    if (_depth == 2 && _ctr[0] == '{' && keyIs(_key[0], "result") && _ctr[1] == '[') finishUpdate();
+  }
+
+  void beginString(Cap cap){
+    _cap = cap; _capLen = 0; _capTrunc = false; _esc = false; _uLeft = 0; _hiSur = 0;
+    switch (cap){
+      case CAP_KEY:  _capBuf = (_depth > 0 && _depth <= MAX_DEPTH) ? _key[_depth-1] : nullptr; _capCap = sizeof(_key[0]) - 1; break;
+      case CAP_TEXT: _capBuf = _text; _capCap = sizeof(_text) - 1; break;
+      case CAP_DATA: _capBuf = _data; _capCap = TG_WEBAPP_MAX;     break;
+      default:       _capBuf = nullptr; _capCap = 0;                break;
+    }
+    _st = S_STRING;
+  }
+
+  void put(char c){
+    if (!_capBuf) return;
+    if (_capLen < _capCap) _capBuf[_capLen++] = c; else _capTrunc = true;
+  }
+
+  void putCodepoint(uint32_t cp){
+    if (cp < 0x80)        { put((char)cp); }
+    else if (cp < 0x800)  { put((char)(0xC0 | (cp >> 6)));  put((char)(0x80 | (cp & 0x3F))); }
+    else if (cp < 0x10000){ put((char)(0xE0 | (cp >> 12))); put((char)(0x80 | ((cp >> 6) & 0x3F))); put((char)(0x80 | (cp & 0x3F))); }
+    else                  { put((char)(0xF0 | (cp >> 18))); put((char)(0x80 | ((cp >> 12) & 0x3F)));
+                            put((char)(0x80 | ((cp >> 6) & 0x3F))); put((char)(0x80 | (cp & 0x3F))); }
+  }
+
+  void endString(){
+    if (_capBuf) _capBuf[_capLen] = 0;
+    if (_cap == CAP_KEY)  { _st = S_AFTER_KEY; _cap = CAP_NONE; _capBuf = nullptr; return; }
+    if (_cap == CAP_TEXT) _textLen = _capLen;
+    if (_cap == CAP_DATA) { _dataLen = _capLen; _hasData = true; _dataTrunc = _capTrunc; }
+    _cap = CAP_NONE; _capBuf = nullptr;
+    _st = S_AFTER_VALUE;
+  }
+
+  void stringChar(char c){
+    if (_uLeft){
+      uint8_t v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 0;
+      _uVal = (_uVal << 4) | v;
+      if (--_uLeft) return;
+      if (_uVal >= 0xD800 && _uVal <= 0xDBFF) { _hiSur = _uVal; return; }
+      if (_uVal >= 0xDC00 && _uVal <= 0xDFFF && _hiSur) {
+        putCodepoint(0x10000 + (((uint32_t)_hiSur - 0xD800) << 10) + (_uVal - 0xDC00));
+      } else {
+        putCodepoint(_uVal);
+      }
+      _hiSur = 0;
+      return;
+    }
+    if (_esc){
+      _esc = false;
+      switch (c){
+        case 'n': put('\n'); break;
+        case 'r': put('\r'); break;
+        case 't': put('\t'); break;
+        case 'b': put('\b'); break;
+        case 'f': put('\f'); break;
+        case 'u': _uLeft = 4; _uVal = 0; break;
+        default:  put(c);    break;   // \"  \\  \/
+      }
+      return;
+    }
+    if (c == '\\') { _esc = true; return; }
+    if (c == '"')  { endString(); return; }
+    put(c);
+  }
+
+  void endAtom(){
+    if (_cap == CAP_UID) { _uid = _neg ? -_num : _num; _hasUid = true; }
+    _cap = CAP_NONE;
+    _st = S_AFTER_VALUE;
+  }
+
+  void feed(char c){
+    if (_st == S_STRING) { stringChar(c); return; }
+    if (_st == S_ATOM){
+      if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || isalpha((unsigned char)c)) {
+        if (_cap == CAP_UID) { if (c == '-') _neg = true; else if (c >= '0' && c <= '9') _num = _num * 10 + (c - '0'); }
+        return;
+      }
+      endAtom();   // 其餘字元交給下方一般流程
+    }
+    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') return;
+
+    switch (_st){
+      case S_VALUE:
+        if (c == '{')      { push('{'); _st = S_KEY_OR_END; }
+        else if (c == '[') { push('['); _st = S_VALUE; }
+        else if (c == ']') { pop(); _st = S_AFTER_VALUE; }        // 空陣列
+        else if (c == '"') { beginString(valueCapture()); }
+        else               { _cap = valueCapture(); _num = 0; _neg = false; _st = S_ATOM; feed(c); }
+        break;
+      case S_KEY_OR_END:
+        if (c == '"')      beginString(CAP_KEY);
+        else if (c == '}') { pop(); _st = S_AFTER_VALUE; }
+        break;
+      case S_AFTER_KEY:
+        if (c == ':') _st = S_VALUE;
+        break;
+      case S_AFTER_VALUE:
+        if (c == ',')                 _st = (_depth > 0 && _depth <= MAX_DEPTH && _ctr[_depth-1] == '{') ? S_KEY_OR_END : S_VALUE;
+        else if (c == '}' || c == ']') { pop(); _st = S_AFTER_VALUE; }
+        break;
+      default: break;
+    }
+  }
+
+  void finishUpdate(){
+    if (_hasUid) { _lastUid = _uid; _updates++; }
+    onUpdate();
+    resetUpdate();
+  }
+};
@@ -0,0 +1,282 @@
+#pragma once
+// =========================【WebApp 設定解碼：欄位表 + 單趟解析】=========================
+// 單趟走過整包 JSON（不產生暫存 String）：遇到 "payload":{…} 就進入該物件，
+// key 依 kWaFields 查表，值直接解到 WaStage 暫存區；表外的 key 整段略過。
+// 單一欄位（或陣列元素）不合法 → 只略過該項並記錄錯誤；JSON 語法錯誤 → 整包不套用。
+// 不依賴 Arduino：韌體（main.cpp 的 waDecodeApply，負責組合 hm/hs 並寫入 cfg）
+// 與主機測試（test/native/test_wa_decoder）共用。
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+static const size_t   WA_STR_MAX  = 128;    // 訊息字串上限（bytes）
+static const int      WA_ERR_MAX  = 8;      // 保留的錯誤筆數
+static const int      WA_RELAY_N  = 6;      // 排程路數（= main.cpp 的 RELAY_COUNT）
+static const int      WA_ALARM_N  = 6;      // 異常 DI 路數（= main.cpp 的 ALARM_COUNT）
+static const uint32_t WA_HOLD_MAX = 3600;   // 保持上限秒數（= main.cpp 的 MAX_HOLD_SEC）
+
+enum WaKind : uint8_t { WA_BIT, WA_HHMM, WA_INT, WA_STR };
+enum WaSlot : uint8_t { WS_WD, WS_T, WS_HM, WS_HS, WS_CT0, WS_CT1, WS_CN0, WS_CN1, WS_CM0, WS_CM1, WS_AM, WS_COUNT };
+
+// 暫存區（POD；欄位表以 offsetof 對應）
+struct WaStage {
+  uint8_t wd;                              // 星期遮罩（bit0=Mon）
+  uint8_t t[WA_RELAY_N][2];                // 排程 HH:MM
+  int32_t hm[WA_RELAY_N], hs[WA_RELAY_N];  // 保持 分 / 秒
+  uint8_t ct[2][2];                        // 計數推播 HH:MM
+  int32_t cn[2];                           // 計數目標
+  char    cm[2][WA_STR_MAX + 1];           // 計數訊息
+  char    am[WA_ALARM_N][WA_STR_MAX + 1];  // 異常 DI 訊息
+};
+
+struct WaField {
+  const char* key;
+  WaKind   kind;
+  WaSlot   slot;
+  uint8_t  n;          // 陣列長度；0 = 純量
+  uint16_t off;        // WaStage 內偏移
+  int32_t  lo, hi;     // WA_INT：數值範圍；WA_STR：長度上限（hi）
+};
+
+static const WaField kWaFields[] = {
+  { "wd",  WA_BIT,  WS_WD,  7,           offsetof(WaStage, wd),    0, 1 },
+  { "t",   WA_HHMM, WS_T,   WA_RELAY_N,  offsetof(WaStage, t),     0, 0 },
+  { "ts",  WA_HHMM, WS_T,   WA_RELAY_N,  offsetof(WaStage, t),     0, 0 },   // 舊版 WebApp 的別名
+  { "hm",  WA_INT,  WS_HM,  WA_RELAY_N,  offsetof(WaStage, hm),    0, (int32_t)(WA_HOLD_MAX / 60) },
+  { "hs",  WA_INT,  WS_HS,  WA_RELAY_N,  offsetof(WaStage, hs),    0, (int32_t)WA_HOLD_MAX },
+  { "ct0", WA_HHMM, WS_CT0, 0,           offsetof(WaStage, ct[0]), 0, 0 },
+  { "ct1", WA_HHMM, WS_CT1, 0,           offsetof(WaStage, ct[1]), 0, 0 },
+  { "cn0", WA_INT,  WS_CN0, 0,           offsetof(WaStage, cn[0]), 0, 999999 },
+  { "cn1", WA_INT,  WS_CN1, 0,           offsetof(WaStage, cn[1]), 0, 999999 },
+  { "cm0", WA_STR,  WS_CM0, 0,           offsetof(WaStage, cm[0]), 0, (int32_t)WA_STR_MAX },
+  { "cm1", WA_STR,  WS_CM1, 0,           offsetof(WaStage, cm[1]), 0, (int32_t)WA_STR_MAX },
+  { "am",  WA_STR,  WS_AM,  WA_ALARM_N,  offsetof(WaStage, am),    0, (int32_t)WA_STR_MAX },
+};
+static const int WA_FIELD_N = sizeof(kWaFields) / sizeof(kWaFields[0]);
+
+struct WaError { uint8_t field; int8_t idx; const char* why; };   // idx<0 = 純量
+struct WaResult {
+  bool     syntaxOk = false;
+  uint16_t errPos   = 0;        // 語法錯誤位置（byte offset）
+  uint8_t  applied  = 0;        // 寫入 cfg 的項目數
+  uint8_t  nErr     = 0;        // 錯誤總數（可能多於保留筆數）
+  WaError  err[WA_ERR_MAX];
+};
+
+class WaDecoder {
+public:
+  WaDecoder(const char* p, size_t n, WaStage& st, uint16_t* got, WaResult& r)
+    : _begin(p), _p(p), _end(p + n), _st(st), _got(got), _r(r) {}
+
+  bool run(){
+    ws();
+    bool ok = object(0);
+    if (ok) { ws(); ok = (_p == _end); }
+    _r.syntaxOk = ok;
+    if (!ok) _r.errPos = (uint16_t)(_p - _begin);
+    return ok;
+  }
+
+private:
+  static const int MAX_DEPTH = 8;
+  const char* _begin;
+  const char* _p;
+  const char* _end;
+  WaStage&    _st;
+  uint16_t*   _got;        // 每個 slot：已收到的元素位元
+  WaResult&   _r;
+  char        _tok[WA_STR_MAX + 1];
+  size_t      _tokLen = 0;
+  bool        _tokStr = false, _tokLong = false;
+
+  void ws(){ while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n')) ++_p; }
+  bool eat(char c){ ws(); if (_p < _end && *_p == c) { ++_p; return true; } return false; }
+  bool peek(char c){ ws(); return _p < _end && *_p == c; }
+
+  void fail(int f, int idx, const char* why){
+    if (_r.nErr < WA_ERR_MAX) _r.err[_r.nErr] = { (uint8_t)f, (int8_t)idx, why };
+    if (_r.nErr < 255) _r.nErr++;
+  }
+
+  // { "key": value, … }；"payload" 物件遞迴進入
+  bool object(int depth){
+    if (depth > MAX_DEPTH || !eat('{')) return false;
+    if (eat('}')) return true;
+    do {
+      ws();
+      if (!string()) return false;
+      if (!eat(':')) return false;
+      if (!_tokLong && !strcmp(_tok, "payload") && peek('{')) {
+        if (!object(depth + 1)) return false;
+        continue;
+      }
+      int f = -1;
+      for (int i = 0; i < WA_FIELD_N && !_tokLong; ++i) if (!strcmp(_tok, kWaFields[i].key)) { f = i; break; }
+      if (f < 0) { if (!skip(depth + 1)) return false; }
+      else if (!field(f, depth + 1)) return false;
+    } while (eat(','));
+    return eat('}');
+  }
+
+  bool field(int f, int depth){
+    const WaField& F = kWaFields[f];
+    if (!F.n) return scalar(f, -1, depth);
+    if (!peek('[')) { fail(f, -1, "type"); return skip(depth); }
+    eat('[');
+    if (eat(']')) return true;
+    int i = 0;
+    do {
+      if (i >= F.n) { fail(f, i, "count"); if (!skip(depth)) return false; }
+      else if (!scalar(f, i, depth)) return false;
+      ++i;
+    } while (eat(','));
+    return eat(']');
+  }
+
+  // 讀一個純量（字串或 atom）並依欄位型別轉換存入暫存區
+  bool scalar(int f, int idx, int depth){
+    ws();
+    if (peek('{') || peek('[')) { fail(f, idx, "type"); return skip(depth); }
+    if (!(_p < _end && *_p == '"' ? string() : atom())) return false;
+
+    const WaField& F = kWaFields[f];
+    uint8_t* base = (uint8_t*)&_st + F.off;
+    int      i    = idx < 0 ? 0 : idx;
+    switch (F.kind) {
+      case WA_BIT: {
+        int v;
+        if      (!strcmp(_tok, "true")  || !strcmp(_tok, "1")) v = 1;
+        else if (!strcmp(_tok, "false") || !strcmp(_tok, "0")) v = 0;
+        else { fail(f, idx, "type"); return true; }
+        if (v) *base |= (1u << i); else *base &= ~(1u << i);
+        break;
+      }
+      case WA_HHMM: {
+        if (!_tokStr) { fail(f, idx, "type"); return true; }
+        if (!_tokLen) return true;                        // 空白 = 不變更
+        int hh, mm;
+        if (!parseHHMM(hh, mm)) { fail(f, idx, "format"); return true; }
+        if (hh > 23 || mm > 59) { fail(f, idx, "range"); return true; }
+        base[i * 2] = (uint8_t)hh; base[i * 2 + 1] = (uint8_t)mm;
+        break;
+      }
+      case WA_INT: {
+        long v;
+        if (!parseInt(v))             { fail(f, idx, "type");  return true; }
+        if (v < F.lo || v > F.hi)     { fail(f, idx, "range"); return true; }
+        ((int32_t*)base)[i] = (int32_t)v;
+        break;
+      }
+      case WA_STR: {
+        if (!_tokStr)                 { fail(f, idx, "type"); return true; }
+        if (_tokLong || (int32_t)_tokLen > F.hi) { fail(f, idx, "len"); return true; }
+        if (!_tokLen) return true;                        // 空白 = 沿用原訊息
+        memcpy(base + i * (WA_STR_MAX + 1), _tok, _tokLen + 1);
+        break;
+      }
+    }
+    _got[F.slot] |= (1u << i);
+    return true;
+  }
+
+  bool parseHHMM(int& hh, int& mm){
+    const char* c = strchr(_tok, ':');
+    if (!c || c == _tok || c - _tok > 2 || strlen(c + 1) != 2) return false;
+    for (const char* q = _tok; *q; ++q) if (q != c && !isdigit((unsigned char)*q)) return false;
+    hh = atoi(_tok); mm = atoi(c + 1);
+    return true;
+  }
+  // 整數：接受 JSON 數字或數字字串（舊版 WebApp 會送 "88"）
+  bool parseInt(long& v){
+    const char* q = _tok;
+    if (*q == '-') ++q;
+    if (!*q) return false;
+    for (const char* d = q; *d; ++d) if (!isdigit((unsigned char)*d)) return false;
+    if (strlen(q) > 9) return false;
+    v = atol(_tok);
+    return true;
+  }
+
+  // "…" → _tok（解跳脫，\uXXXX 轉 UTF-8；超過 WA_STR_MAX 設 _tokLong）
+  bool string(){
+    if (_p >= _end || *_p != '"') return false;
+    ++_p;
+    _tokLen = 0; _tokStr = true; _tokLong = false;
+    uint16_t hi = 0;
+    while (_p < _end) {
+      char c = *_p++;
+      if (c == '"') { _tok[_tokLen] = 0; return true; }
+      if ((uint8_t)c < 0x20) return false;
+      if (c != '\\') { put(c); continue; }
+      if (_p >= _end) return false;
+      c = *_p++;
+      switch (c) {
+        case '"': case '\\': case '/': put(c); break;
+        case 'b': put('\b'); break;
+        case 'f': put('\f'); break;
+        case 'n': put('\n'); break;
+        case 'r': put('\r'); break;
+        case 't': put('\t'); break;
+        case 'u': {
+          if (_end - _p < 4) return false;
+          uint32_t u = 0;
+          for (int k = 0; k < 4; ++k) {
+            char h = *_p++;
+            u <<= 4;
+            if      (h >= '0' && h <= '9') u |= h - '0';
+            else if (h >= 'a' && h <= 'f') u |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') u |= h - 'A' + 10;
+            else return false;
+          }
+          if (u >= 0xD800 && u < 0xDC00) { hi = (uint16_t)u; continue; }      // 代理對前半
+          if (u >= 0xDC00 && u < 0xE000) {
+            if (!hi) continue;                                              // 孤立後半：丟棄
+            u = 0x10000 + (((uint32_t)hi - 0xD800) << 10) + (u - 0xDC00);
+          }
+          hi = 0;
+          putUtf8(u);
+          break;
+        }
+        default: return false;
+      }
+    }
+    return false;
+  }
+  // 數字 / true / false / null → _tok
+  bool atom(){
+    _tokLen = 0; _tokStr = false; _tokLong = false;
+    while (_p < _end && (isalnum((unsigned char)*_p) || *_p == '-' || *_p == '+' || *_p == '.')) put(*_p++);
+    _tok[_tokLen] = 0;
+    return _tokLen > 0;
+  }
+  void put(char c){ if (_tokLen < WA_STR_MAX) _tok[_tokLen++] = c; else _tokLong = true; }
+  void putUtf8(uint32_t u){
+    if (u < 0x80)         { put((char)u); }
+    else if (u < 0x800)   { put((char)(0xC0 | (u >> 6)));  put((char)(0x80 | (u & 0x3F))); }
+    else if (u < 0x10000) { put((char)(0xE0 | (u >> 12))); put((char)(0x80 | ((u >> 6) & 0x3F))); put((char)(0x80 | (u & 0x3F))); }
+    else                  { put((char)(0xF0 | (u >> 18))); put((char)(0x80 | ((u >> 12) & 0x3F)));
+                            put((char)(0x80 | ((u >> 6) & 0x3F))); put((char)(0x80 | (u & 0x3F))); }
+  }
+
+  // 略過任意值（未知欄位 / 型別不符）
+  bool skip(int depth){
+    if (depth > MAX_DEPTH) return false;
+    ws();
+    if (_p >= _end) return false;
+    if (*_p == '"') return string();
+    if (*_p == '{' || *_p == '[') {
+      char close = (*_p == '{') ? '}' : ']';
+      bool obj = (*_p == '{');
+      ++_p;
+      if (eat(close)) return true;
+      do {
+        if (obj) { ws(); if (!string() || !eat(':')) return false; }
+        if (!skip(depth + 1)) return false;
+      } while (eat(','));
+      return eat(close);
+    }
+    return atom();
+  }
+};
@@ -0,0 +1,38 @@
+# 打包 SPIFFS 前把 data/ 內的網頁資產壓成 .gz（只在 buildfs / uploadfs 時執行）
+# index.html 另去掉 {{KEY}} 產生「靜態殼」：欄位值改由頁面載入後向 /page-data 取得，
+# 因此 .gz 內容與設定無關、可被瀏覽器快取；原始 index.html 仍保留作為模板後備。
+Import("env")
+
+import gzip
+import os
+import re
+
+ASSETS = (".html", ".css", ".js")
+TOKEN = re.compile(rb"\{\{[A-Z0-9_]+\}\}")
+
+
+def gzip_assets():
+    data_dir = env.subst("$PROJECT_DATA_DIR")
+    if not os.path.isdir(data_dir):
+        return
+    for name in sorted(os.listdir(data_dir)):
+        src = os.path.join(data_dir, name)
+        if not name.endswith(ASSETS) or not os.path.isfile(src):
+            continue
+        with open(src, "rb") as f:
+            raw = f.read()
+        if name.endswith(".html"):
+            raw = TOKEN.sub(b"", raw)
+        gz = gzip.compress(raw, compresslevel=9, mtime=0)   # mtime=0 → 內容不變則位元組不變
+        dst = src + ".gz"
+        if os.path.isfile(dst):
+            with open(dst, "rb") as f:
+                if f.read() == gz:
+                    continue
+        with open(dst, "wb") as f:
+            f.write(gz)
+        print("gzip_assets: %s %d -> %d bytes" % (name, len(raw), len(gz)))
+
+
+if any(t in COMMAND_LINE_TARGETS for t in ("buildfs", "uploadfs", "uploadfsota")):
+    gzip_assets()
@@ -1,6 +1,6 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WebServer.h>
+#include <ESPAsyncWebServer.h>   // 非同步 HTTP（AsyncTCP）
 #include <SPIFFS.h>
 #include <FS.h>
 #include <Wire.h>
@@ -10,6 +10,24 @@
 #include <U8g2lib.h>         // OLED 顯示函式庫 (U8g2)
 #include <ESP32Ping.h>       // 新增：用來檢測指定 IP 是否被佔用
 #include <vector>
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+#include <driver/gpio.h>     // gpio_set_level()：繼電器在臨界區內切換（IRAM-safe）
+#include <sys/time.h>
+#include <memory>
+#include <freertos/stream_buffer.h>
+#include "tg_update_parser.h"   // getUpdates 串流解析（與 test/native 共用）
+#include "tg_batch.h"           // 日誌補送批次 / 429 解析（與 test/native 共用）
+#include "crc32.h"              // CRC-32（與 test/native 共用）
+#include "cnt_pulse.h"          // 計數去抖 / 64 位元延伸（與 test/native 共用）
+#include "cnt_checkpoint.h"     // 計數斷電保存：紀錄 / 還原挑選 / 寫入時機（與 test/native 共用）
+#include "page_template.h"      // 首頁模板掃描（與 test/native 共用）
+#include "http_pipe.h"          // 串流回應寫入管道的等待規則（與 test/native 共用）
+#include "wa_decoder.h"         // WebApp 設定單趟解碼（與 test/native 共用）
+#include "sched_engine.h"       // 排程器核心：下次觸發 + 最小堆積（與 test/native 共用）
+#include "rtc_alarm.h"          // RTC 鬧鐘：下一個事件 / 寫入規則（與 test/native 共用）
+#include "tg_journal.h"         // Telegram 持久化日誌：每類一份 + 批次 checkpoint（與 test/native 共用）
+#include "tg_link.h"            // Telegram keep-alive 連線：請求組裝 / 回應解析 / 重連規則（與 test/native 共用）
 // --- forward declarations ---
 // --- forward declarations ---
 static inline void oledKick(const char* why);   // ← 改成 static inline
@@ -60,7 +78,9 @@ static inline void oledKick(const char* why ){
 
 // 全域函式宣告
 void drawOled(bool forceSetup);      // 顯示 OLED 畫面（是否強制顯示設定模式）
-static inline void tgEnqueue(const String& s);  // 推播訊息加入佇列
+// 推播優先序：DI 異常 > 繼電器啟停 > 計數回報 / 設定回覆
+enum TgPri : uint8_t { TG_PRI_ALARM = 0, TG_PRI_RELAY = 1, TG_PRI_INFO = 2, TG_PRI_COUNT = 3 };
+static inline void tgEnqueue(const String& s, TgPri pri = TG_PRI_INFO);  // 推播訊息加入 outbox
 
 // =========================【繼電器控制區】=========================
 // 6 路繼電器 GPIO 腳位設定（避免佔用 I2C 的 21/22 腳）
@@ -87,9 +107,7 @@ static const int  ALARM_COUNT = 6;
 const  int ALARM_PINS[ALARM_COUNT] = { 16, 17, 18, 19, 23, 25 };
 bool gAlarmLatched[ALARM_COUNT] = {0,0,0,0,0,0};
 
-// 輸入去抖與前一次狀態紀錄
-static bool gAlarmLast[ALARM_COUNT] = {1,1,1,1,1,1};         // 上次輸入狀態 (1=未觸發)
-static unsigned long gAlarmDebounceMs[ALARM_COUNT] = {0,0,0,0,0,0};
+// 輸入去抖（以事件時間戳計算，見【異常 DI：中斷擷取事件環】）
 static const unsigned long ALARM_DEBOUNCE = 40;              // 去抖時間 (ms)
 
 // =========================【工件計數器區】=========================
@@ -98,58 +116,646 @@ static const int CNT_COUNT = 2;
 const int CNT_PINS[CNT_COUNT] = {4, 15};         // ⚠ 目前使用 GPIO4 / GPIO15
 static const bool CNT_ACTIVE_LOW = true;         // 訊號為低有效
 
+#define CNT_IMPL_ISR            // 使用 GPIO 中斷 + loop re-arm（去抖 CNT_DEBOUNCE / CNT_MIN_US，適合會彈跳的機械接點）
+// #define CNT_IMPL_PCNT         // (可切換為 ESP32 PCNT 硬體計數：每個脈衝不佔 CPU，但只濾掉 ≤12.8μs 的毛刺，
+//                               //  接點彈跳會被重複計數 → 僅用於乾淨的電子輸出，如 NPN/PNP 感測器、PLC)
+#if defined(CNT_IMPL_PCNT) && defined(CNT_IMPL_ISR)
+#undef CNT_IMPL_ISR                // 開啟 PCNT 即取代預設的 ISR 實作
+#endif
+
 // 計數狀態相關全域變數
 volatile uint32_t gCntAck[CNT_COUNT] = {0,0};    // 推播成功後需清除的計數量
-static const unsigned long CNT_DEBOUNCE = 20;    // ms 去抖時間
-static const uint32_t      CNT_MIN_US   = 3000;  // μs 兩次觸發最短間隔 (避免抖動)
+static const unsigned long CNT_DEBOUNCE = 20;    // ms 去抖時間（ISR 實作）
+static const uint32_t      CNT_MIN_US   = 3000;  // μs 兩次觸發最短間隔 (避免抖動，ISR 實作)
+static const uint16_t      CNT_FILTER_APB = 1023; // PCNT 濾波：短於 1023 個 APB 週期（約 12.8μs）的脈衝忽略
 
 // 狀態追蹤用變數
-static int  gCntLast[CNT_COUNT] = {1,1};         // 上次輸入狀態
-static unsigned long gCntDeb[CNT_COUNT] = {0,0}; // 去抖計時
 static uint32_t gCount[CNT_COUNT] = {0,0};       // 計數器累積數值
 static int16_t  lastCntKey[CNT_COUNT] = {-1,-1}; // 上次按鍵索引
-static bool gCntArmed[CNT_COUNT] = {false,false}; // 是否允許下一次計數
 static unsigned long gCntWarmupUntil = 0;        // 啟動後暖機時間
-volatile uint32_t gCntIsr[CNT_COUNT] = {0,0};    // 中斷計數
-volatile uint32_t gCntLastUs[CNT_COUNT] = {0,0}; // 上次觸發時間戳 (us)
+static uint64_t gCntBase[CNT_COUNT] = {0,0};     // 上次歸零時的硬體總數（目前數量 = total - base）
 volatile bool gCntResetReq[CNT_COUNT] = {false,false}; // 是否請求重置
 static uint32_t gCntShown[2] = {0,0};            // OLED 顯示用的數值
 
 
+// =========================【省電模式設定】=========================
+// 預設關閉：loop() 全速輪詢、Wi-Fi 不省電（反應最快）。
+// 開啟 POWER_SAVE（電池機櫃）：loop() 每輪結束後交出 CPU，睡到「最近的期限」（pwrWithin()）或被事件叫醒
+//   （DI / 計數 / RTC 鬧鐘中斷、HTTP handler、Telegram 收件），Wi-Fi 改 modem sleep（依 AP DTIM 醒來收 beacon）。
+// IDF 設定有 CONFIG_PM_ENABLE（含 tickless idle）時另外啟用自動 light sleep，GPIO 以電平喚醒；
+//   ESP32 的 GPIO 喚醒與中斷共用觸發型態，故此時 DI / 計數 / RTC INT 改用「電平中斷 + 每次翻轉電平」取代邊緣中斷。
+//   PCNT 在 light sleep 時停止計數 → 只有 CNT_IMPL_ISR 才啟用 light sleep。
+// #define POWER_SAVE           // (電池供電：事件之間讓出 CPU + Wi-Fi modem sleep)
+
+#if defined(POWER_SAVE) && CONFIG_PM_ENABLE
+  #if defined(CNT_IMPL_ISR)
+    #define PWR_LIGHT_SLEEP 1
+    #include <esp_pm.h>
+    #include <esp_sleep.h>
+    #include <soc/gpio_struct.h>
+  #else
+    #warning "POWER_SAVE：PCNT 在 light sleep 時不計數，僅啟用 loop 阻塞 + modem sleep；要 light sleep 請改用 CNT_IMPL_ISR"
+  #endif
+#endif
+
+static const uint32_t POWER_TICK_MS = 1000;       // 無事件時最長睡多久（timeSvc 每秒取樣）
+
+static TaskHandle_t      gLoopTask    = nullptr;  // loopTask（setup() 記下）
+static volatile uint32_t gPwrWithinMs = POWER_TICK_MS;
+
+// loop() 內各模組登記「最晚多久後要再跑一輪」；本輪結束時取最小值睡眠
+static inline void pwrWithin(uint32_t ms){ if (ms < gPwrWithinMs) gPwrWithinMs = ms; }
+
+// ISR 內叫醒 loop()
+static inline void IRAM_ATTR pwrWakeFromIsr(){
+#ifdef POWER_SAVE
+  if (!gLoopTask) return;
+  BaseType_t hp = pdFALSE;
+  vTaskNotifyGiveFromISR(gLoopTask, &hp);
+  if (hp) portYIELD_FROM_ISR();
+#endif
+}
+
+// 其他任務改了 loop() 會看的狀態後叫醒它（loop 自己呼叫則無動作）
+static inline void pwrWake(){
+#ifdef POWER_SAVE
+  if (gLoopTask && xTaskGetCurrentTaskHandle() != gLoopTask) xTaskNotifyGive(gLoopTask);
+#endif
+}
+
+// 腳位中斷型態：light sleep 時用電平（可喚醒），否則用邊緣
+// level = 目前電平；電平模式下等待「相反電平」，ISR 每次觸發後以 pwrIrqFlip() 翻轉
+static inline int pwrIrqMode(int edgeMode, int level){
+#if PWR_LIGHT_SLEEP
+  (void)edgeMode;
+  return level ? ONLOW_WE : ONHIGH_WE;
+#else
+  (void)level;
+  return edgeMode;
+#endif
+}
+// ISR 內讀腳位電平（直接讀暫存器，不經 flash 內的驅動函式）
+static inline uint32_t IRAM_ATTR pwrPinLevel(uint8_t pin){
+  return ((pin < 32 ? REG_READ(GPIO_IN_REG) : REG_READ(GPIO_IN1_REG)) >> (pin & 31)) & 1;
+}
+static inline void IRAM_ATTR pwrIrqFlip(uint8_t pin, uint32_t level){
+#if PWR_LIGHT_SLEEP
+  GPIO.pin[pin].int_type = level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+#else
+  (void)pin; (void)level;
+#endif
+}
+
+
+// =========================【計數器抽象介面定義】=========================
+// total() 為開機後單調遞增的 64 位元總數；「歸零」只移動 gCntBase，不動硬體
+class ICounter {
+public:
+  virtual bool begin() = 0;                  // 設定腳位並開始計數
+  virtual void poll() {}                     // loop() 每圈呼叫（re-arm / 溢位輔助）
+  virtual uint64_t total(int ch) = 0;        // 讀取累計總數
+  virtual const char* name() const = 0;      // 診斷用名稱
+  virtual ~ICounter() {}
+};
+
+
+// =========================【計數器實作：PCNT 硬體脈衝計數】=========================
+#ifdef CNT_IMPL_PCNT
+#include <driver/pcnt.h>
+
+// 16 位元硬體計數到 PCNT_H_LIM 自動歸零並觸發事件 → ISR 把溢位量累加到 64 位元
+static const int16_t PCNT_H_LIM = 32000;
+
+class CounterPcnt : public ICounter {
+public:
+  bool begin() override {
+    bool ok = true;
+    for (int ch = 0; ch < CNT_COUNT; ++ch) {
+      pcnt_unit_t unit = (pcnt_unit_t)(PCNT_UNIT_0 + ch);
+      pinMode(CNT_PINS[ch], INPUT_PULLUP);
+
+      pcnt_config_t c = {};
+      c.pulse_gpio_num = CNT_PINS[ch];
+      c.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+      c.channel        = PCNT_CHANNEL_0;
+      c.unit           = unit;
+      c.pos_mode       = CNT_ACTIVE_LOW ? PCNT_COUNT_DIS : PCNT_COUNT_INC;  // 只數「進入有效電平」的邊緣
+      c.neg_mode       = CNT_ACTIVE_LOW ? PCNT_COUNT_INC : PCNT_COUNT_DIS;
+      c.lctrl_mode     = PCNT_MODE_KEEP;
+      c.hctrl_mode     = PCNT_MODE_KEEP;
+      c.counter_h_lim  = PCNT_H_LIM;
+      c.counter_l_lim  = -PCNT_H_LIM;
+      ok &= (pcnt_unit_config(&c) == ESP_OK);
+
+      pcnt_set_filter_value(unit, CNT_FILTER_APB);
+      pcnt_filter_enable(unit);
+      pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+      pcnt_counter_pause(unit);
+      pcnt_counter_clear(unit);
+    }
+
+    esp_err_t e = pcnt_isr_service_install(0);
+    ok &= (e == ESP_OK || e == ESP_ERR_INVALID_STATE);   // 已安裝亦可
+    for (int ch = 0; ch < CNT_COUNT; ++ch) {
+      pcnt_unit_t unit = (pcnt_unit_t)(PCNT_UNIT_0 + ch);
+      ok &= (pcnt_isr_handler_add(unit, onLimit, (void*)(intptr_t)ch) == ESP_OK);
+      pcnt_counter_resume(unit);
+    }
+    return ok;
+  }
+
+  uint64_t total(int ch) override {
+    if (ch < 0 || ch >= CNT_COUNT) return 0;
+    uint32_t o1, o2;
+    int16_t  v = 0;
+    do {                                       // 溢位 ISR 與讀值交錯時重讀
+      o1 = _ovf[ch];
+      pcnt_get_counter_value((pcnt_unit_t)(PCNT_UNIT_0 + ch), &v);
+      o2 = _ovf[ch];
+    } while (o1 != o2);
+    return cntPcntTotal(o1, v, PCNT_H_LIM, _last[ch]);   // 硬體已歸零但 ISR 尚未累加的瞬間 → 維持單調
+  }
+
+  const char* name() const override { return "pcnt"; }
+
+private:
+  static void IRAM_ATTR onLimit(void* arg){ _ovf[(intptr_t)arg]++; }
+
+  static volatile uint32_t _ovf[CNT_COUNT];
+  uint64_t _last[CNT_COUNT] = {0, 0};
+};
+volatile uint32_t CounterPcnt::_ovf[CNT_COUNT] = {0, 0};
+#endif
+
+
+// =========================【計數器實作：GPIO 中斷 + re-arm】=========================
+#ifdef CNT_IMPL_ISR
+static CntGate gCntGate[CNT_COUNT];              // 去抖：武裝 / 最短間隔 / re-arm（見 cnt_pulse.h）
+volatile uint32_t gCntIsr[CNT_COUNT] = {0,0};    // 中斷計數
 
-// =========================【計數器中斷服務程式 (ISR)】=========================
-// 工件計數 #0 的 ISR
-void IRAM_ATTR cnt0_isr(){
-  uint32_t now = micros();
-  if (gCntArmed[0] && (now - gCntLastUs[0] > CNT_MIN_US)) {
-    gCntLastUs[0] = now;
-    gCntIsr[0]++;          // 計數加 1 (快照)
-    gCntArmed[0] = false;  // 立即去武裝，必須等回 HIGH 才能再次計數
+// 共用 ISR 本體：邊緣模式只在作用邊緣觸發；light sleep 電平模式兩個方向都會進來，只在作用電平計數
+static inline void IRAM_ATTR cntIsr(int ch){
+  uint8_t  pin = CNT_PINS[ch];
+  uint32_t lvl = pwrPinLevel(pin);
+  pwrIrqFlip(pin, lvl);
+  if (lvl == (CNT_ACTIVE_LOW ? 0u : 1u) && gCntGate[ch].onActive(micros(), CNT_MIN_US)) {
+    gCntIsr[ch]++;            // 計數加 1 (快照)；gate 已去武裝，必須等回閒置電平才能再次計數
   }
+  pwrWakeFromIsr();          // loop() 負責 re-arm
 }
 
-// 工件計數 #1 的 ISR
-void IRAM_ATTR cnt1_isr(){
-  uint32_t now = micros();
-  if (gCntArmed[1] && (now - gCntLastUs[1] > CNT_MIN_US)) {
-    gCntLastUs[1] = now;
-    gCntIsr[1]++;
-    gCntArmed[1] = false;  // 同上：避免抖動誤計數
+// 工件計數 #0 / #1 的 ISR
+void IRAM_ATTR cnt0_isr(){ cntIsr(0); }
+void IRAM_ATTR cnt1_isr(){ cntIsr(1); }
+
+class CounterIsr : public ICounter {
+public:
+  bool begin() override {
+    for (int i = 0; i < CNT_COUNT; i++) {
+      pinMode(CNT_PINS[i], INPUT_PULLUP);    // 4/15 有內建上拉
+      int lvl = digitalRead(CNT_PINS[i]);
+      gCntGate[i].begin(lvl, millis());      // 開機先武裝
+      int edge = CNT_ACTIVE_LOW ? FALLING : RISING;
+      attachInterrupt(digitalPinToInterrupt(CNT_PINS[i]),
+                      (i==0)? cnt0_isr : cnt1_isr, pwrIrqMode(edge, lvl));
+    }
+    return true;
+  }
+
+  // 只有在輸入回到「閒置電平」且去抖完成才重新武裝（允許下一次計數）
+  void poll() override {
+    const int idleLevel = CNT_ACTIVE_LOW ? HIGH : LOW;
+    for (int ci = 0; ci < CNT_COUNT; ++ci) {
+      if (!gCntGate[ci].poll(digitalRead(CNT_PINS[ci]), idleLevel, millis(), CNT_DEBOUNCE))
+        pwrWithin(CNT_DEBOUNCE);                 // 等去抖完成再 re-arm
+    }
+  }
+
+  uint64_t total(int ch) override {
+    if (ch < 0 || ch >= CNT_COUNT) return 0;
+    return _wide[ch](gCntIsr[ch]);             // 32 位元讀取本身即原子
   }
+
+  const char* name() const override { return "isr"; }
+
+private:
+  CntWiden32 _wide[CNT_COUNT];
+};
+#endif
+
+
+// =========================【計數器選用物件】=========================
+#if defined(CNT_IMPL_PCNT)
+CounterPcnt CNT;          // 使用 PCNT
+#elif defined(CNT_IMPL_ISR)
+CounterIsr CNT;           // 使用 GPIO 中斷
+#else
+#error "請定義 CNT_IMPL_ISR 或 CNT_IMPL_PCNT"
+#endif
+
+// 目前數量（自上次歸零起）
+static inline uint32_t cntPeek(int ch){ return (uint32_t)(CNT.total(ch) - gCntBase[ch]); }
+
+static bool gCntCkUrgent = false;   // 歸零後要盡快寫入 flash（避免斷電後重報舊數量）
+
+// 取出目前數量並歸零
+static inline uint32_t cntTake(int ch){
+  uint64_t t = CNT.total(ch);
+  uint32_t q = (uint32_t)(t - gCntBase[ch]);
+  gCntBase[ch] = t;
+  gCntCkUrgent = true;
+  return q;
 }
 
+// =========================【工件計數：斷電保存】=========================
+// 兩層 checkpoint（記錄各路「自上次歸零起」的數量）：
+//   1) RTC slow memory：每 CNT_CK_RTC_MS 寫一次，重開機/brown-out/WDT 後仍在（真正斷電則失效）
+//   2) SPIFFS 日誌 /cntck.log：數量有變且距上次滿 CNT_CK_FLASH_MS 才 append 一筆；
+//      歸零（回報/達標）後提前寫入；檔案超過上限只保留最後一筆重寫
+// 開機在 CNT.begin() 之前還原：取 CRC 有效且序號最大的那一份（含壓實途中斷電留下的暫存檔）
+// 紀錄格式、挑選與寫入時機、間隔與檔案路徑在 cnt_checkpoint.h
+static_assert(CNT_CK_CH == CNT_COUNT, "cnt_checkpoint.h 的 CNT_CK_CH 要等於 CNT_COUNT");
+
+RTC_NOINIT_ATTR static CntCkRec gCntRtcCk;
+
+class CntCheckpoint {
+public:
+  // setup()：SPIFFS 掛載後、CNT.begin() 之前
+  void restore(){
+    CntCkPick pick;
+    pick.offerRtc(gCntRtcCk);
+    bool torn = false;
+    readLog(pick, CNT_CK_TMP, torn);                // 壓實時 remove 與 rename 之間斷電 → 只剩暫存檔
+    torn = false;
+    _fileSize = readLog(pick, CNT_CK_PATH, torn);
+    if (torn) _fileSize = CNT_CK_FILE_MAX;          // 尾巴寫一半：下次直接壓實，免得新紀錄接在垃圾後面讀不到
+
+    if (pick.have) {
+      const CntCkRec& best = pick.best;
+      for (int ch = 0; ch < CNT_COUNT; ++ch) gCntBase[ch] = 0 - (uint64_t)best.qty[ch];  // total 從 0 起算 → peek = qty
+      Serial.printf("[CNT] restored from %s: %lu / %lu (seq=%lu)\n", pick.src,
+                    (unsigned long)best.qty[0], (unsigned long)best.qty[1], (unsigned long)best.seq);
+    }
+    _src = pick.src;
+    _plan.begin(pick, millis());
+  }
+
+  // loop() 每圈呼叫
+  void loop(){
+    uint32_t qty[CNT_COUNT];
+    for (int ch = 0; ch < CNT_COUNT; ++ch) qty[ch] = cntPeek(ch);
+    CntCkRec r;
+    int w = _plan.step(millis(), qty, gCntCkUrgent, r);
+    if (w == CntCkPlanner::W_NONE) return;
+
+    gCntRtcCk = r;
+    _rtcWrites++;
+    if (w & CntCkPlanner::W_FLASH) {
+      writeFlash(r);
+      gCntCkUrgent = false;
+    }
+  }
+
+  const char* source()     const { return _src; }
+  uint32_t    rtcWrites()  const { return _rtcWrites; }
+  uint32_t    flashWrites() const { return _flashWrites; }
+  size_t      fileSize()   const { return _fileSize; }
+
+private:
+  // 回傳檔案大小；torn = 有效紀錄之後還有殘留位元組
+  static size_t readLog(CntCkPick& pick, const char* path, bool& torn){
+    File f = SPIFFS.open(path, "r");
+    if (!f) return 0;
+    CntCkRec r;
+    size_t ok = 0;
+    while (f.read((uint8_t*)&r, sizeof(r)) == sizeof(r) && pick.offerLog(r)) ok += sizeof(r);
+    size_t n = f.size();
+    f.close();
+    torn = ok < n;
+    return n;
+  }
+
+  void writeFlash(const CntCkRec& r){
+    if (_fileSize + sizeof(r) > CNT_CK_FILE_MAX) {    // 壓實：只留最新一筆
+      File t = SPIFFS.open(CNT_CK_TMP, "w");
+      if (!t) return;
+      bool ok = t.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+      t.close();
+      if (!ok) return;
+      SPIFFS.remove(CNT_CK_PATH);
+      SPIFFS.rename(CNT_CK_TMP, CNT_CK_PATH);
+      _fileSize = sizeof(r);
+    } else {
+      File f = SPIFFS.open(CNT_CK_PATH, "a");
+      if (!f) return;
+      bool ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+      f.close();
+      if (!ok) { _fileSize = CNT_CK_FILE_MAX; return; } // 寫一半：下次改為壓實重寫
+      _fileSize += sizeof(r);
+    }
+    _plan.flashDone(r);
+    _flashWrites++;
+  }
+
+  const char*  _src = "none";
+  CntCkPlanner _plan{CNT_CK_RTC_MS, CNT_CK_FLASH_MS, CNT_CK_URGENT_MS};
+  uint32_t     _rtcWrites = 0, _flashWrites = 0;
+  size_t       _fileSize = 0;
+};
+
+static CntCheckpoint cntCk;
+
+// =========================【工件計數：產量時間序列】=========================
+// 每分鐘記錄各路「該分鐘增加的件數」（total 的差分，與歸零無關），以 varint 存進 RAM 位元組環，
+// 最多保留 CNT_HIST_MINUTES 分鐘；每個整點把上一小時的合計 append 到 SPIFFS（每小時一次寫入），
+// 檔案超過上限即輪替為 .old，總佔用固定在兩個檔以內。
+static const size_t   CNT_HIST_RAM      = 9216;        // 分鐘桶位元組環（一般每筆 2 bytes）
+static const uint16_t CNT_HIST_MINUTES  = 72 * 60;     // RAM 最多保留 72 小時
+static const char*    CNT_HIST_PATH     = "/cnthist.log";
+static const char*    CNT_HIST_OLD      = "/cnthist.old";
+static const size_t   CNT_HIST_FILE_MAX = 30 * 24 * 16; // 約 30 天的小時記錄
+
+class CntHistory {
+public:
+  // 小時記錄：整點 epoch + 各路件數 + CRC
+  struct HourRec { uint32_t hour; uint32_t qty[CNT_COUNT]; uint32_t crc; };
+
+  // loop() 每圈呼叫：滿一分鐘收一個桶，整點換小時時落地
+  void loop(){
+    uint32_t nowMs = millis();
+    if (!_started) {
+      for (int ch = 0; ch < CNT_COUNT; ++ch) _lastTotal[ch] = CNT.total(ch);
+      _lastMs = nowMs; _started = true;
+      return;
+    }
+    if (nowMs - _lastMs < 60000UL) return;
+    _lastMs += 60000UL;
+
+    uint32_t d[CNT_COUNT];
+    for (int ch = 0; ch < CNT_COUNT; ++ch) {
+      uint64_t t = CNT.total(ch);
+      d[ch] = (uint32_t)(t - _lastTotal[ch]);
+      _lastTotal[ch] = t;
+    }
+    pushMinute(d);
+
+    time_t now = time(nullptr);
+    if (now < 1577836800) {                       // 尚未對時：先累積，等對時後再歸到當下小時
+      for (int ch = 0; ch < CNT_COUNT; ++ch) _hourAcc[ch] += d[ch];
+      return;
+    }
+    uint32_t hour = (uint32_t)(now - 60) / 3600 * 3600;   // 這一分鐘所屬的小時
+    if (_hour && hour != _hour) flushHour();
+    _hour = hour;
+    for (int ch = 0; ch < CNT_COUNT; ++ch) _hourAcc[ch] += d[ch];
+  }
+
+  // 依序走訪 RAM 內最近 n 分鐘（舊→新）；fn(ageMin, qty[])，ageMin = 距今幾分鐘
+  template <typename F>
+  void forEachMinute(uint16_t n, F fn) const {
+    if (n > _count) n = _count;
+    size_t off = 0;
+    uint32_t q[CNT_COUNT];
+    for (uint16_t i = 0; i < _count; ++i) {
+      for (int ch = 0; ch < CNT_COUNT; ++ch) off += getVarint(off, q[ch]);
+      if (i >= _count - n) fn((uint16_t)(_count - i), q);
+    }
+  }
+
+  // 依序走訪 SPIFFS 上的小時記錄（舊→新）
+  template <typename F>
+  void forEachHour(F fn) const {
+    const char* paths[2] = { CNT_HIST_OLD, CNT_HIST_PATH };
+    for (const char* path : paths) {
+      File f = SPIFFS.open(path, "r");
+      if (!f) continue;
+      HourRec r;
+      while (f.read((uint8_t*)&r, sizeof(r)) == sizeof(r)) {
+        if (crc32Update(0, (const uint8_t*)&r, offsetof(HourRec, crc)) == r.crc) fn(r);
+      }
+      f.close();
+    }
+  }
+
+  uint16_t minutes()  const { return _count; }
+  size_t   ramUsed()  const { return _used; }
+  uint32_t flushes()  const { return _flushes; }
+  uint32_t lastFlushEpoch() const { return _lastFlushHour; }
+  uint32_t msSinceLastBucket() const { return millis() - _lastMs; }
+
+private:
+  void pushMinute(const uint32_t* d){
+    uint8_t rec[CNT_COUNT * 5];
+    size_t n = 0;
+    for (int ch = 0; ch < CNT_COUNT; ++ch) n += putVarint(rec + n, d[ch]);
+    while (_count && (_count >= CNT_HIST_MINUTES || CNT_HIST_RAM - _used < n)) dropOldest();
+    for (size_t i = 0; i < n; ++i) _buf[(_head + _used + i) % CNT_HIST_RAM] = rec[i];
+    _used += n;
+    _count++;
+  }
+
+  void dropOldest(){
+    size_t off = 0;
+    uint32_t v;
+    for (int ch = 0; ch < CNT_COUNT; ++ch) off += getVarint(off, v);
+    _head = (_head + off) % CNT_HIST_RAM;
+    _used -= off;
+    _count--;
+  }
+
+  void flushHour(){
+    HourRec r;
+    r.hour = _hour;
+    for (int ch = 0; ch < CNT_COUNT; ++ch) { r.qty[ch] = _hourAcc[ch]; _hourAcc[ch] = 0; }
+    r.crc = crc32Update(0, (const uint8_t*)&r, offsetof(HourRec, crc));
+
+    File f = SPIFFS.open(CNT_HIST_PATH, "a");
+    if (!f) return;
+    f.write((const uint8_t*)&r, sizeof(r));
+    size_t sz = f.size();
+    f.close();
+    _flushes++;
+    _lastFlushHour = r.hour;
+    if (sz >= CNT_HIST_FILE_MAX) {                // 輪替：丟掉更舊的一份
+      SPIFFS.remove(CNT_HIST_OLD);
+      SPIFFS.rename(CNT_HIST_PATH, CNT_HIST_OLD);
+    }
+  }
+
+  static size_t putVarint(uint8_t* p, uint32_t v){
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+  }
+
+  // 從環內偏移 off 解一個 varint，回傳位元組數
+  size_t getVarint(size_t off, uint32_t& v) const {
+    v = 0;
+    size_t n = 0;
+    uint8_t b;
+    do {
+      b = _buf[(_head + off + n) % CNT_HIST_RAM];
+      v |= (uint32_t)(b & 0x7F) << (7 * n);
+      n++;
+    } while ((b & 0x80) && n < 5);
+    return n;
+  }
+
+  uint8_t  _buf[CNT_HIST_RAM];
+  size_t   _head = 0, _used = 0;
+  uint16_t _count = 0;
+  bool     _started = false;
+  uint32_t _lastMs = 0;
+  uint64_t _lastTotal[CNT_COUNT] = {0, 0};
+  uint32_t _hour = 0, _hourAcc[CNT_COUNT] = {0, 0};
+  uint32_t _flushes = 0, _lastFlushHour = 0;
+};
+
+static CntHistory cntHist;
+
 // =========================【異常 DI 推播訊息】=========================
 // 預設異常輸入訊息，可在設定頁修改
 String gAlarmMsg[ALARM_COUNT] = {
   "異常CH1", "異常CH2", "異常CH3", "異常CH4", "異常CH5", "異常CH6"
 };
 
+// =========================【異常 DI：中斷擷取事件環】=========================
+// 每路 DI 以 CHANGE 中斷把 {通道, 電平, esp_timer μs} 推進單一生產者/單一消費者環
+// （ISR 只寫 head、loop() 只寫 tail，不需鎖）；loop() 再依事件本身的時間戳做去抖與鎖存，
+// 因此 loop 卡住數秒也不會漏掉短脈衝，推播與 /diag 顯示的是實際發生時間。
+struct DiEvent {
+  uint8_t ch;
+  uint8_t level;
+  int64_t us;
+};
+static const uint16_t DI_RING = 64;                 // 須為 2 的冪
+static DiEvent gDiRing[DI_RING];
+static volatile uint16_t gDiHead = 0, gDiTail = 0;
+static volatile uint32_t gDiOverrun = 0;            // 環滿而丟棄的事件數
+static uint16_t gDiPeak = 0;                        // 環內最多同時積壓幾筆
+
+// 各路去抖狀態（只由 loop() 存取）
+struct DiState {
+  uint8_t  stable;       // 已確認電平
+  uint8_t  pending;      // 最新事件電平
+  int64_t  lastEdgeUs;   // 最後一次邊緣
+  int64_t  sinceUs;      // 離開 stable 的第一個邊緣（＝事件發生時間）
+  int64_t  lastEventUs;  // 最近一次確認的變化時間
+  uint32_t edges;
+};
+static DiState gDi[ALARM_COUNT];
+
+// arg = (通道 << 8) | GPIO；ISR 內只讀暫存器，不碰 flash
+static void IRAM_ATTR diIsr(void* arg){
+  uint32_t a   = (uint32_t)(uintptr_t)arg;
+  uint8_t  pin = a & 0xFF;
+  uint32_t in  = (pin < 32) ? REG_READ(GPIO_IN_REG) : REG_READ(GPIO_IN1_REG);
+  pwrIrqFlip(pin, (in >> (pin & 31)) & 1);
+  pwrWakeFromIsr();
+  uint16_t h    = gDiHead;
+  uint16_t next = (h + 1) & (DI_RING - 1);
+  if (next == __atomic_load_n(&gDiTail, __ATOMIC_ACQUIRE)) { gDiOverrun++; return; }
+  gDiRing[h].ch    = (uint8_t)(a >> 8);
+  gDiRing[h].level = (uint8_t)((in >> (pin & 31)) & 1);
+  gDiRing[h].us    = esp_timer_get_time();
+  __atomic_store_n(&gDiHead, next, __ATOMIC_RELEASE);
+}
+
+// esp_timer 時間 → "HH:MM:SS.mmm"（尚未對時回空字串）
+static String diFmtTime(int64_t us){
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < 1577836800) return String();
+  int64_t epochUs = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec - (esp_timer_get_time() - us);
+  time_t sec = (time_t)(epochUs / 1000000LL);
+  struct tm t;
+  localtime_r(&sec, &t);
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%03d", t.tm_hour, t.tm_min, t.tm_sec, (int)((epochUs / 1000) % 1000));
+  return String(buf);
+}
+
+// 電平確認：LOW 觸發推播一次（帶實際發生時間），回 HIGH 解除鎖存
+static void diCommit(int ai, uint8_t level, int64_t atUs){
+  DiState& d = gDi[ai];
+  d.stable = level;
+  d.lastEventUs = atUs;
+  if (level == LOW && !gAlarmLatched[ai]) {
+    gAlarmLatched[ai] = true;
+    oledKick("di");                            // ★ DI 觸發 → 喚醒
+    String at = diFmtTime(atUs);
+    tgEnqueue("⚠️ DI" + String(ai+1) + "：" + gAlarmMsg[ai] + (at.length() ? "（" + at + "）" : ""), TG_PRI_ALARM);
+  }
+  if (level == HIGH && gAlarmLatched[ai]) {
+    gAlarmLatched[ai] = false;
+    // 如需「恢復通知」可在此 enqueue
+  }
+}
+
+// setup()：設定腳位、初始狀態並掛中斷
+static void diBegin(){
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < ALARM_COUNT; i++) {
+    pinMode(ALARM_PINS[i], INPUT_PULLUP);   // 低有效，GPIO 對 GND
+    DiState& d = gDi[i];
+    d.stable  = HIGH;                       // 視為未觸發；開機即為 LOW 者去抖後照常推播
+    d.pending = digitalRead(ALARM_PINS[i]);
+    d.lastEdgeUs = d.sinceUs = now;
+    d.lastEventUs = 0;
+    d.edges = 0;
+    attachInterruptArg(digitalPinToInterrupt(ALARM_PINS[i]), diIsr,
+                       (void*)(uintptr_t)((i << 8) | ALARM_PINS[i]), pwrIrqMode(CHANGE, d.pending));
+  }
+}
+
+// loop()：消化事件環並依時間戳去抖
+static void diLoop(){
+  const int64_t debUs = (int64_t)ALARM_DEBOUNCE * 1000;
+  static uint32_t seenOverrun = 0;
+
+  uint16_t t = gDiTail;
+  uint16_t h = __atomic_load_n(&gDiHead, __ATOMIC_ACQUIRE);
+  uint16_t backlog = (h - t) & (DI_RING - 1);
+  if (backlog > gDiPeak) gDiPeak = backlog;
+
+  while (t != h) {
+    const DiEvent& e = gDiRing[t];
+    DiState& d = gDi[e.ch];
+    if (d.pending != d.stable && e.us - d.lastEdgeUs >= debUs) diCommit(e.ch, d.pending, d.sinceUs);
+    if (d.pending == d.stable) d.sinceUs = e.us;      // 開始一段新的變化
+    d.pending    = e.level;
+    d.lastEdgeUs = e.us;
+    d.edges++;
+    t = (t + 1) & (DI_RING - 1);
+  }
+  __atomic_store_n(&gDiTail, t, __ATOMIC_RELEASE);
+
+  int64_t now = esp_timer_get_time();
+  uint32_t ov = gDiOverrun;
+  for (int ai = 0; ai < ALARM_COUNT; ++ai) {
+    DiState& d = gDi[ai];
+    if (ov != seenOverrun) {                           // 有事件被丟 → 以實際電平重新同步
+      uint8_t v = digitalRead(ALARM_PINS[ai]);
+      if (v != d.pending) {
+        if (d.pending == d.stable) d.sinceUs = now;
+        d.pending = v; d.lastEdgeUs = now;
+      }
+    }
+    if (d.pending != d.stable && now - d.lastEdgeUs >= debUs) diCommit(ai, d.pending, d.sinceUs);
+    if (d.pending != d.stable) pwrWithin((uint32_t)((debUs - (now - d.lastEdgeUs)) / 1000) + 1);  // 去抖到期再看
+  }
+  seenOverrun = ov;
+}
+
 // =========================【應用設定資料結構】=========================
-// 繼電器排程設定
+// 繼電器排程設定（SCH_TIMES / SCH_T_NONE 見 sched_engine.h）
 struct Sched {
   uint8_t  hh = 8, mm = 0;   // 時間 (HH:MM)
   uint32_t hold = 3;         // 保持秒數
   String   msg = "Relay!";   // 推播訊息
+  uint16_t xt[SCH_TIMES - 1] = { SCH_T_NONE, SCH_T_NONE, SCH_T_NONE };  // 額外時間（當日分鐘 0..1439）
+  uint8_t  wd = 0x7F;        // 本路星期遮罩 (bit0=Mon … bit6=Sun)；與全域 wdMask 取交集
 };
 
 // 工件計數設定
@@ -167,8 +773,179 @@ struct AppConfig {
   String aMsg[ALARM_COUNT];    // 異常 DI 訊息
   uint8_t wdMask = 0x7F;       // 星期遮罩 (bit0=Mon … bit6=Sun，預設全開)
   CounterCfg cnt[2];           // 兩組工件計數器設定
+  uint32_t ver = 0;            // 設定版本（每次儲存 +1；用於 ETag）
 } cfg;
 
+// 第 k 個觸發時間（當日分鐘數；k=0 為主時間）；未使用回 SCH_T_NONE
+static inline uint16_t schMinute(const Sched& s, int k){
+  return k == 0 ? (uint16_t)(s.hh * 60 + s.mm) : s.xt[k - 1];
+}
+
+// 額外時間 ↔ 文字 "12:00,17:30"（網頁 tx{i} 欄位）
+static String schExtraText(const Sched& s){
+  String out;
+  for (int k = 1; k < SCH_TIMES; ++k) {
+    uint16_t t = s.xt[k - 1];
+    if (t == SCH_T_NONE) continue;
+    char b[8];
+    snprintf(b, sizeof(b), "%02u:%02u", (unsigned)(t / 60), (unsigned)(t % 60));
+    if (out.length()) out += ',';
+    out += b;
+  }
+  return out;
+}
+
+// 以逗號/空白分隔；格式錯誤、與主時間重複或超過 SCH_TIMES-1 組的項目略過
+static void schExtraParse(Sched& s, const String& v){
+  for (int k = 0; k < SCH_TIMES - 1; ++k) s.xt[k] = SCH_T_NONE;
+  int n = 0, i = 0, len = v.length();
+  while (i < len && n < SCH_TIMES - 1) {
+    while (i < len && (v[i] == ',' || v[i] == ' ')) i++;
+    int h = 0, m = 0, dh = 0, dm = 0;
+    while (i < len && isdigit((unsigned char)v[i]) && dh < 2) { h = h * 10 + (v[i++] - '0'); dh++; }
+    if (i < len && v[i] == ':') i++;
+    while (i < len && isdigit((unsigned char)v[i]) && dm < 2) { m = m * 10 + (v[i++] - '0'); dm++; }
+    while (i < len && v[i] != ',' && v[i] != ' ') i++;       // 吃掉殘餘字元
+    if (!dh || dm != 2 || h > 23 || m > 59) continue;
+    uint16_t t = (uint16_t)(h * 60 + m);
+    bool dup = (t == schMinute(s, 0));
+    for (int k = 0; k < n; ++k) dup |= (s.xt[k] == t);
+    if (!dup) s.xt[n++] = t;
+  }
+}
+
+// 星期遮罩 ↔ 7 字元 "1111100"（Mon..Sun；網頁 sw{i} 欄位）
+static String schWdText(uint8_t m){
+  char b[8];
+  for (int i = 0; i < 7; ++i) b[i] = ((m >> i) & 0x01) ? '1' : '0';
+  b[7] = 0;
+  return String(b);
+}
+static bool schWdParse(const String& v, uint8_t& out){
+  if (v.length() != 7) return false;
+  uint8_t m = 0;
+  for (int i = 0; i < 7; ++i) {
+    if (v[i] != '0' && v[i] != '1') return false;
+    if (v[i] == '1') m |= (1u << i);
+  }
+  out = m;
+  return true;
+}
+
+
+// =========================【Telegram 傳輸層：共用 keep-alive 連線】=========================
+// 所有 Telegram API 呼叫都經由 TgLink：維持一條 HTTP/1.1 keep-alive 的 TLS 連線，
+// 只有在斷線/閒置過久時才重新握手；以互斥鎖保護，tgTask 與 loop() 可共用同一條連線。
+// 請求組裝、回應解析與重用 / 重連規則在 include/tg_link.h（TgHttpConn，主機測試共用）。
+static const size_t   TG_RESP_MAX      = 2048;   // 回應 body 保留上限（超過部分只讀不存）
+
+// 把 body 收進 String（超過上限只讀不存）
+class TgStringSink : public TgBodySink {
+public:
+  TgStringSink(String& s, size_t max) : _s(s), _max(max) {}
+  void begin(long contentLen) override {
+    _s = "";
+    _s.reserve(contentLen > 0 && (size_t)contentLen < _max ? contentLen : 256);
+  }
+  void onBody(const uint8_t* p, size_t n) override {
+    for (size_t i = 0; i < n && _s.length() < _max; ++i) _s += (char)p[i];
+  }
+private:
+  String& _s;
+  size_t  _max;
+};
+
+// TgHttpConn 的 Io：WiFiClientSecure + millis/delay
+struct TgTlsIo {
+  WiFiClientSecure cli;
+  bool     connect()                          { return cli.connect(TG_API_HOST, TG_API_PORT); }
+  bool     connected()                        { return cli.connected(); }
+  void     stop()                             { cli.stop(); }
+  size_t   write(const uint8_t* p, size_t n)  { return cli.write(p, n); }
+  int      available()                        { return cli.available(); }
+  int      read()                             { return cli.read(); }
+  int      read(uint8_t* p, size_t n)         { return cli.read(p, n); }
+  uint32_t now()                              { return millis(); }
+  void     idle()                             { delay(2); }
+};
+
+class TgLink {
+public:
+  void begin(){
+    if (!_mtx) _mtx = xSemaphoreCreateMutex();
+    _io.cli.setInsecure();
+  }
+
+  // 送出一次請求；回傳 HTTP 狀態碼（<0 = 連線/逾時失敗）
+  // resp 可為 nullptr（仍會把回應讀完，保持連線同步）
+  int request(const char* verb, const String& path, const char* ctype, const String& body,
+              String* resp, uint32_t timeoutMs = 5000, size_t respMax = TG_RESP_MAX){
+    if (!resp) return request(verb, path, ctype, body, (TgBodySink*)nullptr, timeoutMs);
+    TgStringSink sink(*resp, respMax);
+    return request(verb, path, ctype, body, &sink, timeoutMs);
+  }
+
+  // 串流版本：body 直接交給 sink，記憶體用量與回應大小無關
+  int request(const char* verb, const String& path, const char* ctype, const String& body,
+              TgBodySink* sink, uint32_t timeoutMs = 5000){
+    if (!_mtx) return -1;
+    xSemaphoreTake(_mtx, portMAX_DELAY);
+    int code = _conn.request(verb, path.c_str(), ctype, body.c_str(), body.length(), sink, timeoutMs);
+    xSemaphoreGive(_mtx);
+    return code;
+  }
+
+  void close(){
+    if (!_mtx) return;
+    xSemaphoreTake(_mtx, portMAX_DELAY);
+    _conn.close();
+    xSemaphoreGive(_mtx);
+  }
+
+  uint32_t handshakes() const { return _conn.handshakes(); }  // 完整 TLS 握手次數
+  uint32_t reuses()     const { return _conn.reuses(); }      // 沿用既有連線的請求數
+  uint32_t retries()    const { return _conn.retries(); }     // 寫入失敗後換新連線重送的次數
+
+private:
+  TgTlsIo              _io;
+  TgHttpConn<TgTlsIo>  _conn{_io};
+  SemaphoreHandle_t    _mtx = nullptr;
+};
+
+static TgLink tgLink;   // 全機共用的 Telegram 連線
+
+// Telegram 憑證副本：cfg.token / cfg.chat 只在持有 app lock 時改寫（loop / HTTP handler），
+// Telegram 任務不拿 app lock，一律經 tgCreds() 取這份以 gTgCredMtx 保護的副本，
+// 避免讀到正被重新配置的 String。改寫 cfg 憑證後呼叫 tgCredsPublish()。
+static SemaphoreHandle_t gTgCredMtx = nullptr;
+static String gTgToken, gTgChat;
+
+static void tgCredsPublish(){
+  if (!gTgCredMtx) gTgCredMtx = xSemaphoreCreateMutex();
+  xSemaphoreTake(gTgCredMtx, portMAX_DELAY);
+  gTgToken = cfg.token;
+  gTgChat  = cfg.chat;
+  xSemaphoreGive(gTgCredMtx);
+}
+
+// 取憑證快照（任一參數可為 nullptr）；回傳兩者是否皆已設定
+static bool tgCreds(String* token, String* chat){
+  if (!gTgCredMtx) return false;
+  xSemaphoreTake(gTgCredMtx, portMAX_DELAY);
+  bool ok = gTgToken.length() && gTgChat.length();
+  if (token) *token = gTgToken;
+  if (chat)  *chat  = gTgChat;
+  xSemaphoreGive(gTgCredMtx);
+  return ok;
+}
+
+// 呼叫 Bot API：POST /bot<token>/<method>
+static int tgApi(const char* method, const char* ctype, const String& body,
+                 String* resp = nullptr, uint32_t timeoutMs = 5000){
+  String token;
+  tgCreds(&token, nullptr);
+  return tgLink.request("POST", "/bot" + token + "/" + method, ctype, body, resp, timeoutMs);
+}
 
 static void tgSendControlKeyboard(const String& chatId){
   String kb = F(
@@ -181,20 +958,14 @@ static void tgSendControlKeyboard(const String& chatId){
     "}"
   );
 
-  WiFiClientSecure cli; cli.setInsecure();
-  if (!cli.connect("api.telegram.org", 443)) return;
   String body = String("{\"chat_id\":\"")+chatId+"\",\"text\":\"已送出設定鍵盤。\",\"reply_markup\":"+kb+"}";
-  String req  = "POST /bot"+cfg.token+"/sendMessage HTTP/1.1\r\nHost: api.telegram.org\r\nContent-Type: application/json\r\nContent-Length: "+String(body.length())+"\r\nConnection: close\r\n\r\n"+body;
-  cli.print(req);
+  if (tgApi("sendMessage", "application/json", body) < 0) return;
     // ★ 發完鍵盤後，啟動 10 秒自動關閉倒數
     gKbHideAt = millis() + 10000UL;
 }
 
 // 送出可「內嵌開啟 WebApp」的 inline keyboard 按鈕
 static void tgSendInlineOpen(const String& chatId){
-  WiFiClientSecure cli; cli.setInsecure();
-  if (!cli.connect("api.telegram.org", 443)) return;
-
   String kb = F(
     "{\"inline_keyboard\":["
       "[{\"text\":\"⚙️ 開啟設定 (WebApp)\",\"web_app\":{\"url\":\"https://lemel0501.github.io/YQ-webapp/\"}}]"
@@ -203,27 +974,14 @@ static void tgSendInlineOpen(const String& chatId){
 
   String body = String("{\"chat_id\":\"")+chatId+
                 "\",\"text\":\"點按下方按鈕開啟設定頁：\",\"reply_markup\":"+kb+"}";
-  String req = "POST /bot"+cfg.token+"/sendMessage HTTP/1.1\r\n"
-               "Host: api.telegram.org\r\n"
-               "Content-Type: application/json\r\n"
-               "Content-Length: "+String(body.length())+"\r\n"
-               "Connection: close\r\n\r\n"+body;
-  cli.print(req);
+  tgApi("sendMessage", "application/json", body);
 }
 
 // 關閉 Telegram 鍵盤（remove_keyboard）
 static void tgHideKeyboard(const String& chatId){
-  WiFiClientSecure cli; cli.setInsecure();
-  if (!cli.connect("api.telegram.org", 443)) return;
-
   String body = String("{\"chat_id\":\"")+chatId+
                 "\",\"text\":\"✅ 已關閉鍵盤。\",\"reply_markup\":{\"remove_keyboard\":true}}";
-  String req = "POST /bot"+cfg.token+"/sendMessage HTTP/1.1\r\n"
-               "Host: api.telegram.org\r\n"
-               "Content-Type: application/json\r\n"
-               "Content-Length: "+String(body.length())+"\r\n"
-               "Connection: close\r\n\r\n"+body;
-  cli.print(req);
+  tgApi("sendMessage", "application/json", body);
 }
 
 
@@ -247,138 +1005,875 @@ static inline String endMsg(int ch){
 }
 
 // =========================【Telegram 傳送訊息】=========================
-// 嚴格檢查 200 OK 與 ok:true
-bool sendTelegram(const String& text){
+// 嚴格檢查 200 OK 與 ok:true；被限流（429）時 retryAfterMs = 伺服器要求的等待時間
+bool sendTelegram(const String& text, uint32_t* retryAfterMs = nullptr){
+  if (retryAfterMs) *retryAfterMs = 0;
   if (!WiFi.isConnected()) { Serial.println("[TG] WiFi not connected"); return false; }
-  if (!cfg.token.length() || !cfg.chat.length()) { Serial.println("[TG] token/chat empty"); return false; }
+  String chat;
+  if (!tgCreds(nullptr, &chat)) { Serial.println("[TG] token/chat empty"); return false; }
+
+  // POST 請求組合（經共用 keep-alive 連線送出）
+  String body = "chat_id=" + urlEncode(chat) + "&text=" + urlEncode(text);
+  String resp;
+  int code = tgApi("sendMessage", "application/x-www-form-urlencoded", body, &resp);
+  if (code < 0) { Serial.println("[TG] no response"); return false; }
+  bool http200 = (code == 200);
+
+  bool okField = (resp.indexOf("\"ok\":true") >= 0);
+  if (code == 429) {
+    long sec = tgRetryAfterSec(resp.c_str());
+    if (retryAfterMs) *retryAfterMs = (uint32_t)sec * 1000UL;
+    Serial.printf("[TG] rate limited, retry_after=%lds\n", sec);
+    return false;
+  }
+  if (!http200 || !okField) {
+    Serial.println("[TG] send fail");
+    Serial.printf("HTTP %d\n", code);
+    Serial.println(resp);
+    return false;
+  }
+  return true;
+}
+
+
+// ===== 讀取 WebApp 回傳（web_app_data）的長輪詢 =====
+static long tgUpdateOffset = 0; // 供 getUpdates 去重
+
+// =========================【Telegram 非阻塞佇列任務】=========================
+// outbox：每個優先序一個位元組環形區（變長訊息），tgEnqueue() 只把記錄放進 RAM 就返回；
+// ALARM / RELAY 由 tgTask 取出後寫進各自的 flash 日誌（flash 寫入不在呼叫端的執行緒上）；
+// INFO 類在連續推送時先等 TG_MERGE_QUIET_MS 無新訊息（或最舊一則已等 TG_MERGE_MAX_MS）
+// 再一次合併成一則送出，避免設定回覆/計數回報洗版。
+static const uint32_t TG_MERGE_QUIET_MS = 1500;  // INFO 靜默多久視為一批結束
+static const uint32_t TG_MERGE_MAX_MS   = 5000;  // INFO 最久延遲
+// ALARM / RELAY 環形區只暫放到 tgTask 寫進日誌為止（最多等一次送信的時間）
+static const size_t   TG_ARENA_ALARM = 1024, TG_ARENA_RELAY = 1536, TG_ARENA_INFO = 3072;
+
+class TgOutbox {
+public:
+  void begin(){
+    _mtx = xSemaphoreCreateMutex();
+    _sig = xSemaphoreCreateBinary();
+    _r[TG_PRI_ALARM].init(_arena,                                 TG_ARENA_ALARM);
+    _r[TG_PRI_RELAY].init(_arena + TG_ARENA_ALARM,                TG_ARENA_RELAY);
+    _r[TG_PRI_INFO ].init(_arena + TG_ARENA_ALARM + TG_ARENA_RELAY, TG_ARENA_INFO);
+  }
+
+  // 放入一則訊息；空間不足回 false（計入 dropped）
+  bool push(TgPri pri, const String& s){
+    if (!_mtx || !s.length() || pri >= TG_PRI_COUNT) return false;
+    Ring& r = _r[pri];
+    size_t len = s.length();
+    if (len > TG_MSG_MAX) len = TG_MSG_MAX;
+    if (len > r.cap - HDR) len = r.cap - HDR;
+    while (len > 0 && len < s.length() && ((uint8_t)s[len] & 0xC0) == 0x80) len--;  // 不切斷 UTF-8 字元
+
+    xSemaphoreTake(_mtx, portMAX_DELAY);
+    bool ok = (r.cap - r.used) >= HDR + len;
+    if (ok) {
+      uint32_t now = millis();
+      uint8_t hdr[HDR] = { (uint8_t)len, (uint8_t)(len >> 8),
+                           (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24) };
+      r.write(hdr, HDR);
+      r.write((const uint8_t*)s.c_str(), len);
+      r.count++;
+      if (r.used > r.peak) r.peak = r.used;
+      if (pri == TG_PRI_INFO) _lastInfoMs = now;
+      _pushed++;
+    } else {
+      _dropped[pri]++;
+    }
+    xSemaphoreGive(_mtx);
+
+    if (ok) xSemaphoreGive(_sig);
+    else Serial.printf("[TG] outbox full (pri=%d), dropped\n", (int)pri);
+    return ok;
+  }
+
+  // 取出下一則 ALARM / RELAY（高優先序先）；atMs = 放入時間 millis
+  bool popDurable(String& out, TgPri& pri, uint32_t& atMs){
+    if (!_mtx) return false;
+    xSemaphoreTake(_mtx, portMAX_DELAY);
+    bool got = false;
+    for (int p = TG_PRI_ALARM; p < TG_PRI_INFO && !got; ++p){
+      if (_r[p].count) { atMs = frontMs(_r[p]); readFront(_r[p], out, false); pri = (TgPri)p; got = true; }
+    }
+    xSemaphoreGive(_mtx);
+    return got;
+  }
+
+  // 取出合併後的 INFO；沒有可送時回 false，waitMs = 建議等待時間
+  bool popInfo(String& out, uint32_t& waitMs){
+    waitMs = 250;
+    if (!_mtx) return false;
+    xSemaphoreTake(_mtx, portMAX_DELAY);
+    bool got = false;
+    Ring& info = _r[TG_PRI_INFO];
+    if (info.count){
+      uint32_t now   = millis();
+      uint32_t quiet = now - _lastInfoMs;
+      uint32_t age   = now - frontMs(info);
+      if (quiet < TG_MERGE_QUIET_MS && age < TG_MERGE_MAX_MS) {
+        uint32_t a = TG_MERGE_QUIET_MS - quiet, b = TG_MERGE_MAX_MS - age;
+        waitMs = a < b ? a : b;
+      } else {
+        readFront(info, out, false);
+        while (info.count && out.length() + 1 + frontLen(info) <= TG_MSG_MAX){
+          out += '\n';
+          readFront(info, out, true);
+          _merged++;
+        }
+        got = true;
+      }
+    }
+    xSemaphoreGive(_mtx);
+    return got;
+  }
+
+  // 等待新訊息（或逾時）
+  void wait(uint32_t ms){ if (_sig) xSemaphoreTake(_sig, pdMS_TO_TICKS(ms)); }
+
+  uint32_t pushed()  const { return _pushed; }
+  uint32_t merged()  const { return _merged; }
+  uint32_t dropped(TgPri p) const { return _dropped[p]; }
+  uint16_t count(TgPri p)   const { return _r[p].count; }
+  size_t   used(TgPri p)    const { return _r[p].used; }
+  size_t   peak(TgPri p)    const { return _r[p].peak; }
+  size_t   capacity(TgPri p) const { return _r[p].cap; }
+
+private:
+  static const size_t HDR = 6;   // 記錄標頭：長度(2) + 放入時間 millis(4)
+
+  struct Ring {
+    uint8_t* buf = nullptr;
+    size_t   cap = 0, head = 0, used = 0, peak = 0;
+    uint16_t count = 0;
+    void init(uint8_t* b, size_t c){ buf = b; cap = c; head = used = peak = 0; count = 0; }
+    void write(const uint8_t* p, size_t n){
+      size_t w = (head + used) % cap;
+      size_t first = (n < cap - w) ? n : cap - w;
+      memcpy(buf + w, p, first);
+      memcpy(buf, p + first, n - first);
+      used += n;
+    }
+    uint8_t at(size_t off) const { return buf[(head + off) % cap]; }
+    void consume(size_t n){ head = (head + n) % cap; used -= n; }
+  };
+
+  size_t   frontLen(const Ring& r) const { return r.at(0) | (r.at(1) << 8); }
+  uint32_t frontMs (const Ring& r) const {
+    return (uint32_t)r.at(2) | ((uint32_t)r.at(3) << 8) | ((uint32_t)r.at(4) << 16) | ((uint32_t)r.at(5) << 24);
+  }
+
+  // 取出最舊一則；append=true 時接在 out 後面
+  void readFront(Ring& r, String& out, bool append){
+    size_t len = frontLen(r);
+    if (!append) out = "";
+    out.reserve(out.length() + len);
+    for (size_t i = 0; i < len; ++i) out += (char)r.at(HDR + i);
+    r.consume(HDR + len);
+    r.count--;
+  }
+
+  SemaphoreHandle_t _mtx = nullptr, _sig = nullptr;
+  uint8_t  _arena[TG_ARENA_ALARM + TG_ARENA_RELAY + TG_ARENA_INFO];
+  Ring     _r[TG_PRI_COUNT];
+  uint32_t _lastInfoMs = 0;
+  uint32_t _pushed = 0, _merged = 0, _dropped[TG_PRI_COUNT] = {0, 0, 0};
+};
+
+static TgOutbox tgOutbox;
+
+// =========================【Telegram 持久化 outbox（SPIFFS 日誌）】=========================
+// ALARM / RELAY 訊息由 tgTask 從 RAM outbox 取出後立刻 append 到各自的日誌（先寫日誌再送），
+// INFO 與其他送不出去的訊息（離線 / 送信失敗）也 append 到 RELAY 日誌；tgTask 以指數退避補送，
+// ALARM 日誌永遠先送。日誌格式、批次 checkpoint 與優先序規則在 include/tg_journal.h（主機測試共用）。
+// 目前 epoch 秒；尚未對時（< 2020 年）回 0
+static inline uint32_t tgNowEpoch(){
+  time_t t = time(nullptr);
+  return t > 1577836800 ? (uint32_t)t : 0;
+}
 
-  WiFiClientSecure cli; cli.setInsecure();
-  if (!cli.connect("api.telegram.org", 443)) { Serial.println("[TG] connect fail"); return false; }
+// 放入 outbox 時的 millis 換算成 epoch 秒（未對時回 0）
+static inline uint32_t tgEpochAt(uint32_t atMs){
+  uint32_t now = tgNowEpoch();
+  return now ? now - (millis() - atMs) / 1000 : 0;
+}
+
+static const uint32_t TGJ_BACKOFF_MIN_MS = 1000;
+static const uint32_t TGJ_BACKOFF_MAX_MS = 60000;
+
+// TgJournal 的 Fs：SPIFFS
+struct TgSpiffsFs {
+  fs::File open(const char* path, const char* mode){ return SPIFFS.open(path, mode); }
+  bool     remove(const char* path){ return SPIFFS.remove(path); }
+  bool     rename(const char* from, const char* to){ return SPIFFS.rename(from, to); }
+};
+
+static TgSpiffsFs               tgJournalFs;
+static TgJournalSet<TgSpiffsFs> tgJournal(tgJournalFs);   // 只由 tgTask 存取（begin 在 setup）
+
+// 推播（ISR 外不可直接 send，必須用 enqueue）：只把記錄放進 RAM outbox，不碰 flash。
+// ALARM / RELAY 由 tgTask 寫進日誌（重開機也不會遺失，送達 200 才 ack）；
+// INFO 合併後送出，送不出去才轉進日誌。
+static inline void tgEnqueue(const String& s, TgPri pri){
+  tgOutbox.push(pri, s);
+}
+
+// Telegram 動作請求（loop()/HTTP 只設旗標，由 tgTask 實際呼叫 API，避免主迴圈卡在 TLS）
+static const uint32_t TG_ACT_PANEL   = 0x01;  // 收舊鍵盤 → 送文字鍵盤 → 送 inline WebApp 鈕
+static const uint32_t TG_ACT_INLINE  = 0x02;  // 只送 inline WebApp 鈕
+static const uint32_t TG_ACT_HIDE_KB = 0x04;  // 關閉鍵盤
+static volatile uint32_t gTgActs = 0;
+static portMUX_TYPE gTgActsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline void tgRequestAction(uint32_t act){
+  portENTER_CRITICAL(&gTgActsMux);
+  gTgActs |= act;
+  portEXIT_CRITICAL(&gTgActsMux);
+}
+
+// 由 tgTask 執行待處理動作（含 10 秒自動關閉鍵盤）
+static void tgRunActions(){
+  portENTER_CRITICAL(&gTgActsMux);
+  uint32_t a = gTgActs; gTgActs = 0;
+  portEXIT_CRITICAL(&gTgActsMux);
+
+  if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) { gKbHideAt = 0; a |= TG_ACT_HIDE_KB; }
+  if (!a) return;
+  String chat;
+  if (!tgCreds(nullptr, &chat)) return;
+
+  if (a & TG_ACT_PANEL) {
+    tgHideKeyboard(chat);        // ★ 收起舊鍵盤
+    tgSendControlKeyboard(chat); // 文字鍵盤（10 秒後自動關）
+    tgSendInlineOpen(chat);      // ★ 關鍵：送 inline WebApp 按鈕（內嵌開啟）
+    return;
+  }
+  if (a & TG_ACT_HIDE_KB) tgHideKeyboard(chat);
+  if (a & TG_ACT_INLINE)  tgSendInlineOpen(chat);
+}
+
+// 任務：負責實際送信 + 重試機制 (不影響主迴圈)
+// 先把 outbox 裡的 ALARM / RELAY 寫進日誌（flash 寫入都在這裡）；
+// 日誌有積存時依類別（ALARM 先）補送，一次最多 TG_BATCH_MSGS 則合併成一則，延遲的記錄帶時間戳；
+// 離線、補送中或送信失敗的 INFO 排到 RELAY 日誌尾端，維持順序。
+// 失敗以指數退避重試；被 Telegram 限流（429）時改依 retry_after 等待。
+static void tgTask(void*){
+  String   text;
+  uint32_t backoffMs = 0;
+  uint32_t nextTryAt = 0;
+  auto deferAfterFail = [&](uint32_t retryAfterMs){
+    if (retryAfterMs) backoffMs = retryAfterMs;
+    else backoffMs = backoffMs ? (backoffMs * 2 > TGJ_BACKOFF_MAX_MS ? TGJ_BACKOFF_MAX_MS : backoffMs * 2)
+                               : TGJ_BACKOFF_MIN_MS;
+    nextTryAt = millis() + backoffMs;
+  };
+
+  for(;;){
+    bool canTry = WiFi.isConnected() && (!backoffMs || (long)(millis() - nextTryAt) >= 0);
+    uint32_t retryAfterMs;
+
+    // 0) RAM 交接的 ALARM / RELAY 寫進各自的日誌；日誌不可用（SPIFFS 未掛載 / 已滿）時直接送一次
+    TgPri    pri;
+    uint32_t atMs;
+    while (tgOutbox.popDurable(text, pri, atMs)){
+      if (tgJournal.append(pri == TG_PRI_ALARM ? TGJ_ALARM : TGJ_RELAY, text, tgEpochAt(atMs))) continue;
+      bool ok = canTry && tgCreds(nullptr, nullptr) && sendTelegram(text, &retryAfterMs);
+      Serial.printf("[TG] journal unavailable (pri=%d), %s\n", (int)pri, ok ? "sent directly" : "dropped");
+    }
 
-  // POST 請求組合
-  String body = "chat_id=" + urlEncode(cfg.chat) + "&text=" + urlEncode(text);
-  String req  = "POST /bot" + cfg.token + "/sendMessage HTTP/1.1\r\n";
-  req += "Host: api.telegram.org\r\n";
-  req += "Content-Type: application/x-www-form-urlencoded\r\n";
-  req += "Content-Length: " + String(body.length()) + "\r\n";
-  req += "Connection: close\r\n\r\n" + body;
+    // 1) 補送 flash 日誌（ALARM 類先，同類依序號，合併成批）
+    uint32_t lastSeq;
+    TgjClass cls;
+    if (canTry && tgJournal.pending() && tgJournal.front(text, lastSeq, cls, TG_BATCH_MSGS, tgNowEpoch())){
+      uint16_t n = tgJournal.frontCount(cls);
+      if (sendTelegram(text, &retryAfterMs)) {
+        tgJournal.ack(cls, lastSeq, millis());
+        backoffMs = 0;
+        Serial.printf("[TG] journal[%d] ..#%u ok (%u msgs)\n", (int)cls, (unsigned)lastSeq, (unsigned)n);
+      } else {
+        deferAfterFail(retryAfterMs);
+        Serial.printf("[TG] journal[%d] ..#%u failed, retry in %u ms\n", (int)cls, (unsigned)lastSeq, (unsigned)backoffMs);
+      }
+      tgRunActions();
+      continue;
+    }
+    tgJournal.tick(millis());                          // 到期的 checkpoint 寫入
+
+    // 2) RAM outbox 的 INFO
+    uint32_t waitMs;
+    if (tgOutbox.popInfo(text, waitMs)){
+      Serial.printf("[TG] dequeued: %s\n", text.c_str());
+      bool direct = canTry && !tgJournal.pending();
+      if (!tgCreds(nullptr, nullptr)) {
+        Serial.println("[TG] token/chat empty, dropped");
+      } else if (direct && sendTelegram(text, &retryAfterMs)) {
+        Serial.println("[TG] ok");
+      } else {
+        if (direct) deferAfterFail(retryAfterMs);      // 剛剛送失敗 → 進入退避
+        bool saved = tgJournal.append(TGJ_RELAY, text, tgNowEpoch());
+        Serial.println(saved ? "[TG] deferred to journal" : "[TG] failed (journal full)");
+      }
+    } else {
+      tgOutbox.wait(waitMs < 250 ? waitMs : 250);
+    }
+    tgRunActions();
+  }
+}
+
+// =========================【系統參數設定】=========================
+static const uint32_t MAX_HOLD_SEC = 3600;  // 繼電器保持上限 (1 小時)
+static const uint32_t MIN_HOLD_SEC = 1;     // 繼電器保持下限 (1 秒)
+
+static const int  AP_MODE_PIN   = 33;       // AP 模式觸發腳位
+static const bool AP_ACTIVE_LOW = true;     // LOW = 啟用 AP
+
+#define RTC_IMPL_PCF8563        // 使用 PCF8563 RTC
+// #define RTC_IMPL_DS3231       // (可切換為 DS3231)
+// #define RTC_IMPL_MOCK         // (無 RTC 硬體：軟體時鐘 + 輪詢鬧鐘)
+
+// I2C 與 RTC 設定
+static const int I2C_SDA    = 21;
+static const int I2C_SCL    = 22;
+static const int RTC_INT_PIN = 5;           // RTC 中斷腳位 (選用)
+
+// 狀態旗標
+static bool gOnlineNotifiedOnce = false;    // 上線通知僅一次
+static unsigned long gCloseApAt = 0;        // 延遲關閉 AP 時間
+static bool gRtcReady = false;              // RTC 是否準備好
+static volatile bool gRtcAlarm = false;     // RTC INT 腳中斷旗標（見【RTC 鬧鐘：叫醒排程器】）
+
+// =========================【繼電器時序引擎 RelayEngine：esp_timer 單次計時】=========================
+// 吸合 / 釋放由 esp_timer 回呼（esp_timer 任務，高優先權）直接寫 GPIO，不受 loop() 被 TLS、I²C 卡住影響：
+//   start(ch, sec)        立即吸合（保持中則延長），同時排定釋放；不動尚未發生的預排
+//   startAt(ch, sec, us)  在 esp_timer 時刻 us 吸合（排程器提前 SCH_PREARM_MS 預排）
+//   cancelAt(ch)          取消尚未發生的預排；已吸合回 false
+//   stop(ch)              立即釋放（中止）
+// 狀態以 portMUX 保護（回呼在另一顆核心）；臨界區內只改狀態與旗標，繼電器腳位以 gpio_set_level
+// （單一暫存器寫入）跟狀態一起切換，兩核同時 start / stop 時腳位與狀態不會不一致。
+// 推播 / OLED 由 loop() 的 relayEng.loop() 補上（含預排到時遇到保持中而延長的通知）。
+// 每次保持記錄「要求 vs 實際」（RelayLogRec 環形紀錄，臨界區外寫入），/diag、/api/status 可檢視精度。
+static const uint8_t RELAY_LOG_N    = 16;     // 最近幾次保持紀錄
+static const int64_t RELAY_EARLY_US = 500;    // 回呼比預定早這麼多以內仍算到時（計時器粒度）
+
+enum RelayEnd : uint8_t { RELAY_END_TIMER = 0, RELAY_END_ABORT = 1 };
+
+struct RelayLogRec {
+  uint8_t  ch, how;          // how = RelayEnd
+  uint32_t reqMs;            // 要求保持（含延長）
+  uint32_t actUs;            // 實際保持
+  int32_t  onLateUs;         // 預排吸合的延遲（立即吸合為 0）
+  uint32_t atMs;             // 釋放時的 millis()
+  uint8_t  ext;              // 保持中被延長的次數（0 = 未延長）
+};
+
+class RelayEngine {
+public:
+  void begin(){
+    for (int ch = 0; ch < RELAY_COUNT; ++ch) {
+      esp_timer_create_args_t a = {};
+      a.arg = (void*)(uintptr_t)ch;
+      a.callback = &RelayEngine::offCb; a.name = "relayOff";
+      esp_timer_create(&a, &_r[ch].offTmr);
+      a.callback = &RelayEngine::onCb;  a.name = "relayOn";
+      esp_timer_create(&a, &_r[ch].onTmr);
+    }
+  }
+
+  // 立即吸合；已在保持中 → 延長 holdSec，回 true
+  // 預排保持原樣：到時由 onCb 延長（或在這次保持結束後重新吸合），排程器的 cancelAt() 也仍能撤回。
+  // 若在這裡撤回，排程器到期時會把 pre=true 當成「已吸合」而不補吸合，那一次排程就整段消失。
+  bool start(int ch, uint32_t holdSec){
+    Rt& r = _r[ch];
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&_mux);
+    bool ext = r.on;
+    if (ext) extend(ch, holdSec);            // 呼叫端（startRelayTimed）自己推播延長
+    else     energize(ch, now, now, holdSec);
+    int64_t until = r.untilUs;
+    portEXIT_CRITICAL(&_mux);
+    armOff(ch, until, now);
+    return ext;
+  }
+
+  void startAt(int ch, uint32_t holdSec, int64_t atUs){
+    Rt& r = _r[ch];
+    esp_timer_stop(r.onTmr);
+    portENTER_CRITICAL(&_mux);
+    r.pendingOn = true; r.atUs = atUs; r.pendHold = holdSec;
+    portEXIT_CRITICAL(&_mux);
+    int64_t left = atUs - esp_timer_get_time();
+    esp_timer_start_once(r.onTmr, left > 0 ? (uint64_t)left : 1);
+  }
+
+  bool cancelAt(int ch){
+    Rt& r = _r[ch];
+    esp_timer_stop(r.onTmr);
+    portENTER_CRITICAL(&_mux);
+    bool was = r.pendingOn;
+    r.pendingOn = false;
+    portEXIT_CRITICAL(&_mux);
+    return was;
+  }
+
+  bool stop(int ch){
+    Rt& r = _r[ch];
+    esp_timer_stop(r.offTmr);
+    RelayLogRec e;
+    portENTER_CRITICAL(&_mux);
+    bool was = r.on;
+    if (was) release(ch, esp_timer_get_time(), RELAY_END_ABORT, e);
+    portEXIT_CRITICAL(&_mux);
+    if (was) logHold(e);
+    return was;
+  }
+
+  // loop()：替已到時釋放、或預排到時延長的路補上推播 / OLED
+  void loop(){
+    for (int ch = 0; ch < RELAY_COUNT; ++ch) {
+      portENTER_CRITICAL(&_mux);
+      bool     ended  = _r[ch].ended;
+      uint32_t extSec = _r[ch].extSec;
+      _r[ch].ended  = false;
+      _r[ch].extSec = 0;
+      portEXIT_CRITICAL(&_mux);
+      if (extSec)
+        tgEnqueue("CH" + String(ch+1) + " 正在保持中，依排程延長 " + String(extSec) + " 秒", TG_PRI_RELAY);
+      if (!ended) continue;
+      tgEnqueue(endMsg(ch), TG_PRI_RELAY);
+      uiShow("CH"+String(ch+1)+" 結束", "");
+    }
+  }
+
+  // ---- 統計 ----
+  uint32_t holds(int ch)    const { return _r[ch].n; }
+  uint32_t errMaxUs(int ch) const { return _r[ch].errMaxUs; }   // |實際 - 要求| 最大值
+  uint32_t errAvgUs(int ch) const { return _r[ch].n ? (uint32_t)(_r[ch].errSumUs / _r[ch].n) : 0; }
+  uint32_t lateMaxUs(int ch) const { return _r[ch].lateMaxUs; } // 預排吸合最大延遲
+  bool     last(int ch, RelayLogRec& out) const {
+    for (int i = 1; i <= RELAY_LOG_N && i <= (int)_logN; ++i) {
+      const RelayLogRec& e = _log[(_logN - i) % RELAY_LOG_N];
+      if (e.ch == ch) { out = e; return true; }
+    }
+    return false;
+  }
+  // 最近第 i 筆（0 = 最新）
+  bool     log(int i, RelayLogRec& out) const {
+    if (i >= RELAY_LOG_N || i >= (int)_logN) return false;
+    out = _log[(_logN - 1 - i) % RELAY_LOG_N];
+    return true;
+  }
+
+private:
+  struct Rt {
+    esp_timer_handle_t onTmr = nullptr, offTmr = nullptr;
+    bool     on = false, pendingOn = false, ended = false;
+    uint8_t  ext = 0;                  // 本次保持被延長的次數
+    uint32_t extSec = 0;               // 預排延長、尚未推播的秒數（relayEng.loop() 送出）
+    int64_t  onUs = 0, untilUs = 0, atUs = 0;
+    int32_t  onLateUs = 0;
+    uint32_t reqMs = 0, pendHold = 0;
+    uint32_t n = 0, errMaxUs = 0, lateMaxUs = 0;
+    uint64_t errSumUs = 0;
+  };
+  Rt          _r[RELAY_COUNT];
+  RelayLogRec _log[RELAY_LOG_N];
+  uint32_t    _logN = 0;
+  static portMUX_TYPE _mux;
+  static portMUX_TYPE _logMux;
+
+  static void setPin(int ch, bool on){
+    gpio_set_level((gpio_num_t)RELAY_PINS[ch], on == RELAY_ACTIVE_HIGH ? 1 : 0);
+  }
+
+  // 以下三個在 _mux 內呼叫：只改狀態 / 旗標與腳位；millis 由 esp_timer 時刻換算（= millis()）
+  void energize(int ch, int64_t now, int64_t planned, uint32_t holdSec){
+    Rt& r = _r[ch];
+    if (holdSec == 0) holdSec = 1;
+    setPin(ch, true);
+    r.on = true;
+    r.ext = 0;
+    r.onUs = now;
+    r.onLateUs = (int32_t)(now - planned);
+    r.reqMs = holdSec * 1000UL;
+    r.untilUs = now + (int64_t)holdSec * 1000000LL;
+    if ((uint32_t)r.onLateUs > r.lateMaxUs) r.lateMaxUs = (uint32_t)r.onLateUs;
+    gTestActive[ch] = true;
+    gTestStart[ch]  = (unsigned long)(now / 1000);
+    gTestUntil[ch]  = gTestStart[ch] + r.reqMs;
+  }
+  void extend(int ch, uint32_t holdSec){
+    Rt& r = _r[ch];
+    r.reqMs   += holdSec * 1000UL;
+    r.untilUs += (int64_t)holdSec * 1000000LL;
+    if (r.ext < 0xFF) r.ext++;
+    gTestUntil[ch] += holdSec * 1000UL;
+  }
+  // e = 這次保持的紀錄，由呼叫端在臨界區外以 logHold() 寫入
+  void release(int ch, int64_t now, RelayEnd how, RelayLogRec& e){
+    Rt& r = _r[ch];
+    setPin(ch, false);
+    r.on = false;
+    gTestActive[ch] = false;
+    e.ch = (uint8_t)ch; e.how = how; e.reqMs = r.reqMs; e.ext = r.ext;
+    e.actUs = (uint32_t)(now - r.onUs); e.onLateUs = r.onLateUs; e.atMs = (uint32_t)(now / 1000);
+    if (how == RELAY_END_TIMER) {
+      int64_t err = (now - r.onUs) - (int64_t)r.reqMs * 1000LL;
+      uint32_t ae = (uint32_t)(err < 0 ? -err : err);
+      r.n++; r.errSumUs += ae;
+      if (ae > r.errMaxUs) r.errMaxUs = ae;
+      r.ended = true;
+    }
+  }
 
-  cli.print(req);
+  void logHold(const RelayLogRec& e){
+    portENTER_CRITICAL(&_logMux);
+    _log[_logN++ % RELAY_LOG_N] = e;
+    portEXIT_CRITICAL(&_logMux);
+  }
 
-  // 等待回應 (最多 5 秒)
-  unsigned long t0 = millis();
-  while (!cli.available() && millis()-t0 < 5000) delay(10);
-  if (!cli.available()) { Serial.println("[TG] no response"); return false; }
+  void armOff(int ch, int64_t until, int64_t now){
+    esp_timer_stop(_r[ch].offTmr);
+    esp_timer_start_once(_r[ch].offTmr, until > now ? (uint64_t)(until - now) : 1);
+  }
 
-  // 解析 HTTP 狀態列
-  String status = cli.readStringUntil('\n');  
-  status.trim();
-  bool http200 = status.indexOf(" 200 ") > 0;
+  static void offCb(void* arg);
+  static void onCb(void* arg);
+};
+portMUX_TYPE RelayEngine::_mux = portMUX_INITIALIZER_UNLOCKED;
+portMUX_TYPE RelayEngine::_logMux = portMUX_INITIALIZER_UNLOCKED;
+static RelayEngine relayEng;
+
+// esp_timer 任務：到時釋放（被延長過則不動作，start() 已重新排定）
+void RelayEngine::offCb(void* arg){
+  int ch = (int)(uintptr_t)arg;
+  Rt& r = relayEng._r[ch];
+  int64_t now = esp_timer_get_time();
+  RelayLogRec e;
+  portENTER_CRITICAL(&_mux);
+  bool fire = r.on && now >= r.untilUs - RELAY_EARLY_US;
+  if (fire) relayEng.release(ch, now, RELAY_END_TIMER, e);
+  portEXIT_CRITICAL(&_mux);
+  if (fire) { relayEng.logHold(e); pwrWake(); }   // loop() 補推播
+}
 
-  // 跳過 header
-  while (cli.connected()) {
-    String h = cli.readStringUntil('\n');
-    if (h == "\r" || h.length()==0) break;
+// esp_timer 任務：預排時刻吸合並排定釋放
+void RelayEngine::onCb(void* arg){
+  int ch = (int)(uintptr_t)arg;
+  Rt& r = relayEng._r[ch];
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&_mux);
+  bool go = r.pendingOn;
+  r.pendingOn = false;
+  if (go) {
+    if (r.on) { relayEng.extend(ch, r.pendHold); r.extSec += r.pendHold; }   // loop() 推播延長
+    else      relayEng.energize(ch, now, r.atUs, r.pendHold);
   }
-  // 讀取 body
-  String resp;
-  while (cli.available()) resp += (char)cli.read();
-  cli.stop();
+  int64_t until = r.untilUs;
+  portEXIT_CRITICAL(&_mux);
+  if (go) { relayEng.armOff(ch, until, now); pwrWake(); }
+}
 
-  bool okField = (resp.indexOf("\"ok\":true") >= 0);
-  if (!http200 || !okField) {
-    Serial.println("[TG] send fail");
-    Serial.println(status);
-    Serial.println(resp);
-    return false;
+static inline void startRelayTimed(int ch, uint32_t holdSec) {
+  if (ch < 0 || ch >= RELAY_COUNT) return;
+  if (holdSec == 0) holdSec = 1;
+
+  if (relayEng.start(ch, holdSec)) {
+    // 已在保持中 → 延長保持時間
+    tgEnqueue("CH" + String(ch+1) + " 正在保持中，依排程延長 " + String(holdSec) + " 秒", TG_PRI_RELAY);
   }
-  return true;
 }
 
+// =========================【HTTP 服務層：非同步伺服器 + 工作佇列】=========================
+// 連線由 ESPAsyncWebServer（AsyncTCP 任務）事件驅動處理，多個連線可同時進行，慢速 client 不再卡住其他請求。
+// 收到請求時只把參數 / 指定標頭 / 本文複製成 HttpJob，暫停該請求並排入工作佇列；
+// handler 由 httpWorker 任務執行（fast / slow 兩條，slow 給會等待的路由），執行期間持有 app lock，
+// 與 loop() 互斥，因此 handler 仍可直接存取全域狀態，寫法沿用 WebServer（srv.arg / srv.send / srv.sendContent）。
+// 串流回應經 StreamBuffer 交給 AsyncTCP 端的 chunked filler 送出；管道滿了（client 收得慢）時
+// 交出 app lock 等待，所以串流回應一律經由 HttpChunkWriter / streamFile（自有緩衝）送出。
+// 逾時：排隊超過路由時限 → 503；串流中對方停止接收超過時限 → 中止。
+#ifndef CONTENT_LENGTH_UNKNOWN
+  #define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#endif
 
-// ===== 讀取 WebApp 回傳（web_app_data）的輕量輪詢 =====
-static long tgUpdateOffset = 0; // 供 getUpdates 去重
+static const uint32_t HTTP_TIMEOUT_FAST_MS = 5000;    // 一般路由：排隊 / 串流停滯上限
+static const uint32_t HTTP_TIMEOUT_SLOW_MS = 30000;   // 會等待的路由（/save、/self-test、/tg）
+static const uint8_t  HTTP_QUEUE_DEPTH     = 8;       // 每條工作佇列深度，滿了回 503
+static const size_t   HTTP_BODY_MAX        = 8192;    // 非表單本文（srv.arg("plain")）上限
+static const size_t   HTTP_PIPE_BYTES      = 4096;    // 串流管道；小回應一次放得下，送出時不需再等
+
+// ---------- app lock：loop() 與 HTTP handler 互斥 ----------
+static SemaphoreHandle_t gAppMtx = nullptr;
+static inline void appLock()  { if (gAppMtx) xSemaphoreTake(gAppMtx, portMAX_DELAY); }
+static inline void appUnlock(){ if (gAppMtx) xSemaphoreGive(gAppMtx); pwrWake(); }   // 其他任務改過狀態 → 叫醒 loop()
+// 等待迴圈中暫時交出 app lock，讓 loop() 與其他請求可以執行
+static inline void appYield(uint32_t ms){ appUnlock(); delay(ms); appLock(); }
+struct AppLockGuard {
+  AppLockGuard(){ appLock(); }
+  ~AppLockGuard(){ appUnlock(); }
+};
 
-// =========================【Telegram 非阻塞佇列任務】=========================
-// 推播訊息結構
-struct TgMsg { char text[256]; };
-static QueueHandle_t tgQ = nullptr;
+enum HttpLane : uint8_t { HTTP_LANE_FAST = 0, HTTP_LANE_SLOW = 1, HTTP_LANE_N };
+
+struct HttpJob {
+  AsyncWebServerRequestPtr req;
+  uint8_t  route = 0;
+  uint32_t queuedAt = 0, timeoutMs = 0, lastProgress = 0;
+  std::vector<std::pair<String, String>> args;     // query + 表單 + "plain"
+  std::vector<std::pair<String, String>> hdrs;     // collectHeaders 指定的請求標頭
+  std::vector<std::pair<String, String>> outHdrs;  // sendHeader 累積的回應標頭
+  size_t   contentLen = 0;                         // setContentLength；UNKNOWN → 串流
+  bool     responded = false, streaming = false, dispatched = false;
+  int      code = 200;
+  String   ctype;
+  StreamBufferHandle_t pipe = nullptr;
+  volatile bool finished = false, aborted = false;
+  ~HttpJob(){ if (pipe) vStreamBufferDelete(pipe); }
+};
+typedef std::shared_ptr<HttpJob> HttpJobPtr;
 
-// 佇列推送（ISR 外不可直接 send，必須用 enqueue）
-static inline void tgEnqueue(const String& s){
-  if (!tgQ || !s.length()) return;
-  TgMsg m{}; strncpy(m.text, s.c_str(), sizeof(m.text)-1);
-  xQueueSend(tgQ, &m, 0);
-}
+class HttpJobServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit HttpJobServer(uint16_t port) : _async(port) {}
+
+  // 綁定路由；lane / timeoutMs 決定由哪條工作佇列執行與逾時（0 → 依 lane 預設）
+  void on(const char* uri, WebRequestMethodComposite method, THandlerFunction fn,
+          HttpLane lane = HTTP_LANE_FAST, uint32_t timeoutMs = 0){
+    uint8_t idx = (uint8_t)_routes.size();
+    _routes.push_back({ fn, lane, timeoutMs ? timeoutMs
+                               : (lane == HTTP_LANE_SLOW ? HTTP_TIMEOUT_SLOW_MS : HTTP_TIMEOUT_FAST_MS) });
+    _async.on(uri, method,
+              [this, idx](AsyncWebServerRequest* r){ enqueue(r, idx); },
+              nullptr, collectBody);
+  }
+  // 非路由型處理器（例如 /events 的 AsyncEventSource），直接掛在 AsyncTCP 端
+  void addHandler(AsyncWebHandler* h){ _async.addHandler(h); }
+  void collectHeaders(const char* names[], size_t n){
+    _collect.clear();
+    for (size_t i = 0; i < n; ++i) _collect.push_back(names[i]);
+  }
 
-// 任務：負責實際送信 + 重試機制 (不影響主迴圈)
-static void tgTask(void*){
-  const TickType_t base = pdMS_TO_TICKS(400);
-  for(;;){
-    TgMsg m{};
-    if (xQueueReceive(tgQ, &m, portMAX_DELAY) == pdTRUE){
-      Serial.print("[TG] dequeued: "); Serial.println(m.text);
-      bool sent = false;
-      for (int attempt=0; attempt<3 && !sent; ++attempt){
-        sent = sendTelegram(String(m.text));
-        if (!sent) { Serial.printf("[TG] retry %d\n", attempt+1); vTaskDelay(base * (attempt + 1)); }
-      }
-      Serial.println(sent ? "[TG] ok" : "[TG] failed");
+  void begin(){
+    if (!gAppMtx) gAppMtx = xSemaphoreCreateMutex();
+    static const char* kName[HTTP_LANE_N]  = { "httpFast", "httpSlow" };
+    static const uint32_t kStack[HTTP_LANE_N] = { 6144, 8192 };   // slow 會走 TLS（/tg）
+    for (int l = 0; l < HTTP_LANE_N; ++l) {
+      _q[l] = xQueueCreate(HTTP_QUEUE_DEPTH, sizeof(HttpJobPtr*));
+      // 與 loop() 同核、較高優先序：loop() 一放開 app lock 就能接手
+      xTaskCreatePinnedToCore(worker, kName[l], kStack[l], (void*)(intptr_t)l, 2, &_task[l], ARDUINO_RUNNING_CORE);
     }
+    _async.begin();
   }
-}
 
-// =========================【系統參數設定】=========================
-static const uint32_t MAX_HOLD_SEC = 3600;  // 繼電器保持上限 (1 小時)
-static const uint32_t MIN_HOLD_SEC = 1;     // 繼電器保持下限 (1 秒)
+  // ---------- handler 端 API（僅在 httpWorker 內呼叫） ----------
+  String arg(const String& name){
+    HttpJob* j = cur();
+    if (j) for (auto& a : j->args) if (a.first == name) return a.second;
+    return String();
+  }
+  bool hasArg(const String& name){
+    HttpJob* j = cur();
+    if (j) for (auto& a : j->args) if (a.first == name) return true;
+    return false;
+  }
+  String header(const String& name){
+    HttpJob* j = cur();
+    if (j) for (auto& h : j->hdrs) if (h.first.equalsIgnoreCase(name)) return h.second;
+    return String();
+  }
+  bool hasHeader(const String& name){ return header(name).length() > 0; }
 
-static const int  AP_MODE_PIN   = 33;       // AP 模式觸發腳位
-static const bool AP_ACTIVE_LOW = true;     // LOW = 啟用 AP
+  void sendHeader(const String& name, const String& value, bool first = false){
+    HttpJob* j = cur();
+    if (!j) return;
+    if (first) j->outHdrs.insert(j->outHdrs.begin(), { name, value });
+    else       j->outHdrs.push_back({ name, value });
+  }
+  void setContentLength(size_t len){ if (HttpJob* j = cur()) j->contentLen = len; }
+
+  void send(int code, const char* ctype = nullptr, const String& body = String()){
+    HttpJob* j = cur();
+    if (!j || j->responded) return;
+    j->responded = true;
+    j->code  = code;
+    j->ctype = ctype ? ctype : "text/plain";
+    if (j->contentLen == CONTENT_LENGTH_UNKNOWN) { j->streaming = true; return; }   // 等 sendContent
+    auto r = j->req.lock();
+    if (!r) { j->aborted = true; return; }
+    AsyncWebServerResponse* resp = r->beginResponse(code, j->ctype, body);
+    for (auto& h : j->outHdrs) resp->addHeader(h.first, h.second);
+    r->send(resp);
+  }
+  void send(int code, const String& ctype, const String& body){ send(code, ctype.c_str(), body); }
+  void send(int code, const char* ctype, const char* body){ send(code, ctype, String(body)); }
+
+  // 串流內容；長度 0 表示結束
+  void sendContent(const char* p, size_t n){
+    HttpJob* j = cur();
+    if (!j || !j->streaming || j->finished) return;
+    if (!n) { finish(*j); return; }
+    pipeWrite(*j, (const uint8_t*)p, n);
+  }
+  void sendContent(const String& s){ sendContent(s.c_str(), s.length()); }
+
+  // 檔名以 .gz 結尾 → 加 Content-Encoding: gzip
+  size_t streamFile(File& f, const String& ctype, int code = 200){
+    if (String(f.name()).endsWith(".gz")) sendHeader("Content-Encoding", "gzip");
+    setContentLength(CONTENT_LENGTH_UNKNOWN);
+    send(code, ctype.c_str(), "");
+    uint8_t buf[512];
+    size_t total = 0;
+    while (f.available()) {
+      int n = f.read(buf, sizeof(buf));
+      if (n <= 0) break;
+      sendContent((const char*)buf, (size_t)n);
+      total += n;
+    }
+    sendContent("");
+    return total;
+  }
 
-#define RTC_IMPL_PCF8563        // 使用 PCF8563 RTC
-// #define RTC_IMPL_DS3231       // (可切換為 DS3231)
+  // ---------- 統計（/diag） ----------
+  uint32_t served = 0, rejected = 0, expired = 0, aborted = 0, stalled = 0, maxWaitMs = 0;
+  UBaseType_t queued(int lane) const { return _q[lane] ? uxQueueMessagesWaiting(_q[lane]) : 0; }
 
-// I2C 與 RTC 設定
-static const int I2C_SDA    = 21;
-static const int I2C_SCL    = 22;
-static const int RTC_INT_PIN = 5;           // RTC 中斷腳位 (選用)
+private:
+  struct Route { THandlerFunction fn; HttpLane lane; uint32_t timeoutMs; };
+
+  AsyncWebServer           _async;
+  std::vector<Route>       _routes;
+  std::vector<String>      _collect;
+  QueueHandle_t            _q[HTTP_LANE_N]    = { nullptr, nullptr };
+  TaskHandle_t             _task[HTTP_LANE_N] = { nullptr, nullptr };
+  HttpJobPtr               _cur[HTTP_LANE_N];
+
+  int curLane(){
+    TaskHandle_t t = xTaskGetCurrentTaskHandle();
+    for (int l = 0; l < HTTP_LANE_N; ++l) if (t == _task[l]) return l;
+    return -1;
+  }
+  HttpJob* cur(){ int l = curLane(); return l < 0 ? nullptr : _cur[l].get(); }
+
+  // onBody：非表單本文收進 _tempObject（請求結束時由程式庫 free）
+  static void collectBody(AsyncWebServerRequest* r, uint8_t* data, size_t len, size_t index, size_t total){
+    if (total > HTTP_BODY_MAX) return;
+    if (index == 0) r->_tempObject = malloc(total + 1);
+    if (!r->_tempObject) return;
+    memcpy((uint8_t*)r->_tempObject + index, data, len);
+    if (index + len == total) ((char*)r->_tempObject)[total] = 0;
+  }
 
-// 狀態旗標
-static bool gOnlineNotifiedOnce = false;    // 上線通知僅一次
-static unsigned long gCloseApAt = 0;        // 延遲關閉 AP 時間
-static bool gRtcReady = false;              // RTC 是否準備好
+  // AsyncTCP 任務內：複製請求內容 → 暫停請求 → 排入佇列（滿了直接 503）
+  void enqueue(AsyncWebServerRequest* r, uint8_t idx){
+    const Route& rt = _routes[idx];
+    QueueHandle_t q = _q[rt.lane];
+    if (!q || !uxQueueSpacesAvailable(q)) { rejected++; r->send(503, "text/plain", "busy"); return; }
+
+    HttpJobPtr job = std::make_shared<HttpJob>();
+    job->route     = idx;
+    job->timeoutMs = rt.timeoutMs;
+    job->queuedAt  = millis();
+    for (size_t i = 0; i < r->params(); ++i) {
+      const AsyncWebParameter* p = r->getParam(i);
+      if (p && !p->isFile()) job->args.push_back({ p->name(), p->value() });
+    }
+    if (r->_tempObject) job->args.push_back({ "plain", String((const char*)r->_tempObject) });
+    for (auto& h : _collect)
+      if (const AsyncWebHeader* hv = r->getHeader(h)) job->hdrs.push_back({ h, hv->value() });
+
+    job->req = r->requestPtr();
+    r->onDisconnect([job](){ job->aborted = true; });
+    r->pause();
+    HttpJobPtr* slot = new HttpJobPtr(job);      // 佇列只放指標；只有本任務會放入，前面已確認有空位
+    xQueueSend(q, &slot, 0);
+  }
 
-// 繼電器啟動 (帶保持秒數)
-static inline void startRelayTimed(int ch, uint32_t holdSec) {
-  if (ch < 0 || ch >= RELAY_COUNT) return;
-  if (holdSec == 0) holdSec = 1;
+  static void worker(void* arg);
+  void run(int lane, HttpJobPtr job);
+
+  // 串流：第一次填滿管道（或結束）時才送出回應標頭，避免 filler 一開始就拿到空管道而延後重試
+  void dispatch(HttpJob& j){
+    j.dispatched = true;
+    auto r = j.req.lock();
+    if (!r) { j.aborted = true; return; }
+    HttpJobPtr keep = _cur[curLane()];                  // filler 持有 job，直到 AsyncTCP 釋放回應
+    AsyncWebServerResponse* resp = r->beginChunkedResponse(j.ctype,
+      [keep](uint8_t* buf, size_t maxLen, size_t) -> size_t {
+        bool fin = keep->finished || keep->aborted;     // 先看旗標再讀：旗標成立時資料必已全部寫入
+        size_t n = keep->pipe ? xStreamBufferReceive(keep->pipe, buf, maxLen, 0) : 0;
+        if (n)   return n;
+        if (fin) return 0;
+        return RESPONSE_TRY_AGAIN;
+      });
+    resp->setCode(j.code);
+    for (auto& h : j.outHdrs) resp->addHeader(h.first, h.second);
+    r->send(resp);
+  }
+  // 管道滿了就交出 app lock 等待（見 http_pipe.h）；p 必須是呼叫端自己的緩衝
+  void pipeWrite(HttpJob& j, const uint8_t* p, size_t n){
+    if (!j.pipe) j.pipe = xStreamBufferCreate(HTTP_PIPE_BYTES, 1);
+    if (!j.pipe) { j.aborted = true; return; }
+    struct Port {
+      HttpJobServer& s;
+      HttpJob&       j;
+      size_t   send(const uint8_t* d, size_t k, uint32_t ms){ return xStreamBufferSend(j.pipe, d, k, pdMS_TO_TICKS(ms)); }
+      void     dispatch(){ s.dispatch(j); }
+      void     unlock(){ appUnlock(); }
+      void     lock(){ appLock(); }
+      uint32_t now(){ return millis(); }
+    } port{ *this, j };
+    if (httpPipeWrite(port, p, n, j.timeoutMs, j.dispatched, j.lastProgress, j.aborted) == HP_STALLED) {
+      j.aborted = true;
+      stalled++;
+    }
+  }
+  void finish(HttpJob& j){
+    if (!j.pipe) j.pipe = xStreamBufferCreate(HTTP_PIPE_BYTES, 1);
+    j.finished = true;
+    if (!j.dispatched) dispatch(j);
+  }
+};
 
-  int pin = RELAY_PINS[ch];
+HttpJobServer srv(80);   // HTTP port 80（非同步伺服器 + 工作佇列）
 
-  if (gTestActive[ch]) {
-    // 若已啟動 → 延長保持時間
-    unsigned long addMs = holdSec * 1000UL;
-    gTestUntil[ch] += addMs;
-    tgEnqueue("CH" + String(ch+1) + " 正在保持中，依排程延長 " + String(holdSec) + " 秒");
-    return;
+void HttpJobServer::worker(void* arg){
+  int lane = (int)(intptr_t)arg;
+  for (;;) {
+    HttpJobPtr* slot = nullptr;
+    if (xQueueReceive(srv._q[lane], &slot, portMAX_DELAY) != pdTRUE || !slot) continue;
+    HttpJobPtr job = *slot;
+    delete slot;
+    srv.run(lane, job);
   }
-
-  digitalWrite(pin, RELAY_ACTIVE_HIGH ? HIGH : LOW);
-  gTestActive[ch] = true;
-  gTestStart[ch]  = millis();
-  gTestUntil[ch]  = millis() + holdSec * 1000UL;
 }
 
-WebServer srv(80);   // 建立 WebServer (HTTP port 80)
+void HttpJobServer::run(int lane, HttpJobPtr job){
+  uint32_t waited = millis() - job->queuedAt;
+  if (waited > maxWaitMs) maxWaitMs = waited;
+  if (job->aborted) { aborted++; return; }                 // client 已離開
+  _cur[lane] = job;
+  if (waited > job->timeoutMs) {                           // 排太久：不執行 handler
+    expired++;
+    send(503, "text/plain", "timeout");
+  } else {
+    AppLockGuard lock;
+    _routes[job->route].fn();
+    if (!job->responded) send(500, "text/plain", "no response");
+    if (job->streaming && !job->finished) finish(*job);    // handler 忘了結尾 chunk
+    served++;
+  }
+  if (job->aborted) aborted++;
+  _cur[lane].reset();
+}
 
 // 停止指定繼電器，並送出原因訊息
 static inline void stopRelayIfActive(int ch, const char* reason){
   if (ch < 0 || ch >= RELAY_COUNT) return;
-  if (!gTestActive[ch]) return;
-  int pin = RELAY_PINS[ch];
-  digitalWrite(pin, RELAY_ACTIVE_HIGH ? LOW : HIGH);
-  gTestActive[ch] = false;
-  tgEnqueue("CH" + String(ch+1) + " 測試結束(" + String(reason ? reason : "中止") + ")");
+  if (!relayEng.stop(ch)) return;
+  tgEnqueue("CH" + String(ch+1) + " 測試結束(" + String(reason ? reason : "中止") + ")", TG_PRI_RELAY);
   uiShow("CH"+String(ch+1)+" 停止", reason?reason:"中止");
 }
 
@@ -387,14 +1882,29 @@ struct YqDateTime {
   int year, month, day, hour, minute, second;
 };
 
+// 公曆日期 ↔ 1970-01-01 起算日數（與時區無關）
+static int64_t tsDaysFromCivil(int y, int m, int d){
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+static int64_t tsLocalSec(int y, int mo, int d, int h, int mi, int s){
+  return tsDaysFromCivil(y, mo, d) * 86400LL + h * 3600 + mi * 60 + s;
+}
+
 class IRtc {
 public:
   virtual bool begin() = 0;                       // 初始化
   virtual bool lostPower() = 0;                   // 是否掉電
   virtual void adjust(const YqDateTime& dt) = 0;  // 設定時間
   virtual YqDateTime now() = 0;                   // 讀取時間
-  virtual bool setDailyAlarm(uint8_t hh, uint8_t mm) = 0; // 設定每日鬧鐘
-  virtual bool clearAlarmFlag() = 0;              // 清除鬧鐘旗標
+  virtual bool setDailyAlarm(uint8_t hh, uint8_t mm) = 0; // 設定每日鬧鐘（只比對 HH:MM；INT 腳拉低）
+  virtual bool clearAlarmFlag() = 0;              // 清除鬧鐘旗標（放開 INT 腳）
+  virtual bool disableAlarm() = 0;                // 關閉鬧鐘中斷
+  virtual bool alarmFired() = 0;                  // 鬧鐘旗標是否置位
   virtual ~IRtc() {}
 };
 
@@ -487,6 +1997,18 @@ public:
     return true;
   }
 
+  bool disableAlarm() override {
+    writeReg(0x09, 0x80);   // 分、時比對皆關閉
+    writeReg(0x0A, 0x80);
+    uint8_t ctl2 = readReg(0x01);
+    writeReg(0x01, ctl2 & ~0x0A);   // AIE=0、AF=0
+    return true;
+  }
+
+  bool alarmFired() override {
+    return (readReg(0x01) & 0x08) != 0;   // AF
+  }
+
 private:
   // I2C 讀寫封裝
   uint8_t readReg(uint8_t r){
@@ -536,7 +2058,7 @@ public:
     // 使用 Alarm2，比對 HH:MM，每日觸發
     ds.clearAlarm(2);
     ds.writeSqwPinMode(DS3231_OFF);
-    ds.setAlarm2(DateTime(2025,1,1, hh, mm, 0), DS3231_A2_Minutes);
+    ds.setAlarm2(DateTime(2025,1,1, hh, mm, 0), DS3231_A2_Hour);   // 時 + 分相符
     return true;
   }
 
@@ -545,6 +2067,61 @@ public:
     ds.clearAlarm(2);
     return true;
   }
+
+  bool disableAlarm() override {
+    ds.disableAlarm(2);
+    ds.clearAlarm(2);
+    return true;
+  }
+
+  bool alarmFired() override {
+    return ds.alarmFired(2);
+  }
+};
+#endif
+
+
+// =========================【RTC 實作：軟體模擬 RtcMock】=========================
+// 無 RTC 硬體（或主機模擬）時使用：以 esp_timer 推算的軟體時鐘，斷電即失效。
+// 沒有 INT 腳 → 定義 RTC_ALARM_POLLED，由 RtcAlarm 每秒輪詢 alarmFired()。
+#ifdef RTC_IMPL_MOCK
+#define RTC_ALARM_POLLED 1
+
+class RtcMock : public IRtc {
+public:
+  bool begin() override { return true; }
+  bool lostPower() override { return !_set; }
+
+  void adjust(const YqDateTime& dt) override {
+    _base = tsLocalSec(dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+    _atUs = esp_timer_get_time();
+    _set  = true;
+  }
+
+  YqDateTime now() override {
+    time_t t = (time_t)cur();
+    struct tm g;
+    gmtime_r(&t, &g);
+    return YqDateTime{ g.tm_year + 1900, g.tm_mon + 1, g.tm_mday, g.tm_hour, g.tm_min, g.tm_sec };
+  }
+
+  bool setDailyAlarm(uint8_t hh, uint8_t mm) override { _alarm = hh * 60 + mm; _af = false; return true; }
+  bool clearAlarmFlag() override { _af = false; return true; }
+  bool disableAlarm() override { _alarm = -1; _af = false; return true; }
+
+  // 進入鬧鐘那一分鐘時置位（與硬體相同：同一分鐘內清除後不再置位）
+  bool alarmFired() override {
+    int64_t m = cur() / 60;
+    if (_alarm >= 0 && m != _lastMin && (int)(m % (24 * 60)) == _alarm) _af = true;
+    _lastMin = m;
+    return _af;
+  }
+
+private:
+  int64_t cur() const { return _base + (esp_timer_get_time() - _atUs) / 1000000LL; }
+  int64_t _base = 946684800LL, _atUs = 0, _lastMin = -1;   // 2000-01-01 00:00
+  int     _alarm = -1;
+  bool    _af = false, _set = false;
 };
 #endif
 
@@ -554,8 +2131,10 @@ public:
 RtcPCF8563 RTC;           // 使用 PCF8563
 #elif defined(RTC_IMPL_DS3231)
 RtcDS3231Wrap RTC;        // 使用 DS3231
+#elif defined(RTC_IMPL_MOCK)
+RtcMock RTC;              // 軟體模擬（無 RTC 硬體）
 #else
-#error "請定義 RTC_IMPL_PCF8563 或 RTC_IMPL_DS3231"
+#error "請定義 RTC_IMPL_PCF8563、RTC_IMPL_DS3231 或 RTC_IMPL_MOCK"
 #endif
 
 
@@ -582,6 +2161,216 @@ bool writeTextFile(const char* path, const String& s){
 }
 
 
+// =========================【時間服務 TimeSvc：每秒取樣一次的時間快取】=========================
+// 取代各處直接呼叫 getLocalTime() / RTC.now() / 讀 /rtc.txt：
+// loop() 每秒取樣一次最佳來源（系統時間(NTP) → RTC → /rtc.txt 開機快照），兩次取樣之間以 esp_timer 推算（含次秒）；
+// RTC 來源每 60 秒才重讀一次 I²C。取用端（排程、計數回報、網頁、診斷）只讀快取，不阻塞。
+// 分鐘改變時依序呼叫 onMinute() 註冊的處理函式（在 loop() 內執行）。
+// 內部以「本地時間秒數」（不經 TZ 換算）保存，來源切換或 configTime() 改時區都不影響推算。
+enum TimeSrc : uint8_t { TS_NONE, TS_NTP, TS_RTC, TS_SNAP };
+static const int64_t TS_SAMPLE_US     = 1000000LL;    // 取樣週期
+static const int64_t TS_RTC_RESYNC_US = 60000000LL;   // RTC 重讀週期
+static const int64_t TS_HOLD_US       = 60000000LL;   // 來源全失效後，沿用推算值的時限
+static const int     TS_MINUTE_FNS    = 4;
+
+class TimeSvc {
+public:
+  typedef void (*MinuteFn)(const struct tm& t);
+
+  void begin(){
+    loadSnapshot();
+    sample();
+  }
+  void onMinute(MinuteFn fn){ if (_nFns < TS_MINUTE_FNS) _fns[_nFns++] = fn; }
+  // 時間被改（RTC.adjust / 校時）後呼叫：下一輪立即重新取樣
+  void invalidate(){ _forceRtc = true; _lastSampleUs = -TS_SAMPLE_US; }
+
+  void loop(){
+    if (esp_timer_get_time() - _lastSampleUs < TS_SAMPLE_US) return;
+    sample();
+    if (_src == TS_NONE) return;
+    int64_t key = _baseLocal / 60;          // 取樣時已把 _baseLocal 對齊到最新
+    if (key == _minKey) return;
+    _minKey = key;
+    for (int i = 0; i < _nFns; ++i) _fns[i](_tm);
+  }
+
+  bool        valid()  const { return _src != TS_NONE; }
+  TimeSrc     source() const { return _src; }
+  const char* sourceName() const {
+    static const char* const n[] = { "none", "ntp", "rtc", "snap" };
+    return n[_src];
+  }
+  const struct tm& now() const { return _tm; }                    // 最近一次取樣（每秒更新）
+  bool hm(int& h, int& m) const { if (!valid()) return false; h = _tm.tm_hour; m = _tm.tm_min; return true; }
+  int  weekdayMon0() const { return _tm.tm_wday == 0 ? 6 : _tm.tm_wday - 1; }
+  // 本地時間（微秒，含次秒推算）
+  int64_t localUs() const { return _baseLocal * 1000000LL + _baseFracUs + (esp_timer_get_time() - _baseUs); }
+  // strftime 到呼叫端緩衝；無時間時輸出 "--"
+  void format(char* buf, size_t n, const char* fmt) const {
+    if (!valid()) { snprintf(buf, n, "--"); return; }
+    strftime(buf, n, fmt, &_tm);
+  }
+
+  uint32_t samples()  const { return _samples; }
+  uint32_t rtcReads() const { return _rtcReads; }
+
+private:
+  TimeSrc   _src = TS_NONE;
+  int64_t   _baseLocal = 0;          // 取樣時的本地秒數
+  int32_t   _baseFracUs = 0;         // 取樣時的次秒
+  int64_t   _baseUs = 0;             // 取樣時的 esp_timer
+  int64_t   _lastSampleUs = -TS_SAMPLE_US, _lastGoodUs = 0, _rtcAtUs = 0;
+  int64_t   _minKey = -1;
+  int64_t   _snapLocal = 0;          // /rtc.txt 快照（視為開機當下的時間）
+  bool      _snapOk = false, _forceRtc = false;
+  struct tm _tm = {};
+  MinuteFn  _fns[TS_MINUTE_FNS] = {};
+  int       _nFns = 0;
+  uint32_t  _samples = 0, _rtcReads = 0;
+
+  void setBase(TimeSrc src, int64_t localSec, int32_t fracUs, int64_t atUs){
+    _src = src; _baseLocal = localSec; _baseFracUs = fracUs; _baseUs = atUs;
+  }
+
+  void sample(){
+    int64_t nowUs = esp_timer_get_time();
+    _lastSampleUs = nowUs;
+    _samples++;
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    if (tv.tv_sec > 1577836800) {                               // 1) 系統時間（NTP 已對時）
+      time_t t = tv.tv_sec;
+      struct tm lt;
+      localtime_r(&t, &lt);
+      setBase(TS_NTP, tsLocalSec(lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday, lt.tm_hour, lt.tm_min, lt.tm_sec),
+              (int32_t)tv.tv_usec, nowUs);
+      _lastGoodUs = nowUs;
+    } else if (gRtcReady) {                                     // 2) RTC（每 60 秒重讀）
+      if (_rtcReads == 0 || _forceRtc || nowUs - _rtcAtUs >= TS_RTC_RESYNC_US) {
+        YqDateTime n = RTC.now();
+        _rtcAtUs = nowUs; _rtcReads++; _forceRtc = false;
+        if (n.year >= 2020) setBase(TS_RTC, tsLocalSec(n.year, n.month, n.day, n.hour, n.minute, n.second), 0, nowUs);
+      }
+      if (_src == TS_RTC) _lastGoodUs = nowUs;
+    } else if (_snapOk) {                                       // 3) 開機快照 + 開機後經過時間
+      if (_src != TS_SNAP) setBase(TS_SNAP, _snapLocal, 0, 0);
+      _lastGoodUs = nowUs;
+    }
+    if (_src != TS_NONE && nowUs - _lastGoodUs > TS_HOLD_US) _src = TS_NONE;   // 4) 逾時 → 無時間
+    if (_src == TS_NONE) return;
+
+    // 推算到此刻並展開成 tm（gmtime：_baseLocal 已是本地秒數）
+    int64_t us = localUs();
+    _baseLocal = us / 1000000LL; _baseFracUs = (int32_t)(us % 1000000LL); _baseUs = nowUs;
+    time_t sec = (time_t)_baseLocal;
+    gmtime_r(&sec, &_tm);
+  }
+
+  // /rtc.txt："YYYY-MM-DD HH:MM"（校時時寫入）
+  void loadSnapshot(){
+    String snap = readTextFile("/rtc.txt");
+    snap.trim();
+    if (snap.length() < 16) return;
+    int y = snap.substring(0,4).toInt(), mo = snap.substring(5,7).toInt(), d = snap.substring(8,10).toInt();
+    int h = snap.substring(11,13).toInt(), mi = snap.substring(14,16).toInt();
+    if (y < 2020 || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59) return;
+    _snapLocal = tsLocalSec(y, mo, d, h, mi, 0);
+    _snapOk = true;
+  }
+};
+static TimeSvc timeSvc;
+
+
+// =========================【省電模式 PowerMgr：事件之間讓出 CPU + 工作週期統計】=========================
+// loop() 最後呼叫 pwr.idle()：POWER_SAVE 時交出 app lock，以 task notification 阻塞到
+// min(pwrWithin() 登記的期限, POWER_TICK_MS)，期間 ISR / 其他任務可用 pwrWake*() 提早叫醒。
+// 統計 loop 醒著的時間比例（duty），並以典型電流估算平均耗電（不含 OLED、繼電器線圈等周邊）。
+static const int64_t  POWER_WINDOW_US    = 10000000LL;   // duty 統計視窗
+static const uint32_t PWR_UA_RUN         = 95000;        // CPU 240 MHz + Wi-Fi 常開
+static const uint32_t PWR_UA_RUN_MODEM   = 45000;        // CPU 執行中 + Wi-Fi modem sleep
+static const uint32_t PWR_UA_IDLE_WAIT   = 22000;        // loop 阻塞、CPU 閒置（waiti）+ modem sleep
+static const uint32_t PWR_UA_LIGHT_SLEEP = 2500;         // 自動 light sleep + Wi-Fi DTIM 平均
+
+class PowerMgr {
+public:
+  void begin(){
+    gLoopTask = xTaskGetCurrentTaskHandle();
+#if PWR_LIGHT_SLEEP
+    esp_pm_config_esp32_t pc = {};
+    pc.max_freq_mhz = 240;
+    pc.min_freq_mhz = 80;              // APB 維持 80 MHz（UART / I²C / LEDC 不受影響）
+    pc.light_sleep_enable = true;
+    _light = (esp_pm_configure(&pc) == ESP_OK);
+    esp_sleep_enable_gpio_wakeup();
+#endif
+    _winStartUs = _awakeSinceUs = esp_timer_get_time();
+  }
+
+  void idle(){
+    uint32_t ms = gPwrWithinMs;
+    gPwrWithinMs = POWER_TICK_MS;
+    int64_t t0 = esp_timer_get_time();
+    _winAwakeUs += t0 - _awakeSinceUs;
+#ifdef POWER_SAVE
+    if (ms) {
+      appUnlock();
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms))) _wakeEvent++;
+      else                                             _wakeTimer++;
+      appLock();
+    }
+#else
+    (void)ms;
+#endif
+    int64_t t1 = esp_timer_get_time();
+    _winSleepUs += t1 - t0;
+    _awakeSinceUs = t1;
+    if (t1 - _winStartUs >= POWER_WINDOW_US) {
+      int64_t tot = _winAwakeUs + _winSleepUs;
+      _dutyPm = tot > 0 ? (uint16_t)(_winAwakeUs * 1000 / tot) : 1000;
+      _winAwakeUs = _winSleepUs = 0;
+      _winStartUs = t1;
+    }
+  }
+
+  const char* mode() const {
+#ifdef POWER_SAVE
+    return _light ? "light" : "wait";
+#else
+    return "active";
+#endif
+  }
+  uint16_t dutyPermille() const { return _dutyPm; }   // 最近一個視窗 loop 醒著的比例（‰）
+  uint32_t wakeEvents() const { return _wakeEvent; }
+  uint32_t wakeTimers() const { return _wakeTimer; }
+
+  // 估算平均電流（μA）
+  uint32_t estUa() const {
+#ifdef POWER_SAVE
+    uint32_t idleUa = _light ? PWR_UA_LIGHT_SLEEP : PWR_UA_IDLE_WAIT;
+    return (uint32_t)(((uint64_t)PWR_UA_RUN_MODEM * _dutyPm + (uint64_t)idleUa * (1000 - _dutyPm)) / 1000);
+#else
+    return PWR_UA_RUN;
+#endif
+  }
+
+private:
+  bool     _light = false;
+  int64_t  _winStartUs = 0, _awakeSinceUs = 0, _winAwakeUs = 0, _winSleepUs = 0;
+  uint16_t _dutyPm = 1000;
+  uint32_t _wakeEvent = 0, _wakeTimer = 0;
+};
+static PowerMgr pwr;
+
+// μA → "12.3"（mA，一位小數）
+static String pwrFmtMa(uint32_t ua){
+  char b[16];
+  snprintf(b, sizeof(b), "%lu.%lu", (unsigned long)(ua / 1000), (unsigned long)((ua % 1000) / 100));
+  return String(b);
+}
+
+
 // =========================【上線推播：notifyOnline】=========================
 // 用法：在成功連上 Wi-Fi 後於主循環週期性呼叫；此函式會：
 // 1) 進行 NTP 對時並把時間寫進 RTC 與 /rtc.txt
@@ -602,7 +2391,7 @@ void notifyOnline() {
   if (getLocalTime(&tinfo, 5000)) {
     YqDateTime dt{ tinfo.tm_year+1900, tinfo.tm_mon+1, tinfo.tm_mday,
                    tinfo.tm_hour, tinfo.tm_min, tinfo.tm_sec };
-    RTC.adjust(dt);
+    RTC.adjust(dt); timeSvc.invalidate();
     char snap[20];
     snprintf(snap, sizeof(snap), "%04d-%02d-%02d %02d:%02d",
              dt.year, dt.month, dt.day, dt.hour, dt.minute);
@@ -625,13 +2414,224 @@ void notifyOnline() {
 }
 
 
-// =========================【設定檔：載入 loadConfig】=========================
-// 用法：開機時呼叫一次，把 /config.txt 讀入 cfg
-// 檔案格式：極簡 key=value（見 saveConfig 的輸出）
-// 作用/功能：還原 WiFi / TG / 排程 / 星期遮罩 / 計數器達標等
-void loadConfig(){
+// =========================【設定檔：二進位 A/B 槽】=========================
+// cfg 以緊湊二進位記錄存在 /cfg.a、/cfg.b 兩個槽，輪流寫入：
+//   [16B 標頭 magic "YQCF" | schema | len | seq | crc32] + [payload]
+// 每次落地（cfgCommit）都寫「非目前」那個槽，寫完讀回驗 CRC；斷電只可能毀掉正在寫的槽，
+// 另一槽仍是上一版完整設定。開機讀兩槽，取 CRC 正確且 seq 最大者（seq = cfg.ver）。
+// payload 依 schema 順序排列：字串為 u16 長度 + bytes，數值為 little-endian。
+// 新增欄位：CFG_SCHEMA +1，欄位加在最後，cfgDecode() 以 schema 判斷是否讀取。
+//   schema 2：尾端加上累計寫入次數 / 寫入頁數（估算 flash 壽命用）
+//   schema 3：各路額外觸發時間（u8 筆數 + u16×n）與本路星期遮罩（u8）
+static const uint32_t CFG_MAGIC  = 0x46435159;   // "YQCF"
+static const uint16_t CFG_SCHEMA = 3;
+static const size_t   CFG_MAX    = 4096;         // payload 上限
+static const uint32_t CFG_FLASH_PAGE  = 256;     // SPIFFS 頁
+static const uint32_t CFG_FLASH_BLOCK = 4096;    // 抹除單位（sector）
+static const uint32_t CFG_VER_GAP     = 64;      // 開機時 cfg.ver 跳過的版本數（見 loadConfig / CfgPersist::touch）
+static const char* const CFG_SLOT[2] = { "/cfg.a", "/cfg.b" };
+
+struct CfgHdr {
+  uint32_t magic;
+  uint16_t schema;
+  uint16_t len;      // payload bytes
+  uint32_t seq;      // = 寫入當時的 cfg.ver
+  uint32_t crc;      // 標頭（crc 欄位為 0）+ payload 的 CRC32
+};
+
+// 診斷用（/diag）
+struct CfgStoreStat {
+  const char* source = "default";   // bin / text（舊檔遷移）/ default
+  int8_t   active   = -1;           // 目前有效槽 0=A 1=B；-1=無
+  uint32_t seq = 0, bytes = 0, loadUs = 0, commits = 0, commitFails = 0;
+};
+static CfgStoreStat gCfgStore;
+
+// 累計寫入量（跟著設定記錄一起保存，重開機不歸零）
+struct CfgWear { uint32_t commits = 0, pages = 0; };
+static CfgWear gCfgWear;
+static inline uint32_t cfgEstErases(){ return gCfgWear.pages / (CFG_FLASH_BLOCK / CFG_FLASH_PAGE); }
+
+class CfgWriter {
+public:
+  std::vector<uint8_t> buf;
+  void u8 (uint8_t v) { buf.push_back(v); }
+  void u16(uint16_t v){ u8((uint8_t)v); u8((uint8_t)(v >> 8)); }
+  void u32(uint32_t v){ u16((uint16_t)v); u16((uint16_t)(v >> 16)); }
+  void u32At(size_t off, uint32_t v){ for (int i = 0; i < 4; ++i) buf[off + i] = (uint8_t)(v >> (8 * i)); }
+  void str(const String& s){
+    size_t n = s.length() > 0xFFFF ? 0xFFFF : s.length();
+    u16((uint16_t)n);
+    buf.insert(buf.end(), (const uint8_t*)s.c_str(), (const uint8_t*)s.c_str() + n);
+  }
+};
+
+class CfgReader {
+public:
+  CfgReader(const uint8_t* p, size_t n) : _p(p), _e(p + n) {}
+  bool ok  = true;
+  bool end() const { return _p == _e; }
+  uint8_t  u8 (){ if (_p >= _e) { ok = false; return 0; } return *_p++; }
+  uint16_t u16(){ uint16_t v = u8(); return v | ((uint16_t)u8() << 8); }
+  uint32_t u32(){ uint32_t v = u16(); return v | ((uint32_t)u16() << 16); }
+  void str(String& out){
+    uint16_t n = u16();
+    if (!ok || (size_t)(_e - _p) < n) { ok = false; return; }
+    out = "";
+    out.reserve(n);
+    for (uint16_t i = 0; i < n; ++i) out += (char)_p[i];
+    _p += n;
+  }
+private:
+  const uint8_t* _p;
+  const uint8_t* _e;
+};
+
+// 依 schema 順序編碼整份 payload（與 cfgDecode() 一一對應）；回傳 wear.pages 欄位的位置，
+// 讓 cfgCommit() 知道總長度後補上本次寫入的頁數（欄位固定寬度，補值不改變長度）
+static size_t cfgEncode(CfgWriter& w, const CfgWear& wear){
+  w.str(cfg.ssid); w.str(cfg.pass); w.str(cfg.token); w.str(cfg.chat);
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    w.u8(cfg.sch[i].hh); w.u8(cfg.sch[i].mm); w.u32(cfg.sch[i].hold); w.str(cfg.sch[i].msg);
+  }
+  for (int i = 0; i < ALARM_COUNT; ++i) w.str(cfg.aMsg[i].length() ? cfg.aMsg[i] : gAlarmMsg[i]);
+  w.u8(cfg.wdMask);
+  for (int i = 0; i < 2; ++i) {
+    w.u8(cfg.cnt[i].hh); w.u8(cfg.cnt[i].mm); w.u32(cfg.cnt[i].target); w.str(cfg.cnt[i].msg);
+  }
+  w.u16((uint16_t)(gOledSleepMs / 1000UL));
+  // schema 2
+  w.u32(wear.commits);
+  size_t pagesAt = w.buf.size();
+  w.u32(wear.pages);
+  // schema 3
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    uint8_t nx = 0;
+    for (int k = 0; k < SCH_TIMES - 1; ++k) if (cfg.sch[i].xt[k] != SCH_T_NONE) nx++;
+    w.u8(nx);
+    for (int k = 0; k < SCH_TIMES - 1; ++k) if (cfg.sch[i].xt[k] != SCH_T_NONE) w.u16(cfg.sch[i].xt[k]);
+    w.u8(cfg.sch[i].wd);
+  }
+  return pagesAt;
+}
+
+// 解到暫存，全部成功才覆蓋 cfg
+static bool cfgDecode(const uint8_t* p, size_t n, uint16_t schema, uint32_t seq){
+  CfgReader r(p, n);
+  AppConfig c;
+  r.str(c.ssid); r.str(c.pass); r.str(c.token); r.str(c.chat);
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    c.sch[i].hh = r.u8(); c.sch[i].mm = r.u8(); c.sch[i].hold = r.u32(); r.str(c.sch[i].msg);
+  }
+  for (int i = 0; i < ALARM_COUNT; ++i) r.str(c.aMsg[i]);
+  c.wdMask = r.u8() & 0x7F;
+  for (int i = 0; i < 2; ++i) {
+    c.cnt[i].hh = r.u8(); c.cnt[i].mm = r.u8(); c.cnt[i].target = r.u32(); r.str(c.cnt[i].msg);
+  }
+  uint32_t oled = r.u16();
+  CfgWear wear;
+  if (schema >= 2) { wear.commits = r.u32(); wear.pages = r.u32(); }
+  if (schema >= 3) {
+    for (int i = 0; i < RELAY_COUNT; ++i) {
+      uint8_t nx = r.u8();
+      for (int k = 0; k < nx; ++k) {
+        uint16_t t = r.u16();
+        if (k < SCH_TIMES - 1 && t < 24 * 60) c.sch[i].xt[k] = t;
+      }
+      c.sch[i].wd = r.u8() & 0x7F;
+    }
+  }
+  if (!r.ok) return false;
+  c.ver = seq;
+  cfg = c;
+  gCfgWear = wear;
+  gOledSleepMs = constrain(oled, 5UL, 3600UL) * 1000UL;
+  return true;
+}
+
+static uint32_t cfgCrc(const CfgHdr& h, const uint8_t* p, size_t n){
+  CfgHdr z = h;
+  z.crc = 0;
+  uint32_t crc = crc32Update(0, (const uint8_t*)&z, sizeof(z));
+  return crc32Update(crc, p, n);
+}
+
+// 讀槽：標頭 + payload 通過檢查才回 true（payload 放在 out）
+static bool cfgReadSlot(int slot, CfgHdr& h, std::vector<uint8_t>& out){
+  File f = SPIFFS.open(CFG_SLOT[slot], "r");
+  if (!f) return false;
+  bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h)
+         && h.magic == CFG_MAGIC && h.schema >= 1 && h.schema <= CFG_SCHEMA
+         && h.len <= CFG_MAX && f.size() == sizeof(h) + h.len;
+  if (ok) {
+    out.resize(h.len);
+    ok = f.read(out.data(), h.len) == h.len && cfgCrc(h, out.data(), h.len) == h.crc;
+  }
+  f.close();
+  return ok;
+}
+
+// 開機載入：兩槽取 seq 較新且可解碼者；回傳是否成功
+static bool cfgLoadBinary(){
+  CfgHdr h[2];
+  std::vector<uint8_t> p[2];
+  bool v[2] = { cfgReadSlot(0, h[0], p[0]), cfgReadSlot(1, h[1], p[1]) };
+  int first = (v[0] && v[1]) ? (h[1].seq > h[0].seq ? 1 : 0) : (v[1] ? 1 : 0);
+  for (int k = 0; k < 2; ++k) {
+    int s = k ? 1 - first : first;
+    if (!v[s] || !cfgDecode(p[s].data(), p[s].size(), h[s].schema, h[s].seq)) continue;
+    gCfgStore.active = s;
+    gCfgStore.seq    = h[s].seq;
+    gCfgStore.bytes  = sizeof(CfgHdr) + h[s].len;
+    if (k) Serial.printf("[CFG] slot %c invalid, using %c\n", 'A' + first, 'A' + s);
+    return true;
+  }
+  return false;
+}
+
+// 寫入另一槽並讀回驗證；成功才切換 active
+static bool cfgCommit(){
+  CfgWriter w;
+  w.buf.reserve(512);
+  // schema 2 的 wear 把本次寫入也算進去（標頭 + payload，以頁為單位）；寫入成功才計入 gCfgWear
+  CfgWear wear = gCfgWear;
+  wear.commits++;
+  size_t pagesAt = cfgEncode(w, wear);
+  wear.pages += (sizeof(CfgHdr) + w.buf.size() + CFG_FLASH_PAGE - 1) / CFG_FLASH_PAGE;
+  w.u32At(pagesAt, wear.pages);
+  if (w.buf.size() > CFG_MAX) { gCfgStore.commitFails++; return false; }
+
+  CfgHdr h = { CFG_MAGIC, CFG_SCHEMA, (uint16_t)w.buf.size(), cfg.ver, 0 };
+  h.crc = cfgCrc(h, w.buf.data(), w.buf.size());
+
+  int slot = gCfgStore.active < 0 ? 0 : 1 - gCfgStore.active;
+  File f = SPIFFS.open(CFG_SLOT[slot], "w");
+  bool ok = f && f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h)
+              && f.write(w.buf.data(), w.buf.size()) == w.buf.size();
+  if (f) f.close();
+
+  CfgHdr chk;
+  std::vector<uint8_t> back;
+  ok = ok && cfgReadSlot(slot, chk, back) && chk.seq == h.seq;
+  if (!ok) {
+    gCfgStore.commitFails++;
+    Serial.printf("[CFG] commit to slot %c failed\n", 'A' + slot);
+    return false;
+  }
+  gCfgStore.active = slot;
+  gCfgStore.seq    = h.seq;
+  gCfgStore.bytes  = sizeof(h) + h.len;
+  gCfgStore.commits++;
+  gCfgWear = wear;
+  return true;
+}
+
+
+// =========================【設定檔：舊版文字格式 loadConfigText】=========================
+// 只用於遷移：讀 /config.txt（key=value）到 cfg；成功後由 loadConfig() 轉存二進位並改名為 /config.bak
+static bool loadConfigText(){
   File f = SPIFFS.open("/config.txt", "r");
-  if (!f) return;
+  if (!f) return false;
   while (f.available()){
     String line = f.readStringUntil('\n');
     line.trim();
@@ -646,6 +2646,7 @@ void loadConfig(){
     else if (k == "pass") cfg.pass = v;
     else if (k == "token") cfg.token = v;
     else if (k == "chat") cfg.chat = v;
+    else if (k == "ver") cfg.ver = (uint32_t)v.toInt();
     // OLED 休眠秒數（5~3600）
     else if (k == "oled") {
       long sec = v.toInt();
@@ -700,364 +2701,298 @@ void loadConfig(){
     }
   }
   f.close();
+  return true;
+}
+
+
+// =========================【設定檔：載入 loadConfig】=========================
+// 用法：開機時呼叫一次（SPIFFS.begin 之後）
+// 順序：二進位 A/B 槽 → 舊版 /config.txt（遷移後轉存二進位）→ 預設值
+// 載入後 cfg.ver 再加 CFG_VER_GAP：上次開機遞增後還沒落地就斷電的版本號不會被重用
+// （否則新內容會拿到舊 ETag，/webapp-export 回 304、WebApp 沿用快取的舊設定）；
+// CfgPersist::touch 保證未落地的版本不會追到這個起點。
+void loadConfig(){
+  uint32_t t0 = micros();
+  if (cfgLoadBinary()) {
+    gCfgStore.source = "bin";
+  } else if (loadConfigText()) {
+    gCfgStore.source = "text";
+    ++cfg.ver;
+    if (cfgCommit()) {
+      SPIFFS.rename("/config.txt", "/config.bak");   // 保留一份舊檔供回溯
+      Serial.println("[CFG] migrated /config.txt -> binary slots");
+    }
+  }
+  cfg.ver += CFG_VER_GAP;
+  gCfgStore.loadUs = micros() - t0;
+  Serial.printf("[CFG] source=%s slot=%d seq=%lu ver=%lu %lu us\n", gCfgStore.source, gCfgStore.active,
+                (unsigned long)gCfgStore.seq, (unsigned long)cfg.ver, (unsigned long)gCfgStore.loadUs);
 }
 
 
+// =========================【設定檔：延遲合併寫入 CfgPersist】=========================
+// saveConfig() 不直接寫 flash：先和「上次版本化的快照」比對出變動的欄位群組（dirty），
+// 沒有實際變動就不寫也不遞增版本；有變動則 cfg.ver +1（記錄的 seq 在落地時才跟上），
+// 並在 CFG_SETTLE_MS 內的後續變更一併合併，到期由 loop() 一次寫入（連續變更最多延到首次變更後 CFG_MAX_DEFER_MS）。
+// Wi-Fi / Telegram 憑證變更立即寫入；esp_restart() 前由 shutdown handler 補寫未落地的變更。
+enum : uint16_t {
+  CFG_F_WIFI = 0x01, CFG_F_TG  = 0x02, CFG_F_SCHED = 0x04, CFG_F_ALARM = 0x08,
+  CFG_F_WD   = 0x10, CFG_F_CNT = 0x20, CFG_F_OLED  = 0x40,
+};
+static const uint16_t CFG_F_URGENT     = CFG_F_WIFI | CFG_F_TG;
+static const uint32_t CFG_SETTLE_MS    = 2000;    // 合併視窗
+static const uint32_t CFG_MAX_DEFER_MS = 30000;   // 最長延後
+static const uint32_t CFG_RETRY_MS     = 10000;   // 寫入失敗重試間隔
+
+class CfgPersist {
+public:
+  void begin(){
+    _shadow = cfg;
+    _shadowOled = gOledSleepMs;
+    esp_register_shutdown_handler(shutdownFlush);
+  }
+
+  // saveConfig() 的本體
+  void touch(){
+    _requests++;
+    uint16_t d = diff(_shadow, cfg) | (gOledSleepMs != _shadowOled ? CFG_F_OLED : 0);
+    if (!d) { _skipped++; return; }
+    ++cfg.ver;                                 // 版本立即遞增（ETag 不必等寫入）
+    _shadow = cfg;
+    _shadowOled = gOledSleepMs;
+
+    uint32_t now = millis();
+    if (_dirty) _coalesced++; else _firstAt = now;
+    _dirty |= d;
+    _dueAt = now + CFG_SETTLE_MS;
+    if ((int32_t)(_dueAt - (_firstAt + CFG_MAX_DEFER_MS)) > 0) _dueAt = _firstAt + CFG_MAX_DEFER_MS;
+    // 未落地的版本要小於「已存 seq + CFG_VER_GAP」（下次開機的起點）：到頂就立即寫入。
+    // 開機後第一次變更必定到頂，之後每 CFG_VER_GAP 個版本才強制寫一次。
+    if ((d & CFG_F_URGENT) || cfg.ver - gCfgStore.seq >= CFG_VER_GAP) flush();
+  }
+
+  void loop(){
+    if (_dirty && (int32_t)(millis() - _dueAt) >= 0) flush();
+    if (_dirty) pwrWithin(pendingMs());
+  }
+
+  bool flush(){
+    if (!_dirty) return true;
+    if (!cfgCommit()) { _dueAt = millis() + CFG_RETRY_MS; return false; }
+    _dirty = 0;
+    return true;
+  }
+
+  uint16_t dirty()     const { return _dirty; }
+  uint32_t pendingMs() const {
+    long left = (long)(_dueAt - millis());
+    return (_dirty && left > 0) ? (uint32_t)left : 0;
+  }
+  uint32_t requests()  const { return _requests; }
+  uint32_t skipped()   const { return _skipped; }
+  uint32_t coalesced() const { return _coalesced; }
+
+private:
+  AppConfig _shadow;
+  uint32_t  _shadowOled = 0;
+  uint16_t  _dirty = 0;
+  uint32_t  _firstAt = 0, _dueAt = 0;
+  uint32_t  _requests = 0, _skipped = 0, _coalesced = 0;
+
+  static void shutdownFlush();
+
+  static uint16_t diff(const AppConfig& a, const AppConfig& b){
+    uint16_t d = 0;
+    if (a.ssid != b.ssid || a.pass != b.pass)   d |= CFG_F_WIFI;
+    if (a.token != b.token || a.chat != b.chat) d |= CFG_F_TG;
+    if (a.wdMask != b.wdMask)                   d |= CFG_F_WD;
+    for (int i = 0; i < RELAY_COUNT; ++i)
+      if (a.sch[i].hh != b.sch[i].hh || a.sch[i].mm != b.sch[i].mm ||
+          a.sch[i].hold != b.sch[i].hold || a.sch[i].msg != b.sch[i].msg ||
+          a.sch[i].wd != b.sch[i].wd || memcmp(a.sch[i].xt, b.sch[i].xt, sizeof(a.sch[i].xt)) != 0) d |= CFG_F_SCHED;
+    for (int i = 0; i < ALARM_COUNT; ++i)
+      if (a.aMsg[i] != b.aMsg[i]) d |= CFG_F_ALARM;
+    for (int i = 0; i < 2; ++i)
+      if (a.cnt[i].hh != b.cnt[i].hh || a.cnt[i].mm != b.cnt[i].mm ||
+          a.cnt[i].target != b.cnt[i].target || a.cnt[i].msg != b.cnt[i].msg) d |= CFG_F_CNT;
+    return d;
+  }
+};
+static CfgPersist cfgPersist;
+void CfgPersist::shutdownFlush(){ cfgPersist.flush(); }
+
+
 // =========================【設定檔：儲存 saveConfig】=========================
-// 用法：設定頁送出或程式內修改後呼叫；會覆寫 /config.txt
-// 作用/功能：把 cfg 目前內容序列化為 key=value 文字檔
+// 用法：設定頁送出或程式內修改後呼叫（可頻繁呼叫）
+// 作用/功能：標記變動，由 CfgPersist 合併後寫入二進位槽（見【設定檔：二進位 A/B 槽】）
 void saveConfig(){
+  cfgPersist.touch();
+}
+
+
+// =========================【WebApp 設定解碼：套用】=========================
+// 解析本身在 wa_decoder.h（單趟 + 欄位表）；這裡在語法正確後才做跨欄位組合（hm/hs → hold）並一次寫入 cfg。
+static_assert(WA_RELAY_N == RELAY_COUNT, "wa_decoder.h 的 WA_RELAY_N 要等於 RELAY_COUNT");
+static_assert(WA_ALARM_N == ALARM_COUNT, "wa_decoder.h 的 WA_ALARM_N 要等於 ALARM_COUNT");
+static_assert(WA_HOLD_MAX == MAX_HOLD_SEC, "wa_decoder.h 的 WA_HOLD_MAX 要等於 MAX_HOLD_SEC");
+
+// 錯誤摘要：「hm[2]:range, ct1:format」
+static String waErrText(const WaResult& r){
   String s;
-  s += "ssid="+cfg.ssid+"\n";
-  s += "pass="+cfg.pass+"\n";
-  s += "token="+cfg.token+"\n";
-  s += "chat="+cfg.chat+"\n";
+  for (int i = 0; i < r.nErr && i < WA_ERR_MAX; ++i) {
+    if (i) s += ", ";
+    s += kWaFields[r.err[i].field].key;
+    if (r.err[i].idx >= 0) { s += '['; s += r.err[i].idx; s += ']'; }
+    s += ':'; s += r.err[i].why;
+  }
+  if (r.nErr > WA_ERR_MAX) { s += " …+"; s += (r.nErr - WA_ERR_MAX); }
+  return s;
+}
+
+// 解碼 + 套用到 cfg（呼叫端需持有 app lock：loop() 或 HTTP handler）
+static WaResult waDecodeApply(const char* p, size_t n){
+  static WaStage st;                 // 約 1 KB，不放堆疊
+  uint16_t got[WS_COUNT] = {0};
+  WaResult r;
+  memset(&st, 0, sizeof(st));
+  WaDecoder dec(p, n, st, got, r);
+  if (!dec.run()) return r;
+
+  auto has = [&](WaSlot s, int i)->bool { return got[s] & (1u << i); };
+  for (int i = 0; i < 7; ++i) if (has(WS_WD, i)) {
+    cfg.wdMask = (cfg.wdMask & ~(1u << i)) | (st.wd & (1u << i));
+    r.applied++;
+  }
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    if (has(WS_T, i)) { cfg.sch[i].hh = st.t[i][0]; cfg.sch[i].mm = st.t[i][1]; r.applied++; }
+    if (has(WS_HM, i) || has(WS_HS, i)) {           // 分、秒任一有給：未給的部分視為 0
+      long hold = (has(WS_HM, i) ? st.hm[i] * 60L : 0) + (has(WS_HS, i) ? st.hs[i] : 0);
+      cfg.sch[i].hold = (uint32_t)(hold > (long)MAX_HOLD_SEC ? MAX_HOLD_SEC : hold);
+      r.applied++;
+    }
+  }
+  for (int c = 0; c < 2; ++c) {
+    if (has((WaSlot)(WS_CT0 + c), 0)) { cfg.cnt[c].hh = st.ct[c][0]; cfg.cnt[c].mm = st.ct[c][1]; r.applied++; }
+    if (has((WaSlot)(WS_CN0 + c), 0)) { cfg.cnt[c].target = (uint32_t)st.cn[c]; r.applied++; }
+    if (has((WaSlot)(WS_CM0 + c), 0)) { cfg.cnt[c].msg = st.cm[c]; r.applied++; }
+  }
+  for (int i = 0; i < ALARM_COUNT; ++i) if (has(WS_AM, i)) {
+    cfg.aMsg[i] = st.am[i];
+    gAlarmMsg[i] = cfg.aMsg[i];
+    r.applied++;
+  }
+  return r;
+}
+
+// 將 WebApp 的 data(JSON) 套用到 cfg 後 save；回傳套用結果（/webapp-save 會回報錯誤）
+static WaResult applyWebAppConfig(const String& raw) {
+  Serial.printf("[CFG] applyWebAppConfig: %d bytes\n", raw.length());
+  WaResult r = waDecodeApply(raw.c_str(), raw.length());
+  if (!r.syntaxOk) {
+    Serial.printf("[CFG] webapp JSON syntax error at %u\n", (unsigned)r.errPos);
+    tgEnqueue("⚠️ WebApp 設定格式錯誤（位置 " + String(r.errPos) + "），未套用");
+    return r;
+  }
+  String errs = waErrText(r);
+  if (r.nErr) Serial.printf("[CFG] webapp skipped: %s\n", errs.c_str());
+  if (r.applied) saveConfig();
+  if (!r.nErr) tgEnqueue("⚙️ WebApp 已更新：定時與保持時間已套用");
+  else         tgEnqueue("⚙️ WebApp 已更新：套用 " + String(r.applied) + " 項，略過 " + String(r.nErr) + " 項（" + errs + "）");
+  return r;
+}
 
-  for (int i=0;i<RELAY_COUNT;i++){
-    s += "t"+String(i)+"="+fmt2(cfg.sch[i].hh)+":"+fmt2(cfg.sch[i].mm)+"\n";
-    s += "h"+String(i)+"="+String(cfg.sch[i].hold)+"\n";
-    s += "m"+String(i)+"="+cfg.sch[i].msg+"\n";
-  }
+// =========================【Telegram 收件：長輪詢任務】=========================
+// tgPollTask 在獨立連線上以 getUpdates 長輪詢（timeout=25）等待更新，
+// 解析出的指令 / web_app_data 經 tgInQ 交給 loop()（cfg 只在主迴圈修改）
+static const int TG_LONGPOLL_SEC = 25;
 
-  for (int i=0;i<ALARM_COUNT;i++){
-    s += "am"+String(i)+"="+ (cfg.aMsg[i].length()? cfg.aMsg[i] : gAlarmMsg[i]) +"\n";
-  }
+enum TgInKind : uint8_t { TG_IN_PANEL = 1, TG_IN_WEBAPP = 2 };
+struct TgInbound { uint8_t kind; String* data; };   // data 由 loop() 負責 delete
+static QueueHandle_t tgInQ = nullptr;
+static TgLink tgPollLink;   // 長輪詢專用：一次佔用 25 秒，不與推播共用
 
-  s += "wd="+String(cfg.wdMask)+"\n";
+static void tgPushInbound(uint8_t kind, String* data){
+  TgInbound in{ kind, data };
+  if (!tgInQ || xQueueSend(tgInQ, &in, pdMS_TO_TICKS(100)) != pdTRUE) delete data;
+  else pwrWake();                       // loop() 的 tgInboxLoop() 消化
+}
 
-  for (int i=0;i<2;i++){
-    s += "ct"+String(i)+"="+fmt2(cfg.cnt[i].hh)+":"+fmt2(cfg.cnt[i].mm)+"\n";
-    s += "cm"+String(i)+"="+cfg.cnt[i].msg+"\n";
-    s += "cn"+String(i)+"="+String(cfg.cnt[i].target)+"\n";
-  }
-  s += "oled=" + String(gOledSleepMs / 1000UL) + "\n";
-
-  // ★ 真正寫檔
-  writeTextFile("/config.txt", s);
-}
-
-  // 粗略擷取工具（不使用 ArduinoJson）
-  static String jsonGet(const String& s, const char* key){
-    // 尋找 "key":
-    String k = String("\"") + key + "\":";
-    int p = s.indexOf(k);
-    if (p < 0) return "";
-    p += k.length();
-    // 跳過空白與引號
-    while (p < (int)s.length() && (s[p]==' '||s[p]=='\"')) { if (s[p]=='\"') { // 如果是字串，取到下一個引號
-        int q = s.indexOf('\"', p+1);
-        if (q>p) return s.substring(p+1, q);
-      } p++;
-    }
-    // 數字/布林/物件字串粗略擷取（直到逗號或右大括號）
-    int q = p;
-    while (q < (int)s.length() && s[q]!=',' && s[q]!='}' && s[q]!=']' && s[q]!='\n') q++;
-    String v = s.substring(p, q); v.trim();
-    // 去除包住的引號
-    if (v.length()>=2 && v[0]=='\"' && v[v.length()-1]=='\"') v = v.substring(1, v.length()-1);
-    return v;
-  }
-  // 在 applyWebAppConfig(const String& data) 一進來就加上這段「解包 payload」的小段
-String unwrapPayloadIfAny(const String& s){
-  // 找 "payload":{ ... } 的大括號範圍，回傳純 payload 內容；找不到就回原字串
-  int p = s.indexOf("\"payload\"");
-  if (p < 0) return s;
-  // 找到冒號
-  p = s.indexOf(':', p);
-  if (p < 0) return s;
-  // 找到第一個 '{'
-  while (p < (int)s.length() && s[p] != '{') p++;
-  if (p >= (int)s.length()) return s;
-  int depth = 0, i = p;
-  for (; i < (int)s.length(); ++i){
-    char c = s[i];
-    if (c == '{') depth++;
-    else if (c == '}'){
-      depth--;
-      if (depth == 0){ // [p..i] 是 payload 物件
-        return s.substring(p, i+1);
+// =========================【getUpdates 串流解析器】=========================
+// 狀態機本體在 include/tg_update_parser.h（主機測試共用）；這裡接上 TgLink 與收件匣
+class TgUpdateParser : public TgBodySink, public TgUpdateScanner {
+public:
+  void begin(long) override { reset(); }
+  void onBody(const uint8_t* p, size_t n) override { feed(p, n); }
+
+protected:
+  // 一筆 update 結束：把指令 / web_app_data 丟進 tgInQ
+  void onUpdate() override {
+    if (textLen()) {
+      String txt(text());
+      String up = txt; up.toUpperCase();
+      if (up == "/PANEL" || txt == "⚙️ 開啟設定" || up == "PANEL") {
+        tgPushInbound(TG_IN_PANEL, nullptr);
       }
     }
-  }
-  return s;
-}
 
-// 將 WebApp 的 data(JSON) 套用到 cfg 後 save
-static void applyWebAppConfig(const String& raw) {
-  Serial.printf("[CFG] applyWebAppConfig: %d bytes\n", raw.length());
-  String data = unwrapPayloadIfAny(raw);   // ★ 修正：參數名改 raw，這裡才建立 data 變數
-
-  // （可選）驗證 ct1（HH:MM 或空白）
-  auto validHHMM = [](const String& v)->bool{
-    if (!v.length()) return true; // 空白=停用
-    if (v.length() < 4) return false;
-    int hh = v.substring(0,2).toInt();
-    int mm = v.substring(3,5).toInt();
-    return hh>=0 && hh<=23 && mm>=0 && mm<=59;
-  };
-
-  uint8_t mask = 0;
-  int pos = data.indexOf("\"wd\":[");
-  if (pos >= 0) {
-    int end = data.indexOf("]", pos);
-    if (end > pos) {
-      String arr = data.substring(pos+6, end);
-      int bit = 0; int i = 0;
-      while (i < (int)arr.length() && bit < 7) {
-        while (i < (int)arr.length() && (arr[i]==' '||arr[i]==',')) i++;
-        if (i < (int)arr.length() && (arr[i]=='1')) mask |= (1u << bit);
-        while (i < (int)arr.length() && arr[i]!=',') i++;
-        bit++;
+    if (hasData()) {
+      if (dataTruncated()) {
+        Serial.println("[TG] web_app_data too long, dropped");
+      } else {
+        Serial.printf("[TG] got web_app_data, %u bytes\n", (unsigned)dataLen());
+        tgPushInbound(TG_IN_WEBAPP, new String(data()));
       }
-      cfg.wdMask = mask;
     }
   }
-  // ——— 定時排程：ts(時間字串), hm(保持分), hs(保持秒) ———
-  auto parseArray = [&](const String& key)->String {
-    int p = data.indexOf(String("\"") + key + "\":[");
-    if (p < 0) return "";
-    int end = data.indexOf("]", p);
-    if (end < 0) return "";
-    return data.substring(p + key.length() + 4, end); // 內容不含 [ ]
-  };
-
-  String tsArr = parseArray("ts");
-  String hmArr = parseArray("hm");
-  String hsArr = parseArray("hs");
-
-  if (tsArr.length() || hmArr.length() || hsArr.length()) {
-    // 先拆出 6 筆
-    auto splitCSV = [&](const String& s, bool isString)->std::vector<String>{
-      std::vector<String> out;
-      int i=0, n=s.length();
-      while (i<n && (int)out.size()<6) {
-        // 跳逗點與空白
-        while (i<n && (s[i]==','||s[i]==' ')) i++;
-        if (i>=n) break;
-        if (isString && s[i]=='\"') {
-          int q = s.indexOf('\"', i+1);
-          if (q<0) break;
-          out.push_back(s.substring(i+1, q));
-          i = q+1;
-        } else {
-          int q=i;
-          while (q<n && s[q]!=',') q++;
-          String v = s.substring(i, q); v.trim();
-          out.push_back(v);
-          i = q+1;
-        }
-      }
-      return out;
-    };
-
-    auto ts = splitCSV(tsArr, true);
-    auto hm = splitCSV(hmArr, false);
-    auto hs = splitCSV(hsArr, false);
-
-    for (int i=0;i<6;i++){
-      // 時間
-      if (i < (int)ts.size() && ts[i].length() >= 4) {
-        int hh = ts[i].substring(0,2).toInt();
-        int mm = ts[i].substring(3,5).toInt();
-        if (hh>=0 && hh<=23) cfg.sch[i].hh = hh;
-        if (mm>=0 && mm<=59) cfg.sch[i].mm = mm;
-      }
-      // 保持
-      long m = (i < (int)hm.size()) ? hm[i].toInt() : 0;
-      long s = (i < (int)hs.size()) ? hs[i].toInt() : 0;
-      long hold = m*60 + s;
-      if (hold < 0) hold = 0;
-      if (hold > 3600) hold = 3600;
-      cfg.sch[i].hold = (uint32_t)hold;
-    }
-  }
-
-    // ——— 計數器 #1 ———
-    String cm0 = jsonGet(data, "cm0");
-    if (cm0.length()) cfg.cnt[0].msg = cm0;
-    String cn0 = jsonGet(data, "cn0");
-    if (cn0.length()) {
-      long v = cn0.toInt();
-      if (v < 0) v = 0;
-      cfg.cnt[0].target = (uint32_t)v;
-    }
-    // ——— 計數器 #2 ———
-    String ct1 = jsonGet(data, "ct1"); // 例如 "17:30"
-    if (ct1.length() >= 4) { cfg.cnt[1].hh = ct1.substring(0,2).toInt(); cfg.cnt[1].mm = ct1.substring(3,5).toInt(); }
-    String cm1 = jsonGet(data, "cm1");
-    if (cm1.length()) cfg.cnt[1].msg = cm1;
-    // ===== 解析 t[] / hm[] / hs[] → cfg.sch[i].hh/mm/hold =====
-auto parseStrArray = [&](const String& key, String out[], int n){
-  int pos = data.indexOf(String("\"")+key+"\":[");
-  if (pos < 0) return false;
-  int end = data.indexOf("]", pos);
-  if (end < 0) return false;
-  String arr = data.substring(pos + key.length() + 4, end);
-  int i=0, p=0;
-  while (i<n && p < (int)arr.length()){
-    int s = arr.indexOf('\"', p); if (s<0) break;
-    int e = arr.indexOf('\"', s+1); if (e<0) break;
-    out[i++] = arr.substring(s+1, e);
-    p = e+1;
-  }
-  return (i>0);
-};
-auto parseIntArray = [&](const String& key, int out[], int n){
-  int pos = data.indexOf(String("\"")+key+"\":[");
-  if (pos < 0) return false;
-  int end = data.indexOf("]", pos);
-  if (end < 0) return false;
-  String arr = data.substring(pos + key.length() + 4, end);
-  int i=0, p=0;
-  while (i<n && p < (int)arr.length()){
-    // 取出下一個數字（逗號分隔）
-    int q = arr.indexOf(',', p); if (q<0) q = arr.length();
-    String token = arr.substring(p, q); token.trim();
-    out[i++] = token.toInt();
-    p = q + 1;
-  }
-  return (i>0);
 };
 
-String t[RELAY_COUNT];
-int    hm[RELAY_COUNT] = {0};
-int    hs[RELAY_COUNT] = {0};
-
-bool hasT  = parseStrArray("t",  t,  RELAY_COUNT);
-bool hasHM = parseIntArray("hm", hm, RELAY_COUNT);
-bool hasHS = parseIntArray("hs", hs, RELAY_COUNT);
-
-if (hasT || hasHM || hasHS){
-  for (int i=0;i<RELAY_COUNT;i++){
-    // 時間 "HH:MM"
-    if (hasT && t[i].length()>=4){
-      int colon = t[i].indexOf(':');
-      if (colon>0){
-        int hh = t[i].substring(0, colon).toInt();
-        int mm = t[i].substring(colon+1).toInt();
-        if (hh<0) hh=0; if (hh>23) hh=23;
-        if (mm<0) mm=0; if (mm>59) mm=59;
-        cfg.sch[i].hh = hh;
-        cfg.sch[i].mm = mm;
-      }
-    }
-    // 保持時間：分/秒 → hold（秒）
-    if (hasHM || hasHS){
-      long hold = (long)cfg.sch[i].hold;  // 先用原值
-      if (hasHM) hold = (long)hm[i] * 60L + (hasHS ? hs[i] : 0);
-      else if (hasHS) hold = (long)hs[i];
-      if (hold < 0) hold = 0;
-      if (hold > 3600) hold = 3600;
-      cfg.sch[i].hold = (uint16_t)hold;
+static TgUpdateParser tgUpdParser;   // 固定緩衝約 4.2KB；只給 tgPollTask 使用
+
+// 任務：長輪詢 getUpdates；失敗時指數退避（1s → 30s）
+static void tgPollTask(void*){
+  uint32_t backoffMs = 1000;
+  String   token;
+  for(;;){
+    tgCreds(&token, nullptr);
+    if (!WiFi.isConnected() || !token.length()) {
+      tgPollLink.close();
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
     }
-  }
-}
 
-    saveConfig();
-    tgEnqueue("⚙️ WebApp 已更新：定時與保持時間已套用");
-  }
-  
-  // 輪詢 getUpdates，抓取 web_app_data.data
-  static void tgUpdatePollLoop(){
-    static unsigned long last = 0;
-    if (millis() - last < 1500) return;  // 1.5s 節流
-    last = millis();
-  
-    if (!WiFi.isConnected() || !cfg.token.length()) return;
-  
-    WiFiClientSecure cli; cli.setInsecure();
-    if (!cli.connect("api.telegram.org", 443)) return;
-  
-    String url = "/bot" + cfg.token + "/getUpdates?timeout=0&limit=5";
+    String url = "/bot" + token + "/getUpdates?timeout=" + String(TG_LONGPOLL_SEC) + "&limit=5";
     if (tgUpdateOffset) url += "&offset=" + String(tgUpdateOffset);
-  
-    String req = "GET " + url + " HTTP/1.1\r\nHost: api.telegram.org\r\nConnection: close\r\n\r\n";
-    cli.print(req);
-  
-    unsigned long t0 = millis();
-    while (!cli.available() && millis()-t0 < 5000) delay(10);
-    if (!cli.available()) { cli.stop(); return; }
-  
-    // 跳 header
-    while (cli.connected()){
-      String h = cli.readStringUntil('\n');
-      if (h == "\r" || h.length()==0) break;
+
+    tgUpdParser.reset();
+    int code = tgPollLink.request("GET", url, nullptr, String(), &tgUpdParser,
+                                  (TG_LONGPOLL_SEC + 10) * 1000UL);
+    // 已完整解析的 update 一律前進 offset（即使連線中途斷掉，避免重複處理）
+    if (tgUpdParser.updates()) tgUpdateOffset = tgUpdParser.lastUpdateId() + 1;
+    if (code != 200) {
+      Serial.printf("[TG] getUpdates fail (%d), retry in %lums\n", code, (unsigned long)backoffMs);
+      vTaskDelay(pdMS_TO_TICKS(backoffMs));
+      if (backoffMs < 30000) backoffMs *= 2;
+      continue;
     }
-  
-    String body;
-    while (cli.available()) body += (char)cli.read();
-    cli.stop();
-  
-    // 逐條擷取 result 陣列裡的物件；只找 web_app_data
-    int pos = 0;
-    while (true){
-      int upd = body.indexOf("\"update_id\":", pos);
-      if (upd < 0) break;
-      int colon = body.indexOf(':', upd);
-      int comma = body.indexOf(',', colon+1);
-      long uid = body.substring(colon+1, comma).toInt();
-      tgUpdateOffset = uid + 1; // 下一輪從下一筆
-// ---- 取得本筆 update 的文字內容（如 /panel、/check_token）----
-int nextUpd = body.indexOf("\"update_id\":", comma+1);
-int scopeEnd = (nextUpd > 0) ? nextUpd : body.length();
-int tpos = body.indexOf("\"text\":\"", comma);
-if (tpos > 0 && tpos < scopeEnd) {
-  int q1 = body.indexOf('\"', tpos + 7);
-  int q2 = body.indexOf('\"', q1 + 1);
-  String txt = (q1 > 0 && q2 > q1) ? body.substring(q1+1, q2) : "";
-
-  String up = txt; up.toUpperCase();
-
-  if (up == "/PANEL" || txt == "⚙️ 開啟設定" || up == "PANEL") {
-    if (cfg.chat.length()) {
-      tgHideKeyboard(cfg.chat);       // ★ 收起舊鍵盤
-      tgSendControlKeyboard(cfg.chat); // 可留著（顯示文字鍵盤）
-      tgSendInlineOpen(cfg.chat);      // ★ 關鍵：送 inline WebApp 按鈕（內嵌開啟）
-    }
-  }
-
- // if (up == "/CHECK_TOKEN") {
-    //if (cfg.chat.length()) {
-     // tgHideKeyboard(cfg.chat);
-     // tgEnqueue("✅ 已關閉鍵盤");
-   // }
-  //}
-}
-
-      int wad = body.indexOf("\"web_app_data\"", comma);
-      if (wad > 0){
-        int dataPos = body.indexOf("\"data\":", wad);
-        if (dataPos > 0) {
-          int q1 = body.indexOf('\"', dataPos + 7);
-          if (q1 > 0) {
-            int i = q1 + 1; bool esc=false;
-            while (i < (int)body.length()) { char c=body[i]; if (esc){esc=false;i++;continue;}
-              if (c=='\\'){esc=true;i++;continue;} if (c=='\"') break; i++; }
-            if (i < (int)body.length()) {
-              String raw = body.substring(q1+1, i);
-              String payload; payload.reserve(raw.length());
-              for (int k=0;k<(int)raw.length();k++){ char c=raw[k];
-                if (c=='\\' && k+1<(int)raw.length()){
-                  char n=raw[k+1]; if (n=='\"'){payload+='\"';k++;continue;}
-                  if (n=='\\'){payload+='\\';k++;continue;}
-                  if (n=='n'){payload+='\n';k++;continue;}
-                  if (n=='r'){payload+='\r';k++;continue;}
-                  if (n=='t'){payload+='\t';k++;continue;}
-                } payload+=c;
-              }
-              Serial.printf("[TG] got web_app_data, %d bytes\n", payload.length());
-              tgEnqueue("🛰 收到 WebApp 設定，開始套用…");
-              applyWebAppConfig(payload);
-            }
-          }
-        }
-    
+    backoffMs = 1000;
+  }
+}
 
-      }
-      pos = comma + 1;
+// 主迴圈消化收件匣：只做記憶體內工作，不做任何網路呼叫
+static void tgInboxLoop(){
+  if (!tgInQ) return;
+  TgInbound in;
+  while (xQueueReceive(tgInQ, &in, 0) == pdTRUE){
+    if (in.kind == TG_IN_PANEL) {
+      tgRequestAction(TG_ACT_PANEL);
+    } else if (in.kind == TG_IN_WEBAPP && in.data) {
+      tgEnqueue("🛰 收到 WebApp 設定，開始套用…");
+      applyWebAppConfig(*in.data);
     }
+    delete in.data;
   }
-  
+}
+
 
 // =========================【工具：安全顯示 IP】=========================
 // 用法：顯示於網頁或日誌；AP 則回 10.10.0.1 類，STA 回本機 DHCP IP
@@ -1070,107 +3005,516 @@ String safeIP() {
 
 // =========================【工具：現在時間字串】=========================
 // 用法：網頁模板 {{NOW}} 置換、或日誌顯示使用
-// 優先使用 NTP（getLocalTime），失敗則退回 RTC
+// 讀 timeSvc 快取（NTP / RTC / 快照）；無時間時回 "--"
 String nowString() {
-  struct tm t;
-  if (getLocalTime(&t, 50)) {
-    char buf[20];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &t);
-    return String(buf);
-  }
-  if (gRtcReady) {
-    YqDateTime n = RTC.now();
-    return String(n.year) + "-" + fmt2(n.month) + "-" + fmt2(n.day) + " " +
-           fmt2(n.hour) + ":" + fmt2(n.minute);
-  }
-  return String("--");
-}
-
-
-// =========================【頁面模板渲染：renderIndex】=========================
-// 用法：HTTP GET "/" 時產生 index.html 的最終頁面字串
-// 功能：讀取 /index.html → 依多種 {{KEY}} 變數做替換，包含：
-//   {{IP}} / {{NOW}} / {{RTC_STATUS}} / {{SHOW_SECRETS}} / {{WD0..6}}
-//   計數器：{{CT0/1}} {{CM0/1}} {{CN0/1}}
-//   排程：{{T0..}} {{HM0..}} {{HS0..}} {{M0..}} {{MON0..}} {{MOFF0..}}
-//   異常 DI：{{AM0..5}}
-String renderIndex(){
-  String html = readTextFile("/index.html");
-
-  // (NEW) RTC 狀態顯示：若 RTC 未 ready 視為需校時
-  bool vl = gRtcReady ? RTC.lostPower() : true;
-  html.replace("{{IP}}", safeIP());
-  html.replace("{{NOW}}", nowString());
-  html.replace("{{RTC_STATUS}}", vl ? "\xE2\x9A\xA0\xEF\xB8\x8F RTC 掉電/未校時" : "\xE2\x9C\x85 RTC 正常");
-
-  // ===== 敏感欄位顯示策略 =====
-  // AP / AP+STA：顯示卡片但欄位清空；STA：隱藏卡片
-  wifi_mode_t md = WiFi.getMode();
-  bool isAP = (md == WIFI_AP || md == WIFI_AP_STA);
-  if (isAP) {
-    html.replace("{{SSID}}",  "");
-    html.replace("{{PASS}}",  "");
-    html.replace("{{TOKEN}}", "");
-    html.replace("{{CHAT}}",  "");
-    html.replace("{{SHOW_SECRETS}}", "1");
-  } else {
-    html.replace("{{SSID}}",  "");
-    html.replace("{{PASS}}",  "");
-    html.replace("{{TOKEN}}", "");
-    html.replace("{{CHAT}}",  "");
-    html.replace("{{SHOW_SECRETS}}", "0");
+  char buf[20];
+  timeSvc.format(buf, sizeof(buf), "%Y-%m-%d %H:%M");
+  return String(buf);
+}
+
+
+// =========================【頁面模板：開機預編譯 + 串流渲染】=========================
+// 開機（或 /index.html 大小改變）時掃描一次模板，切成「文字區段（檔案偏移）」與「變數槽」（page_template.h）；
+// 渲染時依序把文字區段從 SPIFFS 分段複製、變數槽直接印出，整頁不需放進 RAM。
+class PageTemplate {
+public:
+  explicit PageTemplate(const char* path) : _path(path) {}
+
+  // 掃描模板；檔案大小沒變就沿用既有結果
+  bool compile(){
+    File f = SPIFFS.open(_path, "r");
+    if (!f) { _parts.clear(); _size = 0; return false; }
+    size_t size = f.size();
+    if (size == _size && !_parts.empty()) { f.close(); return true; }
+
+    _size = size;
+    TplScanner scan(_parts, TplLimits{ CNT_COUNT, ALARM_COUNT, RELAY_COUNT });
+    uint8_t buf[256];
+    int n;
+    while ((n = f.read(buf, sizeof(buf))) > 0) scan.feed(buf, n);
+    _slots = scan.finish();
+    f.close();
+    Serial.printf("[TPL] %s: %u bytes, %u parts, %u slots\n", _path, (unsigned)_size,
+                  (unsigned)_parts.size(), (unsigned)_slots);
+    return true;
   }
 
-  // ===== 星期 checkbox（bit0=Mon … bit6=Sun）=====
-  for (int i = 0; i < 7; ++i) {
-    String key = String("{{WD") + i + "}}";
-    html.replace(key, ((cfg.wdMask >> i) & 0x01) ? "checked" : "");
+  // 依序輸出到 out（通常是串流回應）
+  bool render(Print& out){
+    if (!compile()) return false;
+    File f = SPIFFS.open(_path, "r");
+    if (!f) return false;
+    Ctx ctx;
+    uint8_t buf[TPL_SPAN_MAX];
+    for (const TplPart& p : _parts) {
+      if (p.var == TV_TEXT) {
+        if (!f.seek(p.off)) break;
+        size_t got = f.read(buf, p.len);
+        out.write(buf, got);
+      } else {
+        printVar(out, ctx, p.var, p.idx);
+      }
+    }
+    f.close();
+    return true;
   }
 
-  // ===== 計數器 {{CT/CM/CN}} =====
-  for (int i=0;i<2;i++){
-    html.replace(String("{{CT")+i+"}}", fmt2(cfg.cnt[i].hh)+":"+fmt2(cfg.cnt[i].mm));
-    html.replace(String("{{CM")+i+"}}", cfg.cnt[i].msg);
-    html.replace(String("{{CN")+i+"}}", String(cfg.cnt[i].target));  // ★ 達標門檻
+  size_t parts() const { return _parts.size(); }
+  size_t slots() const { return _slots; }
+
+private:
+  // 每次渲染只算一次的值（RTC 狀態需走 I2C）
+  struct Ctx {
+    bool rtcLost;
+    bool isAP;
+    Ctx(){
+      rtcLost = gRtcReady ? RTC.lostPower() : true;
+      wifi_mode_t md = WiFi.getMode();
+      isAP = (md == WIFI_AP || md == WIFI_AP_STA);
+    }
+  };
+
+  static void printVar(Print& out, const Ctx& ctx, uint8_t var, uint8_t i){
+    switch (var) {
+      case TV_IP:           out.print(safeIP()); break;
+      case TV_NOW:          out.print(nowString()); break;
+      case TV_RTC_STATUS:   out.print(ctx.rtcLost ? "\xE2\x9A\xA0\xEF\xB8\x8F RTC 掉電/未校時" : "\xE2\x9C\x85 RTC 正常"); break;
+      // ===== 敏感欄位顯示策略 =====
+      // AP / AP+STA：顯示卡片但欄位清空；STA：隱藏卡片
+      case TV_SHOW_SECRETS: out.print(ctx.isAP ? "1" : "0"); break;
+      case TV_SSID: case TV_PASS: case TV_TOKEN: case TV_CHAT: break;
+      // ===== 星期 checkbox（bit0=Mon … bit6=Sun）=====
+      case TV_WD:           if ((cfg.wdMask >> i) & 0x01) out.print("checked"); break;
+      // ===== 計數器 =====
+      case TV_CT:           out.print(fmt2(cfg.cnt[i].hh)); out.print(':'); out.print(fmt2(cfg.cnt[i].mm)); break;
+      case TV_CM:           out.print(cfg.cnt[i].msg); break;
+      case TV_CN:           out.print(cfg.cnt[i].target); break;   // ★ 達標門檻
+      // ===== 繼電器排程區塊 =====
+      case TV_T:            out.print(fmt2(cfg.sch[i].hh)); out.print(':'); out.print(fmt2(cfg.sch[i].mm)); break;
+      case TV_TX:           out.print(schExtraText(cfg.sch[i])); break;
+      case TV_SW:           out.print(schWdText(cfg.sch[i].wd)); break;
+      case TV_HM:           out.print(cfg.sch[i].hold / 60); break;   // 保持時間「分/秒」雙欄
+      case TV_HS:           out.print(cfg.sch[i].hold % 60); break;
+      case TV_M:                                                     // 舊版相容 {{M}}
+      case TV_MON:
+      case TV_MOFF: {
+        // 推播訊息（預設 "RELAY{i}"）
+        if (cfg.sch[i].msg.length()) out.print(cfg.sch[i].msg);
+        else { out.print("RELAY"); out.print(i + 1); }
+        if (var == TV_MOFF) out.print("關閉");
+        break;
+      }
+      // ===== 異常 DI 訊息 =====
+      case TV_AM:           out.print(gAlarmMsg[i]); break;
+    }
   }
 
-  // ===== 繼電器排程區塊 =====
-  for (int i = 0; i < RELAY_COUNT; i++){
-    // HH:MM
-    html.replace(String("{{T")+i+"}}", fmt2(cfg.sch[i].hh)+":"+fmt2(cfg.sch[i].mm));
+  const char*          _path;
+  std::vector<TplPart> _parts;
+  size_t               _size = 0, _slots = 0;
+};
+
+static PageTemplate gIndexTpl("/index.html");
+
+
+// =========================【HTTP：分段串流回應】=========================
+// 固定緩衝的 Print：滿了就以 chunked encoding 送出一段，回應大小不影響記憶體用量。
+// 建構時即送出狀態列與標頭（額外標頭請先 srv.sendHeader()），解構時補上結尾 chunk。
+// 用法：HttpChunkWriter out(srv, 200, "text/plain; charset=utf-8"); out += "a="; out += 1;
+// 只能在 HTTP handler（httpWorker）內使用。
+class HttpChunkWriter : public Print {
+public:
+  HttpChunkWriter(HttpJobServer& s, int code, const char* ctype) : _srv(s) {
+    _srv.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    _srv.send(code, ctype, "");
+  }
+  ~HttpChunkWriter(){ end(); }
+
+  // 與 String 相同的累加寫法，方便既有 handler 直接改用
+  template <typename T>
+  HttpChunkWriter& operator+=(const T& v){ print(v); return *this; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  // 送出緩衝時可能交出 app lock（管道滿），而 p 可能指向全域 String（例如 print(cfg.sch[i].msg)）：
+  // 放不進緩衝的剩餘部分先複製一份再送，等待期間不再讀 p
+  size_t write(const uint8_t* p, size_t n) override {
+    if (_ended) return 0;
+    size_t k = sizeof(_buf) - _len;
+    if (k > n) k = n;
+    memcpy(_buf + _len, p, k);
+    _len += k;
+    size_t rest = n - k;
+    if (!rest) {
+      if (_len == sizeof(_buf)) flush();
+      return n;
+    }
+    std::unique_ptr<uint8_t[]> copy(new (std::nothrow) uint8_t[rest]);
+    if (!copy) return k;                         // 記憶體不足：只收下放得進的部分
+    memcpy(copy.get(), p + k, rest);
+    flush();
+    put(copy.get(), rest);
+    return n;
+  }
+  void flush() override {
+    if (!_len) return;
+    _srv.sendContent((const char*)_buf, _len);
+    _len = 0;
+  }
+  // 送出剩餘內容與結尾 chunk
+  void end(){
+    if (_ended) return;
+    flush();
+    _srv.sendContent("");
+    _ended = true;
+  }
+
+private:
+  // 來源是自有記憶體：可以邊複製邊送
+  void put(const uint8_t* p, size_t n){
+    while (n) {
+      size_t k = sizeof(_buf) - _len;
+      if (k > n) k = n;
+      memcpy(_buf + _len, p, k);
+      _len += k; p += k; n -= k;
+      if (_len == sizeof(_buf)) flush();
+    }
+  }
+
+  HttpJobServer& _srv;
+  uint8_t    _buf[1024];
+  size_t     _len = 0;
+  bool       _ended = false;
+};
 
-    // 保持時間轉換為「分/秒」雙欄顯示
-    uint32_t sec = cfg.sch[i].hold;
-    uint32_t hm  = sec / 60;
-    uint32_t hs  = sec % 60;
-    html.replace(String("{{HM")+i+"}}", String(hm));
-    html.replace(String("{{HS")+i+"}}", String(hs));
 
-    // 推播訊息（預設 "RELAY{i}"）
-    String mon = cfg.sch[i].msg.length() ? cfg.sch[i].msg
-                                         : ("RELAY" + String(i+1));
-    // 舊版相容 {{M}}；新版分離 ON/OFF 文案
-    html.replace(String("{{M")+i+"}}", mon);
-    html.replace(String("{{MON")+i+"}}", mon);
-    html.replace(String("{{MOFF")+i+"}}", mon + "關閉");
+// =========================【即時狀態推送 /events（SSE）】=========================
+// 取代重新整理 / 與輪詢 /diag：繼電器保持（含延長）、DI 鎖存、計數值有變就推一筆差異（event "s"），
+// 多次變更在 LIVE_MIN_INTERVAL_MS 內合併成一筆；閒置時每 LIVE_HEARTBEAT_MS 送 "hb"。
+// 差異格式（只帶有變動的群組）：{"t":[剩餘ms…],"a":[0/1…],"c":[計數…]}；新連線先收到完整快照。
+static const uint32_t LIVE_MIN_INTERVAL_MS = 250;    // 推送速率上限（合併視窗）
+static const uint32_t LIVE_HEARTBEAT_MS    = 15000;  // 心跳間隔
+
+AsyncEventSource gEvents("/events");
+
+class LiveFeed {
+public:
+  enum : uint8_t { LIVE_T = 1, LIVE_A = 2, LIVE_C = 4, LIVE_ALL = 7 };
+
+  void begin(HttpJobServer& s){
+    gEvents.onConnect([this](AsyncEventSourceClient* c){
+      String js = build(LIVE_ALL);                      // AsyncTCP 任務內：只讀全域值
+      c->send(js.c_str(), "s", millis());
+    });
+    s.addHandler(&gEvents);
+  }
+
+  // loop() 內呼叫：比對 → 累積變動 → 到了合併視窗才送
+  void loop(){
+    for (int i = 0; i < RELAY_COUNT; ++i) {                      // 啟停或保持時間被延長（排程重疊 / 再次觸發）
+      if (_t[i] != gTestActive[i] || (gTestActive[i] && _u[i] != gTestUntil[i])) {
+        _t[i] = gTestActive[i]; _u[i] = gTestUntil[i]; _dirty |= LIVE_T;
+      }
+    }
+    for (int i = 0; i < ALARM_COUNT; ++i) if (_a[i] != gAlarmLatched[i]) { _a[i] = gAlarmLatched[i]; _dirty |= LIVE_A; }
+    for (int i = 0; i < CNT_COUNT;   ++i) if (_c[i] != gCount[i])        { _c[i] = gCount[i];        _dirty |= LIVE_C; }
+
+    uint32_t now = millis();
+    if (!gEvents.count()) { _dirty = 0; _lastSend = now; return; }   // 沒人訂閱：新連線會拿完整快照
+    if (_dirty && now - _lastSend >= LIVE_MIN_INTERVAL_MS) {
+      String js = build(_dirty);
+      gEvents.send(js.c_str(), "s", now);
+      _dirty = 0; _lastSend = now; _sent++;
+    } else if (!_dirty && now - _lastSend >= LIVE_HEARTBEAT_MS) {
+      char hb[24];
+      snprintf(hb, sizeof(hb), "{\"up\":%lu}", (unsigned long)(now / 1000));
+      gEvents.send(hb, "hb", now);
+      _lastSend = now;
+    }
+    if (_dirty) pwrWithin(LIVE_MIN_INTERVAL_MS - (now - _lastSend));   // 合併視窗到期就送
   }
 
-  // ===== 異常 DI 訊息 =====
-  for (int i=0;i<ALARM_COUNT;i++){
-    html.replace(String("{{AM")+i+"}}", gAlarmMsg[i]);
+  uint32_t sent() const { return _sent; }
+
+private:
+  bool     _t[RELAY_COUNT] = {false};
+  unsigned long _u[RELAY_COUNT] = {0};   // 上次送出時的 gTestUntil（剩餘時間由頁面自行倒數）
+  bool     _a[ALARM_COUNT] = {false};
+  uint32_t _c[CNT_COUNT]   = {0};
+  uint8_t  _dirty = 0;
+  uint32_t _lastSend = 0, _sent = 0;
+
+  static String build(uint8_t mask){
+    String js; js.reserve(96);
+    js += '{';
+    if (mask & LIVE_T) {
+      js += "\"t\":[";
+      for (int i = 0; i < RELAY_COUNT; ++i) {
+        if (i) js += ',';
+        long left = gTestActive[i] ? (long)(gTestUntil[i] - millis()) : 0;
+        js += gTestActive[i] ? (left > 0 ? left : 1) : 0;    // >0 即保持中，頁面自行倒數
+      }
+      js += ']';
+    }
+    if (mask & LIVE_A) {
+      if (js.length() > 1) js += ',';
+      js += "\"a\":[";
+      for (int i = 0; i < ALARM_COUNT; ++i) { if (i) js += ','; js += gAlarmLatched[i] ? '1' : '0'; }
+      js += ']';
+    }
+    if (mask & LIVE_C) {
+      if (js.length() > 1) js += ',';
+      js += "\"c\":[";
+      for (int i = 0; i < CNT_COUNT; ++i) { if (i) js += ','; js += gCount[i]; }
+      js += ']';
+    }
+    js += '}';
+    return js;
   }
+};
+static LiveFeed liveFeed;
+
+
+// =========================【HTTP：靜態資產（gzip + ETag）】=========================
+// data/*.gz 由 scripts/gzip_assets.py 在 buildfs/uploadfs 前產生（index.html.gz 為去掉 {{KEY}} 的靜態殼，
+// 欄位值由頁面載入後向 /page-data 取得）。開機時算一次內容 CRC，
+// ETag = "內容CRC-設定版本"；瀏覽器帶 If-None-Match 且相同 → 304。
+struct GzAsset {
+  const char* path;
+  uint32_t    crc;
+  size_t      size;
+  bool        ok;
+};
+static GzAsset gIndexGz = { "/index.html.gz", 0, 0, false };
 
-  return html;
+static void gzAssetScan(GzAsset& a){
+  a.ok = false;
+  File f = SPIFFS.open(a.path, "r");
+  if (!f) return;
+  uint8_t buf[256];
+  uint32_t crc = 0;
+  int n;
+  while ((n = f.read(buf, sizeof(buf))) > 0) crc = crc32Update(crc, buf, n);
+  a.size = f.size();
+  a.crc  = crc;
+  a.ok   = a.size > 0;
+  f.close();
+  Serial.printf("[HTTP] %s %u bytes crc=%08lx\n", a.path, (unsigned)a.size, (unsigned long)crc);
+}
+
+static String gzAssetEtag(const GzAsset& a){
+  char b[32];
+  snprintf(b, sizeof(b), "\"%08lx-%lu\"", (unsigned long)a.crc, (unsigned long)cfg.ver);
+  return String(b);
+}
+
+// 送出預壓縮資產（含 304）；不支援 gzip 或檔案不在時回 false，由呼叫端改走後備
+static bool serveGzAsset(const GzAsset& a, const char* ctype){
+  if (!a.ok || srv.header("Accept-Encoding").indexOf("gzip") < 0) return false;
+  String etag = gzAssetEtag(a);
+  if (srv.header("If-None-Match") == etag) {
+    srv.sendHeader("ETag", etag);
+    srv.sendHeader("Cache-Control", "no-cache");
+    srv.send(304);
+    return true;
+  }
+  File f = SPIFFS.open(a.path, "r");
+  if (!f) return false;
+  srv.sendHeader("ETag", etag);
+  srv.sendHeader("Cache-Control", "no-cache");     // 每次都帶 ETag 重新驗證
+  srv.sendHeader("Vary", "Accept-Encoding");
+  srv.streamFile(f, ctype);                        // 檔名 .gz → 自動加 Content-Encoding: gzip
+  f.close();
+  return true;
 }
 
 
 // =========================【HTTP：首頁處理】=========================
 // 用法：HTTP GET "/" 時呼叫
-// 功能：渲染 index.html 模板並回傳
+// 功能：優先送預壓縮的靜態頁（可快取）；沒有時依預編譯的 index.html 模板串流輸出
 void handleRoot(){
   oledKick("http");                 // ★ 只要有 HTTP 存取 → 喚醒
-  String page = renderIndex();
-  srv.send(200, "text/html; charset=utf-8", page);
+  if (serveGzAsset(gIndexGz, "text/html; charset=utf-8")) return;
+  HttpChunkWriter out(srv, 200, "text/html; charset=utf-8");
+  gIndexTpl.render(out);
+}
+
+// JSON 字串輸出（含跳脫）
+static void jsonPrintStr(Print& out, const String& v){
+  out.print('"');
+  for (size_t i = 0; i < v.length(); ++i) {
+    char c = v[i];
+    if (c == '"' || c == '\\') { out.print('\\'); out.print(c); }
+    else if ((uint8_t)c < 0x20) { char b[8]; snprintf(b, sizeof(b), "\\u%04x", (unsigned)(uint8_t)c); out.print(b); }
+    else out.print(c);
+  }
+  out.print('"');
+}
+
+// =========================【HTTP：首頁動態值 /page-data】=========================
+// 靜態頁載入後取用；欄位與模板的 {{KEY}} 一一對應
+void handlePageData(){
+  wifi_mode_t md = WiFi.getMode();
+  bool isAP = (md == WIFI_AP || md == WIFI_AP_STA);
+  bool rtcLost = gRtcReady ? RTC.lostPower() : true;
+
+  srv.sendHeader("Cache-Control", "no-store");
+  HttpChunkWriter out(srv, 200, "application/json");
+  out += "{\"ver\":"; out += cfg.ver;
+  out += ",\"ip\":";  jsonPrintStr(out, safeIP());
+  out += ",\"now\":"; jsonPrintStr(out, nowString());
+  out += ",\"rtcOk\":"; out += rtcLost ? "false" : "true";
+  out += ",\"showSecrets\":"; out += isAP ? "true" : "false";
+  out += ",\"wd\":[";
+  for (int i = 0; i < 7; ++i) { if (i) out += ','; out += ((cfg.wdMask >> i) & 0x01) ? '1' : '0'; }
+  out += "],\"relay\":[";
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    String mon = cfg.sch[i].msg.length() ? cfg.sch[i].msg : ("RELAY" + String(i+1));
+    if (i) out += ',';
+    out += "{\"t\":";    jsonPrintStr(out, fmt2(cfg.sch[i].hh) + ":" + fmt2(cfg.sch[i].mm));
+    out += ",\"tx\":";   jsonPrintStr(out, schExtraText(cfg.sch[i]));
+    out += ",\"sw\":";   jsonPrintStr(out, schWdText(cfg.sch[i].wd));
+    out += ",\"hm\":";   out += cfg.sch[i].hold / 60;
+    out += ",\"hs\":";   out += cfg.sch[i].hold % 60;
+    out += ",\"mon\":";  jsonPrintStr(out, mon);
+    out += ",\"moff\":"; jsonPrintStr(out, mon + "關閉");
+    out += '}';
+  }
+  out += "],\"cnt\":[";
+  for (int i = 0; i < CNT_COUNT; ++i) {
+    if (i) out += ',';
+    out += "{\"t\":";     jsonPrintStr(out, fmt2(cfg.cnt[i].hh) + ":" + fmt2(cfg.cnt[i].mm));
+    out += ",\"msg\":";   jsonPrintStr(out, cfg.cnt[i].msg);
+    out += ",\"target\":"; out += cfg.cnt[i].target;
+    out += '}';
+  }
+  out += "],\"am\":[";
+  for (int i = 0; i < ALARM_COUNT; ++i) { if (i) out += ','; jsonPrintStr(out, gAlarmMsg[i]); }
+  out += "]}";
+}
+
+
+// =========================【HTTP：機器可讀狀態 /api/status】=========================
+// 給監控系統輪詢（可 1 Hz）：內容與 /diag 相近，但為固定結構 JSON。
+// 直接串流到 HttpChunkWriter（固定 1 KB 緩衝），只印常數字串與數值，本身不組 String。
+// 每次請求仍有 HTTP 層的配置：HttpJob（參數 / 標頭 vector）、sendHeader 的 String、
+// 4 KB 串流管道與 chunked 回應物件，回應送完即釋放（1 Hz 輪詢約 5 KB 反覆配置）。
+// 欄位：up / time{src,epoch,local} / wifi{mode,conn,rssi,ip} / rtc{ready,lost}
+//       relay[{active,leftMs,n,reqMs,actMs,errMaxUs}] / di[0/1] / cnt[{count,total,target}]
+//       queue{tg[alarm,relay,info],journal,http[fast,slow],di,sse} / heap{free,min,maxAlloc}
+//       cfg{ver,dirty,writes,pages,erases} / pwr{mode,duty(%),mA(估算),wakeEv,wakeTmr} / loop{lastUs,avgUs,maxUs,n}
+
+// 主循環耗時（LoopTimer 於每輪結束時更新；avg 為 1/16 指數平均）
+struct LoopStats { uint32_t lastUs, avgUs, maxUs, count; };
+static LoopStats gLoopStats = { 0, 0, 0, 0 };
+struct LoopTimer {
+  uint32_t t0 = micros();
+  bool     on = true;
+  ~LoopTimer(){ done(); }
+  void done(){                       // 提早結算（省電睡眠不算進 loop 耗時）
+    if (!on) return;
+    on = false;
+    uint32_t d = micros() - t0;
+    gLoopStats.lastUs = d;
+    if (d > gLoopStats.maxUs) gLoopStats.maxUs = d;
+    gLoopStats.avgUs = gLoopStats.count ? gLoopStats.avgUs + (int32_t)(d - gLoopStats.avgUs) / 16 : d;
+    gLoopStats.count++;
+  }
+};
+
+static void jsonPrintIp(Print& out, uint32_t ip){
+  char b[20];
+  snprintf(b, sizeof(b), "\"%u.%u.%u.%u\"",
+           (unsigned)(ip & 0xFF), (unsigned)((ip >> 8) & 0xFF), (unsigned)((ip >> 16) & 0xFF), (unsigned)(ip >> 24));
+  out.print(b);
+}
+
+void handleApiStatus(){
+  char buf[32];
+  uint32_t nowMs = millis();
+
+  srv.sendHeader("Cache-Control", "no-store");
+  HttpChunkWriter out(srv, 200, "application/json");
+  out += "{\"up\":"; out += nowMs;
+
+  // 時間來源：timeSvc 快取（ntp / rtc / snap / none）；epoch 僅 NTP 來源時有效
+  out += ",\"time\":{\"src\":\""; out += timeSvc.sourceName();
+  out += "\",\"epoch\":";
+  out += timeSvc.source() == TS_NTP ? (uint32_t)time(nullptr) : 0U;
+  out += ",\"local\":";
+  if (timeSvc.valid()) {
+    timeSvc.format(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S");
+    out += '"'; out += buf; out += '"';
+  } else {
+    out += "null";
+  }
+
+  wifi_mode_t md = WiFi.getMode();
+  bool conn = WiFi.isConnected();
+  out += "},\"wifi\":{\"mode\":";
+  out += (md==WIFI_AP) ? "\"AP\"" : (md==WIFI_STA) ? "\"STA\"" : (md==WIFI_AP_STA) ? "\"AP+STA\"" : "\"OFF\"";
+  out += ",\"conn\":"; out += conn ? "true" : "false";
+  out += ",\"rssi\":"; if (conn) out += (int)WiFi.RSSI(); else out += "null";
+  out += ",\"ip\":";
+  jsonPrintIp(out, (uint32_t)(md == WIFI_AP ? WiFi.softAPIP() : conn ? WiFi.localIP() : IPAddress((uint32_t)0)));
+
+  out += "},\"rtc\":{\"ready\":"; out += gRtcReady ? "true" : "false";
+  out += ",\"lost\":"; out += (gRtcReady && !RTC.lostPower()) ? "false" : "true";
+
+  out += "},\"relay\":[";
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    long left = gTestActive[i] ? (long)(gTestUntil[i] - nowMs) : 0;
+    if (i) out += ',';
+    out += "{\"active\":"; out += gTestActive[i] ? "true" : "false";
+    out += ",\"leftMs\":"; out += (left > 0 ? left : 0L);
+    RelayLogRec lr = {};
+    relayEng.last(i, lr);                       // 最近一次保持：要求 vs 實際
+    out += ",\"n\":"; out += relayEng.holds(i);
+    out += ",\"reqMs\":"; out += lr.reqMs;
+    out += ",\"actMs\":"; out += lr.actUs / 1000;
+    out += ",\"errMaxUs\":"; out += relayEng.errMaxUs(i);
+    out += '}';
+  }
+  out += "],\"di\":[";
+  for (int i = 0; i < ALARM_COUNT; ++i) { if (i) out += ','; out += gAlarmLatched[i] ? '1' : '0'; }
+  out += "],\"cnt\":[";
+  for (int i = 0; i < CNT_COUNT; ++i) {
+    if (i) out += ',';
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)CNT.total(i));
+    out += "{\"count\":"; out += gCount[i];
+    out += ",\"total\":"; out += buf;
+    out += ",\"target\":"; out += cfg.cnt[i].target;
+    out += '}';
+  }
+
+  out += "],\"queue\":{\"tg\":[";
+  for (int p = 0; p < TG_PRI_COUNT; ++p) { if (p) out += ','; out += tgOutbox.count((TgPri)p); }
+  out += "],\"journal\":"; out += tgJournal.pendingCount();
+  out += ",\"http\":["; out += (uint32_t)srv.queued(HTTP_LANE_FAST); out += ','; out += (uint32_t)srv.queued(HTTP_LANE_SLOW);
+  out += "],\"di\":"; out += (uint32_t)((gDiHead - gDiTail) & (DI_RING - 1));
+  out += ",\"sse\":"; out += (uint32_t)gEvents.count();
+
+  out += "},\"heap\":{\"free\":"; out += ESP.getFreeHeap();
+  out += ",\"min\":"; out += ESP.getMinFreeHeap();
+  out += ",\"maxAlloc\":"; out += ESP.getMaxAllocHeap();
+
+  out += "},\"cfg\":{\"ver\":"; out += cfg.ver;
+  out += ",\"dirty\":"; out += cfgPersist.dirty();
+  out += ",\"writes\":"; out += gCfgWear.commits;
+  out += ",\"pages\":"; out += gCfgWear.pages;
+  out += ",\"erases\":"; out += cfgEstErases();
+
+  out += "},\"pwr\":{\"mode\":\""; out += pwr.mode();
+  out += "\",\"duty\":"; out += pwr.dutyPermille() / 10; out += '.'; out += pwr.dutyPermille() % 10;
+  uint32_t ua = pwr.estUa();
+  out += ",\"mA\":"; out += ua / 1000; out += '.'; out += (ua % 1000) / 100;
+  out += ",\"wakeEv\":"; out += pwr.wakeEvents();
+  out += ",\"wakeTmr\":"; out += pwr.wakeTimers();
+
+  out += "},\"loop\":{\"lastUs\":"; out += gLoopStats.lastUs;
+  out += ",\"avgUs\":"; out += gLoopStats.avgUs;
+  out += ",\"maxUs\":"; out += gLoopStats.maxUs;
+  out += ",\"n\":"; out += gLoopStats.count;
+  out += "}}";
 }
 
 
@@ -1204,6 +3548,7 @@ void handleSave(){
   String newPass = srv.arg("pass");
   if (srv.hasArg("token") && srv.arg("token").length()) cfg.token = srv.arg("token");
   if (srv.hasArg("chat")  && srv.arg("chat").length())  cfg.chat  = srv.arg("chat");
+  tgCredsPublish();
 
   // ---------- 2) 異常 DI 訊息（先更新，再比對摘要） ----------
   for (int i = 0; i < ALARM_COUNT; i++) {
@@ -1241,10 +3586,19 @@ void handleSave(){
     else if (srv.hasArg("m"+String(i)))
       cfg.sch[i].msg = srv.arg("m"+String(i));
 
+    // 額外時間 tx{i} = "HH:MM,HH:MM"；本路星期 sw{i} = "1111100"（Mon..Sun）
+    // 舊版表單沒有這兩欄 → 維持原值
+    if (srv.hasArg("tx"+String(i))) schExtraParse(cfg.sch[i], srv.arg("tx"+String(i)));
+    if (srv.hasArg("sw"+String(i))) schWdParse(srv.arg("sw"+String(i)), cfg.sch[i].wd);
+
     // 統一在這裡做變更摘要
     addChangeIf(changes, "CH"+String(i+1)+" 時間",
                 hhmm(old.sch[i].hh, old.sch[i].mm),
                 hhmm(cfg.sch[i].hh, cfg.sch[i].mm));
+    addChangeIf(changes, "CH"+String(i+1)+" 額外時間",
+                schExtraText(old.sch[i]), schExtraText(cfg.sch[i]));
+    addChangeIf(changes, "CH"+String(i+1)+" 星期",
+                schWdText(old.sch[i].wd), schWdText(cfg.sch[i].wd));
     addChangeIf(changes, "CH"+String(i+1)+" 保持(秒)",
                 String(old.sch[i].hold), String(cfg.sch[i].hold));
     addChangeIf(changes, "CH"+String(i+1)+" 訊息",
@@ -1316,9 +3670,12 @@ void handleSave(){
     WiFi.mode(WIFI_AP_STA);
     WiFi.begin(cfg.ssid.c_str(), cfg.pass.c_str());
     unsigned long t0 = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - t0 < 12000) delay(100);
+    while (WiFi.status() != WL_CONNECTED && millis() - t0 < 12000) appYield(100);
 
-    String page;
+    HttpChunkWriter page(srv, 200, "text/html; charset=utf-8");
+    page += "<!doctype html><meta charset='utf-8'>"
+            "<title>設定已儲存</title>"
+            "<body style='font-family:system-ui;line-height:1.6'>";
     if (WiFi.status() == WL_CONNECTED) {
       // 成功：NTP → RTC 快照（/rtc.txt）＋ 顯示取得的 IP
       configTime(8*3600, 0, "pool.ntp.org", "time.google.com", "time.windows.com");
@@ -1326,7 +3683,7 @@ void handleSave(){
       if (getLocalTime(&tinfo, 5000)) {
         YqDateTime dt{ tinfo.tm_year+1900, tinfo.tm_mon+1, tinfo.tm_mday,
                        tinfo.tm_hour, tinfo.tm_min, tinfo.tm_sec };
-        RTC.adjust(dt);
+        RTC.adjust(dt); timeSvc.invalidate();
         char snap[20];
         snprintf(snap, sizeof(snap), "%04d-%02d-%02d %02d:%02d",
                  dt.year, dt.month, dt.day, dt.hour, dt.minute);
@@ -1341,29 +3698,19 @@ void handleSave(){
      }
 
       String ip = WiFi.localIP().toString();
-      page =
-        "<!doctype html><meta charset='utf-8'>"
-        "<title>設定已儲存</title>"
-        "<body style='font-family:system-ui;line-height:1.6'>"
-        "<h3>設定已儲存 ✅</h3>"
-        "<p>已連上路由，取得位址：<b>" + ip + "</b></p>"
-        "<ol><li><b>請把電腦/手機改連回你的路由 Wi-Fi</b></li>"
-        "<li>再用這個網址開啟：<a href='http://" + ip + "/'>http://" + ip + "/</a></li></ol>"
-        "<p>AP 將於 5 秒後自動關閉。</p>"
-        "</body>";
+      page += "<h3>設定已儲存 ✅</h3>"
+              "<p>已連上路由，取得位址：<b>"; page += ip; page += "</b></p>"
+              "<ol><li><b>請把電腦/手機改連回你的路由 Wi-Fi</b></li>"
+              "<li>再用這個網址開啟：<a href='http://"; page += ip; page += "/'>http://"; page += ip; page += "/</a></li></ol>"
+              "<p>AP 將於 5 秒後自動關閉。</p>";
       gCloseApAt = millis() + 5000;  // 延遲關 AP
     } else {
       // 失敗：留在 AP 模式，提示回 10.10.0.1 重新設定
-      page =
-        "<!doctype html><meta charset='utf-8'>"
-        "<title>設定已儲存</title>"
-        "<body style='font-family:system-ui;line-height:1.6'>"
-        "<h3>設定已儲存，但目前連不上路由 ⚠️</h3>"
-        "<p>請確認 SSID/密碼無誤。裝置仍維持 AP 模式，"
-        "可回 <a href='http://10.10.0.1/'>http://10.10.0.1/</a> 重新設定。</p>"
-        "</body>";
-    }
-    srv.send(200, "text/html; charset=utf-8", page);
+      page += "<h3>設定已儲存，但目前連不上路由 ⚠️</h3>"
+              "<p>請確認 SSID/密碼無誤。裝置仍維持 AP 模式，"
+              "可回 <a href='http://10.10.0.1/'>http://10.10.0.1/</a> 重新設定。</p>";
+    }
+    page += "</body>";
     return;
   }
 
@@ -1388,7 +3735,7 @@ void handleSetTime(){
     dt.minute = when.substring(14,16).toInt();
     dt.second = 0;
 
-    RTC.adjust(dt);
+    RTC.adjust(dt); timeSvc.invalidate();
     writeTextFile("/rtc.txt", when);  // 例如 "2025-09-05 14:35"
 #if defined(RTC_IMPL_PCF8563)
     // PCF8563：寫秒寄存器時會清 VL，已由 adjust() 處理
@@ -1401,7 +3748,7 @@ void handleSetTime(){
 
 // =========================【工具：繼電器脈衝輸出 pulseRelay】=========================
 // 用法：pulseRelay(ch, sec)
-// 作用：指定通道繼電器吸合 holdSec 秒；過程中持續 srv.handleClient() 避免阻塞
+// 作用：指定通道繼電器吸合 holdSec 秒；等待期間交出 app lock，loop() 與其他請求照常執行
 void pulseRelay(int ch, uint32_t holdSec){
   if (ch < 0 || ch >= RELAY_COUNT) return;
   int pin = RELAY_PINS[ch];
@@ -1409,12 +3756,8 @@ void pulseRelay(int ch, uint32_t holdSec){
   digitalWrite(pin, RELAY_ACTIVE_HIGH ? HIGH : LOW);
   unsigned long until = millis() + (unsigned long)holdSec * 1000UL;
 
-  // ★ 保持期間不停服務 HTTP，避免 /set-time、/save 被卡住
-  while ((long)(millis() - until) < 0) {
-    srv.handleClient();
-    delay(2);
-    yield();
-  }
+  // ★ 保持期間不佔住 app lock，避免 loop() 與 /set-time、/save 被卡住
+  while ((long)(millis() - until) < 0) appYield(2);
   digitalWrite(pin, RELAY_ACTIVE_HIGH ? LOW : HIGH);
 }
 
@@ -1432,15 +3775,17 @@ void handleTestRelay(){
   }
 
   // 立即回應文字，不擋主流程
-  String resp = "已觸發 CH" + String(ch+1) + "（保持 " 
-              + String(cfg.sch[ch].hold) + " 秒），訊息：" 
-              + cfg.sch[ch].msg;
-  srv.send(200, "text/plain; charset=utf-8", resp);
+  {
+    HttpChunkWriter resp(srv, 200, "text/plain; charset=utf-8");
+    resp += "已觸發 CH"; resp += (ch+1); resp += "（保持 ";
+    resp += cfg.sch[ch].hold; resp += " 秒），訊息：";
+    resp += cfg.sch[ch].msg;
+  }
 
   // 啟動計時並推播
   startRelayTimed(ch, cfg.sch[ch].hold);
   uiShow("TEST CH"+String(ch+1), "保持 "+String(cfg.sch[ch].hold)+"s");
-  tgEnqueue(cfg.sch[ch].msg);
+  tgEnqueue(cfg.sch[ch].msg, TG_PRI_RELAY);
 }
 
 
@@ -1448,30 +3793,33 @@ void handleTestRelay(){
 // 用法：HTTP GET /self-test
 // 作用：依序測試 6 路，每路以目前設定 hold（但最多 3 秒），過程不中斷 HTTP，並推播開始/結束
 void handleSelfTest(){
-  String report;
+  bool busy[RELAY_COUNT];
   for (int i = 0; i < RELAY_COUNT; ++i) {
-    if (gTestActive[i]) { report += "CH" + String(i+1) + ": busy\n"; continue; }
+    busy[i] = gTestActive[i];
+    if (busy[i]) continue;
 
     uint32_t hold = cfg.sch[i].hold;
     if (hold > 3) hold = 3;  // 自檢上限 3 秒，避免測太久
 
-    tgEnqueue("CH" + String(i+1) + " 自檢開始（保持 " + String(hold) + " 秒）");
+    tgEnqueue("CH" + String(i+1) + " 自檢開始（保持 " + String(hold) + " 秒）", TG_PRI_RELAY);
     startRelayTimed(i, hold);
 
     // 等待該路測試結束（利用現有非阻塞旗標）
     unsigned long waitStart = millis();
     while (gTestActive[i]) {
-      srv.handleClient();
       if (millis() - waitStart > (hold * 1000UL + 1500)) break; // 超時保險
-      delay(5);
-      yield();
+      appYield(5);   // 交出 app lock：由 loop() 負責到時釋放
     }
 
-    tgEnqueue("CH" + String(i+1) + " 自檢結束");
-    report += "CH" + String(i+1) + ": OK\n";
-    delay(50);
+    tgEnqueue("CH" + String(i+1) + " 自檢結束", TG_PRI_RELAY);
+    appYield(50);
+  }
+
+  // 全部測完才回報結果
+  HttpChunkWriter report(srv, 200, "text/plain; charset=utf-8");
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    report += "CH"; report += (i+1); report += busy[i] ? ": busy\n" : ": OK\n";
   }
-  srv.send(200, "text/plain; charset=utf-8", report);
 }
 
 
@@ -1506,7 +3854,7 @@ bool startSTA() {
     if (getLocalTime(&tinfo, 5000)) {
       YqDateTime dt{ tinfo.tm_year+1900, tinfo.tm_mon+1, tinfo.tm_mday,
                      tinfo.tm_hour, tinfo.tm_min, tinfo.tm_sec };
-      RTC.adjust(dt);
+      RTC.adjust(dt); timeSvc.invalidate();
       char snap[20];
       snprintf(snap, sizeof(snap), "%04d-%02d-%02d %02d:%02d",
                dt.year, dt.month, dt.day, dt.hour, dt.minute);
@@ -1534,7 +3882,11 @@ static bool wifiConnectWait(unsigned long ms=15000){
 // 作用：根據 AP 鍵與是否已有憑證，決定進 AP 或 STA；先恢復 DHCP 預設
 void beginWiFi() {
   WiFi.persistent(false);   // 不寫入 NVS，避免磨損
+#ifdef POWER_SAVE
+  WiFi.setSleep(true);      // modem sleep：兩次 DTIM beacon 之間關 RF
+#else
   WiFi.setSleep(false);     // 關閉省電，減少延遲
+#endif
 
   pinMode(AP_MODE_PIN, INPUT_PULLUP);
   bool apRequested = (digitalRead(AP_MODE_PIN) == (AP_ACTIVE_LOW ? LOW : HIGH));
@@ -1560,41 +3912,10 @@ void beginWiFi() {
 
 // =========================【時間來源：取目前小時/分鐘 getHM】=========================
 // 用法：if (getHM(h,m)) {...}
-// 作用：多層回退策略（NTP -> RTC -> /rtc.txt -> 最近快取 60 秒）
-// 回傳：true=取得 h/m 成功；false=失敗（皆不可用且無快取）
+// 作用：讀 timeSvc 快取（NTP -> RTC -> /rtc.txt 快照 -> 沿用推算 60 秒），不阻塞
+// 回傳：true=取得 h/m 成功；false=失敗（皆不可用）
 static bool getHM(int &h, int &m){
-  static bool     haveCache = false;
-  static int      cacheH = 0, cacheM = 0;
-  static uint32_t lastOkMs = 0;
-
-  struct tm t;
-  // 1) 系統時鐘（NTP 校時後最精準）
-  if (getLocalTime(&t, 200)) { // 200ms 等待
-    h = t.tm_hour; m = t.tm_min;
-    cacheH = h; cacheM = m; haveCache = true; lastOkMs = millis();
-    return true;
-  }
-  // 2) 退回 RTC
-  if (gRtcReady) {
-    YqDateTime n = RTC.now();
-    h = n.hour; m = n.minute;
-    cacheH = h; cacheM = m; haveCache = true; lastOkMs = millis();
-    return true;
-  }
-  // 3) 再退回 /rtc.txt 快照
-  String snap = readTextFile("/rtc.txt");
-  if (snap.length() >= 16) {
-    h = snap.substring(11,13).toInt();
-    m = snap.substring(14,16).toInt();
-    cacheH = h; cacheM = m; haveCache = true; lastOkMs = millis();
-    return true;
-  }
-  // 4) 最後：若 60 秒內剛成功過，就沿用快取
-  if (haveCache && (millis() - lastOkMs) < 60000UL) {
-    h = cacheH; m = cacheM;
-    return true;
-  }
-  return false;
+  return timeSvc.hm(h, m);
 }
 
 // 工具：tm_wday(0=Sun..6=Sat) 轉 Mon=0..Sun=6
@@ -1605,75 +3926,163 @@ static inline int weekdayMon0_from_tm(const tm& t){
 
 // 本日是否在星期遮罩允許內（未取到時間時一律放行，以免整機停擺）
 static bool weekdayEnabled(){
-  struct tm tinfo;
-  if (!getLocalTime(&tinfo, 50)) return true; // 放行
-  int w = weekdayMon0_from_tm(tinfo);         // 0..6
+  if (!timeSvc.valid()) return true; // 放行
+  int w = timeSvc.weekdayMon0();     // 0..6（RTC / 快照來源也可判斷）
   return ((cfg.wdMask >> w) & 0x01) != 0;
 }
 
 
-// =========================【排程觸發：每分鐘比對 schedulerLoop】=========================
-// 用法：在 loop() 內高頻呼叫；本函式內已做 0.5 秒節流
-// 作用：當前 HH:MM 符合任一路排程 → 推播對應訊息 + 啟動對應繼電器保持
-// 去重：以 curKey(HH*60+MM) + lastTrigKey[i] 避免同分鐘重複觸發
-unsigned long lastMinTick = 0;
-int curH_cache = -1, curM_cache = -1;
-uint8_t lastTriggeredMinute[RELAY_COUNT] = {255,255,255,255,255,255}; //（保留相容）
-int16_t lastTrigKey[RELAY_COUNT] = { -1,-1,-1,-1,-1,-1 };
+// =========================【排程器：預算下次觸發 + 最小堆積 SchedEngine】=========================
+// 堆積、補觸發、重建去重與預排規則在 sched_engine.h（SchedCore）；這裡接上 cfg / timeSvc / relayEng，
+// 觸發時推播當路訊息並吸合，另依堆頂的預排時點安排省電睡眠。
+static_assert(SCH_CH == RELAY_COUNT, "sched_engine.h 的 SCH_CH 要等於 RELAY_COUNT");
+
+class SchedEngine : public SchedCore {
+public:
+  void loop(){
+    if (!timeSvc.valid()) return;
+    step(timeSvc.localUs(), esp_timer_get_time(), cfg.ver);
+    if (jobs()) {                               // 省電模式：睡到堆頂的預排時點
+      int64_t leftMs = nextDue() * 1000LL - timeSvc.localUs() / 1000LL - SCH_PREARM_MS;
+      if (leftMs < (int64_t)POWER_TICK_MS) pwrWithin(leftMs > 0 ? (uint32_t)leftMs : 0);
+    }
+  }
 
-void schedulerLoop(){
-  static unsigned long lastTick = 0;
-  if (millis() - lastTick < 500) return;   // 0.5 秒節流
-  lastTick = millis();
+protected:
+  uint16_t jobMinute(int j) override { return schMinute(cfg.sch[j / SCH_TIMES], j % SCH_TIMES); }
+  uint8_t  jobMask(int j) override   { return cfg.wdMask & cfg.sch[j / SCH_TIMES].wd; }
+  void     relayStartAt(int ch, int64_t tmrUs) override { relayEng.startAt(ch, cfg.sch[ch].hold, tmrUs); }
+  bool     relayCancelAt(int ch) override { return relayEng.cancelAt(ch); }
 
-  int curH, curM;
-  if (!getHM(curH, curM)) return;
+  void onFire(int j, int64_t due, int64_t lag, bool pre) override {
+    int ch = j / SCH_TIMES;
+    const Sched& sc = cfg.sch[ch];
+    int mod = (int)((due / 60) % (24 * 60));
 
-  // （可用於除錯展示 dow；目前邏輯未強制依賴）
-  int dow = -1;
-  struct tm t;
-  if (getLocalTime(&t, 50)) {
-    dow = (t.tm_wday + 6) % 7; // Mon=0 … Sun=6
-  } else if (gRtcReady) {
-    YqDateTime n = RTC.now();
-    // 若要嚴謹判斷 dow，可在校時時順便快照 dow
+    Serial.printf("[SCH] CH%d %02d:%02d (#%d) hold=%us lag=%ds\n",
+                  ch+1, mod / 60, mod % 60, j % SCH_TIMES + 1, (unsigned)sc.hold, (int)lag);
+
+    // 推播當路自訂訊息（ON 文案）
+    tgEnqueue(sc.msg, TG_PRI_RELAY);
+    uiShow("SCH CH"+String(ch+1)+" 開始", "保持 "+String(sc.hold)+"s");
+
+    // 啟動對應繼電器（已預排者由 esp_timer 吸合）
+    if (!pre) startRelayTimed(ch, sc.hold);
   }
+};
+static SchedEngine schedEngine;
 
-  int curKey = curH * 60 + curM;
 
-  for (int i = 0; i < RELAY_COUNT; ++i) {
-    if (!weekdayEnabled()) continue;   // 今天未勾選 → 跳過全排程
+// =========================【工件計數：每日定時回報（分鐘事件）】=========================
+// 用法：setup() 以 timeSvc.onMinute(cntDailyReport) 註冊
+// 兩路；但若 #1 啟用達標模式，就略過 #1 的每日回報
+static void cntDailyReport(const struct tm& t){
+  int h = t.tm_hour, m = t.tm_min;
+  int key = h * 60 + m;
+  for (int ci = 0; ci < CNT_COUNT; ++ci) {
+    if (ci == 0 && cfg.cnt[0].target > 0) continue; // #1 啟用達標模式 → 略過每日回報
+    if (!weekdayEnabled()) continue;
+    if (h == cfg.cnt[ci].hh && m == cfg.cnt[ci].mm) {
+      static int16_t lastCntKey[CNT_COUNT] = {-1, -1}; // 同分鐘去重（時間回撥時）
+      if (lastCntKey[ci] == key) continue;
+      lastCntKey[ci] = key;
 
-    if (curH == cfg.sch[i].hh && curM == cfg.sch[i].mm) {
-      if (lastTrigKey[i] != curKey) {  // 同分鐘不重複
-        lastTrigKey[i] = curKey;
+      uint32_t qty = cntTake(ci);  // 取快照並歸零
+      gCntShown[ci] = 0;           // 同步清畫面
+      gCount[ci]    = 0;           // 同步清顯示
 
-        Serial.printf("[SCH] CH%d match %02d:%02d, hold=%us\n",
-                      i+1, curH, curM, (unsigned)cfg.sch[i].hold);
+      if (qty == 0) continue;      // 0 不推播
 
-        // 推播當路自訂訊息（ON 文案）
-        tgEnqueue(cfg.sch[i].msg);
-        uiShow("SCH CH"+String(i+1)+" 開始", "保持 "+String(cfg.sch[i].hold)+"s");
+      // 若其他地方剛要求歸零，也在這裡消除旗標（雙保險）
+      if (gCntResetReq[0]) { gCntShown[0] = 0; gCntResetReq[0] = false; }
+      if (gCntResetReq[1]) { gCntShown[1] = 0; gCntResetReq[1] = false; }
 
-        // 啟動對應繼電器（非阻塞狀態管理）
-        startRelayTimed(i, cfg.sch[i].hold);
-      }
+      String msg = cfg.cnt[ci].msg + " 數量=" + String(qty);
+      tgEnqueue(msg);
+      uiShow("CNT#"+String(ci+1)+" 回報", "數量="+String(qty));
     }
-    // 否則：不重設 lastTrigKey[i]；下個分鐘 curKey 變動自然可再觸發
   }
 }
 
 
-// =========================【選用：RTC 鬧鐘中斷】=========================
-// 用法：若有接 RTC INT 腳並啟用鬧鐘，可在此 ISR 置旗標，主迴圈再消化
-void IRAM_ATTR rtcIntIsr(){
-  // 僅置旗標，避免在 ISR 做重工作
+// =========================【RTC 鬧鐘：叫醒排程器 RtcAlarm】=========================
+// 把「下一個事件」（繼電器排程堆頂、計數每日回報取較早者）的 HH:MM 寫進 RTC 每日鬧鐘。
+// 鬧鐘到 → RTC INT 腳拉低 → rtcAlarmIsr 置 gRtcAlarm → loop()：清旗標、timeSvc 立即重讀時間，
+// 排程器在同一輪評估（不必等下一次取樣），然後改排下一個事件。
+// 目標的選擇與「改變才寫 I²C」規則在 include/rtc_alarm.h（主機測試共用）。
+// 無 INT 腳的實作（RTC_ALARM_POLLED）改為每秒輪詢 alarmFired()。
+static const uint32_t RTC_ALARM_EVAL_MS = 1000;   // 重算目標的週期
+
+void IRAM_ATTR rtcAlarmIsr(){
+  uint32_t lvl = pwrPinLevel(RTC_INT_PIN);
+  pwrIrqFlip(RTC_INT_PIN, lvl);
+  if (!lvl) {
+    gRtcAlarm = true;   // 僅置旗標，避免在 ISR 做 I²C
+    pwrWakeFromIsr();
+  }
+}
+
+// 下一次計數每日回報（本地秒數；無 → -1）
+static int64_t cntNextDue(int64_t now){
+  uint16_t mod[CNT_COUNT];
+  bool     daily[CNT_COUNT];
+  for (int ci = 0; ci < CNT_COUNT; ++ci) {
+    mod[ci]   = (uint16_t)(cfg.cnt[ci].hh * 60 + cfg.cnt[ci].mm);
+    daily[ci] = !(ci == 0 && cfg.cnt[0].target > 0);   // #1 達標模式不做每日回報
+  }
+  return cntReportNextDue(now, mod, daily, CNT_COUNT, cfg.wdMask);
 }
-volatile bool gRtcAlarm = false;
+
+class RtcAlarm {
+public:
+  void begin(){
+    if (!gRtcReady) return;
+    RTC.clearAlarmFlag();          // 重開機前殘留的 AF
+    gRtcAlarm = false;
+  }
+
+  // 在 timeSvc.loop() 之前呼叫：本輪若有鬧鐘，timeSvc 會立即重新取樣
+  void loop(){
+    if (!gRtcReady) return;
+    bool hit = gRtcAlarm;
+    uint32_t ms = millis();
+    bool tick = (ms - _evalMs >= RTC_ALARM_EVAL_MS);
+#ifdef RTC_ALARM_POLLED
+    if (tick && !hit) hit = RTC.alarmFired();
+#endif
+    if (hit) {
+      gRtcAlarm = false;
+      RTC.clearAlarmFlag();
+      timeSvc.invalidate();
+      _hits++;
+      tick = true;
+    }
+    if (!tick) return;
+    _evalMs = ms;
+    arm();
+  }
+
+  int      armed() const { return _plan.armed(); }   // 已寫入的 HH:MM（分鐘數）；-1 = 關閉
+  uint32_t writes() const { return _plan.writes(); }
+  uint32_t hits() const { return _hits; }
+
+private:
+  RtcAlarmPlan _plan;
+  uint32_t     _evalMs = 0, _hits = 0;
+
+  void arm(){
+    if (!timeSvc.valid()) return;
+    int64_t now = timeSvc.localUs() / 1000000LL;
+    _plan.arm(RTC, schedEngine.nextDue(), cntNextDue(now));
+  }
+};
+static RtcAlarm rtcAlarm;
+
 
 // Forward declarations（若 handler 定義在後面）
 void handleSelfTest();   // 自檢
 void handleDiag();       // 診斷頁（之後補實作）
+void handleCounterHistory(); // 產量時間序列
 
 
 // =========================【心跳燈（LEDC）】=========================
@@ -1705,7 +4114,7 @@ void heartbeatLoop(){
   }
 
   unsigned long now = millis();
-  if (now < hbNext) return;
+  if (now < hbNext) { pwrWithin(hbNext - now); return; }
 
   switch(hbStage){
     case HB_ON1:   hbSet(HB_BRIGHT); hbNext = now + HB_ON1_MS;   hbStage = HB_OFF1;  break;
@@ -1715,26 +4124,76 @@ void heartbeatLoop(){
   }
 }
 // ===== CORS 工具（外部瀏覽器直接呼叫裝置 API 會用到）=====
-static inline void addCorsHeaders() {
+static inline void addCorsHeaders(const char* methods = "POST, OPTIONS") {
   srv.sendHeader("Access-Control-Allow-Origin", "*");
-  srv.sendHeader("Access-Control-Allow-Methods", "POST, OPTIONS");
-  srv.sendHeader("Access-Control-Allow-Headers", "Content-Type");
+  srv.sendHeader("Access-Control-Allow-Methods", methods);
+  srv.sendHeader("Access-Control-Allow-Headers", "Content-Type, If-None-Match");
+  srv.sendHeader("Access-Control-Expose-Headers", "ETag, X-Config-Version");
+}
+
+// =========================【HTTP：WebApp 設定匯出 /webapp-export】=========================
+// 用法：GET /webapp-export（docs/index.html 的 fetchLiveIfAny() 預填表單用）
+// 輸出與 applyWebAppConfig() 接受的欄位同形：wd[] / t[] / hm[] / hs[] / cm0 cn0 ct0 / cm1 cn1 ct1 / am[]，另附 ver。
+// ETag = "cfg-<cfg.ver>"（每次 saveConfig() 遞增）；帶 If-None-Match 且相同 → 304，不重送內容。
+static String webAppExportEtag(){
+  char b[24];
+  snprintf(b, sizeof(b), "\"cfg-%lu\"", (unsigned long)cfg.ver);
+  return String(b);
+}
+
+void handleWebAppExport(){
+  String etag = webAppExportEtag();
+  addCorsHeaders("GET, OPTIONS");
+  srv.sendHeader("ETag", etag);
+  srv.sendHeader("Cache-Control", "no-cache");
+  srv.sendHeader("X-Config-Version", String(cfg.ver));
+  if (srv.header("If-None-Match") == etag) { srv.send(304); return; }
+
+  HttpChunkWriter out(srv, 200, "application/json");
+  out += "{\"ver\":"; out += cfg.ver;
+  out += ",\"wd\":[";
+  for (int i = 0; i < 7; ++i) { if (i) out += ','; out += ((cfg.wdMask >> i) & 0x01) ? '1' : '0'; }
+  out += "],\"t\":[";
+  for (int i = 0; i < RELAY_COUNT; ++i) { if (i) out += ','; jsonPrintStr(out, hhmm(cfg.sch[i].hh, cfg.sch[i].mm)); }
+  out += "],\"hm\":[";
+  for (int i = 0; i < RELAY_COUNT; ++i) { if (i) out += ','; out += cfg.sch[i].hold / 60; }
+  out += "],\"hs\":[";
+  for (int i = 0; i < RELAY_COUNT; ++i) { if (i) out += ','; out += cfg.sch[i].hold % 60; }
+  out += ']';
+  for (int i = 0; i < CNT_COUNT; ++i) {
+    out += ",\"cm"; out += i; out += "\":"; jsonPrintStr(out, cfg.cnt[i].msg);
+    out += ",\"cn"; out += i; out += "\":"; out += cfg.cnt[i].target;
+    out += ",\"ct"; out += i; out += "\":"; jsonPrintStr(out, hhmm(cfg.cnt[i].hh, cfg.cnt[i].mm));
+  }
+  out += ",\"am\":[";
+  for (int i = 0; i < ALARM_COUNT; ++i) { if (i) out += ','; jsonPrintStr(out, gAlarmMsg[i]); }
+  out += "]}";
 }
 // =========================【系統初始化 setup()】=========================
 void setup() {
   Serial.begin(115200);
   delay(100);
+  pwr.begin();                            // 記下 loopTask（ISR 喚醒用）；POWER_SAVE 時設定 PM
+
+  // --- SPIFFS ---（tgTask 會用到日誌，須先掛載）
+  if (!SPIFFS.begin(true)) {
+    Serial.println("SPIFFS mount failed");
+  }
+  gIndexTpl.compile();                    // 首頁模板預編譯（後備）
+  gzAssetScan(gIndexGz);                  // 預壓縮首頁
 
   // --- 顯示與推播 ---
   u8g2.begin();  // 初始化 OLED
   oledKick("boot");  // ★ 開機先喚醒（並初始化時間點）
-  tgQ = xQueueCreate(20, sizeof(TgMsg));  // 建立 Telegram 佇列
+  tgLink.begin();                         // Telegram 共用連線（互斥鎖）
+  tgOutbox.begin();                       // 建立 Telegram outbox
+  if (!tgJournal.begin()) Serial.println("[TGJ] torn tail, compacted");   // 載入 flash 上未送達的訊息
+  Serial.printf("[TGJ] pending alarm=%u relay=%u\n", (unsigned)tgJournal.journal(TGJ_ALARM).pendingCount(),
+                (unsigned)tgJournal.journal(TGJ_RELAY).pendingCount());
   xTaskCreatePinnedToCore(tgTask, "tgTask", 8192, nullptr, 1, nullptr, 0); // 建議跑 Core0
-
-  // --- SPIFFS ---
-  if (!SPIFFS.begin(true)) {
-    Serial.println("SPIFFS mount failed");
-  }
+  tgPollLink.begin();
+  tgInQ = xQueueCreate(8, sizeof(TgInbound));                                // Telegram 收件匣
+  xTaskCreatePinnedToCore(tgPollTask, "tgPoll", 8192, nullptr, 1, nullptr, 0);
 
   // --- 心跳燈 LEDC ---
   ledcSetup(HB_CH, HB_HZ, 8);
@@ -1743,31 +4202,25 @@ void setup() {
 
   // --- 載入設定檔 ---
   loadConfig();
+  tgCredsPublish();                       // Telegram 任務用的憑證副本
+  cfgPersist.begin();
 
   // --- 繼電器腳位 ---
   for (int i = 0; i < RELAY_COUNT; ++i) {
     pinMode(RELAY_PINS[i], OUTPUT);
     digitalWrite(RELAY_PINS[i], RELAY_ACTIVE_HIGH ? LOW : HIGH);
   }
+  relayEng.begin();
 
   // --- DI 訊息初始化 ---
   for (int i = 0; i < ALARM_COUNT; i++) {
     gAlarmMsg[i] = cfg.aMsg[i].length() ? cfg.aMsg[i] : gAlarmMsg[i];
   }
-  for (int i = 0; i < ALARM_COUNT; i++) {
-    pinMode(ALARM_PINS[i], INPUT_PULLUP);   // 低有效，GPIO 對 GND
-    gAlarmLast[i] = digitalRead(ALARM_PINS[i]);
-  }
+  diBegin();                                // DI 中斷擷取
 
-  // --- 工件計數腳位 ---
-  for (int i = 0; i < CNT_COUNT; i++) {
-    pinMode(CNT_PINS[i], INPUT_PULLUP);    // 4/15 有內建上拉
-    gCntLast[i]  = digitalRead(CNT_PINS[i]);
-    gCntArmed[i] = true;                   // 開機先武裝
-    int edge = CNT_ACTIVE_LOW ? FALLING : RISING;
-    attachInterrupt(digitalPinToInterrupt(CNT_PINS[i]),
-                    (i==0)? cnt0_isr : cnt1_isr, edge);
-  }
+  // --- 工件計數腳位 ---（先還原斷電前的數量再開始計數）
+  cntCk.restore();
+  if (!CNT.begin()) Serial.printf("[CNT] %s init failed\n", CNT.name());
 
   // --- RTC 初始化 ---
   gRtcReady = RTC.begin();
@@ -1785,14 +4238,20 @@ void setup() {
       dt.hour   = snap.substring(11,13).toInt();
       dt.minute = snap.substring(14,16).toInt();
       dt.second = 0;
-      RTC.adjust(dt);
+      RTC.adjust(dt); timeSvc.invalidate();
       Serial.println("[RTC] 已用快照對時");
     } else {
       Serial.println("[RTC] 找不到快照，請到設定頁手動校時");
     }
   }
+
+  // --- 時間服務：RTC 就緒後首次取樣；分鐘事件驅動每日計數回報 ---
+  timeSvc.begin();
+  timeSvc.onMinute(cntDailyReport);
+
   pinMode(RTC_INT_PIN, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(RTC_INT_PIN), [](){ gRtcAlarm = true; }, FALLING);
+  attachInterrupt(digitalPinToInterrupt(RTC_INT_PIN), rtcAlarmIsr, pwrIrqMode(FALLING, digitalRead(RTC_INT_PIN)));
+  rtcAlarm.begin();
 
   // --- Wi-Fi 事件：取得 IP 時推播 ---
   WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) {
@@ -1806,9 +4265,7 @@ void setup() {
     int ch = srv.hasArg("ch") ? srv.arg("ch").toInt() : 0;
     if (ch < 0 || ch >= CNT_COUNT){ srv.send(400,"text/plain","bad ch"); return; }
 
-    noInterrupts();
-    gCntIsr[ch] = 0;   // 清 ISR 快照
-    interrupts();
+    cntTake(ch);       // 歸零（移動基準點）
 
     gCntShown[ch] = 0; // 清畫面側
     gCount[ch]    = 0; // 清對外顯示值
@@ -1819,24 +4276,36 @@ void setup() {
   beginWiFi();
   Serial.print("IP: "); Serial.println(WiFi.localIP());  // AP 模式下會是 192.168.4.1
 
-  // --- WebServer 路由綁定 ---
+  // --- HTTP 路由綁定 ---
   srv.on("/",           HTTP_GET,  handleRoot);
-  srv.on("/save",       HTTP_POST, handleSave);
+  srv.on("/page-data",  HTTP_GET,  handlePageData);
+  srv.on("/api/status", HTTP_GET,  handleApiStatus);
+  srv.on("/save",       HTTP_POST, handleSave, HTTP_LANE_SLOW);        // AP 模式會等 Wi-Fi 連線
   srv.on("/set-time",   HTTP_POST, handleSetTime);
   srv.on("/test-relay", HTTP_GET,  handleTestRelay);
-  srv.on("/self-test",  HTTP_GET,  handleSelfTest);
+  srv.on("/self-test",  HTTP_GET,  handleSelfTest, HTTP_LANE_SLOW, 60000);
   srv.on("/diag",       HTTP_GET,  handleDiag);
+  srv.on("/counter/history", HTTP_GET, handleCounterHistory);
   srv.on("/tg",         HTTP_GET, [](){
     String text = srv.hasArg("text") ? srv.arg("text") : "ping";
+    appUnlock();                                   // TLS 往返期間不擋 loop()
     bool ok = sendTelegram("[/tg] " + text);
+    appLock();
     srv.send(200, "text/plain", ok ? "sent" : "fail");
-  }); 
+  }, HTTP_LANE_SLOW);
   // 允許瀏覽器預檢
 srv.on("/webapp-save", HTTP_OPTIONS, [](){
   addCorsHeaders();
   srv.send(200, "text/plain", "");
 });
 
+// WebApp 讀取目前設定（可條件式請求）
+srv.on("/webapp-export", HTTP_OPTIONS, [](){
+  addCorsHeaders("GET, OPTIONS");
+  srv.send(200, "text/plain", "");
+});
+srv.on("/webapp-export", HTTP_GET, handleWebAppExport);
+
 // 外部瀏覽器可直接 POST JSON 到這裡
 // Header: Content-Type: application/json
 // Body:   你的設定 JSON（與 Telegram WebApp 的 payload 內容一致）
@@ -1849,8 +4318,20 @@ srv.on("/webapp-save", HTTP_POST, [](){
   }
   Serial.printf("[CFG] /webapp-save %d bytes\n", body.length());
   tgEnqueue("🛰 收到外部瀏覽器設定，開始套用…");
-  applyWebAppConfig(body);       // ← 直接沿用你現有的解析邏輯
-  srv.send(200, "application/json", "{\"ok\":true}");
+  WaResult r = applyWebAppConfig(body);
+  // 回報：{"ok":…,"applied":N,"errors":[{"k":"hm","i":2,"e":"range"},…]}；語法錯誤 → 400 + pos
+  String js = "{\"ok\":"; js += r.syntaxOk ? "true" : "false";
+  if (!r.syntaxOk) { js += ",\"pos\":"; js += r.errPos; }
+  js += ",\"applied\":"; js += r.applied;
+  js += ",\"errors\":[";
+  for (int i = 0; i < r.nErr && i < WA_ERR_MAX; ++i) {
+    if (i) js += ',';
+    js += "{\"k\":\""; js += kWaFields[r.err[i].field].key;
+    js += "\",\"i\":"; js += r.err[i].idx;
+    js += ",\"e\":\""; js += r.err[i].why; js += "\"}";
+  }
+  js += "]}";
+  srv.send(r.syntaxOk ? 200 : 400, "application/json", js);
 });
 
     // 即時設定 OLED 休眠秒數：/set-oled-sleep?sec=120
@@ -1860,15 +4341,13 @@ srv.on("/webapp-save", HTTP_POST, [](){
     if (sec < 5) sec = 5;
     if (sec > 3600) sec = 3600;
     gOledSleepMs = (uint32_t)sec * 1000UL;
-    saveConfig();                          // ★ 同步存檔
+    saveConfig();                          // ★ 存檔（CfgPersist 合併後寫入）
     oledKick("api");                       // ★ 修改當下喚醒
     srv.send(200, "text/plain; charset=utf-8", "OK, sleep=" + String(sec) + "s");
   });
   srv.on("/panel", HTTP_GET, [](){
     if (!cfg.chat.length()) { srv.send(400,"text/plain","no chat"); return; }
-    tgHideKeyboard(cfg.chat);         // 先把舊的收掉
-    tgSendControlKeyboard(cfg.chat);  // 再送新的 WebApp 鍵（已啟動10秒自動關）
-    tgSendInlineOpen(cfg.chat);       // 額外送一顆 Inline WebApp 按鈕（不殘留）
+    tgRequestAction(TG_ACT_PANEL);    // 收舊鍵盤 → 送 WebApp 鍵（10秒自動關）→ Inline 按鈕（由 tgTask 送出）
     srv.send(200, "text/plain; charset=utf-8", "OK");
   });
   
@@ -1876,13 +4355,17 @@ srv.on("/webapp-save", HTTP_POST, [](){
 // 單獨送一顆 Inline WebApp 按鈕（不殘留、最保險）
 srv.on("/open", HTTP_GET, [](){
   if (!cfg.chat.length()) { srv.send(400,"text/plain","no chat"); return; }
-  tgSendInlineOpen(cfg.chat);
+  tgRequestAction(TG_ACT_INLINE);
   srv.send(200, "text/plain; charset=utf-8", "OK");
 });
 
+  // 需讀取的請求標頭（快取驗證 / gzip 協商）
+  static const char* kHdrs[] = { "If-None-Match", "Accept-Encoding" };
+  srv.collectHeaders(kHdrs, 2);
 
+  liveFeed.begin(srv);   // /events（SSE）
   srv.begin();
-  Serial.println("WebServer started");
+  Serial.println("HTTP server started (async)");
 }
 
 
@@ -1890,16 +4373,14 @@ srv.on("/open", HTTP_GET, [](){
 // 用法：HTTP GET /diag
 // 作用：輸出目前時間、Wi-Fi 狀態、RTC 狀態、各路繼電器狀態、計數器狀態
 void handleDiag(){
-  struct tm t;
-  bool got = getLocalTime(&t, 10);  // 嘗試抓目前系統時間
-
-  String s;
-  s += "NTP: " + String(got ? "OK" : "NG") + "\n";
-  if (got){
+  HttpChunkWriter s(srv, 200, "text/plain; charset=utf-8");
+  s += "NTP: "; s += timeSvc.source() == TS_NTP ? "OK" : "NG";
+  s += "  src="; s += timeSvc.sourceName();
+  s += " samples="; s += timeSvc.samples();
+  s += " rtcReads="; s += timeSvc.rtcReads(); s += "\n";
+  if (timeSvc.valid()){
     char buf[40];
-    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d",
-             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-             t.tm_hour, t.tm_min, t.tm_sec);
+    timeSvc.format(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S");
     s += "Now: "; s += buf; s += "\n\n";
   } else {
     s += "Now: <no system time>\n\n";
@@ -1910,8 +4391,38 @@ void handleDiag(){
     snprintf(hhmm, sizeof(hhmm), "%02d:%02d", cfg.sch[i].hh, cfg.sch[i].mm);
     s += "CH"; s += (i+1);
     s += " -> "; s += hhmm;
+    String xt = schExtraText(cfg.sch[i]);
+    if (xt.length()) { s += ","; s += xt; }
+    s += "  wd="; s += schWdText(cfg.wdMask & cfg.sch[i].wd);
     s += "  hold="; s += cfg.sch[i].hold; s += "s  msg="; s += cfg.sch[i].msg; s += "\n";
   }
+  s += "Sched: jobs="; s += schedEngine.jobs();
+  s += " next=";
+  if (schedEngine.nextDue() >= 0) {
+    char nb[24];
+    time_t nd = (time_t)schedEngine.nextDue();
+    struct tm nt;
+    gmtime_r(&nd, &nt);                      // nextDue() 為本地秒數
+    strftime(nb, sizeof(nb), "%m-%d %H:%M", &nt);
+    s += nb; s += " CH"; s += schedEngine.nextChannel() + 1;
+  } else {
+    s += "-";
+  }
+  s += " fired="; s += schedEngine.fired();
+  s += " late="; s += schedEngine.late();
+  s += " prearmed="; s += schedEngine.prearmed();
+  s += " missed="; s += schedEngine.missed();
+  s += " maxLag="; s += schedEngine.maxLagS(); s += "s";
+  s += " rebuilds="; s += schedEngine.rebuilds(); s += "\n";
+  s += "Power: mode="; s += pwr.mode();
+  s += " duty="; s += pwr.dutyPermille() / 10; s += '.'; s += pwr.dutyPermille() % 10; s += "%";
+  s += " est="; s += pwrFmtMa(pwr.estUa()); s += "mA";
+  s += " wakes(ev/tmr)="; s += pwr.wakeEvents(); s += '/'; s += pwr.wakeTimers(); s += "\n";
+  s += "RTC alarm: ";
+  if (rtcAlarm.armed() >= 0) s += hhmm(rtcAlarm.armed() / 60, rtcAlarm.armed() % 60);
+  else                       s += "off";
+  s += " writes="; s += rtcAlarm.writes();
+  s += " hits="; s += rtcAlarm.hits(); s += "\n";
 
   s += "\nWiFiMode: ";
   wifi_mode_t md = WiFi.getMode();
@@ -1919,6 +4430,21 @@ void handleDiag(){
   s += "  IP="; s += safeIP(); s += "\n";
 
   s += "RTC Ready: "; s += gRtcReady?"YES":"NO"; s += "\n";
+  s += "Config: src="; s += gCfgStore.source;
+  s += " slot="; s += gCfgStore.active < 0 ? '-' : (char)('A' + gCfgStore.active);
+  s += " seq="; s += gCfgStore.seq;
+  s += " bytes="; s += gCfgStore.bytes;
+  s += " load="; s += gCfgStore.loadUs; s += "us";
+  s += " commits="; s += gCfgStore.commits;
+  s += " fails="; s += gCfgStore.commitFails; s += "\n";
+  s += "Config persist: dirty="; s += cfgPersist.dirty();
+  s += " due="; s += cfgPersist.pendingMs(); s += "ms";
+  s += " saves="; s += cfgPersist.requests();
+  s += " noop="; s += cfgPersist.skipped();
+  s += " coalesced="; s += cfgPersist.coalesced();
+  s += " | flash writes="; s += gCfgWear.commits;
+  s += " pages="; s += gCfgWear.pages;
+  s += " estErases="; s += cfgEstErases(); s += "\n";
 
   for (int i = 0; i < RELAY_COUNT; ++i){
     s += "CH"; s += (i+1);
@@ -1927,24 +4453,139 @@ void handleDiag(){
       long msLeft = (long)(gTestUntil[i] - millis());
       s += "  left="; s += (msLeft>0?msLeft:0); s += "ms";
     }
+    s += "  holds="; s += relayEng.holds(i);
+    s += " err(avg/max)="; s += relayEng.errAvgUs(i); s += '/'; s += relayEng.errMaxUs(i); s += "us";
+    s += " onLateMax="; s += relayEng.lateMaxUs(i); s += "us";
     s += "\n";
   }
+  s += "Relay log (新→舊):\n";
+  RelayLogRec lr;
+  for (int k = 0; relayEng.log(k, lr); ++k) {
+    s += "  CH"; s += lr.ch + 1;
+    s += lr.how == RELAY_END_ABORT ? " abort" : " timer";
+    s += " req="; s += lr.reqMs; s += "ms";
+    if (lr.ext) { s += " (extended x"; s += (uint32_t)lr.ext; s += ")"; }
+    char ab[16];
+    snprintf(ab, sizeof(ab), "%lu.%03lu", (unsigned long)(lr.actUs / 1000), (unsigned long)(lr.actUs % 1000));
+    s += " act="; s += ab; s += "ms";
+    s += " onLate="; s += lr.onLateUs; s += "us";
+    s += " @"; s += lr.atMs; s += "\n";
+  }
 
-  s += "\n[Counter]\n";
+  s += "\n[Counter] backend="; s += CNT.name(); s += "\n";
   for(int i=0;i<CNT_COUNT;i++){
     s += "CNT"; s += i;
     s += " count="; s += gCount[i];
+    s += " total="; s += String((unsigned long long)CNT.total(i));
     s += " time="; s += fmt2(cfg.cnt[i].hh); s += ":"; s += fmt2(cfg.cnt[i].mm);
     s += " msg="; s += cfg.cnt[i].msg;
     s += " target="; s += cfg.cnt[i].target;  // ★ 新增
     s += "\n";
   }
 
-  srv.send(200, "text/plain; charset=utf-8", s);
+  s += "checkpoint restored="; s += cntCk.source();
+  s += " rtcWrites="; s += cntCk.rtcWrites();
+  s += " flashWrites="; s += cntCk.flashWrites();
+  s += " log="; s += (uint32_t)cntCk.fileSize(); s += "/"; s += (uint32_t)CNT_CK_FILE_MAX; s += "\n";
+
+  s += "\n[DI] overrun="; s += (uint32_t)gDiOverrun;
+  s += " peak="; s += gDiPeak; s += "/"; s += (DI_RING - 1); s += "\n";
+  for (int i = 0; i < ALARM_COUNT; ++i){
+    s += "DI"; s += (i+1);
+    s += gDi[i].stable == LOW ? " LOW" : " HIGH";
+    s += gAlarmLatched[i] ? " latched" : "";
+    s += " edges="; s += gDi[i].edges;
+    if (gDi[i].lastEventUs) {
+      String at = diFmtTime(gDi[i].lastEventUs);
+      s += " last="; s += at.length() ? at : String((long)(gDi[i].lastEventUs / 1000)) + "ms(uptime)";
+    }
+    s += "\n";
+  }
+
+  s += "\n[HTTP] served="; s += srv.served;
+  s += " busy503="; s += srv.rejected;
+  s += " timeout503="; s += srv.expired;
+  s += " aborted="; s += srv.aborted;
+  s += " stalled="; s += srv.stalled;
+  s += " maxWait="; s += srv.maxWaitMs; s += "ms";
+  s += " queued="; s += (uint32_t)srv.queued(HTTP_LANE_FAST); s += "/"; s += (uint32_t)srv.queued(HTTP_LANE_SLOW);
+  s += "\nsse clients="; s += (uint32_t)gEvents.count();
+  s += " pushed="; s += liveFeed.sent(); s += "\n";
+
+  s += "\n[Telegram]\n";
+  s += "handshakes="; s += tgLink.handshakes();
+  s += " reused="; s += tgLink.reuses();
+  s += " retried="; s += tgLink.retries(); s += "\n";
+  static const char* const priName[TG_PRI_COUNT] = { "alarm", "relay", "info" };
+  for (int p = 0; p < TG_PRI_COUNT; ++p){
+    s += "outbox."; s += priName[p];
+    s += " queued="; s += tgOutbox.count((TgPri)p);
+    s += " used="; s += tgOutbox.used((TgPri)p); s += "/"; s += tgOutbox.capacity((TgPri)p);
+    s += " peak="; s += tgOutbox.peak((TgPri)p);
+    s += " dropped="; s += tgOutbox.dropped((TgPri)p); s += "\n";
+  }
+  s += "outbox pushed="; s += tgOutbox.pushed();
+  s += " merged="; s += tgOutbox.merged(); s += "\n";
+  static const char* const jName[TGJ_CLASSES] = { "alarm", "relay" };
+  for (int c = 0; c < TGJ_CLASSES; ++c){
+    const auto& j = tgJournal.journal((TgjClass)c);
+    s += "journal["; s += jName[c]; s += "] pending="; s += j.pendingCount();
+    s += " bytes="; s += (uint32_t)j.bytes(); s += "/"; s += (uint32_t)j.maxBytes();
+    s += " ack="; s += j.ackSeq(); s += " saved="; s += j.ackSaved();
+    s += " ackWrites="; s += j.ackWrites();
+    s += " appended="; s += j.appended();
+    s += " acked="; s += j.acked();
+    s += " batches="; s += j.batches();
+    s += " cacheHits="; s += j.cacheHits();
+    s += " dropped="; s += j.dropped();
+    s += " corrupt="; s += j.corrupt(); s += "\n";
+  }
+
+  s += "\n[CounterHistory]\n";
+  s += "minutes="; s += cntHist.minutes();
+  s += " ram="; s += (uint32_t)cntHist.ramUsed(); s += "/"; s += (uint32_t)CNT_HIST_RAM;
+  s += " hourFlushes="; s += cntHist.flushes();
+  s += " lastHour="; s += cntHist.lastFlushEpoch(); s += "\n";
+}
+
+// 產量時間序列（CSV，分段送出）
+//   /counter/history?res=min&minutes=N → t,cnt0,cnt1（t = 該分鐘結束的 epoch；未對時為 -距今分鐘數）
+//   /counter/history?res=hour          → hour,cnt0,cnt1（hour = 整點 epoch）
+void handleCounterHistory(){
+  bool hourly = (srv.arg("res") == "hour");
+  srv.sendHeader("Cache-Control", "no-store");
+  HttpChunkWriter out(srv, 200, "text/csv; charset=utf-8");
+
+  auto emit = [&](long t, const uint32_t* q){
+    out.print(t);
+    for (int ch = 0; ch < CNT_COUNT; ++ch) { out.print(','); out.print((unsigned long)q[ch]); }
+    out.print('\n');
+  };
+
+  if (hourly) {
+    out += "hour,cnt0,cnt1\n";
+    cntHist.forEachHour([&](const CntHistory::HourRec& r){ emit((long)r.hour, r.qty); });
+  } else {
+    long minutes = srv.hasArg("minutes") ? srv.arg("minutes").toInt() : 60;
+    if (minutes < 1) minutes = 1;
+    if (minutes > CNT_HIST_MINUTES) minutes = CNT_HIST_MINUTES;
+    time_t now = time(nullptr);
+    bool synced = now > 1577836800;
+    long lastEnd = (long)now - (long)(cntHist.msSinceLastBucket() / 1000);
+    out += "t,cnt0,cnt1\n";
+    cntHist.forEachMinute((uint16_t)minutes, [&](uint16_t age, const uint32_t* q){
+      emit(synced ? lastEnd - (long)(age - 1) * 60 : -(long)age, q);
+    });
+  }
 }
 
 // =========================【主循環 loop()】=========================
 void loop() {
+  AppLockGuard appLk;   // HTTP handler 在 httpWorker 任務執行，與 loop() 主體互斥
+  LoopTimer    loopTm;  // 本輪耗時 → gLoopStats（/api/status）
+  rtcAlarm.loop();      // RTC 鬧鐘到 → 本輪立即重新取樣；並把下一個事件排進 RTC
+  timeSvc.loop();       // 每秒取樣一次時間；分鐘改變 → cntDailyReport()
+  schedEngine.loop();   // 堆頂到期才觸發（平時只比較一次）
   // ---------- AP 觸發鍵（長按切 AP + 冷卻） ----------
   // 用法：長按 AP_MODE_PIN 進 AP；已連線需長按 5s，未連線 1.2s；切換後 30s 冷卻
   static unsigned long apSenseStart = 0;
@@ -1958,6 +4599,7 @@ void loop() {
   unsigned long needHold = staConnected ? AP_HOLD_MS_CONNECTED : AP_HOLD_MS_DISCONNECTED;
 
   if (apPinActive) {
+    pwrWithin(50);                          // 長按計時中：保持輪詢
     if (apSenseStart == 0) apSenseStart = millis();
     if ((millis() - apSenseStart) > needHold) {
       if (millis() - apLastToggleMs > AP_COOLDOWN_MS) {
@@ -1973,14 +4615,7 @@ void loop() {
     apSenseStart = 0;
   }
 
-  // ---------- HTTP 服務（維持即時回應） ----------
-  srv.handleClient();
-  tgUpdatePollLoop();  // ★ 輪詢 Telegram，接收 WebApp 回傳設定
-  // ★ 10 秒自動關閉鍵盤
-if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
-  gKbHideAt = 0;
-  if (cfg.chat.length()) tgHideKeyboard(cfg.chat);
-}
+  tgInboxLoop();       // ★ 消化 Telegram 收件（長輪詢在 tgPollTask）
 
 
   // ---------- Wi-Fi 看門狗（每 3 秒輕量重連，避免干擾 AP 手動模式） ----------
@@ -2000,25 +4635,23 @@ if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
   // ---------- 心跳燈（僅連線狀態顯示兩閃一停） ----------
   heartbeatLoop();
 
-  // =========================【工件計數 re-arm】=========================
-  // 用法：每圈檢查；只有在輸入回到「閒置電平」且去抖完成才重新武裝（允許下一次計數）
-  for (int ci = 0; ci < CNT_COUNT; ++ci) {
-    int v = digitalRead(CNT_PINS[ci]);
-    if (v != gCntLast[ci]) {
-      gCntLast[ci] = v;
-      gCntDeb[ci]  = millis();                 // 電平變化 → 重置去抖計時
-    } else {
-      int idleLevel = CNT_ACTIVE_LOW ? HIGH : LOW; // 閒置電平
-      if (!gCntArmed[ci] && v == idleLevel && (millis() - gCntDeb[ci]) >= CNT_DEBOUNCE) {
-        gCntArmed[ci] = true;                  // 放開且穩定於閒置電平 → 允許下一次計數
-      }
-    }
-  }
+  // =========================【工件計數後端輪詢】=========================
+  CNT.poll();
+  cntHist.loop();
+  cntCk.loop();
+
+  // ---------- 即時狀態推送（/events） ----------
+  liveFeed.loop();
+
+  // ---------- 設定延遲寫入（合併視窗到期才落地） ----------
+  cfgPersist.loop();
 
   // ---------- OLED 畫面（AP 顯示 SETUP；STA 顯示 IP 等） ----------
   bool forceSetup = (WiFi.getMode() == WIFI_AP);
   drawOled(forceSetup);
 
+  if (gUi.until && (long)(gUi.until - millis()) > 0) pwrWithin(gUi.until - millis());   // 提示到期要重畫
+
   // ---------- 延後關 AP（成功頁 5s 後只留 STA） ----------
   if (gCloseApAt && millis() >= gCloseApAt) {
     gCloseApAt = 0;
@@ -2026,60 +4659,15 @@ if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
     WiFi.softAPdisconnect(true);
     WiFi.mode(WIFI_STA);
   }
+  if (gCloseApAt) pwrWithin(gCloseApAt - millis());
 
-  // ---------- 分鐘級排程 ----------
-  schedulerLoop();
-
-  // ---------- RTC 鬧鐘旗標清除 ----------
-  if (gRtcAlarm) {
-    gRtcAlarm = false;
-    RTC.clearAlarmFlag();
-  }
-
-  // =========================【繼電器保持收斂（非阻塞）】=========================
-  // 正常收斂：時間到即釋放；保險收斂：超過 hold+5s 強制釋放
-  for (int ch = 0; ch < RELAY_COUNT; ++ch) {
-    // 正常收斂
-    if (gTestActive[ch] && (long)(millis() - gTestUntil[ch]) >= 0) {
-      int pin = RELAY_PINS[ch];
-      digitalWrite(pin, RELAY_ACTIVE_HIGH ? LOW : HIGH);
-      tgEnqueue(endMsg(ch));
-      uiShow("CH"+String(ch+1)+" 結束", "");
-      gTestActive[ch] = false;
-    }
-    // 保險收斂
-    if (gTestActive[ch]) {
-      unsigned long holdMs = (unsigned long)cfg.sch[ch].hold * 1000UL;
-      if (millis() - gTestStart[ch] > holdMs + 5000UL) {
-        int pin = RELAY_PINS[ch];
-        digitalWrite(pin, RELAY_ACTIVE_HIGH ? LOW : HIGH);
-        tgEnqueue(endMsg(ch));
-        uiShow("CH"+String(ch+1)+" 結束", "");
-        gTestActive[ch] = false;
-      }
-    }
-  }
+  // =========================【繼電器保持收斂】=========================
+  // 釋放已由 esp_timer 回呼完成；這裡只補推播 / OLED
+  relayEng.loop();
 
   // =========================【異常 DI 監看】=========================
-  // 低有效、去彈跳；LOW 觸發推播一次，回 HIGH 解除鎖存
-  for (int ai = 0; ai < ALARM_COUNT; ++ai) {
-    int v = digitalRead(ALARM_PINS[ai]);
-    if (v != gAlarmLast[ai]) {
-      gAlarmDebounceMs[ai] = millis();
-      gAlarmLast[ai] = v;
-    } else if ((millis() - gAlarmDebounceMs[ai]) > ALARM_DEBOUNCE) {
-
-      if (v == LOW && !gAlarmLatched[ai]) {
-        gAlarmLatched[ai] = true;
-        oledKick("di");                            // ★ DI 觸發 → 喚醒
-        tgEnqueue("⚠️ DI" + String(ai+1) + "：" + gAlarmMsg[ai]);
-      }
-      if (v == HIGH && gAlarmLatched[ai]) {
-        gAlarmLatched[ai] = false;
-        // 如需「恢復通知」可在此 enqueue
-      }
-    }
-  }
+  // 事件由 ISR 擷取；這裡依事件時間戳去抖、鎖存與推播
+  diLoop();
 
   // =========================【工件計數：從 ISR 快照同步到顯示/對外值】=========================
   {
@@ -2091,9 +4679,7 @@ if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
 
     if (millis() - last >= 10) {  // 10ms 節流
       last = millis();
-      noInterrupts();
-      uint32_t s0 = gCntIsr[0], s1 = gCntIsr[1];  // 取快照
-      interrupts();
+      uint32_t s0 = cntPeek(0), s1 = cntPeek(1);  // 取快照
     // ★★ 在同步前先判斷是否「變多」：只要任一路快照比目前顯示值大，就代表有新計數
      bool cntChanged = (s0 > gCntShown[0]) || (s1 > gCntShown[1]);
      if (cntChanged) oledKick("count");  // ★ 計數有變 → 喚醒 OLED
@@ -2108,17 +4694,11 @@ if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
 
   // =========================【工件計數：推播規則】=========================
   // (#1) 達標即推播（cn0>0），推播後把 #1 完整清零（ISR/顯示/對外）→ 可反覆達標
-  int h, m;
   if (cfg.cnt[0].target > 0) {
-    noInterrupts();
-    uint32_t snap0 = gCntIsr[0];
-    interrupts();
+    uint32_t snap0 = cntPeek(0);
 
     if (snap0 >= cfg.cnt[0].target) {
-      noInterrupts();
-      uint32_t qty = gCntIsr[0];  // 取量
-      gCntIsr[0]   = 0;           // 清 ISR 計數
-      interrupts();
+      uint32_t qty = cntTake(0);  // 取量並歸零
 
       gCntShown[0] = 0;           // 同步清畫面
       gCount[0]    = 0;           // 同步清對外
@@ -2130,36 +4710,11 @@ if (gKbHideAt && (long)(millis() - gKbHideAt) >= 0) {
     }
   }
 
-  // (#2) 每日定時回報（兩路；但若 #1 啟用達標模式，就略過 #1 的每日回報）
-  if (getHM(h, m)) {
-    int key = h * 60 + m;
-    for (int ci = 0; ci < CNT_COUNT; ++ci) {
-      if (ci == 0 && cfg.cnt[0].target > 0) continue; // #1 啟用達標模式 → 略過每日回報
-      if (!weekdayEnabled()) continue;
-      if (h == cfg.cnt[ci].hh && m == cfg.cnt[ci].mm) {
-        static int16_t lastCntKey[CNT_COUNT] = {-1, -1}; // 同分鐘去重
-        if (lastCntKey[ci] == key) continue;
-        lastCntKey[ci] = key;
-
-        noInterrupts();
-        uint32_t qty = gCntIsr[ci];  // 取快照
-        gCntIsr[ci] = 0;             // 清 ISR 計數
-        gCntShown[ci] = 0;           // 同步清畫面
-        gCount[ci]    = 0;           // 同步清顯示
-        interrupts();
-
-        if (qty == 0) continue;      // 0 不推播
-
-        // 若其他地方剛要求歸零，也在這裡消除旗標（雙保險）
-        if (gCntResetReq[0]) { gCntShown[0] = 0; gCntResetReq[0] = false; }
-        if (gCntResetReq[1]) { gCntShown[1] = 0; gCntResetReq[1] = false; }
-
-        String msg = cfg.cnt[ci].msg + " 數量=" + String(qty);
-        tgEnqueue(msg);
-        uiShow("CNT#"+String(ci+1)+" 回報", "數量="+String(qty));
-      }
-    }
-  }
+  // (#2) 每日定時回報：見 cntDailyReport()（timeSvc 分鐘事件）
+
+  // ---------- 省電：睡到最近的期限或下一個事件 ----------
+  loopTm.done();
+  pwr.idle();
 }
 
 // ====== OLED 顯示（獨立函式；不要放在 loop() 裡）======
@@ -0,0 +1,139 @@
+#pragma once
+// =========================【主機測試：Arduino String 替身】=========================
+// 只實作測試中「舊版對照程式」用得到的 String 成員，行為對齊 arduino-esp32 的 WString：
+// 緩衝區依需要的長度精確配置（concat / reserve 每次重配），所以配置次數與峰值
+// 可作為裝置上 String 寫法的近似（這裡以 new[] + 複製模擬 realloc，峰值略偏保守）。
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+class String {
+public:
+  String() {}
+  String(const char* s){ if (s) assign(s, strlen(s)); }
+  String(const String& o){ assign(o._buf, o._len); }
+  String(String&& o) noexcept : _buf(o._buf), _len(o._len), _cap(o._cap) { o._buf = nullptr; o._len = o._cap = 0; }
+  explicit String(char c){ assign(&c, 1); }
+  explicit String(int v)          { char b[16]; snprintf(b, sizeof(b), "%d", v);  assign(b, strlen(b)); }
+  explicit String(unsigned v)     { char b[16]; snprintf(b, sizeof(b), "%u", v);  assign(b, strlen(b)); }
+  explicit String(long v)         { char b[24]; snprintf(b, sizeof(b), "%ld", v); assign(b, strlen(b)); }
+  explicit String(unsigned long v){ char b[24]; snprintf(b, sizeof(b), "%lu", v); assign(b, strlen(b)); }
+  ~String(){ delete[] _buf; }
+
+  String& operator=(const String& o){ if (this != &o) assign(o._buf, o._len); return *this; }
+  String& operator=(String&& o) noexcept {
+    if (this != &o) { delete[] _buf; _buf = o._buf; _len = o._len; _cap = o._cap; o._buf = nullptr; o._len = o._cap = 0; }
+    return *this;
+  }
+  String& operator=(const char* s){ assign(s ? s : "", s ? strlen(s) : 0); return *this; }
+
+  bool reserve(size_t n){ if (n > _cap) grow(n); return true; }
+  size_t length() const { return _len; }
+  const char* c_str() const { return _buf ? _buf : ""; }
+  char operator[](size_t i) const { return i < _len ? _buf[i] : 0; }
+  char& operator[](size_t i) { static char dummy; return i < _len ? _buf[i] : dummy; }
+
+  bool concat(const char* s, size_t n){
+    if (!n) return true;
+    if (_len + n > _cap) grow(_len + n);
+    memcpy(_buf + _len, s, n);
+    _len += n; _buf[_len] = 0;
+    return true;
+  }
+  String& operator+=(const String& o){ concat(o._buf ? o._buf : "", o._len); return *this; }
+  String& operator+=(const char* s)  { if (s) concat(s, strlen(s)); return *this; }
+  String& operator+=(char c)         { concat(&c, 1); return *this; }
+  String& operator+=(int v)          { return *this += String(v); }
+  String& operator+=(unsigned v)     { return *this += String(v); }
+  String& operator+=(long v)         { return *this += String(v); }
+  String& operator+=(unsigned long v){ return *this += String(v); }
+
+  bool operator==(const String& o) const { return _len == o._len && memcmp(c_str(), o.c_str(), _len) == 0; }
+  bool operator==(const char* s)   const { return strcmp(c_str(), s ? s : "") == 0; }
+  bool operator!=(const String& o) const { return !(*this == o); }
+  bool operator!=(const char* s)   const { return !(*this == s); }
+
+  int indexOf(char c, unsigned from = 0) const {
+    if (from >= _len) return -1;
+    const char* p = (const char*)memchr(_buf + from, c, _len - from);
+    return p ? (int)(p - _buf) : -1;
+  }
+  int indexOf(const char* s, unsigned from = 0) const {
+    if (from >= _len) return -1;
+    const char* p = strstr(_buf + from, s);
+    return p ? (int)(p - _buf) : -1;
+  }
+  int indexOf(const String& s, unsigned from = 0) const { return indexOf(s.c_str(), from); }
+
+  String substring(unsigned from) const { return substring(from, _len); }
+  String substring(unsigned from, unsigned to) const {
+    if (from > to) { unsigned t = from; from = to; to = t; }
+    if (from >= _len) return String();
+    if (to > _len) to = _len;
+    String out;
+    out.assign(_buf + from, to - from);
+    return out;
+  }
+  long toInt() const { return _buf ? atol(_buf) : 0; }
+  void trim(){
+    if (!_len) return;
+    size_t a = 0, b = _len;
+    while (a < b && isspace((unsigned char)_buf[a])) a++;
+    while (b > a && isspace((unsigned char)_buf[b - 1])) b--;
+    memmove(_buf, _buf + a, b - a);
+    _len = b - a; _buf[_len] = 0;
+  }
+  void toUpperCase(){ for (size_t i = 0; i < _len; ++i) _buf[i] = (char)toupper((unsigned char)_buf[i]); }
+  bool startsWith(const char* s) const { return strncmp(c_str(), s, strlen(s)) == 0; }
+
+  // 與 WString::replace 相同：逐一找出並換掉（長度不同時重配一次）
+  void replace(const String& find, const String& repl){
+    if (!_len || !find._len) return;
+    int diff = (int)repl._len - (int)find._len;
+    if (diff == 0) {
+      for (char* p = strstr(_buf, find._buf); p; p = strstr(p + repl._len, find._buf)) memcpy(p, repl._buf, repl._len);
+      return;
+    }
+    size_t n = 0;
+    for (const char* p = strstr(_buf, find._buf); p; p = strstr(p + find._len, find._buf)) n++;
+    if (!n) return;
+    size_t newLen = _len + n * diff;
+    char* nb = new char[newLen + 1];
+    char* w = nb;
+    const char* r = _buf;
+    for (const char* p = strstr(r, find._buf); p; p = strstr(r, find._buf)) {
+      memcpy(w, r, p - r); w += p - r;
+      memcpy(w, repl.c_str(), repl._len); w += repl._len;
+      r = p + find._len;
+    }
+    memcpy(w, r, _buf + _len - r + 1);
+    delete[] _buf;
+    _buf = nb; _len = newLen; _cap = newLen;
+  }
+  void replace(const char* find, const String& repl){ replace(String(find), repl); }
+  void replace(const char* find, const char* repl)  { replace(String(find), String(repl)); }
+
+private:
+  char*  _buf = nullptr;
+  size_t _len = 0, _cap = 0;
+
+  void grow(size_t n){
+    char* nb = new char[n + 1];
+    if (_buf) memcpy(nb, _buf, _len + 1); else nb[0] = 0;
+    delete[] _buf;
+    _buf = nb; _cap = n;
+  }
+  void assign(const char* s, size_t n){
+    if (n > _cap || !_buf) grow(n);
+    memcpy(_buf, s, n);
+    _len = n; _buf[n] = 0;
+  }
+};
+
+inline String operator+(const String& a, const String& b){ String r(a); r += b; return r; }
+inline String operator+(const String& a, const char* b)  { String r(a); r += b; return r; }
+inline String operator+(const char* a, const String& b)  { String r(a); r += b; return r; }
+inline String operator+(const String& a, char c)         { String r(a); r += c; return r; }
@@ -0,0 +1,47 @@
+#pragma once
+// =========================【主機測試：堆積量測 heap_probe】=========================
+// 取代全域 operator new / delete，統計目前配置量、峰值與配置次數。
+// 每個測試程式只有一個 test_main.cpp，只能在那裡 include 一次（定義不可重複）。
+//   heapProbeReset();  …被測程式…  heapProbePeak() / heapProbeAllocs()
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+
+struct HeapProbe {
+  size_t cur = 0, peak = 0, base = 0;
+  size_t allocs = 0;
+};
+
+static HeapProbe gHeapProbe;
+
+static inline void heapProbeReset(){
+  gHeapProbe.base = gHeapProbe.peak = gHeapProbe.cur;
+  gHeapProbe.allocs = 0;
+}
+// 自上次 reset 以來：峰值增量（bytes）/ 配置次數
+static inline size_t heapProbePeak()  { return gHeapProbe.peak - gHeapProbe.base; }
+static inline size_t heapProbeAllocs(){ return gHeapProbe.allocs; }
+
+// 每塊前面放一個 size 標頭，delete 時扣回
+static void* heapProbeAlloc(size_t n){
+  size_t* p = (size_t*)malloc(n + sizeof(max_align_t));
+  if (!p) throw std::bad_alloc();
+  *p = n;
+  gHeapProbe.cur += n;
+  gHeapProbe.allocs++;
+  if (gHeapProbe.cur > gHeapProbe.peak) gHeapProbe.peak = gHeapProbe.cur;
+  return (char*)p + sizeof(max_align_t);
+}
+static void heapProbeFree(void* q){
+  if (!q) return;
+  size_t* p = (size_t*)((char*)q - sizeof(max_align_t));
+  gHeapProbe.cur -= *p;
+  free(p);
+}
+
+void* operator new(size_t n)                   { return heapProbeAlloc(n); }
+void* operator new[](size_t n)                 { return heapProbeAlloc(n); }
+void  operator delete(void* p) noexcept        { heapProbeFree(p); }
+void  operator delete[](void* p) noexcept      { heapProbeFree(p); }
+void  operator delete(void* p, size_t) noexcept   { heapProbeFree(p); }
+void  operator delete[](void* p, size_t) noexcept { heapProbeFree(p); }
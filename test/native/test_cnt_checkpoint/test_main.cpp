@@ -0,0 +1,250 @@
+// 工件計數斷電保存：隨機斷電模擬
+//   裝置反覆「開機還原 → 計數一段時間 → 斷電 / 重開機」，斷點可落在 flash 寫入的任一步（含寫一半）。
+//   斷電（RTC 記憶體消失）最多遺失一個 flash 間隔；重開機（RTC 保留）最多遺失一個 RTC 間隔。
+//   pio test -e native -f native/test_cnt_checkpoint -v
+#include <unity.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <random>
+#include <math.h>
+#include "cnt_checkpoint.h"
+
+// 間隔與檔案路徑取自 cnt_checkpoint.h（與 main.cpp 相同）
+static const uint32_t LOOP_MS  = 10;
+static const uint32_t PULSE_PCT = 8;       // 每圈每路計到一件的機率（%）
+
+// ---------- 記憶體內的 SPIFFS：每個操作都可能是斷電點 ----------
+struct PowerCut {};
+
+struct SimFs {
+  std::map<std::string, std::vector<uint8_t>> files;
+  long opsLeft = -1;                  // <0 不斷電；0 = 下一個操作中途斷電
+  std::mt19937* rng = nullptr;
+
+  void tick(){ if (opsLeft >= 0 && opsLeft-- == 0) throw PowerCut(); }
+
+  bool exists(const char* p) const { return files.count(p) != 0; }
+  void truncate(const char* p){ tick(); files[p].clear(); }
+  void write(const char* p, const void* d, size_t n){
+    if (opsLeft == 0) {                                 // 寫一半
+      size_t part = (*rng)() % n;
+      files[p].insert(files[p].end(), (const uint8_t*)d, (const uint8_t*)d + part);
+    }
+    tick();
+    files[p].insert(files[p].end(), (const uint8_t*)d, (const uint8_t*)d + n);
+  }
+  void remove(const char* p){ tick(); files.erase(p); }
+  void rename(const char* a, const char* b){ tick(); auto it = files.find(a); if (it == files.end()) return; files[b] = it->second; files.erase(it); }
+};
+
+static SimFs    gFs;
+static CntCkRec gRtc;                 // RTC_NOINIT：重開機保留，斷電成為亂碼
+
+// ---------- 與 main.cpp CntCheckpoint 相同的檔案操作順序 ----------
+class SimCheckpoint {
+public:
+  uint32_t qty[CNT_CK_CH] = {0, 0};
+  bool     urgent = false;
+  const char* src = "none";
+
+  void restore(uint32_t nowMs){
+    CntCkPick pick;
+    pick.offerRtc(gRtc);
+    bool torn = false;
+    readLog(pick, CNT_CK_TMP, torn);
+    torn = false;
+    _fileSize = readLog(pick, CNT_CK_PATH, torn);
+    if (torn) _fileSize = CNT_CK_FILE_MAX;
+    for (int ch = 0; ch < CNT_CK_CH; ++ch) qty[ch] = pick.have ? pick.best.qty[ch] : 0;
+    src = pick.src;
+    _plan.begin(pick, nowMs);
+  }
+
+  // 回傳是否做了 RTC checkpoint
+  bool loop(uint32_t nowMs){
+    CntCkRec r;
+    int w = _plan.step(nowMs, qty, urgent, r);
+    if (w == CntCkPlanner::W_NONE) return false;
+    gRtc = r;
+    if (w & CntCkPlanner::W_FLASH) { writeFlash(r); urgent = false; }
+    return true;
+  }
+
+  uint32_t flashWrites = 0;
+
+private:
+  CntCkPlanner _plan{CNT_CK_RTC_MS, CNT_CK_FLASH_MS, CNT_CK_URGENT_MS};
+  size_t _fileSize = 0;
+
+  static size_t readLog(CntCkPick& pick, const char* path, bool& torn){
+    if (!gFs.exists(path)) return 0;
+    const std::vector<uint8_t>& f = gFs.files[path];
+    size_t ok = 0;
+    CntCkRec r;
+    while (ok + sizeof(r) <= f.size()) {
+      memcpy(&r, &f[ok], sizeof(r));
+      if (!pick.offerLog(r)) break;
+      ok += sizeof(r);
+    }
+    torn = ok < f.size();
+    return f.size();
+  }
+
+  void writeFlash(const CntCkRec& r){
+    if (_fileSize + sizeof(r) > CNT_CK_FILE_MAX) {
+      gFs.truncate(CNT_CK_TMP);
+      gFs.write(CNT_CK_TMP, &r, sizeof(r));
+      gFs.remove(CNT_CK_PATH);
+      gFs.rename(CNT_CK_TMP, CNT_CK_PATH);
+      _fileSize = sizeof(r);
+    } else {
+      gFs.write(CNT_CK_PATH, &r, sizeof(r));
+      _fileSize += sizeof(r);
+    }
+    _plan.flashDone(r);
+    flashWrites++;
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+// 每次 RTC checkpoint 時的數量快照
+struct Snap { uint32_t t; uint32_t q[CNT_CK_CH]; };
+
+static bool findSnap(const std::vector<Snap>& snaps, uint32_t from, const uint32_t* q){
+  for (const Snap& s : snaps)
+    if (s.t >= from && !memcmp(s.q, q, sizeof(s.q))) return true;
+  return false;
+}
+
+// 一次開機週期：執行 runMs 後斷電；midWrite = 斷點落在下一次 flash 寫入的第幾個操作
+static void lifetime(unsigned seed, int cycles, bool keepRtc, uint32_t& worstLost, uint32_t& torn){
+  std::mt19937 rng(seed);
+  gFs = SimFs(); gFs.rng = &rng;
+  memset(&gRtc, 0xA5, sizeof(gRtc));
+
+  uint32_t lastQty[CNT_CK_CH] = {0, 0};       // 上次斷電時的真實數量
+  std::vector<Snap> snaps;                     // 上次開機週期的快照
+  uint32_t cutAt = 0;
+  bool     first = true;
+
+  for (int c = 0; c < cycles; ++c) {
+    SimCheckpoint ck;
+    gFs.opsLeft = -1;
+    ck.restore(0);
+
+    if (!first) {
+      // 還原值必須等於斷電前一個間隔內某次 checkpoint 的數量
+      uint32_t win = keepRtc ? CNT_CK_RTC_MS : CNT_CK_FLASH_MS + CNT_CK_RTC_MS;
+      uint32_t from = cutAt > win ? cutAt - win : 0;
+      char msg[96];
+      snprintf(msg, sizeof(msg), "cycle %d: restored %u/%u from %s", c, ck.qty[0], ck.qty[1], ck.src);
+      TEST_ASSERT_TRUE_MESSAGE(findSnap(snaps, from, ck.qty), msg);
+      for (int ch = 0; ch < CNT_CK_CH; ++ch)
+        if (lastQty[ch] >= ck.qty[ch] && lastQty[ch] - ck.qty[ch] > worstLost) worstLost = lastQty[ch] - ck.qty[ch];
+    }
+    first = false;
+
+    snaps.clear();
+    snaps.push_back({0, {ck.qty[0], ck.qty[1]}});
+    uint32_t runMs = 1000 + rng() % (20 * 60 * 1000);
+    bool cutInWrite = (rng() % 3) == 0;        // 三分之一的斷點落在 flash 寫入途中
+    uint32_t t = 0;
+    try {
+      for (t = LOOP_MS; t <= runMs || cutInWrite; t += LOOP_MS) {
+        for (int ch = 0; ch < CNT_CK_CH; ++ch)
+          if (rng() % 100 < PULSE_PCT) ck.qty[ch]++;   // 每路約 8 件/秒
+        if (rng() % 20000 == 0) {              // 偶爾回報歸零
+          ck.qty[0] = ck.qty[1] = 0;
+          ck.urgent = true;
+        }
+        if (t > runMs && gFs.opsLeft < 0) gFs.opsLeft = rng() % 4;
+        if (ck.loop(t)) snaps.push_back({t, {ck.qty[0], ck.qty[1]}});
+        if (t > runMs + 10 * CNT_CK_FLASH_MS) break;   // 數量沒變就不會寫 flash
+      }
+    } catch (const PowerCut&) {              // 斷在 flash 寫入途中：這一輪的 RTC 紀錄已寫好
+      snaps.push_back({t, {ck.qty[0], ck.qty[1]}});
+      torn++;
+    }
+    cutAt = t;
+    memcpy(lastQty, ck.qty, sizeof(lastQty));
+    if (!keepRtc) memset(&gRtc, rng() & 0xFF, sizeof(gRtc));
+  }
+}
+
+// 一個間隔內計到的件數上限。遺失的就是最後一筆有效 checkpoint 之後計到的件數，
+// lifetime() 已逐輪確認那一筆落在斷電前一個間隔內（findSnap），所以遺失量 ≤ 一個間隔的件數；
+// 件數是隨機的（每圈 PULSE_PCT% 的二項分佈），上限取期望值 + 4σ（種子固定，結果可重現）。
+static uint32_t oneIntervalPulses(uint32_t winMs){
+  double n = winMs / LOOP_MS, p = PULSE_PCT / 100.0;
+  return (uint32_t)(n * p + 4 * sqrt(n * p * (1 - p)));
+}
+
+static void test_power_off_loses_at_most_one_flash_interval(){
+  uint32_t worst = 0, torn = 0;
+  for (unsigned seed = 1; seed <= 8; ++seed) lifetime(seed, 60, false, worst, torn);
+  char msg[96];
+  snprintf(msg, sizeof(msg), "power off: worst loss %u pulses/channel, %u cuts inside a flash write", worst, torn);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(torn > 0);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(oneIntervalPulses(CNT_CK_FLASH_MS + CNT_CK_RTC_MS), worst);
+}
+
+static void test_reset_loses_at_most_one_rtc_interval(){
+  uint32_t worst = 0, torn = 0;
+  for (unsigned seed = 101; seed <= 108; ++seed) lifetime(seed, 60, true, worst, torn);
+  char msg[96];
+  snprintf(msg, sizeof(msg), "reset: worst loss %u pulses/channel, %u cuts inside a flash write", worst, torn);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(oneIntervalPulses(CNT_CK_RTC_MS), worst);
+}
+
+// 壓實時 remove 之後、rename 之前斷電：只剩暫存檔也要能還原
+static void test_restore_from_tmp_after_cut_between_remove_and_rename(){
+  std::mt19937 rng(7);
+  gFs = SimFs(); gFs.rng = &rng;
+  memset(&gRtc, 0, sizeof(gRtc));
+  CntCkRec r = {};
+  r.magic = CNT_CK_MAGIC; r.seq = 41; r.qty[0] = 1234; r.qty[1] = 5;
+  r.crc = cntCkCrc(r);
+  gFs.files[CNT_CK_TMP].assign((const uint8_t*)&r, (const uint8_t*)&r + sizeof(r));
+  SimCheckpoint ck;
+  ck.restore(0);
+  TEST_ASSERT_EQUAL_UINT32(1234, ck.qty[0]);
+  TEST_ASSERT_EQUAL_STRING("flash", ck.src);
+}
+
+// 尾巴寫一半：還原時停在有效紀錄；下一筆改為壓實，不接在垃圾後面
+static void test_torn_tail_forces_compaction(){
+  std::mt19937 rng(9);
+  gFs = SimFs(); gFs.rng = &rng;
+  memset(&gRtc, 0, sizeof(gRtc));
+  CntCkRec r = {};
+  r.magic = CNT_CK_MAGIC; r.seq = 10; r.qty[0] = 7; r.crc = cntCkCrc(r);
+  std::vector<uint8_t>& f = gFs.files[CNT_CK_PATH];
+  f.assign((const uint8_t*)&r, (const uint8_t*)&r + sizeof(r));
+  f.insert(f.end(), (const uint8_t*)&r, (const uint8_t*)&r + 9);       // 半筆
+
+  SimCheckpoint ck;
+  ck.restore(0);
+  TEST_ASSERT_EQUAL_UINT32(7, ck.qty[0]);
+  ck.qty[0] = 8;
+  ck.loop(CNT_CK_FLASH_MS);
+  TEST_ASSERT_EQUAL_UINT32(1, ck.flashWrites);
+  TEST_ASSERT_EQUAL(sizeof(CntCkRec), gFs.files[CNT_CK_PATH].size());
+
+  SimCheckpoint again;
+  again.restore(0);
+  TEST_ASSERT_EQUAL_UINT32(8, again.qty[0]);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_power_off_loses_at_most_one_flash_interval);
+  RUN_TEST(test_reset_loses_at_most_one_rtc_interval);
+  RUN_TEST(test_restore_from_tmp_after_cut_between_remove_and_rename);
+  RUN_TEST(test_torn_tail_forces_compaction);
+  return UNITY_END();
+}
@@ -0,0 +1,184 @@
+// 工件計數兩種實作的脈衝列模擬：
+//   ISR  ：CntGate（作用邊緣計一次並去武裝，loop 每 1ms 輪詢，回閒置電平穩定 20ms 才 re-arm）
+//   PCNT ：硬體只濾掉短於 1023 個 APB 週期（約 12.8μs）的脈衝，16 位元計到 32000 歸零 + 溢位 ISR
+//   pio test -e native -f native/test_cnt_pulse
+#include <unity.h>
+#include <vector>
+#include <random>
+#include "cnt_pulse.h"
+
+// 與 main.cpp 相同的參數
+static const uint32_t CNT_DEBOUNCE_MS = 20;
+static const uint32_t CNT_MIN_US      = 3000;
+static const uint32_t PCNT_FILTER_US  = 13;      // 1023 / 80MHz ≈ 12.8μs
+static const int16_t  PCNT_H_LIM      = 32000;
+static const int      ACTIVE = 0, IDLE = 1;      // 低有效
+
+// 脈衝列：依時間排序的電平變化
+struct Edge { uint64_t us; int lvl; };
+typedef std::vector<Edge> Train;
+
+// 一次動作：按下（前緣彈跳）→ 保持 holdUs → 放開（後緣彈跳）
+static void press(Train& t, uint64_t& at, std::mt19937& rng, int bounces, uint32_t holdUs, uint32_t gapUs){
+  std::uniform_int_distribution<uint32_t> bw(20, 400);   // 彈跳寬度 20~400μs
+  for (int b = 0; b < bounces; ++b) { t.push_back({at, ACTIVE}); at += bw(rng); t.push_back({at, IDLE}); at += bw(rng); }
+  t.push_back({at, ACTIVE}); at += holdUs;
+  for (int b = 0; b < bounces; ++b) { t.push_back({at, IDLE}); at += bw(rng); t.push_back({at, ACTIVE}); at += bw(rng); }
+  t.push_back({at, IDLE}); at += gapUs;
+}
+
+// 加一個極短的毛刺（例如感應雜訊）
+static void glitch(Train& t, uint64_t& at, uint32_t widthUs, uint32_t gapUs){
+  t.push_back({at, ACTIVE}); at += widthUs; t.push_back({at, IDLE}); at += gapUs;
+}
+
+// ---------- ISR 實作：邊緣中斷 + loop() 每 1ms 輪詢 ----------
+static uint32_t runIsr(const Train& t){
+  CntGate g;
+  g.begin(IDLE, 0);
+  uint32_t count = 0;
+  int lvl = IDLE;
+  uint64_t nextPollUs = 1000;
+  for (const Edge& e : t) {
+    while (nextPollUs <= e.us) { g.poll(lvl, IDLE, (uint32_t)(nextPollUs / 1000), CNT_DEBOUNCE_MS); nextPollUs += 1000; }
+    if (e.lvl != lvl) {
+      lvl = e.lvl;
+      if (lvl == ACTIVE && g.onActive((uint32_t)e.us, CNT_MIN_US)) count++;   // micros() 32 位元
+    }
+  }
+  return count;
+}
+
+// ---------- PCNT 實作：數「進入有效電平」的邊緣，濾掉過短脈衝 ----------
+struct PcntModel {
+  int16_t  hw = 0;
+  uint32_t ovf = 0;
+  uint64_t last = 0;
+  bool     ovfPending = false;   // 硬體已歸零、ISR 尚未累加
+
+  void edge(){ if (++hw >= PCNT_H_LIM) { hw = 0; ovfPending = true; } }
+  void isr(){ if (ovfPending) { ovf++; ovfPending = false; } }
+  uint64_t total(){ return cntPcntTotal(ovf, hw, PCNT_H_LIM, last); }
+};
+
+static uint32_t runPcnt(const Train& t){
+  PcntModel m;
+  int lvl = IDLE;
+  for (size_t i = 0; i < t.size(); ++i) {
+    const Edge& e = t[i];
+    if (e.lvl == lvl) continue;
+    lvl = e.lvl;
+    if (lvl != ACTIVE) continue;
+    uint64_t width = (i + 1 < t.size()) ? t[i + 1].us - e.us : ~0ull;
+    if (width > PCNT_FILTER_US) { m.edge(); m.isr(); }
+  }
+  return (uint32_t)m.total();
+}
+
+void setUp() {}
+void tearDown() {}
+
+// 乾淨的感測器輸出：兩種實作都精確
+static void test_clean_pulses_both_exact(){
+  std::mt19937 rng(1);
+  Train t; uint64_t at = 5000;
+  for (int i = 0; i < 500; ++i) press(t, at, rng, 0, 30000, 40000);
+  TEST_ASSERT_EQUAL_UINT32(500, runIsr(t));
+  TEST_ASSERT_EQUAL_UINT32(500, runPcnt(t));
+}
+
+// 機械接點：按下與放開各彈跳數次 → ISR 每次動作只算一次；PCNT 會重複計數（所以不是預設）
+static void test_bouncing_contact_isr_counts_once(){
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<int> nb(1, 6);
+  Train t; uint64_t at = 5000;
+  for (int i = 0; i < 500; ++i) press(t, at, rng, nb(rng), 50000, 60000);
+  TEST_ASSERT_EQUAL_UINT32(500, runIsr(t));
+  TEST_ASSERT_GREATER_THAN_UINT32(500, runPcnt(t));
+}
+
+// 短於 12.8μs 的毛刺：PCNT 濾波器擋掉；ISR 由最短間隔 / 武裝狀態擋掉緊跟在計數後的毛刺
+static void test_short_glitches(){
+  std::mt19937 rng(3);
+  Train t; uint64_t at = 5000;
+  for (int i = 0; i < 200; ++i) {
+    press(t, at, rng, 0, 30000, 1000);
+    glitch(t, at, 5, 39000);                 // 放開後 1ms 的毛刺：ISR 尚未 re-arm
+  }
+  TEST_ASSERT_EQUAL_UINT32(200, runIsr(t));
+  TEST_ASSERT_EQUAL_UINT32(200, runPcnt(t));
+}
+
+// 放開後閒置不足去抖時間就再按：ISR 不 re-arm，第二次不計（規格上的最短週期 = 去抖時間）
+static void test_isr_requires_stable_idle_before_rearm(){
+  std::mt19937 rng(4);
+  Train t; uint64_t at = 5000;
+  press(t, at, rng, 0, 10000, 5000);         // 閒置 5ms < 20ms
+  press(t, at, rng, 0, 10000, 40000);
+  press(t, at, rng, 0, 10000, 40000);
+  TEST_ASSERT_EQUAL_UINT32(2, runIsr(t));
+}
+
+// 彈跳整段落在兩次輪詢之間（loop 沒看到任何電平變化）：去武裝本身要重置去抖計時
+static void test_isr_bounce_between_polls_does_not_rearm(){
+  CntGate g;
+  g.begin(IDLE, 0);
+  g.poll(IDLE, IDLE, 50, CNT_DEBOUNCE_MS);   // 已閒置 50ms
+  TEST_ASSERT_TRUE(g.onActive(50100, CNT_MIN_US));
+  // 50.1ms 按下、50.4ms 彈回閒置、51.2ms 再按：51ms 的輪詢只看到閒置
+  TEST_ASSERT_FALSE(g.poll(IDLE, IDLE, 51, CNT_DEBOUNCE_MS));
+  TEST_ASSERT_FALSE(g.onActive(51200, CNT_MIN_US));
+  TEST_ASSERT_FALSE(g.poll(ACTIVE, IDLE, 55, CNT_DEBOUNCE_MS));
+  TEST_ASSERT_FALSE(g.poll(IDLE, IDLE, 90, CNT_DEBOUNCE_MS));
+  TEST_ASSERT_TRUE(g.poll(IDLE, IDLE, 110, CNT_DEBOUNCE_MS));
+}
+
+// micros() 繞回（約 71 分鐘）不影響最短間隔判斷
+static void test_isr_micros_wraparound(){
+  CntGate g;
+  g.begin(IDLE, 0);
+  g.lastUs = 0xFFFFF000u;                    // 繞回前 4096μs 計過一次
+  g.armed  = false;
+  TEST_ASSERT_FALSE(g.onActive(0x00000100u, CNT_MIN_US));   // 間隔 4352μs，但未 re-arm
+  g.armed = true;
+  TEST_ASSERT_FALSE(g.onActive(0xFFFFF800u, CNT_MIN_US));   // 間隔 2048μs < 3000
+  TEST_ASSERT_TRUE(g.onActive(0x00000100u, CNT_MIN_US));
+}
+
+// 32 位元 ISR 計數繞回後，64 位元總數仍連續
+static void test_widen32(){
+  CntWiden32 w;
+  TEST_ASSERT_EQUAL_UINT64(0xFFFFFFF0ull, w(0xFFFFFFF0u));
+  TEST_ASSERT_EQUAL_UINT64(0x100000005ull, w(5));
+  TEST_ASSERT_EQUAL_UINT64(0x100000005ull, w(5));
+  TEST_ASSERT_EQUAL_UINT64(0x100000100ull, w(0x100));
+}
+
+// PCNT 溢位：10 萬個脈衝跨過多次 32000；讀值夾在「硬體歸零」與「溢位 ISR」之間時不可倒退
+static void test_pcnt_overflow_monotonic(){
+  PcntModel m;
+  uint64_t prev = 0;
+  for (uint32_t i = 1; i <= 100000; ++i) {
+    m.edge();
+    uint64_t t = m.total();                  // ISR 還沒跑
+    TEST_ASSERT_TRUE(t >= prev);
+    prev = t;
+    m.isr();
+    t = m.total();
+    TEST_ASSERT_EQUAL_UINT64(i, t);
+    prev = t;
+  }
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_pulses_both_exact);
+  RUN_TEST(test_bouncing_contact_isr_counts_once);
+  RUN_TEST(test_short_glitches);
+  RUN_TEST(test_isr_requires_stable_idle_before_rearm);
+  RUN_TEST(test_isr_bounce_between_polls_does_not_rearm);
+  RUN_TEST(test_isr_micros_wraparound);
+  RUN_TEST(test_widen32);
+  RUN_TEST(test_pcnt_overflow_monotonic);
+  return UNITY_END();
+}
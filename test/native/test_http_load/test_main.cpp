@@ -0,0 +1,276 @@
+// HTTP 服務層負載測試（主機模擬）：50 個同時連線的 client，其中 5 個建立連線後停止接收。
+//   模擬 HttpJobServer 的結構：兩條工作佇列（fast / slow，深度 8，滿了 503）、handler 持有 app lock、
+//   串流回應經 4KB 管道交給 client、loop() 每 2ms 取一次 app lock。管道寫入用韌體同一份 httpPipeWrite。
+//   比較「等待管道時持有 app lock（舊）」與「交出 app lock（新）」：loop() 最長等待與 client 延遲 p50 / p99。
+//   逾時縮短為 400ms（韌體 5s）以加快測試。
+//   pio test -e native -f native/test_http_load -v
+#include <unity.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include "http_pipe.h"
+
+static const uint32_t TIMEOUT_MS   = 400;
+static const size_t   PIPE_BYTES   = 4096;
+static const size_t   QUEUE_DEPTH  = 8;
+static const int      CLIENTS      = 50;
+static const int      STALLED      = 5;
+static const int      REQS_EACH    = 6;
+static const size_t   PAGE_BYTES   = 22 * 1024;   // 首頁大小
+static const size_t   STATUS_BYTES = 1500;        // /api/status
+
+typedef std::chrono::steady_clock Clk;
+static Clk::time_point gT0 = Clk::now();
+static uint32_t nowMs(){ return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clk::now() - gT0).count(); }
+static double   sinceMs(Clk::time_point t){ return std::chrono::duration<double, std::milli>(Clk::now() - t).count(); }
+
+// ---------- StreamBuffer 替身 ----------
+class Pipe {
+public:
+  size_t send(const uint8_t* p, size_t n, uint32_t waitMs){
+    std::unique_lock<std::mutex> lk(_m);
+    if (_len == PIPE_BYTES && waitMs)
+      _cv.wait_for(lk, std::chrono::milliseconds(waitMs), [&]{ return _len < PIPE_BYTES; });
+    size_t k = std::min(n, PIPE_BYTES - _len);
+    for (size_t i = 0; i < k; ++i) _buf[(_head + _len + i) % PIPE_BYTES] = p[i];
+    _len += k;
+    return k;
+  }
+  size_t receive(uint8_t* out, size_t max){
+    std::lock_guard<std::mutex> lk(_m);
+    size_t k = std::min(max, _len);
+    for (size_t i = 0; i < k; ++i) out[i] = _buf[(_head + i) % PIPE_BYTES];
+    _head = (_head + k) % PIPE_BYTES; _len -= k;
+    if (k) _cv.notify_all();
+    return k;
+  }
+private:
+  std::mutex _m;
+  std::condition_variable _cv;
+  uint8_t _buf[PIPE_BYTES];
+  size_t  _head = 0, _len = 0;
+};
+
+struct Job {
+  int      route = 0;                    // 0 = "/"，1 = /api/status，2 = slow（/tg：TLS 期間交出 lock）
+  uint32_t queuedAt = 0, lastProgress = 0;
+  Pipe     pipe;
+  bool     dispatched = false;
+  std::atomic<bool> headers{false}, finished{false};
+  volatile bool aborted = false;
+  int      code = 200;
+};
+typedef std::shared_ptr<Job> JobPtr;
+
+// ---------- 伺服器 ----------
+struct Server {
+  bool unlockWhileFull = true;           // false = 舊版：等待管道時仍持有 app lock
+  std::mutex app;                        // gAppMtx（不可重入）
+  std::mutex qm;
+  std::condition_variable qcv;
+  std::deque<JobPtr> q[2];
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> rejected{0}, stalled{0}, expired{0}, served{0};
+
+  bool enqueue(const JobPtr& j){
+    std::lock_guard<std::mutex> lk(qm);
+    int lane = j->route == 2 ? 1 : 0;
+    if (q[lane].size() >= QUEUE_DEPTH) { rejected++; return false; }
+    j->queuedAt = nowMs();
+    q[lane].push_back(j);
+    qcv.notify_all();
+    return true;
+  }
+
+  struct Port {
+    Server& s; Job& j;
+    size_t   send(const uint8_t* p, size_t n, uint32_t ms){ return j.pipe.send(p, n, ms); }
+    void     dispatch(){ j.headers = true; }
+    void     unlock(){ if (s.unlockWhileFull) s.app.unlock(); }
+    void     lock(){ if (s.unlockWhileFull) s.app.lock(); }
+    uint32_t now(){ return nowMs(); }
+  };
+
+  void write(Job& j, const uint8_t* p, size_t n){
+    Port port{ *this, j };
+    if (httpPipeWrite(port, p, n, TIMEOUT_MS, j.dispatched, j.lastProgress, j.aborted) == HP_STALLED) {
+      j.aborted = true;
+      stalled++;
+    }
+  }
+
+  // handler：以 1KB 區塊（HttpChunkWriter 的緩衝）輸出，每塊約 0.1ms 產生時間
+  void handle(Job& j){
+    size_t total = j.route == 0 ? PAGE_BYTES : STATUS_BYTES;
+    if (j.route == 2) {                      // /tg：TLS 往返期間交出 app lock
+      app.unlock();
+      std::this_thread::sleep_for(std::chrono::milliseconds(60));
+      app.lock();
+      total = 64;
+    }
+    uint8_t chunk[1024];
+    for (size_t off = 0; off < total && !j.aborted; off += sizeof(chunk)) {
+      size_t k = std::min(sizeof(chunk), total - off);
+      for (size_t i = 0; i < k; ++i) chunk[i] = (uint8_t)(off + i);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      write(j, chunk, k);
+    }
+  }
+
+  void worker(int lane){
+    for (;;) {
+      JobPtr j;
+      {
+        std::unique_lock<std::mutex> lk(qm);
+        qcv.wait(lk, [&]{ return stop || !q[lane].empty(); });
+        if (stop && q[lane].empty()) return;
+        j = q[lane].front(); q[lane].pop_front();
+      }
+      if (j->aborted) continue;
+      if (nowMs() - j->queuedAt > TIMEOUT_MS) { expired++; j->code = 503; j->headers = true; j->finished = true; continue; }
+      {
+        std::lock_guard<std::mutex> lk(app);
+        handle(*j);
+        served++;
+      }
+      j->headers = true;                     // finish()：未 dispatch 的小回應此時送出
+      j->finished = true;
+    }
+  }
+};
+
+// ---------- client ----------
+struct Stats {
+  std::mutex m;
+  std::vector<double> lat;
+  size_t okBytes = 0;
+  int    ok = 0, badLen = 0;
+};
+
+static void client(Server& s, Stats& st, int id){
+  bool stall = id < STALLED;
+  int reqs = stall ? 1 : REQS_EACH;
+  for (int r = 0; r < reqs; ++r) {
+    int route = stall ? 0 : (r % 6 == 5 ? 2 : r % 2);
+    Clk::time_point t = Clk::now();
+    JobPtr j;
+    for (;;) {                               // 503 → 稍後重試（與瀏覽器重新整理相同）
+      j = std::make_shared<Job>();
+      j->route = route;
+      if (s.enqueue(j)) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    size_t got = 0;
+    uint8_t buf[1460];
+    for (;;) {
+      if (stall) {                           // 送出請求後不再接收：等伺服器放棄
+        if (j->aborted || j->finished) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        continue;
+      }
+      bool fin = j->finished || j->aborted;
+      size_t n = j->headers ? j->pipe.receive(buf, sizeof(buf)) : 0;
+      got += n;
+      if (!n && fin) break;
+      if (!n) std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    if (stall) continue;
+    if (j->code == 503) { r--; continue; }   // 排隊逾時：重試
+    size_t want = route == 0 ? PAGE_BYTES : route == 1 ? STATUS_BYTES : 64;
+    std::lock_guard<std::mutex> lk(st.m);
+    st.lat.push_back(sinceMs(t));
+    if (got == want) { st.ok++; st.okBytes += got; } else st.badLen++;
+  }
+}
+
+struct Result { double loopMax, loopP99, p50, p99; int ok, badLen; uint32_t stalled, rejected, expired; };
+
+static double pct(std::vector<double>& v, double p){
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static Result runLoad(bool unlockWhileFull){
+  Server s;
+  s.unlockWhileFull = unlockWhileFull;
+  Stats st;
+  std::vector<double> loopWait;
+  std::atomic<bool> done{false};
+
+  std::thread w0([&]{ s.worker(0); }), w1([&]{ s.worker(1); });
+  std::thread loop([&]{                      // loop()：每 2ms 一輪，每輪持有 app lock 約 0.2ms
+    while (!done) {
+      Clk::time_point t = Clk::now();
+      {
+        std::lock_guard<std::mutex> lk(s.app);
+        loopWait.push_back(sinceMs(t));
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  });
+
+  std::vector<std::thread> cs;
+  for (int i = 0; i < CLIENTS; ++i) cs.emplace_back(client, std::ref(s), std::ref(st), i);
+  for (auto& c : cs) c.join();
+
+  done = true;
+  loop.join();
+  { std::lock_guard<std::mutex> lk(s.qm); s.stop = true; s.qcv.notify_all(); }
+  w0.join(); w1.join();
+
+  Result r;
+  r.loopMax = loopWait.empty() ? 0 : *std::max_element(loopWait.begin(), loopWait.end());
+  r.loopP99 = pct(loopWait, 0.99);
+  r.p50 = pct(st.lat, 0.50);
+  r.p99 = pct(st.lat, 0.99);
+  r.ok = st.ok; r.badLen = st.badLen;
+  r.stalled = s.stalled; r.rejected = s.rejected; r.expired = s.expired;
+  return r;
+}
+
+static void report(const char* name, const Result& r){
+  char msg[220];
+  snprintf(msg, sizeof(msg), "%-22s loop() lock wait max %6.1f ms p99 %5.1f ms | requests ok %d p50 %6.1f ms p99 %6.1f ms | stalled %u 503 %u expired %u",
+           name, r.loopMax, r.loopP99, r.ok, r.p50, r.p99, r.stalled, r.rejected, r.expired);
+  TEST_MESSAGE(msg);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static const int EXPECT_OK = (CLIENTS - STALLED) * REQS_EACH;
+
+// 新版：停滯的 client 不會卡住 loop()
+static void test_unlock_while_pipe_full(){
+  Result r = runLoad(true);
+  report("unlock while full", r);
+  TEST_ASSERT_EQUAL(EXPECT_OK, r.ok);
+  TEST_ASSERT_EQUAL(0, r.badLen);
+  TEST_ASSERT_TRUE(r.stalled >= 1);          // 其餘停滯 client 的請求可能在佇列中就逾時
+  TEST_ASSERT_TRUE(r.loopMax < TIMEOUT_MS / 4);
+}
+
+// 對照：等待管道時持有 app lock，每個停滯的 client 讓 loop() 停住整個逾時
+static void test_hold_lock_while_pipe_full_blocks_loop(){
+  Result r = runLoad(false);
+  report("hold lock while full", r);
+  TEST_ASSERT_EQUAL(EXPECT_OK, r.ok);
+  TEST_ASSERT_TRUE(r.stalled >= 1);          // 其餘停滯 client 的請求可能在佇列中就逾時
+  TEST_ASSERT_TRUE(r.loopMax >= TIMEOUT_MS * 0.9);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_unlock_while_pipe_full);
+  RUN_TEST(test_hold_lock_while_pipe_full_blocks_loop);
+  return UNITY_END();
+}
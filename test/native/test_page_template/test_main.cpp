@@ -0,0 +1,274 @@
+// 首頁模板：預編譯 + 串流渲染 vs 舊版（整頁讀進 String 再逐一 replace）
+//   輸出逐 byte 相同；比較每次渲染的時間與峰值堆積。模板為 data/index.html。
+//   pio test -e native -f native/test_page_template -v
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "heap_probe.h"
+#include "WString.h"
+#include "page_template.h"
+
+static const int RELAY_COUNT = 6, CNT_COUNT = 2, ALARM_COUNT = 6;
+
+// ---------- 假設定（與 main.cpp 的 cfg / gAlarmMsg 同型別）----------
+struct Sched { int hh, mm; uint8_t wd; uint32_t hold; String msg; String extra; };
+struct Cnt   { int hh, mm; String msg; uint32_t target; };
+static struct {
+  uint8_t wdMask = 0x1F;
+  Sched   sch[RELAY_COUNT];
+  Cnt     cnt[CNT_COUNT];
+} cfg;
+static String gAlarmMsg[ALARM_COUNT];
+static bool   gIsAP = false;
+static const char* kIP  = "192.168.1.23";
+static const char* kNow = "2026-10-17 08:30";
+
+static void fillConfig(){
+  static const char* msgs[RELAY_COUNT] = { "上班鈴", "", "午休", "下班鈴", "", "加班" };
+  for (int i = 0; i < RELAY_COUNT; ++i) {
+    cfg.sch[i].hh = 8 + i; cfg.sch[i].mm = 5 * i; cfg.sch[i].wd = (uint8_t)(0x7F >> (i % 3));
+    cfg.sch[i].hold = 7 + 61 * i; cfg.sch[i].msg = msgs[i];
+    cfg.sch[i].extra = (i % 2) ? "12:00,17:30" : "";
+  }
+  for (int i = 0; i < CNT_COUNT; ++i) { cfg.cnt[i].hh = 17; cfg.cnt[i].mm = 30 + i; cfg.cnt[i].msg = i ? "第二線計數" : "第一線計數"; cfg.cnt[i].target = 500 * (i + 1); }
+  for (int i = 0; i < ALARM_COUNT; ++i) gAlarmMsg[i] = String("DI") + String(i + 1) + "異常";
+}
+
+// main.cpp 的 String 小工具
+static String fmt2(int v){ char b[8]; snprintf(b, sizeof(b), "%02d", v); return String(b); }
+static String schWdText(uint8_t m){ char b[8]; for (int i = 0; i < 7; ++i) b[i] = ((m >> i) & 1) ? '1' : '0'; b[7] = 0; return String(b); }
+static String schExtraText(const Sched& s){ return s.extra; }
+static const char* kRtcOk = "\xE2\x9C\x85 RTC 正常";
+
+// ---------- 輸出端：與 HttpChunkWriter 相同的 1KB 固定緩衝，滿了交給 sink ----------
+struct Sink {
+  char*  out = nullptr;      // nullptr = 只計長度（基準用，不讓輸出本身佔堆積）
+  size_t len = 0;
+  uint8_t buf[1024]; size_t n = 0;
+  void write(const void* p, size_t k){
+    const uint8_t* s = (const uint8_t*)p;
+    while (k) {
+      size_t c = sizeof(buf) - n; if (c > k) c = k;
+      memcpy(buf + n, s, c); n += c; s += c; k -= c;
+      if (n == sizeof(buf)) flush();
+    }
+  }
+  void print(const char* s)   { write(s, strlen(s)); }
+  void print(const String& s) { write(s.c_str(), s.length()); }
+  void print(char c)          { write(&c, 1); }
+  void print(unsigned long v) { char b[12]; print((snprintf(b, sizeof(b), "%lu", v), b)); }
+  void flush(){ if (out) memcpy(out + len, buf, n); len += n; n = 0; }
+};
+
+// ---------- 新版：PageTemplate::render 的主機版本 ----------
+static std::string gTpl;                     // 模板檔內容（代替 SPIFFS）
+static std::vector<TplPart> gParts;
+
+static void compileTpl(){
+  TplScanner scan(gParts, TplLimits{ CNT_COUNT, ALARM_COUNT, RELAY_COUNT });
+  for (size_t i = 0; i < gTpl.size(); i += 256)
+    scan.feed((const uint8_t*)gTpl.data() + i, gTpl.size() - i < 256 ? gTpl.size() - i : 256);
+  scan.finish();
+}
+
+static void printVar(Sink& out, uint8_t var, uint8_t i){
+  switch (var) {
+    case TV_IP:           out.print(String(kIP)); break;        // safeIP() 回傳 String
+    case TV_NOW:          out.print(String(kNow)); break;       // nowString() 回傳 String
+    case TV_RTC_STATUS:   out.print(kRtcOk); break;
+    case TV_SHOW_SECRETS: out.print(gIsAP ? "1" : "0"); break;
+    case TV_SSID: case TV_PASS: case TV_TOKEN: case TV_CHAT: break;
+    case TV_WD:           if ((cfg.wdMask >> i) & 0x01) out.print("checked"); break;
+    case TV_CT:           out.print(fmt2(cfg.cnt[i].hh)); out.print(':'); out.print(fmt2(cfg.cnt[i].mm)); break;
+    case TV_CM:           out.print(cfg.cnt[i].msg); break;
+    case TV_CN:           out.print((unsigned long)cfg.cnt[i].target); break;
+    case TV_T:            out.print(fmt2(cfg.sch[i].hh)); out.print(':'); out.print(fmt2(cfg.sch[i].mm)); break;
+    case TV_TX:           out.print(schExtraText(cfg.sch[i])); break;
+    case TV_SW:           out.print(schWdText(cfg.sch[i].wd)); break;
+    case TV_HM:           out.print((unsigned long)(cfg.sch[i].hold / 60)); break;
+    case TV_HS:           out.print((unsigned long)(cfg.sch[i].hold % 60)); break;
+    case TV_M: case TV_MON: case TV_MOFF:
+      if (cfg.sch[i].msg.length()) out.print(cfg.sch[i].msg);
+      else { out.print("RELAY"); out.print((unsigned long)(i + 1)); }
+      if (var == TV_MOFF) out.print("關閉");
+      break;
+    case TV_AM:           out.print(gAlarmMsg[i]); break;
+  }
+}
+
+static void renderNew(Sink& out){
+  uint8_t buf[TPL_SPAN_MAX];                 // 與韌體相同：逐段 seek + read
+  for (const TplPart& p : gParts) {
+    if (p.var == TV_TEXT) { memcpy(buf, gTpl.data() + p.off, p.len); out.write(buf, p.len); }
+    else printVar(out, p.var, p.idx);
+  }
+  out.flush();
+}
+
+// ---------- 舊版（44d6549 之前）renderIndex()：整頁 String + replace ----------
+// readTextFile() 的 f.readString() 在裝置上逐字元 concat；這裡先 reserve 再分段 concat，對舊版有利
+static String readTextFile(){
+  String s;
+  s.reserve(gTpl.size());
+  for (size_t i = 0; i < gTpl.size(); i += 128) s.concat(gTpl.data() + i, gTpl.size() - i < 128 ? gTpl.size() - i : 128);
+  return s;
+}
+
+static String renderOld(){
+  String html = readTextFile();
+  html.replace("{{IP}}", String(kIP));
+  html.replace("{{NOW}}", String(kNow));
+  html.replace("{{RTC_STATUS}}", kRtcOk);
+  html.replace("{{SSID}}",  "");
+  html.replace("{{PASS}}",  "");
+  html.replace("{{TOKEN}}", "");
+  html.replace("{{CHAT}}",  "");
+  html.replace("{{SHOW_SECRETS}}", gIsAP ? "1" : "0");
+  for (int i = 0; i < 7; ++i) html.replace(String("{{WD") + String(i) + "}}", ((cfg.wdMask >> i) & 0x01) ? "checked" : "");
+  for (int i = 0; i < CNT_COUNT; i++) {
+    html.replace(String("{{CT") + String(i) + "}}", fmt2(cfg.cnt[i].hh) + ":" + fmt2(cfg.cnt[i].mm));
+    html.replace(String("{{CM") + String(i) + "}}", cfg.cnt[i].msg);
+    html.replace(String("{{CN") + String(i) + "}}", String((unsigned long)cfg.cnt[i].target));
+  }
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    html.replace(String("{{T") + String(i) + "}}", fmt2(cfg.sch[i].hh) + ":" + fmt2(cfg.sch[i].mm));
+    html.replace(String("{{TX") + String(i) + "}}", schExtraText(cfg.sch[i]));   // 之後新增的欄位，同樣寫法
+    html.replace(String("{{SW") + String(i) + "}}", schWdText(cfg.sch[i].wd));
+    html.replace(String("{{HM") + String(i) + "}}", String((unsigned long)(cfg.sch[i].hold / 60)));
+    html.replace(String("{{HS") + String(i) + "}}", String((unsigned long)(cfg.sch[i].hold % 60)));
+    String mon = cfg.sch[i].msg.length() ? cfg.sch[i].msg : (String("RELAY") + String(i + 1));
+    html.replace(String("{{M") + String(i) + "}}", mon);
+    html.replace(String("{{MON") + String(i) + "}}", mon);
+    html.replace(String("{{MOFF") + String(i) + "}}", mon + "關閉");
+  }
+  for (int i = 0; i < ALARM_COUNT; i++) html.replace(String("{{AM") + String(i) + "}}", gAlarmMsg[i]);
+  return html;
+}
+
+// ---------- 讀模板：pio test 在專案根目錄執行；否則以本檔位置推算 ----------
+static bool loadTemplate(){
+  const char* paths[] = { "data/index.html", nullptr };
+  std::string rel = __FILE__;
+  rel = rel.substr(0, rel.rfind('/') + 1) + "../../../data/index.html";
+  paths[1] = rel.c_str();
+  for (const char* p : paths) {
+    FILE* f = fopen(p, "rb");
+    if (!f) continue;
+    char b[4096]; size_t n;
+    gTpl.clear();
+    while ((n = fread(b, 1, sizeof(b), f)) > 0) gTpl.append(b, n);
+    fclose(f);
+    return true;
+  }
+  return false;
+}
+
+static char gOut[64 * 1024];
+
+void setUp() {}
+void tearDown() {}
+
+static void test_scan_finds_all_known_slots(){
+  TEST_ASSERT_TRUE_MESSAGE(loadTemplate(), "data/index.html not found");
+  compileTpl();
+  size_t slots = 0, text = 0;
+  for (const TplPart& p : gParts) { if (p.var == TV_TEXT) { text += p.len; TEST_ASSERT_TRUE(p.len <= TPL_SPAN_MAX); } else slots++; }
+  size_t braces = 0;                         // 模板裡 {{ 的總數（含不認得的 {{SCREEN_OFF}}）
+  for (size_t i = gTpl.find("{{"); i != std::string::npos; i = gTpl.find("{{", i + 2)) braces++;
+  TEST_ASSERT_EQUAL(braces - 1, slots);
+  TEST_ASSERT_TRUE(text < gTpl.size());
+}
+
+// 未知 key、單個大括號、超過 TPL_SPAN_MAX 的長區段、越界索引
+static void test_scan_edge_cases(){
+  std::vector<TplPart> parts;
+  const char* src = "{x}{{NOPE}}{{WD7}}{{WD6}}{{{IP}}}";
+  TplScanner s(parts, TplLimits{ CNT_COUNT, ALARM_COUNT, RELAY_COUNT });
+  s.feed((const uint8_t*)src, strlen(src));
+  TEST_ASSERT_EQUAL(2, s.finish());
+  TEST_ASSERT_EQUAL(TV_WD, parts[1].var);
+  TEST_ASSERT_EQUAL(6, parts[1].idx);
+  TEST_ASSERT_EQUAL(TV_IP, parts[3].var);
+  TEST_ASSERT_EQUAL(18, parts[0].len);       // "{x}{{NOPE}}{{WD7}}"
+  TEST_ASSERT_EQUAL(1, parts[2].len);        // "{"
+  TEST_ASSERT_EQUAL(1, parts[4].len);        // "}"
+
+  std::string big(1300, 'a');
+  TplScanner s2(parts, TplLimits{ CNT_COUNT, ALARM_COUNT, RELAY_COUNT });
+  s2.feed((const uint8_t*)big.data(), big.size());
+  s2.finish();
+  TEST_ASSERT_EQUAL(3, parts.size());
+  TEST_ASSERT_EQUAL(1300 - 2 * TPL_SPAN_MAX, parts[2].len);
+}
+
+// 新舊輸出逐 byte 相同（STA / AP 兩種）
+static void test_output_identical_to_replace(){
+  fillConfig();
+  compileTpl();
+  for (int ap = 0; ap < 2; ++ap) {
+    gIsAP = ap;
+    Sink s; s.out = gOut;
+    renderNew(s);
+    String old = renderOld();
+    TEST_ASSERT_EQUAL(old.length(), s.len);
+    TEST_ASSERT_EQUAL_MEMORY(old.c_str(), gOut, s.len);
+  }
+}
+
+// 隨機拼湊大括號與 key 片段：與 replace 結果相同
+static void test_random_templates_match_replace(){
+  static const char* bits[] = { "{", "}", "{{", "}}", "IP", "NOW", "WD", "MOFF", "M", "AM", "CT", "TX", "SW", "HS", "SHOW_SECRETS", "3", "9", "1", "0", "x", " " };
+  std::string saved = gTpl;
+  uint32_t seed = 12345;
+  for (int n = 0; n < 20000; ++n) {
+    gTpl.clear();
+    int k = (int)((seed = seed * 1103515245u + 12345u) >> 16) % 40;
+    for (int j = 0; j < k; ++j) gTpl += bits[((seed = seed * 1103515245u + 12345u) >> 16) % (sizeof(bits) / sizeof(bits[0]))];
+    compileTpl();
+    Sink s; s.out = gOut;
+    renderNew(s);
+    String old = renderOld();
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(old.c_str(), std::string(gOut, s.len).c_str(), gTpl.c_str());
+  }
+  gTpl = saved;
+  compileTpl();
+}
+
+static void test_bench_against_string_replace(){
+  const int REP = 300;
+  using clk = std::chrono::steady_clock;
+  gIsAP = false;
+
+  heapProbeReset();
+  auto t0 = clk::now();
+  size_t bytes = 0;
+  for (int i = 0; i < REP; ++i) { Sink s; renderNew(s); bytes = s.len; }
+  double newUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t newPeak = heapProbePeak(), newAllocs = heapProbeAllocs() / REP;
+
+  heapProbeReset();
+  t0 = clk::now();
+  for (int i = 0; i < REP; ++i) { String html = renderOld(); bytes = html.length(); }
+  double oldUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t oldPeak = heapProbePeak(), oldAllocs = heapProbeAllocs() / REP;
+
+  char msg[200];
+  snprintf(msg, sizeof(msg), "index.html %u B -> %u B | new %7.1f us peak %4u B allocs %u | old %7.1f us peak %6u B allocs %u",
+           (unsigned)gTpl.size(), (unsigned)bytes, newUs, (unsigned)newPeak, (unsigned)newAllocs,
+           oldUs, (unsigned)oldPeak, (unsigned)oldAllocs);
+  TEST_MESSAGE(msg);
+
+  TEST_ASSERT_TRUE(newPeak < 256);                   // 只有變數值的小 String
+  TEST_ASSERT_GREATER_OR_EQUAL(gTpl.size(), oldPeak); // 舊版至少整頁
+  TEST_ASSERT_TRUE(newUs < oldUs);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_scan_finds_all_known_slots);
+  RUN_TEST(test_scan_edge_cases);
+  RUN_TEST(test_output_identical_to_replace);
+  RUN_TEST(test_random_templates_match_replace);
+  RUN_TEST(test_bench_against_string_replace);
+  return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// RTC 鬧鐘：下一個事件（排程堆頂 vs 計數每日回報）換成 RTC 的 HH:MM，
+// 跨午夜、明天的事件以今天的 HH:MM 寫入、沒有工作時關閉，以及「目標改變才寫」（假 RTC）
+//   pio test -e native -f native/test_rtc_alarm -v
+#include <unity.h>
+#include "rtc_alarm.h"
+
+static const int64_t DAY  = 86400;
+static const int64_t MON0 = 20374 * DAY;     // 2025-10-13（週一）00:00，本地秒
+static const int64_t US   = 1000000LL;
+
+static int64_t at(int day, int hh, int mm, int ss = 0){ return MON0 + day * DAY + hh * 3600 + mm * 60 + ss; }
+
+// 假 RTC：記錄寫入；fail = 下一次寫入失敗
+struct MockRtc {
+  int  alarm = -2;                 // 目前的 HH:MM（分鐘數）；-1 = 關閉
+  int  sets = 0, disables = 0;
+  bool fail = false;
+  bool setDailyAlarm(uint8_t hh, uint8_t mm){
+    if (fail) { fail = false; return false; }
+    alarm = hh * 60 + mm; sets++; return true;
+  }
+  bool disableAlarm(){
+    if (fail) { fail = false; return false; }
+    alarm = -1; disables++; return true;
+  }
+};
+
+// 排程：每路一個時間，星期遮罩可設；繼電器預排不在這裡測
+class MiniSched : public SchedCore {
+public:
+  uint16_t minute[SCH_CH];
+  uint8_t  wd[SCH_CH];
+  uint32_t ver = 1;
+  MiniSched(){ for (int c = 0; c < SCH_CH; ++c) { minute[c] = SCH_T_NONE; wd[c] = 0x7F; } }
+  void set(int ch, int hh, int mm, uint8_t mask = 0x7F){ minute[ch] = (uint16_t)(hh * 60 + mm); wd[ch] = mask; ver++; }
+  void clear(int ch){ minute[ch] = SCH_T_NONE; ver++; }
+  void at(int64_t localSec){ step(localSec * US, localSec * US, ver); }
+protected:
+  uint16_t jobMinute(int j) override { return j % SCH_TIMES ? SCH_T_NONE : minute[j / SCH_TIMES]; }
+  uint8_t  jobMask(int j) override   { return wd[j / SCH_TIMES]; }
+  void     relayStartAt(int, int64_t) override {}
+  bool     relayCancelAt(int) override { return false; }
+  void     onFire(int, int64_t, int64_t, bool) override {}
+};
+
+// 兩路計數回報：#1 hh:mm（daily0=false → 達標模式，不回報），#2 hh:mm
+static int64_t cntDue(int64_t now, int m0, bool daily0, int m1, uint8_t mask = 0x7F){
+  uint16_t mod[2]  = { (uint16_t)m0, (uint16_t)m1 };
+  bool     daily[2] = { daily0, true };
+  return cntReportNextDue(now, mod, daily, 2, mask);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 堆頂 vs 計數回報 ----------
+static void test_earlier_of_sched_and_counter(){
+  MiniSched s; MockRtc rtc; RtcAlarmPlan plan;
+  s.set(0, 17, 30);
+  int64_t now = at(0, 12, 0);
+  s.at(now);
+  TEST_ASSERT_TRUE(plan.arm(rtc, s.nextDue(), cntDue(now, 17 * 60, true, 21 * 60)));
+  TEST_ASSERT_EQUAL(17 * 60, rtc.alarm);                     // 計數 17:00 較早
+
+  TEST_ASSERT_TRUE(plan.arm(rtc, s.nextDue(), cntDue(now, 17 * 60, false, 21 * 60)));
+  TEST_ASSERT_EQUAL(17 * 60 + 30, rtc.alarm);                // #1 達標模式 → 排程 17:30
+
+  TEST_ASSERT_TRUE(plan.arm(rtc, -1, cntDue(now, 17 * 60, false, 21 * 60)));
+  TEST_ASSERT_EQUAL(21 * 60, rtc.alarm);                     // 沒有排程 → 計數 21:00
+}
+
+// ---------- 跨午夜 ----------
+static void test_midnight_wrap(){
+  MiniSched s; MockRtc rtc; RtcAlarmPlan plan;
+  s.set(0, 0, 0);                                            // 每天 00:00
+  int64_t now = at(0, 23, 59, 30);
+  s.at(now);
+  TEST_ASSERT_EQUAL(at(1, 0, 0), s.nextDue());
+  // 計數 23:59 今天已過 → 明天 23:59；排程明天 00:00 較早
+  plan.arm(rtc, s.nextDue(), cntDue(now, 23 * 60 + 59, true, 23 * 60 + 59));
+  TEST_ASSERT_EQUAL(0, rtc.alarm);
+
+  // 過了午夜觸發後，下一個事件是今天 23:59 的回報（早於明天 00:00）
+  now = at(1, 0, 0, 1);
+  s.at(now);
+  TEST_ASSERT_EQUAL(at(2, 0, 0), s.nextDue());
+  plan.arm(rtc, s.nextDue(), cntDue(now, 23 * 60 + 59, true, 23 * 60 + 59));
+  TEST_ASSERT_EQUAL(23 * 60 + 59, rtc.alarm);
+}
+
+// ---------- 明天（以後）的事件：以它的 HH:MM 寫入 ----------
+static void test_tomorrows_event_armed_at_todays_hhmm(){
+  MiniSched s; MockRtc rtc; RtcAlarmPlan plan;
+  s.set(0, 7, 0, 0x1F);                                      // 平日 07:00
+  int64_t now = at(0, 12, 0);                                // 週一 12:00，今天的已過
+  s.at(now);
+  TEST_ASSERT_EQUAL(at(1, 7, 0), s.nextDue());
+  plan.arm(rtc, s.nextDue(), -1);
+  TEST_ASSERT_EQUAL(7 * 60, rtc.alarm);                      // RTC 明天 07:00 才比對到
+
+  // 只剩週三 15:00 的工作：週一 15:00 會多叫醒一次；重新評估目標不變 → 不重寫
+  s.clear(0);
+  s.set(1, 15, 0, 0x04);
+  s.at(now);
+  TEST_ASSERT_EQUAL(at(2, 15, 0), s.nextDue());
+  plan.arm(rtc, s.nextDue(), -1);
+  TEST_ASSERT_EQUAL(15 * 60, rtc.alarm);
+  int sets = rtc.sets;
+  now = at(0, 15, 0, 1);                                     // 週一 15:00 的多餘叫醒
+  s.at(now);
+  TEST_ASSERT_FALSE(plan.arm(rtc, s.nextDue(), -1));
+  TEST_ASSERT_EQUAL(sets, rtc.sets);
+}
+
+// ---------- 沒有工作：關閉鬧鐘（只寫一次） ----------
+static void test_disable_when_no_jobs(){
+  MiniSched s; MockRtc rtc; RtcAlarmPlan plan;
+  s.set(0, 8, 0);
+  int64_t now = at(0, 6, 0);
+  s.at(now);
+  plan.arm(rtc, s.nextDue(), -1);
+  TEST_ASSERT_EQUAL(8 * 60, rtc.alarm);
+
+  s.clear(0);
+  s.at(now);
+  TEST_ASSERT_EQUAL(-1, s.nextDue());
+  TEST_ASSERT_TRUE(plan.arm(rtc, s.nextDue(), -1));
+  TEST_ASSERT_EQUAL(-1, rtc.alarm);
+  TEST_ASSERT_EQUAL(-1, plan.armed());
+  TEST_ASSERT_FALSE(plan.arm(rtc, s.nextDue(), -1));
+  TEST_ASSERT_EQUAL(1, rtc.disables);
+
+  // 全域星期遮罩全關：計數回報也沒有 → 仍是關閉
+  TEST_ASSERT_EQUAL(-1, cntDue(now, 17 * 60, true, 21 * 60, 0x00));
+  TEST_ASSERT_FALSE(plan.arm(rtc, -1, cntDue(now, 17 * 60, true, 21 * 60, 0x00)));
+}
+
+// ---------- 目標改變才寫；寫入失敗下次重試 ----------
+static void test_write_only_on_change(){
+  MockRtc rtc; RtcAlarmPlan plan;
+  TEST_ASSERT_EQUAL(-2, plan.armed());
+  TEST_ASSERT_TRUE(plan.arm(rtc, at(0, 9, 0), -1));
+  for (int i = 0; i < 100; ++i) TEST_ASSERT_FALSE(plan.arm(rtc, at(0, 9, 0), -1));
+  TEST_ASSERT_FALSE(plan.arm(rtc, at(3, 9, 0), -1));         // 不同天、同一 HH:MM
+  TEST_ASSERT_EQUAL(1, rtc.sets);
+  TEST_ASSERT_EQUAL_UINT32(1, plan.writes());
+
+  rtc.fail = true;
+  TEST_ASSERT_FALSE(plan.arm(rtc, at(0, 10, 0), -1));
+  TEST_ASSERT_EQUAL(9 * 60, plan.armed());
+  TEST_ASSERT_TRUE(plan.arm(rtc, at(0, 10, 0), -1));
+  TEST_ASSERT_EQUAL(10 * 60, rtc.alarm);
+  TEST_ASSERT_EQUAL_UINT32(2, plan.writes());
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_earlier_of_sched_and_counter);
+  RUN_TEST(test_midnight_wrap);
+  RUN_TEST(test_tomorrows_event_armed_at_todays_hhmm);
+  RUN_TEST(test_disable_when_no_jobs);
+  RUN_TEST(test_write_only_on_change);
+  return UNITY_END();
+}
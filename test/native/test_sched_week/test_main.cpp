@@ -0,0 +1,236 @@
+// 排程器一週模擬：以 250 ms 為一輪跑 SchedCore，搭配模擬的預排繼電器（計時器到點吸合），
+// 驗證星期遮罩、寬限窗補觸發、時鐘往回跳與設定變更重建都不會漏觸發或重複觸發
+//   pio test -e native -f native/test_sched_week -v
+#include <unity.h>
+#include <vector>
+#include "sched_engine.h"
+
+static const int64_t US    = 1000000LL;
+static const int64_t DAY   = 86400;
+static const int64_t MON0  = 20374 * DAY;     // 2025-10-13（週一）00:00，本地秒
+static const int64_t TICK  = 250000;          // loop() 一輪
+
+// 吸合紀錄：本地秒 + 是否由預排吸合
+struct Ev { int ch; int64_t at; bool pre; };
+
+class SimSched : public SchedCore {
+public:
+  // ---- 設定（對應 cfg.sch[] / cfg.wdMask）----
+  uint16_t minute[SCH_CH][SCH_TIMES];
+  uint8_t  wd[SCH_CH];
+  uint8_t  wdMask = 0x7F;
+  uint32_t ver = 1;
+
+  // ---- 時鐘：local = tmr + offset；時鐘跳動只改 offset ----
+  int64_t tmrUs = 0, offsetUs = 0;
+
+  // ---- 模擬繼電器 ----
+  int64_t pendAt[SCH_CH];                      // 預排的計時器時刻（-1 = 無）
+  std::vector<Ev> on;                          // 實際吸合
+  int fires = 0, firesPre = 0;
+
+  SimSched(){
+    for (int c = 0; c < SCH_CH; ++c) {
+      for (int k = 0; k < SCH_TIMES; ++k) minute[c][k] = SCH_T_NONE;
+      wd[c] = 0x7F; pendAt[c] = -1;
+    }
+  }
+  void set(int ch, int k, int hh, int mm){ minute[ch][k] = (uint16_t)(hh * 60 + mm); }
+
+  int64_t localUs() const { return tmrUs + offsetUs; }
+  void    startAt(int64_t localSec){ offsetUs = localSec * US; tmrUs = 0; }
+  void    stepClock(int64_t deltaSec){ offsetUs += deltaSec * US; }   // NTP 校時跳動
+
+  // 一輪：推進計時器 → 到點的預排吸合（esp_timer 任務）→ loop()
+  void tick(int64_t dtUs = TICK){
+    int64_t t1 = tmrUs + dtUs;
+    for (int c = 0; c < SCH_CH; ++c)
+      if (pendAt[c] >= 0 && pendAt[c] <= t1) {
+        on.push_back({ c, (pendAt[c] + offsetUs) / US, true });
+        pendAt[c] = -1;
+      }
+    tmrUs = t1;
+    step(localUs(), tmrUs, ver);
+  }
+  // loop() 被卡住 sec 秒（計時器照走，期間沒有 step）
+  void stall(int64_t sec){
+    int64_t t1 = tmrUs + sec * US;
+    for (int c = 0; c < SCH_CH; ++c)
+      if (pendAt[c] >= 0 && pendAt[c] <= t1) { on.push_back({ c, (pendAt[c] + offsetUs) / US, true }); pendAt[c] = -1; }
+    tmrUs = t1;
+  }
+  void runUntil(int64_t localSec){ while (localUs() < localSec * US) tick(); }
+
+  int count(int ch) const { int n = 0; for (const Ev& e : on) n += (e.ch == ch); return n; }
+
+protected:
+  uint16_t jobMinute(int j) override { return minute[j / SCH_TIMES][j % SCH_TIMES]; }
+  uint8_t  jobMask(int j) override   { return wdMask & wd[j / SCH_TIMES]; }
+  void     relayStartAt(int ch, int64_t at) override { pendAt[ch] = at; }
+  bool     relayCancelAt(int ch) override { bool was = pendAt[ch] >= 0; pendAt[ch] = -1; return was; }
+  void onFire(int j, int64_t due, int64_t lag, bool pre) override {
+    // 觸發點必須是這個工作的整分時刻；lag = 本輪本地秒 - 觸發點
+    TEST_ASSERT_EQUAL(0, due % 60);
+    TEST_ASSERT_EQUAL((int64_t)jobMinute(j) * 60, ((due % DAY) + DAY) % DAY);
+    // （預排者本身不受寬限窗限制，但這裡的情境都不會在預排窗內卡住）
+    TEST_ASSERT_TRUE(lag >= 0 && lag <= SCH_GRACE_SEC);
+    if (!pre) TEST_ASSERT_EQUAL(localUs() / US - due, lag);
+    fires++;
+    if (pre) firesPre++;
+    else     on.push_back({ j / SCH_TIMES, localUs() / US, false });   // 韌體：startRelayTimed()
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 整週：各路星期遮罩 + 額外時間，全部由預排準時吸合 ----------
+static void test_week_weekday_masks(){
+  static SimSched s;
+  s.set(0, 0, 8, 0);                            // CH1 每天 08:00
+  s.set(1, 0, 12, 30); s.set(1, 1, 17, 45);     // CH2 平日 12:30 + 17:45
+  s.wd[1] = 0x1F;
+  s.set(2, 0, 6, 0);   s.wd[2] = 0x3F;          // CH3 週一~週六 06:00
+  s.set(3, 0, 9, 0);   s.wd[3] = 0x00;          // CH4 停用
+  s.set(4, 0, 23, 59); s.wd[4] = 0x40;          // CH5 只有週日 23:59
+  s.set(5, 0, 0, 0);                            // CH6 每天 00:00（起點那一刻本身也算）
+  s.startAt(MON0);
+  s.runUntil(MON0 + 7 * DAY - 1);               // 週一 00:00 ~ 週日 23:59:59
+
+  TEST_ASSERT_EQUAL(7,  s.count(0));
+  TEST_ASSERT_EQUAL(10, s.count(1));
+  TEST_ASSERT_EQUAL(6,  s.count(2));
+  TEST_ASSERT_EQUAL(0,  s.count(3));
+  TEST_ASSERT_EQUAL(1,  s.count(4));
+  TEST_ASSERT_EQUAL(7,  s.count(5));
+  for (const Ev& e : s.on) {
+    TEST_ASSERT_EQUAL(0, e.at % 60);            // 都在整分吸合
+    int dow = (int)((e.at - MON0) / DAY);       // 0 = 週一
+    TEST_ASSERT_TRUE((s.wd[e.ch] >> dow) & 1);
+  }
+  TEST_ASSERT_EQUAL(MON0 + 6 * DAY + 23 * 3600 + 59 * 60, s.on[s.on.size() - 1].at);
+  TEST_ASSERT_EQUAL(31, s.fires);
+  TEST_ASSERT_EQUAL(30, s.firesPre);            // 只有起點 00:00 來不及預排
+  TEST_ASSERT_EQUAL(0, s.missed());
+  TEST_ASSERT_EQUAL(1, s.rebuilds());
+
+  // 週末起全域遮罩改為只留平日：下週六、週日都不再觸發
+  s.wdMask = 0x1F; s.ver++;
+  s.runUntil(MON0 + 14 * DAY);
+  TEST_ASSERT_EQUAL(7 + 5, s.count(0));
+  TEST_ASSERT_EQUAL(1, s.count(4));
+}
+
+// ---------- 寬限窗：卡住 90 s 補上；卡住 5 分鐘略過且不逐日補算 ----------
+static void test_grace_catch_up(){
+  static SimSched s;
+  s.set(0, 0, 8, 0);
+  s.set(1, 0, 12, 30);
+  s.startAt(MON0 + 7 * 3600);
+  s.runUntil(MON0 + 7 * 3600 + 59 * 60);        // 07:59:00
+  s.stall(150);                                 // 卡到 08:01:30（還沒進預排窗就卡住）
+  s.tick();
+  TEST_ASSERT_EQUAL(1, s.count(0));
+  TEST_ASSERT_FALSE(s.on[0].pre);
+  TEST_ASSERT_EQUAL(MON0 + 8 * 3600 + 90, s.on[0].at);
+  TEST_ASSERT_EQUAL(1, s.late());
+  TEST_ASSERT_EQUAL(90, s.maxLagS());
+
+  s.runUntil(MON0 + 12 * 3600 + 29 * 60);       // 12:29:00
+  s.stall(300);                                 // 卡到 12:34:00 → 超過寬限窗
+  s.tick();
+  TEST_ASSERT_EQUAL(0, s.count(1));
+  TEST_ASSERT_EQUAL(1, s.missed());
+
+  // 整整卡三天：每個工作只記一次 missed，醒來後不會一口氣補觸發
+  s.runUntil(MON0 + DAY + 7 * 3600);            // 週二 07:00
+  int before = (int)s.on.size();
+  s.stall(3 * DAY);                             // 到週五 07:00
+  s.tick();
+  TEST_ASSERT_EQUAL(before, (int)s.on.size());
+  TEST_ASSERT_EQUAL(1 + 2, s.missed());         // CH1、CH2 各只記一次
+  s.runUntil(MON0 + 4 * DAY + 13 * 3600);       // 週五 13:00
+  TEST_ASSERT_EQUAL(before + 2, (int)s.on.size());
+  TEST_ASSERT_TRUE(s.on.back().pre);
+}
+
+// ---------- 時鐘往回跳：同一時間點不重複觸發 ----------
+static void test_backward_clock_steps(){
+  static SimSched s;
+  s.set(0, 0, 8, 0);
+  s.set(1, 0, 8, 1);
+  s.startAt(MON0 + 7 * 3600 + 50 * 60);
+  s.runUntil(MON0 + 8 * 3600 + 65);             // 08:00、08:01 都已吸合
+  TEST_ASSERT_EQUAL(1, s.count(0));
+  TEST_ASSERT_EQUAL(1, s.count(1));
+
+  uint32_t r0 = s.rebuilds();
+  s.stepClock(-15);                             // 08:01:05 → 08:00:50（小幅校時，落回同一分鐘）
+  s.runUntil(MON0 + 8 * 3600 + 90);
+  TEST_ASSERT_EQUAL(r0 + 1, s.rebuilds());
+  TEST_ASSERT_EQUAL(1, s.count(0));
+  TEST_ASSERT_EQUAL(1, s.count(1));
+
+  s.stepClock(-3600);                           // 整整倒退一小時（時區 / RTC 誤差修正）
+  s.runUntil(MON0 + 8 * 3600 + 90);             // 再次經過 08:00、08:01
+  TEST_ASSERT_EQUAL(r0 + 2, s.rebuilds());
+  TEST_ASSERT_EQUAL(1, s.count(0));
+  TEST_ASSERT_EQUAL(1, s.count(1));
+
+  // 隔天 CH2 已預排、尚未吸合時時間倒退：預排撤回重排，仍只準時吸合一次
+  s.runUntil(MON0 + DAY + 8 * 3600 + 30);
+  TEST_ASSERT_EQUAL(2, s.count(0));
+  while (s.pendAt[1] < 0) s.tick();             // 進入 CH2 的預排窗
+  s.stepClock(-10);
+  s.runUntil(MON0 + DAY + 8 * 3600 + 120);
+  TEST_ASSERT_EQUAL(2, s.count(1));
+  TEST_ASSERT_EQUAL(MON0 + DAY + 8 * 3600 + 60, s.on.back().at);
+  TEST_ASSERT_TRUE(s.on.back().pre);
+  TEST_ASSERT_EQUAL(0, s.missed());
+}
+
+// ---------- 設定變更重建：已觸發 / 已吸合的時間點不重複 ----------
+static void test_rebuild_dedup(){
+  static SimSched s;
+  s.set(0, 0, 8, 0);
+  s.set(1, 0, 9, 0);
+  s.set(2, 0, 10, 0);
+  s.startAt(MON0 + 7 * 3600 + 59 * 60);
+  s.runUntil(MON0 + 8 * 3600 + 20);
+  s.ver++;                                      // 08:00:20 存設定（本分鐘的 08:00 已觸發）
+  s.runUntil(MON0 + 8 * 3600 + 120);
+  TEST_ASSERT_EQUAL(1, s.count(0));
+
+  // 預排窗內存設定：撤回重排，仍只吸合一次且準時
+  while (s.pendAt[1] < 0) s.tick();
+  s.ver++;
+  s.runUntil(MON0 + 9 * 3600 + 60);
+  TEST_ASSERT_EQUAL(1, s.count(1));
+  TEST_ASSERT_EQUAL(MON0 + 9 * 3600, s.on.back().at);
+  TEST_ASSERT_TRUE(s.on.back().pre);
+
+  // 計時器已吸合、loop() 還沒處理到期就遇上重建：視為已觸發（只補推播）
+  while (s.pendAt[2] < 0) s.tick();
+  s.stall((s.pendAt[2] - s.tmrUs) / US + 1);    // 吸合在 loop 看到之前
+  int firesBefore = s.fires;
+  s.ver++;
+  s.tick();
+  s.runUntil(MON0 + 10 * 3600 + 120);
+  TEST_ASSERT_EQUAL(1, s.count(2));
+  TEST_ASSERT_EQUAL(firesBefore + 1, s.fires);  // 推播只補一次
+
+  // 改時間到稍後：新時間點照常觸發，不受剛才去重影響
+  s.set(2, 0, 10, 5); s.ver++;
+  s.runUntil(MON0 + 10 * 3600 + 6 * 60);
+  TEST_ASSERT_EQUAL(2, s.count(2));
+  TEST_ASSERT_EQUAL(0, s.missed());
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_week_weekday_masks);
+  RUN_TEST(test_grace_catch_up);
+  RUN_TEST(test_backward_clock_steps);
+  RUN_TEST(test_rebuild_dedup);
+  return UNITY_END();
+}
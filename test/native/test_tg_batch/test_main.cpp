@@ -0,0 +1,156 @@
+// Telegram 日誌補送：TgBatch 批次上限、時間戳規則、429 retry_after 解析，
+// 以及 500 則積壓的補送模擬（模擬時鐘，回報 msgs/s）
+//   pio test -e native -f native/test_tg_batch -v
+#include <unity.h>
+#include <stdlib.h>
+#include "WString.h"
+#include "tg_batch.h"
+
+static const uint32_t NOW = 1760688000;   // 2025-10-17 08:00:00 UTC
+
+void setUp() { setenv("TZ", "UTC0", 1); tzset(); }
+void tearDown() {}
+
+static String msg(size_t len, char c = 'a'){
+  String s;
+  s.reserve(len);
+  for (size_t i = 0; i < len; ++i) s += c;
+  return s;
+}
+
+// ---------- 批次上限 ----------
+static void test_batch_stops_at_max_msgs(){
+  String out;
+  TgBatch b(out, TG_BATCH_MSGS, NOW);
+  int added = 0;
+  for (uint32_t seq = 1; seq <= 25; ++seq) { if (!b.add(seq, NOW, "x")) break; added++; }
+  TEST_ASSERT_EQUAL(TG_BATCH_MSGS, added);
+  TEST_ASSERT_TRUE(b.full());
+  TEST_ASSERT_EQUAL_UINT32(20, b.lastSeq());
+  TEST_ASSERT_EQUAL(2 * 20 - 1, out.length());          // "x\nx\n…x"
+}
+
+static void test_batch_stops_before_tg_msg_max(){
+  String out;
+  TgBatch b(out, TG_BATCH_MSGS, NOW);
+  String m = msg(1000);
+  int added = 0;
+  for (uint32_t seq = 1; seq <= 10; ++seq) { if (!b.add(seq, NOW, m)) break; added++; }
+  TEST_ASSERT_EQUAL(3, added);                         // 3×1000 + 2 換行；第 4 則會到 4003
+  TEST_ASSERT_LESS_OR_EQUAL(TG_MSG_MAX, out.length());
+  TEST_ASSERT_EQUAL_UINT32(3, b.lastSeq());
+  TEST_ASSERT_EQUAL(3000, b.textBytes());
+}
+
+static void test_batch_exact_fit(){
+  String out;
+  TgBatch b(out, TG_BATCH_MSGS, NOW);
+  TEST_ASSERT_TRUE(b.add(1, NOW, msg(1999)));
+  TEST_ASSERT_TRUE(b.add(2, NOW, msg(2000)));          // 1999 + 1 + 2000 = 4000
+  TEST_ASSERT_FALSE(b.add(3, NOW, "y"));
+  TEST_ASSERT_EQUAL(TG_MSG_MAX, out.length());
+}
+
+static void test_first_message_always_taken(){
+  String out;
+  TgBatch b(out, TG_BATCH_MSGS, NOW);
+  TEST_ASSERT_TRUE(b.add(7, NOW - 3600, msg(TG_MSG_MAX)));   // 單則已截在上限，加時間戳仍收
+  TEST_ASSERT_FALSE(b.add(8, NOW, "z"));
+  TEST_ASSERT_EQUAL(1, b.count());
+  TEST_ASSERT_EQUAL_UINT32(7, b.lastSeq());
+}
+
+static void test_single_slot_batch(){
+  String out;
+  TgBatch b(out, 1, NOW);
+  TEST_ASSERT_TRUE(b.add(1, NOW, "a"));
+  TEST_ASSERT_FALSE(b.add(2, NOW, "b"));
+  TEST_ASSERT_EQUAL_STRING("a", out.c_str());
+}
+
+// ---------- 時間戳 ----------
+static void test_stamp_only_for_delayed_records(){
+  TEST_ASSERT_EQUAL_STRING("", tgStamp(NOW - 5, NOW).c_str());                  // 即時送出
+  TEST_ASSERT_EQUAL_STRING("", tgStamp(NOW - TGJ_STAMP_AGE_S + 1, NOW).c_str());
+  TEST_ASSERT_EQUAL_STRING("[10/17 07:59:00] ", tgStamp(NOW - TGJ_STAMP_AGE_S, NOW).c_str());
+  TEST_ASSERT_EQUAL_STRING("", tgStamp(0, NOW).c_str());                         // 未對時的記錄
+  TEST_ASSERT_EQUAL_STRING("", tgStamp(NOW - 3600, 0).c_str());                  // 現在未對時
+
+  String out;
+  TgBatch b(out, TG_BATCH_MSGS, NOW);
+  b.add(1, NOW - 7200, "DI1 異常");
+  b.add(2, NOW - 1, "CH1 關閉");
+  TEST_ASSERT_EQUAL_STRING("[10/17 06:00:00] DI1 異常\nCH1 關閉", out.c_str());
+}
+
+// ---------- 429 ----------
+static void test_retry_after_parsing(){
+  TEST_ASSERT_EQUAL(35, tgRetryAfterSec(
+    "{\"ok\":false,\"error_code\":429,\"description\":\"Too Many Requests: retry after 35\",\"parameters\":{\"retry_after\":35}}"));
+  TEST_ASSERT_EQUAL(7, tgRetryAfterSec("{\"parameters\":{\"retry_after\": 7}}"));
+  TEST_ASSERT_EQUAL(1, tgRetryAfterSec("{\"ok\":false,\"error_code\":429}"));      // 缺欄位
+  TEST_ASSERT_EQUAL(1, tgRetryAfterSec("{\"parameters\":{\"retry_after\":0}}"));
+  TEST_ASSERT_EQUAL(1, tgRetryAfterSec("{\"parameters\":{\"retry_after\":-3}}"));
+  TEST_ASSERT_EQUAL(1, tgRetryAfterSec(""));
+  TEST_ASSERT_EQUAL(1, tgRetryAfterSec(nullptr));
+}
+
+// ---------- 500 則積壓的補送模擬 ----------
+// 假伺服器：每次 sendMessage 往返 RTT_MS；每 N_429 次回一次 429（retry_after=RETRY_S）。
+// 依 tgTask 的流程：front() 組批 → 送 → 200 就 ack 前進，429 就等 retry_after 再送同一批。
+static void test_drain_500_backlog(){
+  const int      N = 500;
+  const uint32_t RTT_MS = 350, RETRY_S = 3;
+  const int      N_429 = 7;
+
+  static String texts[N];
+  srand(12345);
+  for (int i = 0; i < N; ++i) texts[i] = msg(20 + rand() % 120, 'a' + i % 26);   // 20~139 字的事件訊息
+
+  uint64_t simMs = 0;
+  int next = 0, requests = 0, limited = 0, batches = 0;
+  size_t maxLen = 0;
+  while (next < N) {
+    String out;
+    TgBatch b(out, TG_BATCH_MSGS, NOW + (uint32_t)(simMs / 1000));
+    for (int i = next; i < N && !b.full(); ++i) if (!b.add(i + 1, NOW - 600, texts[i])) break;
+    TEST_ASSERT_TRUE(b.count() > 0);
+    TEST_ASSERT_LESS_OR_EQUAL(TG_MSG_MAX + 17, out.length());   // 最多超出第一則的時間戳
+    if (out.length() > maxLen) maxLen = out.length();
+
+    requests++;
+    simMs += RTT_MS;
+    if (requests % N_429 == 0) {
+      limited++;
+      char resp[96];
+      snprintf(resp, sizeof(resp), "{\"ok\":false,\"error_code\":429,\"parameters\":{\"retry_after\":%u}}", (unsigned)RETRY_S);
+      simMs += (uint64_t)tgRetryAfterSec(resp) * 1000;
+      continue;                                    // 不 ack，同一批重送
+    }
+    TEST_ASSERT_EQUAL_UINT32(next + b.count(), b.lastSeq());
+    next = b.lastSeq();
+    batches++;
+  }
+
+  double mps = N / (simMs / 1000.0);
+  char line[160];
+  snprintf(line, sizeof(line), "500 msgs: %d requests (%d batches, %d x 429), max %u chars, %.1f s simulated -> %.1f msgs/s",
+           requests, batches, limited, (unsigned)maxLen, simMs / 1000.0, mps);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_LESS_OR_EQUAL((N + TG_BATCH_MSGS - 1) / TG_BATCH_MSGS + 10, batches);  // 幾乎都是滿批
+  TEST_ASSERT_TRUE(mps > 10.0);                    // 逐則送出（1 則/請求）約 2.9 msgs/s
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_batch_stops_at_max_msgs);
+  RUN_TEST(test_batch_stops_before_tg_msg_max);
+  RUN_TEST(test_batch_exact_fit);
+  RUN_TEST(test_first_message_always_taken);
+  RUN_TEST(test_single_slot_batch);
+  RUN_TEST(test_stamp_only_for_delayed_records);
+  RUN_TEST(test_retry_after_parsing);
+  RUN_TEST(test_drain_500_backlog);
+  return UNITY_END();
+}
@@ -0,0 +1,222 @@
+// Telegram 持久化日誌：TgJournalSet 的類別優先序（ALARM 排在先前的 RELAY 之前）、
+// checkpoint 批次寫入、斷電重開後的重送範圍與半筆尾巴壓實（RAM 假檔案系統）
+//   pio test -e native -f native/test_tg_journal -v
+#include <unity.h>
+#include <map>
+#include <string>
+#include "WString.h"
+#include "tg_journal.h"
+
+// RAM 檔案系統：map<路徑, 內容>；記錄每個路徑以寫入模式開啟的次數（= flash 寫入次數）
+struct FakeFs {
+  std::map<std::string, std::string> files;
+  std::map<std::string, int>         writeOpens;
+
+  struct File {
+    std::string* d = nullptr;
+    size_t       pos = 0;
+    explicit operator bool() const { return d != nullptr; }
+    size_t read(uint8_t* p, size_t n){
+      size_t k = d->size() - pos < n ? d->size() - pos : n;
+      memcpy(p, d->data() + pos, k);
+      pos += k;
+      return k;
+    }
+    size_t write(const uint8_t* p, size_t n){ d->append((const char*)p, n); return n; }
+    bool   seek(size_t off){ if (off > d->size()) return false; pos = off; return true; }
+    size_t size() const { return d->size(); }
+    void   close(){ d = nullptr; }
+  };
+
+  File open(const char* path, const char* mode){
+    File f;
+    if (mode[0] == 'r') {
+      auto it = files.find(path);
+      if (it != files.end()) f.d = &it->second;
+      return f;
+    }
+    writeOpens[path]++;
+    f.d = &files[path];
+    if (mode[0] == 'w') f.d->clear();
+    return f;
+  }
+  bool remove(const char* path){ return files.erase(path) > 0; }
+  bool rename(const char* from, const char* to){
+    auto it = files.find(from);
+    if (it == files.end()) return false;
+    files[to] = it->second;
+    files.erase(it);
+    return true;
+  }
+  bool exists(const char* path) const { return files.count(path) > 0; }
+};
+
+typedef TgJournalSet<FakeFs> Set;
+
+static void appendN(Set& js, TgjClass c, const char* prefix, int from, int to){
+  char buf[16];
+  for (int i = from; i <= to; ++i) {
+    snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+    TEST_ASSERT_TRUE(js.append(c, buf, 0));
+  }
+}
+
+// 取出下一批並標記送達；回傳送出的文字
+static std::string sendNext(Set& js, uint16_t maxMsgs, uint32_t nowMs, TgjClass* clsOut = nullptr){
+  String out;
+  uint32_t last = 0;
+  TgjClass cls = TGJ_RELAY;
+  if (!js.front(out, last, cls, maxMsgs, 0)) return std::string();
+  js.ack(cls, last, nowMs);
+  if (clsOut) *clsOut = cls;
+  return std::string(out.c_str());
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 優先序 ----------
+static void test_alarm_sent_before_earlier_relays(){
+  FakeFs fs; Set js(fs);
+  js.begin();
+  appendN(js, TGJ_RELAY, "R", 1, 30);
+  appendN(js, TGJ_ALARM, "A", 1, 1);
+
+  TgjClass cls;
+  TEST_ASSERT_EQUAL_STRING("A1", sendNext(js, TG_BATCH_MSGS, 0, &cls).c_str());
+  TEST_ASSERT_EQUAL(TGJ_ALARM, cls);
+
+  std::string b = sendNext(js, TG_BATCH_MSGS, 0, &cls);
+  TEST_ASSERT_EQUAL(TGJ_RELAY, cls);
+  TEST_ASSERT_EQUAL(0, b.find("R1\nR2\n"));
+  TEST_ASSERT_TRUE(b.find("R20") != std::string::npos && b.find("R21") == std::string::npos);
+
+  // 補送途中又來一則警報 → 插在剩下的 RELAY 之前
+  appendN(js, TGJ_ALARM, "A", 2, 2);
+  TEST_ASSERT_EQUAL_STRING("A2", sendNext(js, TG_BATCH_MSGS, 0).c_str());
+  b = sendNext(js, TG_BATCH_MSGS, 0);
+  TEST_ASSERT_EQUAL(0, b.find("R21\n"));
+  TEST_ASSERT_FALSE(js.pending());
+}
+
+// 重開機後（只剩 flash，沒有 RAM 快取）順序不變
+static void test_priority_survives_reboot(){
+  FakeFs fs;
+  {
+    Set js(fs);
+    js.begin();
+    appendN(js, TGJ_RELAY, "R", 1, 5);
+    appendN(js, TGJ_ALARM, "A", 1, 2);
+  }
+  Set js(fs);
+  TEST_ASSERT_TRUE(js.begin());
+  TEST_ASSERT_EQUAL_UINT32(7, js.pendingCount());
+  TEST_ASSERT_EQUAL_STRING("A1\nA2", sendNext(js, TG_BATCH_MSGS, 0).c_str());
+  TEST_ASSERT_EQUAL_STRING("R1\nR2\nR3\nR4\nR5", sendNext(js, TG_BATCH_MSGS, 0).c_str());
+}
+
+// ---------- checkpoint 批次寫入 ----------
+static void test_ack_written_every_n_records(){
+  FakeFs fs; Set js(fs);
+  js.begin();
+  appendN(js, TGJ_RELAY, "R", 1, 30);
+  const auto& j = js.journal(TGJ_RELAY);
+  for (int i = 1; i < TGJ_ACK_EVERY; ++i) sendNext(js, 1, 100);
+  TEST_ASSERT_EQUAL_UINT32(0, j.ackWrites());
+  TEST_ASSERT_EQUAL(0, fs.writeOpens["/tgq.ack"]);
+  sendNext(js, 1, 100);
+  TEST_ASSERT_EQUAL_UINT32(1, j.ackWrites());
+  TEST_ASSERT_EQUAL_UINT32(TGJ_ACK_EVERY, j.ackSaved());
+
+  // 一批 20 則：一次 ack 就超過門檻 → 一次寫入
+  sendNext(js, TG_BATCH_MSGS, 200);
+  TEST_ASSERT_EQUAL_UINT32(2, j.ackWrites());
+  TEST_ASSERT_EQUAL_UINT32(TGJ_ACK_EVERY + 20, j.ackSaved());
+}
+
+static void test_ack_written_after_interval(){
+  FakeFs fs; Set js(fs);
+  js.begin();
+  appendN(js, TGJ_RELAY, "R", 1, 10);
+  const auto& j = js.journal(TGJ_RELAY);
+  sendNext(js, 1, 1000);
+  sendNext(js, 1, 2000);
+  js.tick(1000 + TGJ_ACK_MS - 1);
+  TEST_ASSERT_EQUAL_UINT32(0, j.ackWrites());
+  js.tick(1000 + TGJ_ACK_MS);                   // 從第一則未寫入的 ack 起算
+  TEST_ASSERT_EQUAL_UINT32(1, j.ackWrites());
+  TEST_ASSERT_EQUAL_UINT32(2, j.ackSaved());
+  js.tick(1000 + 2 * TGJ_ACK_MS);               // 沒有新的 ack → 不再寫
+  TEST_ASSERT_EQUAL_UINT32(1, j.ackWrites());
+}
+
+// 全部送達：日誌整檔刪除，checkpoint 不必寫
+static void test_drained_journal_skips_checkpoint(){
+  FakeFs fs; Set js(fs);
+  js.begin();
+  for (int i = 0; i < 50; ++i) {
+    appendN(js, TGJ_RELAY, "R", i, i);
+    sendNext(js, 1, (uint32_t)i * 100);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, js.journal(TGJ_RELAY).ackWrites());
+  TEST_ASSERT_FALSE(fs.exists("/tgq.log"));
+  TEST_ASSERT_FALSE(fs.exists("/tgq.ack"));
+
+  Set again(fs);
+  again.begin();
+  TEST_ASSERT_FALSE(again.pending());
+}
+
+// ---------- 斷電 ----------
+// checkpoint 沒寫到的 ack 會在重開機後重送，但不超過 TGJ_ACK_EVERY - 1 則
+static void test_replay_bounded_after_power_loss(){
+  FakeFs fs;
+  {
+    Set js(fs);
+    js.begin();
+    appendN(js, TGJ_RELAY, "R", 1, 20);
+    for (int i = 0; i < 10; ++i) sendNext(js, 1, 0);   // 第 8 則時寫 checkpoint
+    TEST_ASSERT_EQUAL_UINT32(8, js.journal(TGJ_RELAY).ackSaved());
+  }
+  Set js(fs);
+  js.begin();
+  TEST_ASSERT_EQUAL_UINT32(12, js.pendingCount());     // R9、R10 重送
+  TEST_ASSERT_EQUAL_STRING("R9", sendNext(js, 1, 0).c_str());
+
+  // flushAck() 之後斷電不重送
+  sendNext(js, 1, 0);
+  js.flushAck();
+  Set js2(fs);
+  js2.begin();
+  TEST_ASSERT_EQUAL_UINT32(10, js2.pendingCount());
+  TEST_ASSERT_EQUAL_STRING("R11", sendNext(js2, 1, 0).c_str());
+}
+
+static void test_torn_tail_compacted(){
+  FakeFs fs;
+  {
+    Set js(fs);
+    js.begin();
+    appendN(js, TGJ_ALARM, "A", 1, 3);
+  }
+  std::string& log = fs.files["/tgqa.log"];
+  log.resize(log.size() - 1);                           // 最後一筆寫一半就斷電
+  Set js(fs);
+  TEST_ASSERT_FALSE(js.begin());
+  TEST_ASSERT_EQUAL_UINT32(2, js.pendingCount());
+  TEST_ASSERT_EQUAL_STRING("A1\nA2", sendNext(js, TG_BATCH_MSGS, 0).c_str());
+  TEST_ASSERT_TRUE(js.append(TGJ_ALARM, "A4", 0));      // 序號接續，不與壓實後的記錄重複
+  TEST_ASSERT_EQUAL_STRING("A4", sendNext(js, TG_BATCH_MSGS, 0).c_str());
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_alarm_sent_before_earlier_relays);
+  RUN_TEST(test_priority_survives_reboot);
+  RUN_TEST(test_ack_written_every_n_records);
+  RUN_TEST(test_ack_written_after_interval);
+  RUN_TEST(test_drained_journal_skips_checkpoint);
+  RUN_TEST(test_replay_bounded_after_power_loss);
+  RUN_TEST(test_torn_tail_compacted);
+  return UNITY_END();
+}
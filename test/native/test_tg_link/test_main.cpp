@@ -0,0 +1,214 @@
+// Telegram 傳輸層：TgHttpConn 對假傳輸的 keep-alive / 重連規則
+// （N 次請求只握手一次、閒置逾時 / 伺服器關閉各只重連一次、已寫出未回應不重送），
+// 以及 chunked / 無長度回應與大 body 的請求組裝
+//   pio test -e native -f native/test_tg_link -v
+#include <unity.h>
+#include <string>
+#include "tg_link.h"
+
+// 假傳輸：同時扮演伺服器，收滿一個請求（header + Content-Length）就排入回應
+struct FakeIo {
+  // 伺服器端行為（只作用於下一個請求）
+  enum Reply : uint8_t { KEEP, CLOSE_HDR, CHUNKED, NO_LENGTH, DROP };
+  Reply    next = KEEP;
+  bool     failWrite = false;    // 下一次 write 失敗（對方已重置，本機尚未察覺）
+
+  bool        up = false;
+  uint32_t    t = 1000;
+  uint32_t    connects = 0, requests = 0;
+  std::string req, rx, lastPath, lastBody;
+  size_t      pos = 0;
+
+  bool connect(){ up = true; connects++; req.clear(); rx.clear(); pos = 0; return true; }
+  bool connected(){ return up || pos < rx.size(); }
+  void stop(){ up = false; rx.clear(); pos = 0; }
+  size_t write(const uint8_t* p, size_t n){
+    if (!up) return 0;
+    if (failWrite) { failWrite = false; up = false; return 0; }
+    req.append((const char*)p, n);
+    serve();
+    return n;
+  }
+  int available(){ return (int)(rx.size() - pos); }
+  int read(){ return pos < rx.size() ? (uint8_t)rx[pos++] : -1; }
+  int read(uint8_t* p, size_t n){
+    size_t k = rx.size() - pos;
+    if (k > n) k = n;
+    if (!k) return -1;
+    memcpy(p, rx.data() + pos, k);
+    pos += k;
+    return (int)k;
+  }
+  uint32_t now(){ return t; }
+  void idle(){ t += 2; }
+
+  void serve(){
+    size_t he = req.find("\r\n\r\n");
+    if (he == std::string::npos) return;
+    size_t cl = 0, k = req.find("Content-Length: ");
+    if (k != std::string::npos && k < he) cl = strtoul(req.c_str() + k + 16, nullptr, 10);
+    if (req.size() < he + 4 + cl) return;
+    size_t sp = req.find(' ');
+    lastPath = req.substr(sp + 1, req.find(' ', sp + 1) - sp - 1);
+    lastBody = req.substr(he + 4, cl);
+    req.erase(0, he + 4 + cl);
+    requests++;
+    Reply r = next;
+    next = KEEP;
+    switch (r) {
+      case KEEP:      rx += "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\n{\"ok\":true}"; break;
+      case CLOSE_HDR: rx += "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 11\r\n\r\n{\"ok\":true}";
+                      up = false; break;
+      case CHUNKED:   rx += "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                            "5\r\n{\"ok\"\r\n6\r\n:true}\r\n0\r\n\r\n"; break;
+      case NO_LENGTH: rx += "HTTP/1.0 200 OK\r\n\r\n{\"ok\":true}"; up = false; break;
+      case DROP:      up = false; break;    // 收到請求（可能已處理）但沒有回應就關閉
+    }
+  }
+};
+
+struct CollectSink : TgBodySink {
+  std::string body;
+  long        len = -2;
+  void begin(long contentLen) override { body.clear(); len = contentLen; }
+  void onBody(const uint8_t* p, size_t n) override { body.append((const char*)p, n); }
+};
+
+static int send(TgHttpConn<FakeIo>& c, CollectSink* sink = nullptr, const char* body = "chat_id=1&text=x"){
+  return c.request("POST", "/botT/sendMessage", "application/x-www-form-urlencoded",
+                   body, strlen(body), sink, 5000);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 重用 ----------
+static void test_n_sends_one_handshake(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  CollectSink s;
+  for (int i = 0; i < 20; ++i) {
+    io.t += 1000;
+    TEST_ASSERT_EQUAL(200, send(c, &s));
+    TEST_ASSERT_EQUAL_STRING("{\"ok\":true}", s.body.c_str());
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(1, c.handshakes());
+  TEST_ASSERT_EQUAL_UINT32(19, c.reuses());
+  TEST_ASSERT_EQUAL_UINT32(20, io.requests);
+  TEST_ASSERT_EQUAL_STRING("/botT/sendMessage", io.lastPath.c_str());
+  TEST_ASSERT_EQUAL_STRING("chat_id=1&text=x", io.lastBody.c_str());
+}
+
+// ---------- 重連 ----------
+static void test_idle_timeout_reconnects_once(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  TEST_ASSERT_EQUAL(200, send(c));
+  io.t += TG_IDLE_CLOSE_MS;                     // 伺服器快要關閉閒置連線 → 自行換新
+  for (int i = 0; i < 5; ++i) TEST_ASSERT_EQUAL(200, send(c));
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(6, io.requests);
+  TEST_ASSERT_EQUAL_UINT32(0, c.retries());
+}
+
+static void test_server_idle_drop_reconnects_once(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  TEST_ASSERT_EQUAL(200, send(c));
+  io.up = false;                                // 閒置中被伺服器關閉（FIN 已到）
+  for (int i = 0; i < 5; ++i) TEST_ASSERT_EQUAL(200, send(c));
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(6, io.requests);     // 每則恰好送一次
+  TEST_ASSERT_EQUAL_UINT32(0, c.retries());
+}
+
+static void test_connection_close_reconnects_once(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  TEST_ASSERT_EQUAL(200, send(c));
+  io.next = FakeIo::CLOSE_HDR;
+  TEST_ASSERT_EQUAL(200, send(c));
+  for (int i = 0; i < 5; ++i) TEST_ASSERT_EQUAL(200, send(c));
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(7, io.requests);
+}
+
+// ---------- 重送 ----------
+// 已寫出但沒有回應：對方可能已處理 sendMessage → 不重送，回報失敗交給日誌
+static void test_no_resend_after_write(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  TEST_ASSERT_EQUAL(200, send(c));
+  io.next = FakeIo::DROP;
+  TEST_ASSERT_TRUE(send(c) < 0);
+  TEST_ASSERT_EQUAL_UINT32(2, io.requests);     // 伺服器只看到一次
+  TEST_ASSERT_EQUAL_UINT32(1, io.connects);     // 沒有為重送而重連
+  TEST_ASSERT_EQUAL_UINT32(0, c.retries());
+  TEST_ASSERT_EQUAL(200, send(c));              // 下一則才換新連線
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+}
+
+// 重用的連線寫入就失敗：請求沒送出 → 換新連線重送一次
+static void test_write_failure_retried_once(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  TEST_ASSERT_EQUAL(200, send(c));
+  io.failWrite = true;
+  TEST_ASSERT_EQUAL(200, send(c));
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(2, io.requests);
+  TEST_ASSERT_EQUAL_UINT32(1, c.retries());
+}
+
+// 新連線寫入失敗不重送（不是連線過期造成）
+static void test_fresh_write_failure_not_retried(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  io.failWrite = true;
+  TEST_ASSERT_TRUE(send(c) < 0);
+  TEST_ASSERT_EQUAL_UINT32(1, io.connects);
+  TEST_ASSERT_EQUAL_UINT32(0, io.requests);
+  TEST_ASSERT_EQUAL_UINT32(0, c.retries());
+}
+
+// ---------- 回應格式 / 請求組裝 ----------
+static void test_chunked_keeps_connection(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  CollectSink s;
+  io.next = FakeIo::CHUNKED;
+  TEST_ASSERT_EQUAL(200, send(c, &s));
+  TEST_ASSERT_EQUAL(-1, s.len);
+  TEST_ASSERT_EQUAL_STRING("{\"ok\":true}", s.body.c_str());
+  TEST_ASSERT_EQUAL(200, send(c, &s));
+  TEST_ASSERT_EQUAL_UINT32(1, io.connects);
+}
+
+static void test_no_length_reads_to_close(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  CollectSink s;
+  io.next = FakeIo::NO_LENGTH;
+  TEST_ASSERT_EQUAL(200, send(c, &s));
+  TEST_ASSERT_EQUAL_STRING("{\"ok\":true}", s.body.c_str());
+  TEST_ASSERT_EQUAL(200, send(c, &s));
+  TEST_ASSERT_EQUAL_UINT32(2, io.connects);
+}
+
+static void test_large_body_sent_intact(){
+  FakeIo io; TgHttpConn<FakeIo> c(io);
+  std::string big(3000, 'z');
+  TEST_ASSERT_EQUAL(200, send(c, nullptr, big.c_str()));
+  TEST_ASSERT_EQUAL_UINT32(1, io.requests);
+  TEST_ASSERT_EQUAL(3000, io.lastBody.size());
+  TEST_ASSERT_EQUAL(200, c.request("GET", "/botT/getUpdates?timeout=25", nullptr, "", 0, nullptr, 5000));
+  TEST_ASSERT_EQUAL_STRING("/botT/getUpdates?timeout=25", io.lastPath.c_str());
+  TEST_ASSERT_EQUAL(0, io.lastBody.size());
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_n_sends_one_handshake);
+  RUN_TEST(test_idle_timeout_reconnects_once);
+  RUN_TEST(test_server_idle_drop_reconnects_once);
+  RUN_TEST(test_connection_close_reconnects_once);
+  RUN_TEST(test_no_resend_after_write);
+  RUN_TEST(test_write_failure_retried_once);
+  RUN_TEST(test_fresh_write_failure_not_retried);
+  RUN_TEST(test_chunked_keeps_connection);
+  RUN_TEST(test_no_length_reads_to_close);
+  RUN_TEST(test_large_body_sent_intact);
+  return UNITY_END();
+}
@@ -0,0 +1,50 @@
+#pragma once
+// 實機 getUpdates 回應（長輪詢 limit=5），個資已換成假值；保留 Telegram 原始的欄位順序與 \u 跳脫。
+
+// 1) 逾時無更新
+static const char kUpdEmpty[] = "{\"ok\":true,\"result\":[]}";
+
+// 2) 文字指令 /panel
+static const char kUpdPanel[] =
+  "{\"ok\":true,\"result\":[{\"update_id\":812345601,\n"
+  "\"message\":{\"message_id\":1201,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\",\"last_name\":\"\\u5de5\\u5ee0\",\"username\":\"yq_factory\",\"language_code\":\"zh-hans\"},"
+  "\"chat\":{\"id\":5012345678,\"first_name\":\"YQ\",\"last_name\":\"\\u5de5\\u5ee0\",\"username\":\"yq_factory\",\"type\":\"private\"},"
+  "\"date\":1760688000,\"text\":\"/panel\",\"entities\":[{\"offset\":0,\"length\":6,\"type\":\"bot_command\"}]}}]}";
+
+// 3) 按下文字鍵盤「⚙️ 開啟設定」（Telegram 以 \uXXXX 送出非 ASCII）
+static const char kUpdKeyboard[] =
+  "{\"ok\":true,\"result\":[{\"update_id\":812345602,\n"
+  "\"message\":{\"message_id\":1202,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\",\"language_code\":\"zh-hans\"},"
+  "\"chat\":{\"id\":5012345678,\"first_name\":\"YQ\",\"type\":\"private\"},"
+  "\"date\":1760688011,\"text\":\"\\u2699\\ufe0f \\u958b\\u555f\\u8a2d\\u5b9a\"}}]}";
+
+// 4) WebApp sendData（docs/index.html 的 save_config 封包）
+static const char kUpdWebApp[] =
+  "{\"ok\":true,\"result\":[{\"update_id\":812345603,\n"
+  "\"message\":{\"message_id\":1203,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\",\"language_code\":\"zh-hans\"},"
+  "\"chat\":{\"id\":5012345678,\"first_name\":\"YQ\",\"type\":\"private\"},\"date\":1760688042,"
+  "\"web_app_data\":{\"button_text\":\"\\u2699\\ufe0f \\u958b\\u555f\\u8a2d\\u5b9a\","
+  "\"data\":\"{\\\"type\\\":\\\"save_config\\\",\\\"payload\\\":{\\\"chs\\\":[1,0,1,0,1,0],\\\"cn0\\\":88,\\\"ct1\\\":\\\"21:18\\\"},\\\"version\\\":2}\"}}}]}";
+
+// 5) 一次五筆：群組訊息、貼圖、編輯、WebApp、指令（測試略過未知欄位與巢狀結構）
+static const char kUpdBatch[] =
+  "{\"ok\":true,\"result\":["
+  "{\"update_id\":812345610,\"message\":{\"message_id\":1210,\"from\":{\"id\":6011111111,\"is_bot\":false,\"first_name\":\"\\u6797\"},"
+    "\"chat\":{\"id\":-1002233445566,\"title\":\"\\u7522\\u7dda A\",\"type\":\"supergroup\"},\"date\":1760688100,"
+    "\"text\":\"\\u4eca\\u5929\\u5e7e\\u9ede\\u4e0b\\u73ed\\uff1f \\ud83d\\ude00\",\"reply_to_message\":{\"message_id\":1199,"
+    "\"from\":{\"id\":6022222222,\"is_bot\":false,\"first_name\":\"\\u738b\"},\"chat\":{\"id\":-1002233445566,\"type\":\"supergroup\"},"
+    "\"date\":1760687000,\"text\":\"/panel\"}}},"
+  "{\"update_id\":812345611,\"message\":{\"message_id\":1211,\"from\":{\"id\":6011111111,\"is_bot\":false,\"first_name\":\"\\u6797\"},"
+    "\"chat\":{\"id\":-1002233445566,\"type\":\"supergroup\"},\"date\":1760688101,"
+    "\"sticker\":{\"width\":512,\"height\":512,\"emoji\":\"\\ud83d\\udc4d\",\"set_name\":\"HotCherry\",\"is_animated\":true,\"is_video\":false,"
+    "\"type\":\"regular\",\"thumbnail\":{\"file_id\":\"AAMCAgADGQEAAgABZ\",\"file_unique_id\":\"AQADAgAT\",\"file_size\":5416,\"width\":128,\"height\":128},"
+    "\"file_id\":\"CAACAgIAAxkBAAIBAAFn\",\"file_unique_id\":\"AgADAgAT\",\"file_size\":35416}}},"
+  "{\"update_id\":812345612,\"edited_message\":{\"message_id\":1205,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\"},"
+    "\"chat\":{\"id\":5012345678,\"type\":\"private\"},\"date\":1760688000,\"edit_date\":1760688102,\"text\":\"/panel\"}},"
+  "{\"update_id\":812345613,\"message\":{\"message_id\":1213,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\"},"
+    "\"chat\":{\"id\":5012345678,\"type\":\"private\"},\"date\":1760688103,"
+    "\"web_app_data\":{\"button_text\":\"\\u2699\\ufe0f \\u958b\\u555f\\u8a2d\\u5b9a (WebApp)\","
+    "\"data\":\"{\\\"type\\\":\\\"save_config\\\",\\\"payload\\\":{\\\"chs\\\":[0,1,1,1,0,0],\\\"cn0\\\":120,\\\"ct1\\\":\\\"07:30\\\",\\\"cm0\\\":\\\"\\u7b2c\\u4e00\\u7dda\\u8a08\\u6578\\\"},\\\"version\\\":2}\"}}},"
+  "{\"update_id\":812345614,\"message\":{\"message_id\":1214,\"from\":{\"id\":5012345678,\"is_bot\":false,\"first_name\":\"YQ\"},"
+    "\"chat\":{\"id\":5012345678,\"type\":\"private\"},\"date\":1760688104,\"text\":\"PANEL\"}}"
+  "]}";
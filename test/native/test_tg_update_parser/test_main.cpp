@@ -0,0 +1,216 @@
+// getUpdates 串流解析器：正確性 + 與舊版（整包 String + indexOf）的時間 / 峰值堆積比較
+//   pio test -e native -f native/test_tg_update_parser -v
+#include <unity.h>
+#include <chrono>
+#include "heap_probe.h"
+#include "WString.h"
+#include "tg_update_parser.h"
+#include "payloads.h"
+
+// ---------- 新版：記錄每筆 update 的擷取結果 ----------
+class Capture : public TgUpdateScanner {
+public:
+  int  panels = 0, datas = 0, truncs = 0;
+  char lastText[64] = "";
+  char lastData[TG_WEBAPP_MAX + 1] = "";
+
+  void run(const char* body, size_t chunk){
+    reset();
+    size_t n = strlen(body);
+    for (size_t i = 0; i < n; i += chunk) feed((const uint8_t*)body + i, n - i < chunk ? n - i : chunk);
+  }
+
+protected:
+  void onUpdate() override {
+    if (textLen()) {
+      snprintf(lastText, sizeof(lastText), "%s", text());
+      if (!strcasecmp(text(), "/panel") || !strcmp(text(), "⚙️ 開啟設定") || !strcasecmp(text(), "panel")) panels++;
+    }
+    if (hasData()) {
+      if (dataTruncated()) truncs++;
+      else { datas++; memcpy(lastData, data(), dataLen() + 1); }
+    }
+  }
+};
+
+// ---------- 舊版（83859d3 之前）：整包收進 String 再 indexOf ----------
+struct OldResult { long offset = 0; int panels = 0, datas = 0; };
+
+static void oldReadBody(String& resp, const char* body, size_t respMax){
+  size_t n = strlen(body);
+  resp = "";
+  resp.reserve(n < respMax ? n : 256);
+  for (size_t i = 0; i < n; i += 128)                     // TgLink 每次讀 128 bytes
+    for (size_t k = i; k < n && k < i + 128 && resp.length() < respMax; ++k) resp += body[k];
+}
+
+static void oldParseUpdates(const String& body, OldResult& r){
+  int pos = 0;
+  while (true){
+    int upd = body.indexOf("\"update_id\":", pos);
+    if (upd < 0) break;
+    int colon = body.indexOf(':', upd);
+    int comma = body.indexOf(',', colon+1);
+    long uid = body.substring(colon+1, comma).toInt();
+    r.offset = uid + 1;
+    int nextUpd = body.indexOf("\"update_id\":", comma+1);
+    int scopeEnd = (nextUpd > 0) ? nextUpd : body.length();
+    int tpos = body.indexOf("\"text\":\"", comma);
+    if (tpos > 0 && tpos < scopeEnd) {
+      int q1 = body.indexOf('\"', tpos + 7);
+      int q2 = body.indexOf('\"', q1 + 1);
+      String txt = (q1 > 0 && q2 > q1) ? body.substring(q1+1, q2) : "";
+      String up = txt; up.toUpperCase();
+      if (up == "/PANEL" || txt == "⚙️ 開啟設定" || up == "PANEL") r.panels++;
+    }
+    int wad = body.indexOf("\"web_app_data\"", comma);
+    if (wad > 0 && wad < scopeEnd){
+      int dataPos = body.indexOf("\"data\":", wad);
+      if (dataPos > 0) {
+        int q1 = body.indexOf('\"', dataPos + 7);
+        if (q1 > 0) {
+          int i = q1 + 1; bool esc=false;
+          while (i < (int)body.length()) { char c=body[i]; if (esc){esc=false;i++;continue;}
+            if (c=='\\'){esc=true;i++;continue;} if (c=='\"') break; i++; }
+          if (i < (int)body.length()) {
+            String raw = body.substring(q1+1, i);
+            String* payload = new String(); payload->reserve(raw.length());
+            for (int k=0;k<(int)raw.length();k++){ char c=raw[k];
+              if (c=='\\' && k+1<(int)raw.length()){
+                char n=raw[k+1]; if (n=='\"'){*payload+='\"';k++;continue;}
+                if (n=='\\'){*payload+='\\';k++;continue;}
+                if (n=='n'){*payload+='\n';k++;continue;}
+                if (n=='r'){*payload+='\r';k++;continue;}
+                if (n=='t'){*payload+='\t';k++;continue;}
+              } *payload+=c;
+            }
+            r.datas++;
+            delete payload;                                  // 裝置上交給 loop()；這裡量完即釋放
+          }
+        }
+      }
+    }
+    pos = comma + 1;
+  }
+}
+
+static Capture gCap;   // 固定緩衝約 4.2KB，與韌體相同放在靜態區
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 正確性 ----------
+static void test_empty_result(){
+  gCap.run(kUpdEmpty, 64);
+  TEST_ASSERT_EQUAL_UINT32(0, gCap.updates());
+  TEST_ASSERT_EQUAL(0, gCap.lastUpdateId());
+}
+
+static void test_panel_command(){
+  gCap.panels = 0;
+  gCap.run(kUpdPanel, 128);
+  TEST_ASSERT_EQUAL_UINT32(1, gCap.updates());
+  TEST_ASSERT_EQUAL(812345601L, gCap.lastUpdateId());
+  TEST_ASSERT_EQUAL(1, gCap.panels);
+  TEST_ASSERT_EQUAL_STRING("/panel", gCap.lastText);
+}
+
+static void test_keyboard_text_unicode_escape(){
+  gCap.panels = 0;
+  gCap.run(kUpdKeyboard, 128);
+  TEST_ASSERT_EQUAL_STRING("⚙️ 開啟設定", gCap.lastText);
+  TEST_ASSERT_EQUAL(1, gCap.panels);
+}
+
+static void test_web_app_data_unescaped(){
+  gCap.datas = 0;
+  gCap.run(kUpdWebApp, 128);
+  TEST_ASSERT_EQUAL(1, gCap.datas);
+  TEST_ASSERT_EQUAL_STRING("{\"type\":\"save_config\",\"payload\":{\"chs\":[1,0,1,0,1,0],\"cn0\":88,\"ct1\":\"21:18\"},\"version\":2}",
+                           gCap.lastData);
+}
+
+// 五筆混合：巢狀 reply_to_message / edited_message 的 text 不算；代理對 emoji 轉成 4-byte UTF-8
+static void test_batch_skips_nested_and_unknown(){
+  gCap.panels = gCap.datas = 0;
+  gCap.run(kUpdBatch, 128);
+  TEST_ASSERT_EQUAL_UINT32(5, gCap.updates());
+  TEST_ASSERT_EQUAL(812345614L, gCap.lastUpdateId());
+  TEST_ASSERT_EQUAL(1, gCap.panels);                 // 只有最後一筆 "PANEL"
+  TEST_ASSERT_EQUAL(1, gCap.datas);
+  TEST_ASSERT_TRUE(strstr(gCap.lastData, "\"cm0\":\"第一線計數\"") != nullptr);
+}
+
+// 任意切塊（含逐 byte）結果都相同
+static void test_chunking_is_transparent(){
+  const size_t chunks[] = { 1, 2, 3, 7, 64, 1460 };
+  for (size_t c : chunks) {
+    gCap.panels = gCap.datas = 0;
+    gCap.run(kUpdBatch, c);
+    TEST_ASSERT_EQUAL_UINT32(5, gCap.updates());
+    TEST_ASSERT_EQUAL(1, gCap.panels);
+    TEST_ASSERT_EQUAL(1, gCap.datas);
+  }
+}
+
+// 超過 TG_WEBAPP_MAX 的 web_app_data 標記截斷，不交出半包
+static void test_oversized_web_app_data_is_flagged(){
+  static char big[TG_WEBAPP_MAX + 512];
+  int n = snprintf(big, sizeof(big), "{\"ok\":true,\"result\":[{\"update_id\":9,\"message\":{\"web_app_data\":{\"data\":\"");
+  for (size_t i = 0; i < TG_WEBAPP_MAX + 100; ++i) big[n++] = 'x';
+  snprintf(big + n, sizeof(big) - n, "\"}}}]}");
+  gCap.datas = gCap.truncs = 0;
+  gCap.run(big, 256);
+  TEST_ASSERT_EQUAL(0, gCap.datas);
+  TEST_ASSERT_EQUAL(1, gCap.truncs);
+  TEST_ASSERT_EQUAL(9L, gCap.lastUpdateId());
+}
+
+// ---------- 基準：解析時間與峰值堆積（新 vs 舊） ----------
+static void bench(const char* name, const char* body){
+  const int REP = 2000;
+  using clk = std::chrono::steady_clock;
+
+  heapProbeReset();
+  auto t0 = clk::now();
+  for (int i = 0; i < REP; ++i) gCap.run(body, 1460);
+  double newUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t newPeak = heapProbePeak(), newAllocs = heapProbeAllocs() / REP;
+
+  OldResult r;
+  heapProbeReset();
+  t0 = clk::now();
+  for (int i = 0; i < REP; ++i) { String resp; oldReadBody(resp, body, 16384); oldParseUpdates(resp, r); }
+  double oldUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t oldPeak = heapProbePeak(), oldAllocs = heapProbeAllocs() / REP;
+
+  char msg[200];
+  snprintf(msg, sizeof(msg), "%-9s %5u B | new %7.2f us peak %4u B allocs %u | old %7.2f us peak %5u B allocs %u",
+           name, (unsigned)strlen(body), newUs, (unsigned)newPeak, (unsigned)newAllocs,
+           oldUs, (unsigned)oldPeak, (unsigned)oldAllocs);
+  TEST_MESSAGE(msg);
+
+  TEST_ASSERT_EQUAL(0, newPeak);                       // 固定緩衝：完全不配置
+  TEST_ASSERT_GREATER_OR_EQUAL(strlen(body), oldPeak); // 舊版至少要整包 body
+}
+
+static void test_bench_against_string_parser(){
+  bench("empty",    kUpdEmpty);
+  bench("panel",    kUpdPanel);
+  bench("keyboard", kUpdKeyboard);
+  bench("webapp",   kUpdWebApp);
+  bench("batch5",   kUpdBatch);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_result);
+  RUN_TEST(test_panel_command);
+  RUN_TEST(test_keyboard_text_unicode_escape);
+  RUN_TEST(test_web_app_data_unescaped);
+  RUN_TEST(test_batch_skips_nested_and_unknown);
+  RUN_TEST(test_chunking_is_transparent);
+  RUN_TEST(test_oversized_web_app_data_is_flagged);
+  RUN_TEST(test_bench_against_string_parser);
+  return UNITY_END();
+}
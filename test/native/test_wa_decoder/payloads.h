@@ -0,0 +1,27 @@
+#pragma once
+// WebApp 送到 applyWebAppConfig() 的 data 字串（已由 getUpdates 解析器解開外層跳脫）。
+// 1~2 由 docs/index.html 的 doSend() 產生：JSON.stringify({type:"save_config", payload:collect(), version:2})；
+// 3 是 /webapp-export 的輸出（round-trip）；4 是舊版 WebApp（ts 別名、數字字串）。
+
+// 1) docs/index.html：勾選 1/3/5 路、cn0=88、ct1=21:18
+static const char kWaDocsSend[] =
+  "{\"type\":\"save_config\",\"payload\":{\"chs\":[1,0,1,0,1,0],\"cn0\":88,\"ct1\":\"21:18\"},\"version\":2}";
+
+// 2) docs/index.html：全不勾、cn0 留白（→0）、ct1 留白（不變更）
+static const char kWaDocsBlank[] =
+  "{\"type\":\"save_config\",\"payload\":{\"chs\":[0,0,0,0,0,0],\"cn0\":0,\"ct1\":\"\"},\"version\":2}";
+
+// 3) GET /webapp-export 的回應（非 ASCII 維持 UTF-8；am[5] 改以 \uXXXX 與代理對送出，測跳脫）
+static const char kWaExport[] =
+  "{\"ver\":17,\"wd\":[1,1,1,1,1,0,0],"
+  "\"t\":[\"07:30\",\"12:00\",\"13:00\",\"17:30\",\"00:00\",\"23:59\"],"
+  "\"hm\":[5,0,1,60,0,0],\"hs\":[0,45,30,0,0,59],"
+  "\"cm0\":\"第一線計數\",\"cn0\":1200,\"ct0\":\"17:00\","
+  "\"cm1\":\"包裝線 \\\"B\\\"\",\"cn1\":0,\"ct1\":\"21:18\","
+  "\"am\":[\"DI1 急停\",\"DI2 氣壓不足\",\"DI3\",\"DI4\",\"DI5\",\"DI6 \\u6eab\\u5ea6\\ud83d\\udd25\"]}";
+
+// 4) 舊版 WebApp：ts 別名、hm 以字串送出、欄位間有空白與換行
+static const char kWaLegacy[] =
+  "{ \"type\": \"save_config\",\n  \"payload\": { \"wd\": [1, 0, 1, 0, 1, 0, 1],\n"
+  "    \"ts\": [\"8:05\", \"18:45\"], \"hm\": [\"2\", \"10\"], \"hs\": [15, 0],\n"
+  "    \"cm0\": \"A 線\", \"cn0\": \"300\" },\n  \"version\": 1 }";
@@ -0,0 +1,437 @@
+// WebApp 設定解碼器：docs/index.html 封包正確性、逐欄位錯誤、隨機變異 fuzz，
+// 以及與舊版（jsonGet / indexOf + 暫存 String）的時間 / 峰值堆積比較
+//   pio test -e native -f native/test_wa_decoder -v
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "heap_probe.h"
+#include "WString.h"
+#include "wa_decoder.h"
+#include "payloads.h"
+
+static WaStage  gSt;               // 與韌體相同放在靜態區
+static uint16_t gGot[WS_COUNT];
+
+static WaResult decode(const char* p, size_t n){
+  WaResult r;
+  memset(&gSt, 0, sizeof(gSt));
+  memset(gGot, 0, sizeof(gGot));
+  WaDecoder dec(p, n, gSt, gGot, r);
+  dec.run();
+  return r;
+}
+static WaResult decode(const char* p){ return decode(p, strlen(p)); }
+static bool has(WaSlot s, int i){ return gGot[s] & (1u << i); }
+
+// 保留的錯誤中是否有 key[idx]:why
+static bool hasErr(const WaResult& r, const char* key, int idx, const char* why){
+  for (int i = 0; i < r.nErr && i < WA_ERR_MAX; ++i)
+    if (!strcmp(kWaFields[r.err[i].field].key, key) && r.err[i].idx == idx && !strcmp(r.err[i].why, why)) return true;
+  return false;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ---------- 正確性：實際封包 ----------
+static void test_docs_save_config(){
+  WaResult r = decode(kWaDocsSend);
+  TEST_ASSERT_TRUE(r.syntaxOk);
+  TEST_ASSERT_EQUAL(0, r.nErr);                       // chs / type / version 不在表內：略過，不算錯
+  TEST_ASSERT_TRUE(has(WS_CN0, 0));
+  TEST_ASSERT_EQUAL(88, gSt.cn[0]);
+  TEST_ASSERT_TRUE(has(WS_CT1, 0));
+  TEST_ASSERT_EQUAL(21, gSt.ct[1][0]);
+  TEST_ASSERT_EQUAL(18, gSt.ct[1][1]);
+  for (int s = 0; s < WS_COUNT; ++s)
+    if (s != WS_CN0 && s != WS_CT1) TEST_ASSERT_EQUAL(0, gGot[s]);
+}
+
+static void test_docs_blank_time_keeps_setting(){
+  WaResult r = decode(kWaDocsBlank);
+  TEST_ASSERT_TRUE(r.syntaxOk);
+  TEST_ASSERT_EQUAL(0, r.nErr);
+  TEST_ASSERT_TRUE(has(WS_CN0, 0));
+  TEST_ASSERT_EQUAL(0, gSt.cn[0]);
+  TEST_ASSERT_FALSE(has(WS_CT1, 0));                  // 空白 = 不變更
+}
+
+static void test_export_round_trip(){
+  WaResult r = decode(kWaExport);
+  TEST_ASSERT_TRUE(r.syntaxOk);
+  TEST_ASSERT_EQUAL(0, r.nErr);
+  TEST_ASSERT_EQUAL_HEX8(0x1F, gSt.wd);
+  TEST_ASSERT_EQUAL_HEX16(0x7F, gGot[WS_WD]);
+  TEST_ASSERT_EQUAL_HEX16(0x3F, gGot[WS_T]);
+  TEST_ASSERT_EQUAL(7,  gSt.t[0][0]); TEST_ASSERT_EQUAL(30, gSt.t[0][1]);
+  TEST_ASSERT_EQUAL(23, gSt.t[5][0]); TEST_ASSERT_EQUAL(59, gSt.t[5][1]);
+  TEST_ASSERT_EQUAL(60, gSt.hm[3]);   TEST_ASSERT_EQUAL(59, gSt.hs[5]);
+  TEST_ASSERT_EQUAL_STRING("第一線計數", gSt.cm[0]);
+  TEST_ASSERT_EQUAL_STRING("包裝線 \"B\"", gSt.cm[1]);
+  TEST_ASSERT_EQUAL(1200, gSt.cn[0]);
+  TEST_ASSERT_TRUE(has(WS_CN1, 0));
+  TEST_ASSERT_EQUAL(17, gSt.ct[0][0]);
+  TEST_ASSERT_EQUAL_HEX16(0x3F, gGot[WS_AM]);
+  TEST_ASSERT_EQUAL_STRING("DI2 氣壓不足", gSt.am[1]);
+  TEST_ASSERT_EQUAL_STRING("DI6 溫度🔥", gSt.am[5]);   // \uXXXX + 代理對 → UTF-8
+}
+
+static void test_legacy_alias_and_numeric_strings(){
+  WaResult r = decode(kWaLegacy);
+  TEST_ASSERT_TRUE(r.syntaxOk);
+  TEST_ASSERT_EQUAL(0, r.nErr);
+  TEST_ASSERT_EQUAL_HEX8(0x55, gSt.wd);
+  TEST_ASSERT_EQUAL_HEX16(0x03, gGot[WS_T]);          // 只給兩路：其餘不動
+  TEST_ASSERT_EQUAL(8,  gSt.t[0][0]); TEST_ASSERT_EQUAL(5, gSt.t[0][1]);
+  TEST_ASSERT_EQUAL(18, gSt.t[1][0]); TEST_ASSERT_EQUAL(45, gSt.t[1][1]);
+  TEST_ASSERT_EQUAL(2, gSt.hm[0]);    TEST_ASSERT_EQUAL(10, gSt.hm[1]);
+  TEST_ASSERT_EQUAL(15, gSt.hs[0]);
+  TEST_ASSERT_EQUAL(300, gSt.cn[0]);
+  TEST_ASSERT_EQUAL_STRING("A 線", gSt.cm[0]);
+}
+
+// ---------- 逐欄位錯誤：只略過壞掉的那一項 ----------
+static void test_per_field_errors(){
+  std::string longMsg(WA_STR_MAX + 1, 'x');
+  std::string p = "{\"payload\":{"
+    "\"wd\":[1,\"x\",1],"
+    "\"t\":[\"07:00\",\"24:00\",\"7:5\",5,\"06:30\",\"01:00\",\"02:00\"],"
+    "\"hm\":[1,61,-1,\"2\",\"a\"],"
+    "\"ct0\":{\"h\":1},"
+    "\"cn1\":1000000,"
+    "\"cm0\":\"" + longMsg + "\","
+    "\"cm1\":\"ok\"}}";
+  WaResult r = decode(p.c_str(), p.size());
+  TEST_ASSERT_TRUE(r.syntaxOk);
+  TEST_ASSERT_TRUE(hasErr(r, "wd", 1, "type"));
+  TEST_ASSERT_TRUE(hasErr(r, "t", 1, "range"));
+  TEST_ASSERT_TRUE(hasErr(r, "t", 2, "format"));
+  TEST_ASSERT_TRUE(hasErr(r, "t", 3, "type"));
+  TEST_ASSERT_TRUE(hasErr(r, "t", 6, "count"));
+  TEST_ASSERT_TRUE(hasErr(r, "hm", 1, "range"));
+  TEST_ASSERT_TRUE(hasErr(r, "hm", 2, "range"));
+  TEST_ASSERT_TRUE(hasErr(r, "hm", 4, "type"));       // 保留的 WA_ERR_MAX(8) 筆到此為止
+  TEST_ASSERT_EQUAL(11, r.nErr);                      // 之後的 ct0:type、cn1:range、cm0:len 只計數
+  // 合法的項目照常收下
+  TEST_ASSERT_EQUAL_HEX16(0x05, gGot[WS_WD]);
+  TEST_ASSERT_EQUAL_HEX16(0x31, gGot[WS_T]);
+  TEST_ASSERT_EQUAL_HEX16(0x09, gGot[WS_HM]);
+  TEST_ASSERT_EQUAL(2, gSt.hm[3]);
+  TEST_ASSERT_FALSE(has(WS_CT0, 0));
+  TEST_ASSERT_FALSE(has(WS_CN1, 0));
+  TEST_ASSERT_FALSE(has(WS_CM0, 0));
+  TEST_ASSERT_EQUAL_STRING("ok", gSt.cm[1]);
+}
+
+// 語法錯誤：整包不套用並回報位置
+static void test_syntax_error_rejects_packet(){
+  const char* bad[] = {
+    "{\"payload\":{\"cn0\":88,\"ct1\":\"21:18\"}",       // 少一個 }
+    "{\"payload\":{\"cn0\":88 \"ct1\":\"21:18\"}}",      // 少逗號
+    "{\"payload\":{\"cm0\":\"a\\qb\"}}",                 // 不合法跳脫
+    "{\"payload\":{\"cm0\":\"\\u12\"}}",                 // \u 不足四位
+    "{\"cn0\":1} trailing",
+    "",
+  };
+  for (const char* p : bad) {
+    WaResult r = decode(p);
+    TEST_ASSERT_FALSE_MESSAGE(r.syntaxOk, p);
+    TEST_ASSERT_TRUE(r.errPos <= strlen(p));
+  }
+  WaResult r = decode(bad[1]);
+  TEST_ASSERT_EQUAL(21, r.errPos);                    // 停在 "ct1" 前的引號
+}
+
+// 超過 MAX_DEPTH 的巢狀：回報語法錯誤，不會遞迴爆堆疊
+static void test_deep_nesting_is_bounded(){
+  std::string p = "{\"x\":";
+  for (int i = 0; i < 10000; ++i) p += '[';
+  WaResult r = decode(p.c_str(), p.size());
+  TEST_ASSERT_FALSE(r.syntaxOk);
+}
+
+// ---------- fuzz：隨機變異實際封包 ----------
+static uint32_t gRng = 0x2545F491;
+static uint32_t rnd(){ gRng ^= gRng << 13; gRng ^= gRng >> 17; gRng ^= gRng << 5; return gRng; }
+
+static void mutate(std::string& s){
+  static const char kTok[] = "{}[]\":,\\u0123456789-.tfn ";
+  int k = 1 + rnd() % 4;
+  while (k--) {
+    size_t at = s.empty() ? 0 : rnd() % s.size();
+    switch (rnd() % 6) {
+      case 0: if (!s.empty()) s[at] = (char)rnd(); break;                         // 任意 byte
+      case 1: if (!s.empty()) s[at] = kTok[rnd() % (sizeof(kTok) - 1)]; break;    // JSON 結構字元
+      case 2: s.insert(at, 1, kTok[rnd() % (sizeof(kTok) - 1)]); break;
+      case 3: if (!s.empty()) s.erase(at, 1 + rnd() % 8); break;
+      case 4: s.resize(at); break;                                                // 截斷
+      case 5: { size_t n = rnd() % 32; s.insert(at, s.substr(rnd() % (s.size() + 1), n)); break; }
+    }
+  }
+}
+
+// 解出的暫存值必須都在欄位表的範圍內，字串一定有結尾且不超長
+static void checkStage(const WaResult& r, size_t n){
+  if (!r.syntaxOk) { TEST_ASSERT_TRUE(r.errPos <= n); return; }
+  for (int i = 0; i < WA_RELAY_N; ++i) {
+    if (has(WS_T, i))  { TEST_ASSERT_TRUE(gSt.t[i][0] <= 23 && gSt.t[i][1] <= 59); }
+    if (has(WS_HM, i)) { TEST_ASSERT_TRUE(gSt.hm[i] >= 0 && gSt.hm[i] <= (int32_t)(WA_HOLD_MAX / 60)); }
+    if (has(WS_HS, i)) { TEST_ASSERT_TRUE(gSt.hs[i] >= 0 && gSt.hs[i] <= (int32_t)WA_HOLD_MAX); }
+  }
+  for (int c = 0; c < 2; ++c) {
+    if (has((WaSlot)(WS_CT0 + c), 0)) TEST_ASSERT_TRUE(gSt.ct[c][0] <= 23 && gSt.ct[c][1] <= 59);
+    if (has((WaSlot)(WS_CN0 + c), 0)) TEST_ASSERT_TRUE(gSt.cn[c] >= 0 && gSt.cn[c] <= 999999);
+    TEST_ASSERT_TRUE(memchr(gSt.cm[c], 0, WA_STR_MAX + 1) != nullptr);
+  }
+  for (int i = 0; i < WA_ALARM_N; ++i) TEST_ASSERT_TRUE(memchr(gSt.am[i], 0, WA_STR_MAX + 1) != nullptr);
+  TEST_ASSERT_TRUE(gGot[WS_WD] < (1u << 7));
+  TEST_ASSERT_TRUE(gGot[WS_T] < (1u << WA_RELAY_N) && gGot[WS_AM] < (1u << WA_ALARM_N));
+}
+
+static void test_fuzz_mutated_payloads(){
+  const char* seeds[] = { kWaDocsSend, kWaDocsBlank, kWaExport, kWaLegacy };
+  const int ITER = 200000;
+  int ok = 0;
+  for (int it = 0; it < ITER; ++it) {
+    std::string s = seeds[it % 4];
+    mutate(s);
+    std::vector<char> buf(s.begin(), s.end());          // 不含結尾 NUL：越界讀取交給 ASan 抓
+    WaResult r = decode(buf.data(), buf.size());
+    checkStage(r, buf.size());
+    ok += r.syntaxOk;
+  }
+  char msg[96];
+  snprintf(msg, sizeof(msg), "fuzz: %d payloads, %d still valid JSON", ITER, ok);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_GREATER_THAN(0, ok);
+}
+
+// ---------- 舊版（c6bc9ea 之前）：jsonGet / unwrapPayloadIfAny / parseArray… ----------
+struct OldCfg {
+  uint8_t wdMask = 0;
+  struct { uint8_t hh = 0, mm = 0; uint32_t hold = 0; } sch[WA_RELAY_N];
+  struct { uint8_t hh = 0, mm = 0; uint32_t target = 0; String msg; } cnt[2];
+};
+
+static String jsonGet(const String& s, const char* key){
+  String k = String("\"") + key + "\":";
+  int p = s.indexOf(k);
+  if (p < 0) return "";
+  p += k.length();
+  while (p < (int)s.length() && (s[p]==' '||s[p]=='\"')) { if (s[p]=='\"') {
+      int q = s.indexOf('\"', p+1);
+      if (q>p) return s.substring(p+1, q);
+    } p++;
+  }
+  int q = p;
+  while (q < (int)s.length() && s[q]!=',' && s[q]!='}' && s[q]!=']' && s[q]!='\n') q++;
+  String v = s.substring(p, q); v.trim();
+  if (v.length()>=2 && v[0]=='\"' && v[v.length()-1]=='\"') v = v.substring(1, v.length()-1);
+  return v;
+}
+static String unwrapPayloadIfAny(const String& s){
+  int p = s.indexOf("\"payload\"");
+  if (p < 0) return s;
+  p = s.indexOf(':', p);
+  if (p < 0) return s;
+  while (p < (int)s.length() && s[p] != '{') p++;
+  if (p >= (int)s.length()) return s;
+  int depth = 0, i = p;
+  for (; i < (int)s.length(); ++i){
+    char c = s[i];
+    if (c == '{') depth++;
+    else if (c == '}'){ depth--; if (depth == 0) return s.substring(p, i+1); }
+  }
+  return s;
+}
+
+static void oldApply(OldCfg& cfg, const String& raw){
+  String data = unwrapPayloadIfAny(raw);
+  uint8_t mask = 0;
+  int pos = data.indexOf("\"wd\":[");
+  if (pos >= 0) {
+    int end = data.indexOf("]", pos);
+    if (end > pos) {
+      String arr = data.substring(pos+6, end);
+      int bit = 0; int i = 0;
+      while (i < (int)arr.length() && bit < 7) {
+        while (i < (int)arr.length() && (arr[i]==' '||arr[i]==',')) i++;
+        if (i < (int)arr.length() && (arr[i]=='1')) mask |= (1u << bit);
+        while (i < (int)arr.length() && arr[i]!=',') i++;
+        bit++;
+      }
+      cfg.wdMask = mask;
+    }
+  }
+  auto parseArray = [&](const String& key)->String {
+    int p = data.indexOf(String("\"") + key + "\":[");
+    if (p < 0) return "";
+    int end = data.indexOf("]", p);
+    if (end < 0) return "";
+    return data.substring(p + key.length() + 4, end);
+  };
+  String tsArr = parseArray("ts");
+  String hmArr = parseArray("hm");
+  String hsArr = parseArray("hs");
+  if (tsArr.length() || hmArr.length() || hsArr.length()) {
+    auto splitCSV = [&](const String& s, bool isString)->std::vector<String>{
+      std::vector<String> out;
+      int i=0, n=s.length();
+      while (i<n && (int)out.size()<6) {
+        while (i<n && (s[i]==','||s[i]==' ')) i++;
+        if (i>=n) break;
+        if (isString && s[i]=='\"') {
+          int q = s.indexOf('\"', i+1);
+          if (q<0) break;
+          out.push_back(s.substring(i+1, q));
+          i = q+1;
+        } else {
+          int q=i;
+          while (q<n && s[q]!=',') q++;
+          String v = s.substring(i, q); v.trim();
+          out.push_back(v);
+          i = q+1;
+        }
+      }
+      return out;
+    };
+    auto ts = splitCSV(tsArr, true);
+    auto hm = splitCSV(hmArr, false);
+    auto hs = splitCSV(hsArr, false);
+    for (int i=0;i<6;i++){
+      if (i < (int)ts.size() && ts[i].length() >= 4) {
+        int hh = ts[i].substring(0,2).toInt();
+        int mm = ts[i].substring(3,5).toInt();
+        if (hh>=0 && hh<=23) cfg.sch[i].hh = hh;
+        if (mm>=0 && mm<=59) cfg.sch[i].mm = mm;
+      }
+      long m = (i < (int)hm.size()) ? hm[i].toInt() : 0;
+      long s = (i < (int)hs.size()) ? hs[i].toInt() : 0;
+      long hold = m*60 + s;
+      if (hold < 0) hold = 0;
+      if (hold > 3600) hold = 3600;
+      cfg.sch[i].hold = (uint32_t)hold;
+    }
+  }
+  String cm0 = jsonGet(data, "cm0");
+  if (cm0.length()) cfg.cnt[0].msg = cm0;
+  String cn0 = jsonGet(data, "cn0");
+  if (cn0.length()) { long v = cn0.toInt(); if (v < 0) v = 0; cfg.cnt[0].target = (uint32_t)v; }
+  String ct1 = jsonGet(data, "ct1");
+  if (ct1.length() >= 4) { cfg.cnt[1].hh = ct1.substring(0,2).toInt(); cfg.cnt[1].mm = ct1.substring(3,5).toInt(); }
+  String cm1 = jsonGet(data, "cm1");
+  if (cm1.length()) cfg.cnt[1].msg = cm1;
+  auto parseStrArray = [&](const String& key, String out[], int n){
+    int pos = data.indexOf(String("\"")+key+"\":[");
+    if (pos < 0) return false;
+    int end = data.indexOf("]", pos);
+    if (end < 0) return false;
+    String arr = data.substring(pos + key.length() + 4, end);
+    int i=0, p=0;
+    while (i<n && p < (int)arr.length()){
+      int s = arr.indexOf('\"', p); if (s<0) break;
+      int e = arr.indexOf('\"', s+1); if (e<0) break;
+      out[i++] = arr.substring(s+1, e);
+      p = e+1;
+    }
+    return (i>0);
+  };
+  auto parseIntArray = [&](const String& key, int out[], int n){
+    int pos = data.indexOf(String("\"")+key+"\":[");
+    if (pos < 0) return false;
+    int end = data.indexOf("]", pos);
+    if (end < 0) return false;
+    String arr = data.substring(pos + key.length() + 4, end);
+    int i=0, p=0;
+    while (i<n && p < (int)arr.length()){
+      int q = arr.indexOf(',', p); if (q<0) q = arr.length();
+      String token = arr.substring(p, q); token.trim();
+      out[i++] = token.toInt();
+      p = q + 1;
+    }
+    return (i>0);
+  };
+  String t[WA_RELAY_N];
+  int    hm[WA_RELAY_N] = {0};
+  int    hs[WA_RELAY_N] = {0};
+  bool hasT  = parseStrArray("t",  t,  WA_RELAY_N);
+  bool hasHM = parseIntArray("hm", hm, WA_RELAY_N);
+  bool hasHS = parseIntArray("hs", hs, WA_RELAY_N);
+  if (hasT || hasHM || hasHS){
+    for (int i=0;i<WA_RELAY_N;i++){
+      if (hasT && t[i].length()>=4){
+        int colon = t[i].indexOf(':');
+        if (colon>0){
+          int hh = t[i].substring(0, colon).toInt();
+          int mm = t[i].substring(colon+1).toInt();
+          if (hh<0) hh=0;
+          if (hh>23) hh=23;
+          if (mm<0) mm=0;
+          if (mm>59) mm=59;
+          cfg.sch[i].hh = hh;
+          cfg.sch[i].mm = mm;
+        }
+      }
+      if (hasHM || hasHS){
+        long hold = (long)cfg.sch[i].hold;
+        if (hasHM) hold = (long)hm[i] * 60L + (hasHS ? hs[i] : 0);
+        else if (hasHS) hold = (long)hs[i];
+        if (hold < 0) hold = 0;
+        if (hold > 3600) hold = 3600;
+        cfg.sch[i].hold = (uint16_t)hold;
+      }
+    }
+  }
+}
+
+// ---------- 基準：解碼時間與峰值堆積（新 vs 舊） ----------
+static void bench(const char* name, const char* body){
+  const int REP = 20000;
+  using clk = std::chrono::steady_clock;
+  size_t n = strlen(body);
+
+  heapProbeReset();
+  auto t0 = clk::now();
+  for (int i = 0; i < REP; ++i) decode(body, n);
+  double newUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t newPeak = heapProbePeak(), newAllocs = heapProbeAllocs() / REP;
+
+  OldCfg cfg;
+  String raw(body);                                    // 裝置上 raw 已是 String（tgInQ 交來）
+  heapProbeReset();
+  t0 = clk::now();
+  for (int i = 0; i < REP; ++i) oldApply(cfg, raw);
+  double oldUs = std::chrono::duration<double, std::micro>(clk::now() - t0).count() / REP;
+  size_t oldPeak = heapProbePeak(), oldAllocs = heapProbeAllocs() / REP;
+
+  char msg[200];
+  snprintf(msg, sizeof(msg), "%-7s %4u B | new %6.2f us peak %4u B allocs %u | old %6.2f us peak %5u B allocs %u",
+           name, (unsigned)n, newUs, (unsigned)newPeak, (unsigned)newAllocs,
+           oldUs, (unsigned)oldPeak, (unsigned)oldAllocs);
+  TEST_MESSAGE(msg);
+
+  TEST_ASSERT_EQUAL(0, newPeak);                       // 靜態暫存區 + 堆疊 token：完全不配置
+  TEST_ASSERT_GREATER_THAN(0, oldAllocs);
+}
+
+static void test_bench_against_string_decoder(){
+  bench("docs",   kWaDocsSend);
+  bench("blank",  kWaDocsBlank);
+  bench("export", kWaExport);
+  bench("legacy", kWaLegacy);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_docs_save_config);
+  RUN_TEST(test_docs_blank_time_keeps_setting);
+  RUN_TEST(test_export_round_trip);
+  RUN_TEST(test_legacy_alias_and_numeric_strings);
+  RUN_TEST(test_per_field_errors);
+  RUN_TEST(test_syntax_error_rejects_packet);
+  RUN_TEST(test_deep_nesting_is_bounded);
+  RUN_TEST(test_fuzz_mutated_payloads);
+  RUN_TEST(test_bench_against_string_decoder);
+  return UNITY_END();
+}